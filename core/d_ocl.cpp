@@ -1,18 +1,24 @@
 #include "d_ocl.h"
+#include "d_ocl_convert.h"
+#include "d_ocl_handle.h"
+#include "d_ocl_program_cache.h"
 #include "d_ocl_utils.h"
+#include <algorithm>
 #include <cstdlib>
 #include <cstring>
-#include <fstream>
+#include <fcntl.h>
 #include <iostream>
 #include <list>
 #include <mutex>
+#include <set>
 #include <opencv2/imgcodecs.hpp>
 #include <opencv2/imgproc.hpp>
 #include <sstream>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 static std::mutex g_mutex;
-// all-purpose buffer e.g. for file i/o
-static std::vector<char> g_scratchBuffer;
 
 auto d_ocl::gpuPlatforms() -> std::vector<cl_platform_id>
 {
@@ -34,48 +40,138 @@ auto d_ocl::gpuPlatforms() -> std::vector<cl_platform_id>
     return platforms;
 }
 
-auto d_ocl::gpuDevices(cl_platform_id platform) -> std::vector<cl_device_id>
+auto d_ocl::devices(cl_platform_id platform, cl_device_type deviceType)
+    -> std::vector<cl_device_id>
 {
     cl_uint numDevices;
-    if (!utils::checkRun(
-            "clGetDeviceIDs",
-            clGetDeviceIDs(
-                platform, CL_DEVICE_TYPE_GPU, 0, nullptr, &numDevices))) {
+    // CL_DEVICE_NOT_FOUND is expected e.g. for cpu-only platforms
+    cl_int status
+        = clGetDeviceIDs(platform, deviceType, 0, nullptr, &numDevices);
+    if (status == CL_DEVICE_NOT_FOUND
+        || !utils::checkRun("clGetDeviceIDs", status)) {
         numDevices = 0;
     }
 
     std::vector<cl_device_id> devices(numDevices);
     if (numDevices == 0
-        || !utils::checkRun("clGetDeviceIDs",
-                            clGetDeviceIDs(platform,
-                                           CL_DEVICE_TYPE_GPU,
-                                           numDevices,
-                                           devices.data(),
-                                           nullptr))) {
+        || !utils::checkRun(
+            "clGetDeviceIDs",
+            clGetDeviceIDs(
+                platform, deviceType, numDevices, devices.data(), nullptr))) {
         devices.clear();
     }
 
     return devices;
 }
 
-auto d_ocl::gpuPlatformDevices()
+auto d_ocl::gpuDevices(cl_platform_id platform) -> std::vector<cl_device_id>
+{
+    return devices(platform, CL_DEVICE_TYPE_GPU);
+}
+
+auto d_ocl::platformDevices(cl_device_type deviceType)
     -> std::unordered_map<cl_platform_id, std::vector<cl_device_id>>
 {
-    // find platforms and all gpu devices in each
+    // find platforms and all devices of deviceType in each
 
     std::unordered_map<cl_platform_id, std::vector<cl_device_id>>
         platformDevices;
     for (cl_platform_id platform : gpuPlatforms()) {
-        std::vector<cl_device_id> devices = gpuDevices(platform);
-        // exclude platform if no gpu device
-        if (!devices.empty()) {
-            platformDevices[platform] = devices;
+        std::vector<cl_device_id> platformDeviceList
+            = devices(platform, deviceType);
+        // exclude platform if no matching device
+        if (!platformDeviceList.empty()) {
+            platformDevices[platform] = platformDeviceList;
         }
     }
 
     return platformDevices;
 }
 
+auto d_ocl::gpuPlatformDevices()
+    -> std::unordered_map<cl_platform_id, std::vector<cl_device_id>>
+{
+    return platformDevices(CL_DEVICE_TYPE_GPU);
+}
+
+auto d_ocl::defaultDeviceScore(cl_device_id device) -> double
+{
+    std::vector<cl_uint> clockMhz;
+    std::vector<cl_ulong> globalMemSize;
+    std::vector<cl_bool> imageSupport;
+    if (!utils::information<cl_uint>(
+            device, CL_DEVICE_MAX_CLOCK_FREQUENCY, clockMhz, 0)
+        || !utils::information<cl_ulong>(
+            device, CL_DEVICE_GLOBAL_MEM_SIZE, globalMemSize, 0)
+        || !utils::information<cl_bool>(
+            device, CL_DEVICE_IMAGE_SUPPORT, imageSupport, CL_FALSE)) {
+        // can't rank it; only pick it if nothing else is there
+        return 0;
+    }
+
+    // rough peak throughput
+    double score = static_cast<double>(utils::maxComputeUnits(device))
+                   * std::max<cl_uint>(clockMhz[0], 1);
+    // memory in gb is small compared to throughput,
+    // so it mostly breaks ties between otherwise identical devices
+    score += static_cast<double>(globalMemSize[0]) / (1 << 30);
+    if (imageSupport[0] != CL_TRUE) {
+        score *= 0.01;
+    }
+    return score;
+}
+
+auto d_ocl::selectDevice(const device_selector& selector,
+                         cl_platform_id& platform,
+                         cl_device_id& device) -> bool
+{
+    std::string deviceName = selector.deviceName;
+    const char* envDeviceName = std::getenv("D_OCL_DEVICE");
+    if (deviceName.empty() && envDeviceName != nullptr) {
+        deviceName = envDeviceName;
+    }
+
+    const std::vector<cl_platform_id> platforms = gpuPlatforms();
+    for (cl_device_type deviceType : selector.deviceTypes) {
+        bool found = false;
+        double bestScore = 0;
+
+        // visit in enumeration order, which is stable on a given host,
+        // and only replace on strictly better score
+        for (cl_platform_id candidatePlatform : platforms) {
+            for (cl_device_id candidate :
+                 devices(candidatePlatform, deviceType)) {
+                if (!deviceName.empty()
+                    && utils::deviceName(candidate).find(deviceName)
+                           == std::string::npos) {
+                    continue;
+                }
+
+                double score
+                    = selector.score ? selector.score(candidate) : 0;
+                if (!found || score > bestScore) {
+                    found = true;
+                    bestScore = score;
+                    platform = candidatePlatform;
+                    device = candidate;
+                }
+            }
+        }
+
+        // don't fall back to a less preferred type if this one had a match
+        if (found) {
+            return true;
+        }
+    }
+
+    std::cerr << "no device found";
+    if (!deviceName.empty()) {
+        std::cerr << " matching name \"" << deviceName << "\"";
+    }
+    std::cerr << std::endl;
+    return false;
+}
+
 auto handleError(const char* errinfo,
                  const void* private_info,
                  size_t cb,
@@ -109,113 +205,211 @@ auto d_ocl::createContext(cl_platform_id platform,
         &clReleaseContext);
 }
 
-auto d_ocl::createCmdQueue(cl_device_id device, cl_context context)
+auto d_ocl::createCmdQueue(cl_device_id device,
+                           cl_context context,
+                           cl_command_queue_properties properties /*= 0*/)
     -> std::shared_ptr<utils::manager<cl_command_queue>>
 {
-    return utils::manager<cl_command_queue>::makeShared(
-        clCreateCommandQueueWithProperties(context, device, nullptr, nullptr),
-        &clReleaseCommandQueue);
+    const char* envProfile = std::getenv("D_OCL_PROFILE");
+    if (envProfile != nullptr && std::string(envProfile) == "1") {
+        properties |= CL_QUEUE_PROFILING_ENABLE;
+    }
+
+    // zero-terminated {name, value} list
+    std::vector<cl_queue_properties> queueProperties;
+    if (properties != 0) {
+        queueProperties.push_back(CL_QUEUE_PROPERTIES);
+        queueProperties.push_back(properties);
+        queueProperties.push_back(0);
+    }
+
+    cl_int status;
+    std::shared_ptr<utils::manager<cl_command_queue>> queue
+        = utils::manager<cl_command_queue>::makeShared(
+            clCreateCommandQueueWithProperties(
+                context,
+                device,
+                queueProperties.empty() ? nullptr : queueProperties.data(),
+                &status),
+            &clReleaseCommandQueue);
+    if (!queue) {
+        std::cerr << "clCreateCommandQueueWithProperties() failed: "
+                  << utils::errorString(status) << std::endl;
+    }
+    return queue;
 }
 
-auto d_ocl::createContextSet(context_set& contextSet) -> bool
+auto d_ocl::createContextSet(context_set& contextSet,
+                             const device_selector& selector
+                             /*= device_selector()*/,
+                             cl_command_queue_properties queueProperties
+                             /*= 0*/) -> bool
 {
-    std::unordered_map<cl_platform_id, std::vector<cl_device_id>>
-        platformDevices = gpuPlatformDevices();
-    if (platformDevices.empty()) {
-        std::cerr << "no gpu device found" << std::endl;
+    cl_platform_id platform;
+    cl_device_id device;
+    if (!selectDevice(selector, platform, device)) {
         return false;
     }
-    const auto platformIter = platformDevices.cbegin();
-    // guaranteed to have at least 1 device in platform.
-    // just going to use the first one
-    cl_device_id device = platformIter->second[0];
 
     std::shared_ptr<utils::manager<cl_context>> context = d_ocl::createContext(
-        platformIter->first, std::vector<cl_device_id>(1, device));
+        platform, std::vector<cl_device_id>(1, device));
     if (!context) {
-        std::cerr << "error creating gpu device context" << std::endl;
+        std::cerr << "error creating device context" << std::endl;
         return false;
     }
     // to communicate with device
     std::shared_ptr<utils::manager<cl_command_queue>> cmdQueue
-        = d_ocl::createCmdQueue(device, context->openclObject);
-    if (!cmdQueue) {
-        std::cerr << "error creating gpu device cmd queue" << std::endl;
+        = d_ocl::createCmdQueue(
+            device, context->openclObject, queueProperties);
+    std::shared_ptr<utils::manager<cl_command_queue>> uploadQueue
+        = d_ocl::createCmdQueue(
+            device, context->openclObject, queueProperties);
+    std::shared_ptr<utils::manager<cl_command_queue>> downloadQueue
+        = d_ocl::createCmdQueue(
+            device, context->openclObject, queueProperties);
+    if (!cmdQueue || !uploadQueue || !downloadQueue) {
+        std::cerr << "error creating device cmd queue" << std::endl;
         return false;
     }
 
     contextSet.device = device;
     contextSet.context = context;
     contextSet.cmdQueue = cmdQueue;
+    contextSet.uploadQueue = uploadQueue;
+    contextSet.downloadQueue = downloadQueue;
     return true;
 }
 
-auto d_ocl::createProgram(cl_context context, const std::string& filePath)
-    -> std::shared_ptr<utils::manager<cl_program>>
+// read-only view of a whole file. unmapped when out of scope
+struct mapped_file
 {
-    // something really wrong if a single source file is more than 8 mb
-    const size_t bufferSize = 1 << 23;
-    if (g_scratchBuffer.size() < bufferSize) {
-        g_scratchBuffer.resize(bufferSize);
-    }
-    std::memset(g_scratchBuffer.data(), '\0', bufferSize);
-
-    std::vector<const char*> lines;
-    std::vector<size_t> lengths;
-    // offset in g_scratchBuffer for the next line
-    size_t pos = 0;
-    char* line = g_scratchBuffer.data();
-    std::ifstream stream(filePath);
-
-    // store each line as char*; clCreateProgram() wants char**
-    while (stream.getline(line, bufferSize - pos)) {
-        lines.push_back(line);
-        size_t length = std::strlen(line);
-        // getline() doesn't store the delimiter '\n'
-        std::memset(line + length++, '\n', 1);
-        // each line passed to clCreateProgram() must be null terminated
-        std::memset(line + length, '\0', 1);
-        // line size must exclude null terminator
-        lengths.push_back(length);
-
-        // + 1 to go past the null terminator
-        length++;
-        pos += length;
-        line += length;
-        if (pos >= bufferSize) {
-            std::cerr << filePath << " is more than " << bufferSize << " bytes"
-                      << std::endl;
-            return utils::manager<cl_program>::makeShared(nullptr, nullptr);
+    explicit mapped_file(const std::string& filePath)
+    {
+        int fd = open(filePath.c_str(), O_RDONLY);
+        if (fd < 0) {
+            return;
+        }
+
+        struct stat fileStat;
+        if (fstat(fd, &fileStat) == 0 && fileStat.st_size > 0) {
+            void* mapped = mmap(
+                nullptr, fileStat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (mapped != MAP_FAILED) {
+                data = reinterpret_cast<const char*>(mapped);
+                size = fileStat.st_size;
+            }
+        }
+        // mapping stays valid after close()
+        close(fd);
+    }
+    ~mapped_file()
+    {
+        if (data != nullptr) {
+            munmap(const_cast<char*>(data), size);
         }
     }
+    mapped_file(const mapped_file&) = delete;
+    auto operator=(const mapped_file&) -> mapped_file& = delete;
 
-    std::shared_ptr<utils::manager<cl_program>> program
-        = utils::manager<cl_program>::makeShared(
-            clCreateProgramWithSource(
-                context, lines.size(), lines.data(), lengths.data(), nullptr),
-            &clReleaseProgram);
-    if (!program) {
-        return program;
+    const char* data{nullptr};
+    size_t size{0};
+};
+
+// text of the files source #includes with quotes, and of the ones they
+// include in turn, each after its name. looked up in directory
+static auto includedSources(const std::string& directory,
+                            const char* source,
+                            size_t size) -> std::string
+{
+    std::string included;
+    std::set<std::string> seen;
+    std::vector<std::string> pending(1, std::string(source, size));
+    while (!pending.empty()) {
+        std::istringstream lines(pending.back());
+        pending.pop_back();
+        std::string line;
+        while (std::getline(lines, line)) {
+            const size_t start = line.find_first_not_of(" \t");
+            if (start == std::string::npos
+                || line.compare(start, 8, "#include") != 0) {
+                continue;
+            }
+            const size_t open = line.find('"', start + 8);
+            const size_t close = open == std::string::npos
+                                     ? std::string::npos
+                                     : line.find('"', open + 1);
+            if (close == std::string::npos) {
+                continue;
+            }
+            const std::string name = line.substr(open + 1, close - open - 1);
+            if (!seen.insert(name).second) {
+                continue;
+            }
+            // a missing file is left for the compiler to report
+            std::string text;
+            d_ocl::utils::readFile(directory + "/" + name, text);
+            included += name + "\n" + text;
+            pending.push_back(text);
+        }
+    }
+    return included;
+}
+
+auto d_ocl::createProgram(cl_context context,
+                          const std::string& filePath,
+                          const std::string& options /*= std::string()*/,
+                          const program_defines& defines
+                          /*= program_defines()*/)
+    -> std::shared_ptr<utils::manager<cl_program>>
+{
+    // no copy of the source on our side.
+    // clCreateProgramWithSource() takes the whole file as a single string
+    mapped_file source(filePath);
+    if (source.data == nullptr) {
+        std::cerr << "error reading kernel source " << filePath << std::endl;
+        return std::shared_ptr<utils::manager<cl_program>>();
     }
 
-    // compile and link the program
-    if (!utils::checkRun("clBuildProgram",
-                         clBuildProgram(program->openclObject,
-                                        0,
-                                        nullptr,
-                                        nullptr,
-                                        nullptr,
-                                        nullptr))) {
-        // clReleaseProgram if build failed
-        program.reset();
+    // #include "name" is looked up next to the source, e.g. the shared
+    // helpers in res/. the included text is part of the cache key too
+    const size_t slash = filePath.rfind('/');
+    const std::string directory = slash == std::string::npos
+                                      ? std::string(".")
+                                      : filePath.substr(0, slash);
+    const std::string included
+        = includedSources(directory, source.data, source.size);
+    std::string buildOptions = options;
+    if (!included.empty()) {
+        if (!buildOptions.empty()) {
+            buildOptions += " ";
+        }
+        buildOptions += "-I " + directory;
+    }
+
+    // -D NAME=VALUE for every define, in name order so the same defines
+    // always make the same options string (and program cache key)
+    for (const std::pair<const std::string, std::string>& define : defines) {
+        if (!buildOptions.empty()) {
+            buildOptions += " ";
+        }
+        buildOptions += "-D " + define.first;
+        if (!define.second.empty()) {
+            buildOptions += "=" + define.second;
+        }
     }
-    return program;
+
+    // reuses the binary from a previous build if cached
+    return buildProgram(context,
+                        std::vector<const char*>(1, source.data),
+                        std::vector<size_t>(1, source.size),
+                        buildOptions,
+                        included);
 }
 
-auto getImageFormat(const cv::Mat& mat, cl_image_format& imageFormat) -> bool
+auto getImageFormat(int type, cl_image_format& imageFormat) -> bool
 {
     cl_channel_type channelType;
-    switch (mat.depth()) {
+    switch (CV_MAT_DEPTH(type)) {
     case CV_8S:
         channelType = CL_SIGNED_INT8;
         break;
@@ -242,13 +436,13 @@ auto getImageFormat(const cv::Mat& mat, cl_image_format& imageFormat) -> bool
         break;
 
     default:
-        std::cerr << "unsupported cv::Mat::depth() " << mat.depth()
+        std::cerr << "unsupported cv::Mat::depth() " << CV_MAT_DEPTH(type)
                   << std::endl;
         return false;
     }
 
     cl_channel_order channelOrder;
-    switch (mat.channels()) {
+    switch (CV_MAT_CN(type)) {
     case 1:
         channelOrder = CL_R;
         break;
@@ -259,7 +453,7 @@ auto getImageFormat(const cv::Mat& mat, cl_image_format& imageFormat) -> bool
         channelOrder = CL_RGBA;
         break;
     default:
-        std::cerr << "unsupported cv::Mat.channels() " << mat.channels()
+        std::cerr << "unsupported cv::Mat.channels() " << CV_MAT_CN(type)
                   << std::endl;
         return false;
     }
@@ -269,10 +463,16 @@ auto getImageFormat(const cv::Mat& mat, cl_image_format& imageFormat) -> bool
     return true;
 }
 
+auto getImageFormat(const cv::Mat& mat, cl_image_format& imageFormat) -> bool
+{
+    return getImageFormat(mat.type(), imageFormat);
+}
+
 auto getImageDescription(const cv::Mat& mat, cl_image_desc& description) -> bool
 {
-    if (mat.cols <= 0 || mat.rows <= 0 || mat.cols > CL_DEVICE_IMAGE2D_MAX_WIDTH
-        || mat.rows > CL_DEVICE_IMAGE2D_MAX_HEIGHT) {
+    // the device's limits are checked by clCreateImage(), see
+    // utils::imageLimits() and d_ocl_tiling.h for larger images
+    if (mat.cols <= 0 || mat.rows <= 0) {
         std::cerr << "invalid image resolution " << mat.cols << "x" << mat.rows
                   << std::endl;
         return false;
@@ -285,6 +485,333 @@ auto getImageDescription(const cv::Mat& mat, cl_image_desc& description) -> bool
     return true;
 }
 
+auto d_ocl::loadImage(const std::string& filePath,
+                      const std::vector<utils::mat_convert_func>& matConverts,
+                      cv::Mat& finalMat) -> bool
+{
+    cv::Mat srcMat = cv::imread(filePath);
+    if (srcMat.empty()) {
+        std::cerr << "cv::imread(" << filePath << ") failed" << std::endl;
+        return false;
+    }
+
+    return convertImage(srcMat, matConverts, finalMat);
+}
+
+auto d_ocl::convertImage(
+    const cv::Mat& srcMat,
+    const std::vector<utils::mat_convert_func>& matConverts,
+    cv::Mat& finalMat) -> bool
+{
+    // 1 pass and 1 allocation instead of 1 of each per convert
+    int type;
+    if (!matConverts.empty()
+        && fusedConvertedType(srcMat.type(), matConverts, type)) {
+        finalMat.create(srcMat.rows, srcMat.cols, type);
+        return fusedConvert(srcMat, matConverts, finalMat);
+    }
+
+    cv::Mat convertMat = srcMat;
+    finalMat = srcMat;
+    // apply requested conversions like bgra -> rgba
+    for (utils::mat_convert_func convertFunc : matConverts) {
+        convertFunc(&convertMat, &finalMat);
+        convertMat = finalMat;
+    }
+    return true;
+}
+
+// inverse of getImageFormat()
+static auto getMatType(const cl_image_format& imageFormat, int& type) -> bool
+{
+    int depth;
+    switch (imageFormat.image_channel_data_type) {
+    case CL_SIGNED_INT8:
+    case CL_SNORM_INT8:
+        depth = CV_8S;
+        break;
+    case CL_UNSIGNED_INT8:
+    case CL_UNORM_INT8:
+        depth = CV_8U;
+        break;
+    case CL_HALF_FLOAT:
+        depth = CV_16F;
+        break;
+    case CL_SIGNED_INT16:
+    case CL_SNORM_INT16:
+        depth = CV_16S;
+        break;
+    case CL_UNSIGNED_INT16:
+    case CL_UNORM_INT16:
+        depth = CV_16U;
+        break;
+    case CL_FLOAT:
+        depth = CV_32F;
+        break;
+    case CL_SIGNED_INT32:
+        depth = CV_32S;
+        break;
+    default:
+        std::cerr << "unsupported image channel data type "
+                  << imageFormat.image_channel_data_type << std::endl;
+        return false;
+    }
+
+    int channels;
+    switch (imageFormat.image_channel_order) {
+    case CL_R:
+    case CL_A:
+    case CL_INTENSITY:
+    case CL_LUMINANCE:
+        channels = 1;
+        break;
+    case CL_RG:
+        channels = 2;
+        break;
+    case CL_RGB:
+        channels = 3;
+        break;
+    case CL_RGBA:
+    case CL_BGRA:
+    case CL_ARGB:
+        channels = 4;
+        break;
+    default:
+        std::cerr << "unsupported image channel order "
+                  << imageFormat.image_channel_order << std::endl;
+        return false;
+    }
+
+    type = CV_MAKETYPE(depth, channels);
+    return true;
+}
+
+// cv::Mat type and size of a 2d image
+static auto getImageMat(cl_mem image, int& type, int& cols, int& rows) -> bool
+{
+    cl_image_format imageFormat;
+    size_t width = 0;
+    size_t height = 0;
+    if (!d_ocl::utils::checkRun("clGetImageInfo",
+                                clGetImageInfo(image,
+                                               CL_IMAGE_FORMAT,
+                                               sizeof(imageFormat),
+                                               &imageFormat,
+                                               nullptr))
+        || !d_ocl::utils::checkRun(
+            "clGetImageInfo",
+            clGetImageInfo(
+                image, CL_IMAGE_WIDTH, sizeof(width), &width, nullptr))
+        || !d_ocl::utils::checkRun(
+            "clGetImageInfo",
+            clGetImageInfo(
+                image, CL_IMAGE_HEIGHT, sizeof(height), &height, nullptr))) {
+        return false;
+    }
+
+    cols = static_cast<int>(width);
+    rows = static_cast<int>(std::max<size_t>(height, 1));
+    return getMatType(imageFormat, type);
+}
+
+auto d_ocl::hostVisibleFlags(cl_context context) -> cl_mem_flags
+{
+    std::vector<cl_device_id> devices = utils::contextDevices(context);
+    if (devices.empty()) {
+        return 0;
+    }
+    for (cl_device_id device : devices) {
+        if (!utils::hostUnifiedMemory(device)) {
+            // mapping would copy anyway, and device memory is faster
+            return 0;
+        }
+    }
+    return CL_MEM_ALLOC_HOST_PTR;
+}
+
+d_ocl::mapped_memory::mapped_memory(cl_command_queue queue,
+                                    cl_mem memObject,
+                                    void* data)
+    : queue(queue), memObject(memObject), data(data)
+{
+    // the mapping may outlive the caller's handles
+    clRetainCommandQueue(queue);
+    clRetainMemObject(memObject);
+}
+
+d_ocl::mapped_memory::~mapped_memory()
+{
+    utils::checkRun(
+        "clEnqueueUnmapMemObject",
+        clEnqueueUnmapMemObject(queue, memObject, data, 0, nullptr, nullptr));
+    // the unmap must reach the device before anything waits on it
+    clFlush(queue);
+    clReleaseMemObject(memObject);
+    clReleaseCommandQueue(queue);
+}
+
+auto d_ocl::mapBuffer(cl_command_queue queue,
+                      cl_mem buffer,
+                      cl_map_flags mapFlags,
+                      size_t offset,
+                      size_t size,
+                      const std::vector<cl_event>& waitList)
+    -> std::shared_ptr<mapped_memory>
+{
+    cl_int status;
+    void* data = clEnqueueMapBuffer(queue,
+                                    buffer,
+                                    CL_TRUE,
+                                    mapFlags,
+                                    offset,
+                                    size,
+                                    static_cast<cl_uint>(waitList.size()),
+                                    waitList.empty() ? nullptr
+                                                     : waitList.data(),
+                                    nullptr,
+                                    &status);
+    if (!utils::checkRun("clEnqueueMapBuffer", status)) {
+        return std::shared_ptr<mapped_memory>();
+    }
+    return std::make_shared<mapped_memory>(queue, buffer, data);
+}
+
+auto d_ocl::mapImage(cl_command_queue queue,
+                     cl_mem image,
+                     cl_map_flags mapFlags,
+                     const std::vector<cl_event>& waitList,
+                     cv::Mat& view) -> std::shared_ptr<mapped_memory>
+{
+    int type;
+    int cols;
+    int rows;
+    if (!getImageMat(image, type, cols, rows)) {
+        return std::shared_ptr<mapped_memory>();
+    }
+
+    std::vector<size_t> origin(3, 0);
+    std::vector<size_t> region = {(size_t)cols, (size_t)rows, 1};
+    size_t rowPitch = 0;
+    cl_int status;
+    void* data = clEnqueueMapImage(queue,
+                                   image,
+                                   CL_TRUE,
+                                   mapFlags,
+                                   origin.data(),
+                                   region.data(),
+                                   &rowPitch,
+                                   nullptr,
+                                   static_cast<cl_uint>(waitList.size()),
+                                   waitList.empty() ? nullptr : waitList.data(),
+                                   nullptr,
+                                   &status);
+    if (!utils::checkRun("clEnqueueMapImage", status)) {
+        return std::shared_ptr<mapped_memory>();
+    }
+
+    view = cv::Mat(rows, cols, type, data, rowPitch);
+    return std::make_shared<mapped_memory>(queue, image, data);
+}
+
+auto d_ocl::readImage(cl_command_queue queue,
+                      cl_mem image,
+                      const std::vector<cl_event>& waitList,
+                      cv::Mat& hostMat,
+                      std::shared_ptr<mapped_memory>& mapping) -> bool
+{
+    mapping.reset();
+
+    cl_mem_flags flags = 0;
+    if (!utils::checkRun(
+            "clGetMemObjectInfo",
+            clGetMemObjectInfo(
+                image, CL_MEM_FLAGS, sizeof(flags), &flags, nullptr))) {
+        return false;
+    }
+    if ((flags & (CL_MEM_ALLOC_HOST_PTR | CL_MEM_USE_HOST_PTR)) != 0
+        && utils::hostUnifiedMemory(utils::queueDevice(queue))) {
+        // zero-copy
+        mapping = mapImage(queue, image, CL_MAP_READ, waitList, hostMat);
+        return static_cast<bool>(mapping);
+    }
+
+    // discrete memory. an explicit copy is as cheap as mapping, and the
+    // result outlives the image
+    int type;
+    int cols;
+    int rows;
+    if (!getImageMat(image, type, cols, rows)) {
+        return false;
+    }
+    hostMat.create(rows, cols, type);
+    std::vector<size_t> origin(3, 0);
+    std::vector<size_t> region = {(size_t)cols, (size_t)rows, 1};
+    return utils::checkRun(
+        "clEnqueueReadImage",
+        clEnqueueReadImage(queue,
+                           image,
+                           CL_TRUE,
+                           origin.data(),
+                           region.data(),
+                           hostMat.step[0],
+                           0,
+                           hostMat.data,
+                           static_cast<cl_uint>(waitList.size()),
+                           waitList.empty() ? nullptr : waitList.data(),
+                           nullptr));
+}
+
+auto d_ocl::readImageArray(cl_command_queue queue,
+                           cl_mem image,
+                           const std::vector<cl_event>& waitList,
+                           std::vector<cv::Mat>& layers) -> bool
+{
+    int type;
+    int cols;
+    int rows;
+    size_t count = 0;
+    if (!getImageMat(image, type, cols, rows)
+        || !utils::checkRun("clGetImageInfo",
+                            clGetImageInfo(image,
+                                           CL_IMAGE_ARRAY_SIZE,
+                                           sizeof(count),
+                                           &count,
+                                           nullptr))) {
+        return false;
+    }
+    if (count == 0) {
+        std::cerr << "readImageArray() of an image that isn't an array"
+                  << std::endl;
+        return false;
+    }
+
+    // 1 transfer of the whole array, layers end to end
+    cv::Mat stacked(static_cast<int>(rows * count), cols, type);
+    std::vector<size_t> origin(3, 0);
+    std::vector<size_t> region = {(size_t)cols, (size_t)rows, count};
+    if (!utils::checkRun(
+            "clEnqueueReadImage",
+            clEnqueueReadImage(queue,
+                               image,
+                               CL_TRUE,
+                               origin.data(),
+                               region.data(),
+                               stacked.step[0],
+                               stacked.step[0] * rows,
+                               stacked.data,
+                               static_cast<cl_uint>(waitList.size()),
+                               waitList.empty() ? nullptr : waitList.data(),
+                               nullptr))) {
+        return false;
+    }
+    layers.resize(count);
+    for (size_t i = 0; i < count; i++) {
+        layers[i] = stacked.rowRange(static_cast<int>(i * rows),
+                                     static_cast<int>((i + 1) * rows));
+    }
+    return true;
+}
+
 auto d_ocl::createInputImage(
     cl_context context,
     cl_mem_flags flags,
@@ -293,19 +820,11 @@ auto d_ocl::createInputImage(
     cv::Mat* opencvMat /*= nullptr*/
     ) -> std::shared_ptr<utils::manager<cl_mem>>
 {
-    cv::Mat srcMat = cv::imread(filePath);
-    if (srcMat.empty()) {
-        std::cerr << "cv::imread(" << filePath << ") failed" << std::endl;
+    cv::Mat finalMat;
+    if (!loadImage(filePath, matConverts, finalMat)) {
         return std::shared_ptr<utils::manager<cl_mem>>();
     }
 
-    cv::Mat finalMat = srcMat;
-    // apply requested conversions like bgra -> rgba
-    for (utils::mat_convert_func convertFunc : matConverts) {
-        convertFunc(&srcMat, &finalMat);
-        srcMat = finalMat;
-    }
-
     // now ready to map to opencl image meta data
     cl_image_format imageFormat;
     cl_image_desc imageDesc;
@@ -338,9 +857,184 @@ auto d_ocl::createInputImage(
     return image;
 }
 
+// upload the image after its host converts as decoded, and run the device
+// converts after them on it by converter, or a new one if null
+static auto createDeviceConvertedImage(
+    cl_command_queue queue,
+    cl_mem_flags flags,
+    const std::string& filePath,
+    const std::vector<d_ocl::utils::mat_convert_func>& matConverts,
+    size_t hostConverts,
+    cv::Mat* opencvMat,
+    d_ocl::device_converter* converter)
+    -> std::shared_ptr<d_ocl::utils::manager<cl_mem>>
+{
+    cv::Mat rawMat;
+    if (!d_ocl::loadImage(
+            filePath,
+            std::vector<d_ocl::utils::mat_convert_func>(
+                matConverts.begin(), matConverts.begin() + hostConverts),
+            rawMat)) {
+        return std::shared_ptr<d_ocl::utils::manager<cl_mem>>();
+    }
+    const std::vector<d_ocl::utils::mat_convert_func> deviceConverts(
+        matConverts.begin() + hostConverts, matConverts.end());
+
+    cl_context context = d_ocl::utils::queueContext(queue);
+    int type;
+    if (!d_ocl::deviceConvertedType(rawMat.type(), deviceConverts, type)) {
+        // e.g. not 8-bit. the device converts run their host versions
+        return d_ocl::createInputImage(
+            context, flags, filePath, matConverts, opencvMat);
+    }
+    std::unique_ptr<d_ocl::device_converter> ownConverter;
+    if (converter == nullptr) {
+        ownConverter.reset(new d_ocl::device_converter(context));
+        converter = ownConverter.get();
+    }
+    if (!*converter) {
+        return std::shared_ptr<d_ocl::utils::manager<cl_mem>>();
+    }
+
+    // the raw 8-bit image. bgr can't be an 8-bit image, so a buffer
+    std::shared_ptr<d_ocl::utils::manager<cl_mem>> rawBuffer
+        = d_ocl::utils::createBuffer(
+            context,
+            CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR | CL_MEM_HOST_NO_ACCESS,
+            rawMat.step[0] * rawMat.rows,
+            rawMat.data);
+    if (!rawBuffer) {
+        std::cerr << "uploading " << filePath << " failed" << std::endl;
+        return std::shared_ptr<d_ocl::utils::manager<cl_mem>>();
+    }
+
+    // the conversion kernel writes the image, whatever kernels do later
+    const cv::Mat finalMat(rawMat.rows, rawMat.cols, type);
+    std::shared_ptr<d_ocl::utils::manager<cl_mem>> image
+        = d_ocl::createOutputImage(
+            context,
+            (flags & ~(CL_MEM_READ_ONLY | CL_MEM_WRITE_ONLY))
+                | CL_MEM_READ_WRITE,
+            finalMat);
+    if (!image) {
+        return image;
+    }
+
+    d_ocl::handle<cl_event> converted;
+    if (!converter->bytesToImage(queue,
+                                 rawBuffer->openclObject,
+                                 rawMat.step[0],
+                                 rawMat.type(),
+                                 rawMat.cols,
+                                 rawMat.rows,
+                                 deviceConverts,
+                                 image->openclObject,
+                                 {},
+                                 converted.outParam())
+        || !d_ocl::utils::checkRun("clWaitForEvents",
+                                   clWaitForEvents(1, converted.address()))) {
+        return std::shared_ptr<d_ocl::utils::manager<cl_mem>>();
+    }
+
+    if (opencvMat != nullptr) {
+        *opencvMat = finalMat;
+    }
+    return image;
+}
+
+auto d_ocl::createInputImage(
+    cl_command_queue queue,
+    cl_mem_flags flags,
+    const std::string& filePath,
+    const std::vector<utils::mat_convert_func>& matConverts,
+    cv::Mat* opencvMat /*= nullptr*/,
+    device_converter* converter /*= nullptr*/
+    ) -> std::shared_ptr<utils::manager<cl_mem>>
+{
+    cl_context context = utils::queueContext(queue);
+    const size_t hostConverts = hostConvertCount(matConverts);
+    if (hostConverts < matConverts.size()) {
+        return createDeviceConvertedImage(queue,
+                                          flags,
+                                          filePath,
+                                          matConverts,
+                                          hostConverts,
+                                          opencvMat,
+                                          converter);
+    }
+    if (!utils::hostUnifiedMemory(utils::queueDevice(queue))) {
+        return createInputImage(
+            context, flags, filePath, matConverts, opencvMat);
+    }
+
+    cv::Mat decodedMat;
+    if (!loadImage(filePath, {}, decodedMat)) {
+        return std::shared_ptr<utils::manager<cl_mem>>();
+    }
+    // converted straight into the mapping below, without a staging cv::Mat,
+    // unless the caller wants the converted image
+    int fusedType;
+    const bool convertIntoMapping
+        = opencvMat == nullptr
+          && fusedConvertedType(decodedMat.type(), matConverts, fusedType);
+    cv::Mat finalMat;
+    if (!convertIntoMapping
+        && !convertImage(decodedMat, matConverts, finalMat)) {
+        return std::shared_ptr<utils::manager<cl_mem>>();
+    }
+
+    cl_image_format imageFormat;
+    cl_image_desc imageDesc;
+    if (!getImageFormat(convertIntoMapping ? fusedType : finalMat.type(),
+                        imageFormat)
+        || !getImageDescription(decodedMat, imageDesc)) {
+        return std::shared_ptr<utils::manager<cl_mem>>();
+    }
+
+    cl_int status;
+    std::shared_ptr<utils::manager<cl_mem>> image
+        = utils::manager<cl_mem>::makeShared(
+            // driver-allocated, page-aligned host-visible memory
+            clCreateImage(context,
+                          flags | CL_MEM_ALLOC_HOST_PTR,
+                          &imageFormat,
+                          &imageDesc,
+                          nullptr,
+                          &status),
+            &clReleaseMemObject);
+    if (!image || status != CL_SUCCESS) {
+        std::cerr << "clCreateImage(" << filePath
+                  << ") failed: " << utils::errorString(status) << "(" << status
+                  << ")" << std::endl;
+        return std::shared_ptr<utils::manager<cl_mem>>();
+    }
+
+    cv::Mat view;
+    std::shared_ptr<mapped_memory> mapping = mapImage(
+        queue, image->openclObject, CL_MAP_WRITE_INVALIDATE_REGION, {}, view);
+    if (!mapping) {
+        return std::shared_ptr<utils::manager<cl_mem>>();
+    }
+    // view already has the converted size and type, so this writes in place
+    if (convertIntoMapping) {
+        if (!fusedConvert(decodedMat, matConverts, view)) {
+            return std::shared_ptr<utils::manager<cl_mem>>();
+        }
+    } else {
+        finalMat.copyTo(view);
+    }
+    mapping.reset();
+
+    if (opencvMat != nullptr) {
+        *opencvMat = finalMat;
+    }
+    return image;
+}
+
 auto d_ocl::createOutputImage(cl_context context,
                               cl_mem_flags flags,
-                              const cv::Mat& opencvMat)
+                              const cv::Mat& opencvMat,
+                              image_pool* pool /*= nullptr*/)
     -> std::shared_ptr<utils::manager<cl_mem>>
 {
     cl_image_format imageFormat;
@@ -350,6 +1044,15 @@ auto d_ocl::createOutputImage(cl_context context,
         return std::shared_ptr<utils::manager<cl_mem>>();
     }
 
+    if (pool != nullptr) {
+        if (pool->context() != context) {
+            std::cerr << "createOutputImage() with a pool of another context"
+                      << std::endl;
+            return std::shared_ptr<utils::manager<cl_mem>>();
+        }
+        return pool->acquire(flags, imageFormat, imageDesc);
+    }
+
     cl_int status;
     std::shared_ptr<utils::manager<cl_mem>> image
         = utils::manager<cl_mem>::makeShared(
@@ -363,3 +1066,32 @@ auto d_ocl::createOutputImage(cl_context context,
 
     return image;
 }
+
+auto d_ocl::createOutputImageArray(cl_context context,
+                                   cl_mem_flags flags,
+                                   const cv::Mat& opencvMat,
+                                   size_t layers)
+    -> std::shared_ptr<utils::manager<cl_mem>>
+{
+    cl_image_format imageFormat;
+    cl_image_desc imageDesc;
+    if (layers == 0 || !getImageFormat(opencvMat, imageFormat)
+        || !getImageDescription(opencvMat, imageDesc)) {
+        return std::shared_ptr<utils::manager<cl_mem>>();
+    }
+    imageDesc.image_type = CL_MEM_OBJECT_IMAGE2D_ARRAY;
+    imageDesc.image_array_size = layers;
+
+    cl_int status;
+    std::shared_ptr<utils::manager<cl_mem>> image
+        = utils::manager<cl_mem>::makeShared(
+            clCreateImage(
+                context, flags, &imageFormat, &imageDesc, nullptr, &status),
+            &clReleaseMemObject);
+    if (!image || status != CL_SUCCESS) {
+        std::cerr << "clCreateImage() for output image array failed: "
+                  << status << std::endl;
+    }
+
+    return image;
+}
@@ -2,8 +2,11 @@
 #define D_OCL_H
 
 #include "d_ocl_defines.h"
+#include "d_ocl_memory_pool.h"
 #include "d_ocl_utils.h"
 #include <CL/cl.h>
+#include <functional>
+#include <map>
 #include <memory>
 #include <string>
 #include <unordered_map>
@@ -14,35 +17,165 @@ struct Mat;
 }
 
 namespace d_ocl {
+struct device_converter;
+
+// all available platforms, regardless of the device types they offer
 auto D_OCL_API gpuPlatforms() -> std::vector<cl_platform_id>;
+// devices in platform of deviceType e.g. CL_DEVICE_TYPE_CPU
+auto D_OCL_API devices(cl_platform_id platform, cl_device_type deviceType)
+    -> std::vector<cl_device_id>;
 auto D_OCL_API gpuDevices(cl_platform_id platform) -> std::vector<cl_device_id>;
 // every vector<cl_device_id> is guaranteed to have at least 1 cl_device_id
+auto D_OCL_API platformDevices(cl_device_type deviceType)
+    -> std::unordered_map<cl_platform_id, std::vector<cl_device_id>>;
 auto D_OCL_API gpuPlatformDevices()
     -> std::unordered_map<cl_platform_id, std::vector<cl_device_id>>;
 
+// higher is better
+using device_score_func = std::function<double(cl_device_id)>;
+// compute units * clock frequency, tie-broken by global memory size.
+// devices without image support are heavily penalized since most examples
+// work on images
+auto D_OCL_API defaultDeviceScore(cl_device_id device) -> double;
+
+// how to pick the device for createContextSet()
+struct D_OCL_API device_selector
+{
+    // device types to try in order of preference.
+    // the first type with at least 1 matching device wins,
+    // so cpu-only hosts fall back to e.g. pocl
+    std::vector<cl_device_type> deviceTypes{
+        CL_DEVICE_TYPE_GPU, CL_DEVICE_TYPE_ACCELERATOR, CL_DEVICE_TYPE_CPU};
+    // pin to devices whose CL_DEVICE_NAME contains this, if not empty.
+    // D_OCL_DEVICE environment variable is used if this is empty
+    std::string deviceName;
+    // rank the candidate devices of the winning type
+    device_score_func score{&defaultDeviceScore};
+};
+// find the highest scoring device according to selector.
+// ties go to the device enumerated first, so the choice is stable per host
+auto D_OCL_API selectDevice(const device_selector& selector,
+                            cl_platform_id& platform,
+                            cl_device_id& device) -> bool;
+
 // the following "created" resources like cl_context
 // are managed and auto released via shared_ptr
 
 auto D_OCL_API createContext(cl_platform_id platform,
                              const std::vector<cl_device_id>& devices)
     -> std::shared_ptr<utils::manager<cl_context>>;
-auto D_OCL_API createCmdQueue(cl_device_id device, cl_context context)
+// properties e.g. CL_QUEUE_PROFILING_ENABLE for d_ocl_profiler.h.
+// D_OCL_PROFILE=1 environment variable adds CL_QUEUE_PROFILING_ENABLE to every
+// queue, to profile without rebuilding
+auto D_OCL_API createCmdQueue(cl_device_id device,
+                              cl_context context,
+                              cl_command_queue_properties properties = 0)
     -> std::shared_ptr<utils::manager<cl_command_queue>>;
 
 struct D_OCL_API context_set
 {
     cl_device_id device;
     std::shared_ptr<utils::manager<cl_context>> context;
+    // kernels
     std::shared_ptr<utils::manager<cl_command_queue>> cmdQueue;
+    // host -> device and device -> host transfers, so they can overlap with
+    // kernels on cmdQueue. see d_ocl_pipeline.h
+    std::shared_ptr<utils::manager<cl_command_queue>> uploadQueue;
+    std::shared_ptr<utils::manager<cl_command_queue>> downloadQueue;
 };
-// convenience func to create context and command queue for the first gpu device
-auto D_OCL_API createContextSet(context_set& contextSet) -> bool;
+// convenience func to create context and command queue for the device
+// picked by selector. by default the best gpu, else accelerator, else cpu.
+// queueProperties as in createCmdQueue()
+auto D_OCL_API createContextSet(
+    context_set& contextSet,
+    const device_selector& selector = device_selector(),
+    cl_command_queue_properties queueProperties = 0) -> bool;
 
+// macro name -> value, e.g. {"HIST_BINS", "256"} -> -D HIST_BINS=256.
+// empty value -> -D NAME
+using program_defines = std::map<std::string, std::string>;
 // read kernel source from filePath to create cl_program
-// program will have been built (compile, link)
-auto D_OCL_API createProgram(cl_context context, const std::string& filePath)
+// program will have been built (compile, link), or loaded from the
+// program binary cache (see d_ocl_program_cache.h).
+// #include "name" in the source is looked up in filePath's directory.
+// options are passed to clBuildProgram() e.g. "-cl-fast-relaxed-math".
+// defines bake constants into the program so the compiler can fold them and
+// unroll loops over them. safe to call from multiple threads
+auto D_OCL_API createProgram(cl_context context,
+                             const std::string& filePath,
+                             const std::string& options = std::string(),
+                             const program_defines& defines
+                             = program_defines())
     -> std::shared_ptr<utils::manager<cl_program>>;
 
+// CL_MEM_ALLOC_HOST_PTR if every device in context shares memory with the host
+// (see utils::hostUnifiedMemory()), else 0.
+// bit-or to flags of memory objects the host writes or reads back, so mapping
+// them is zero-copy
+auto D_OCL_API hostVisibleFlags(cl_context context) -> cl_mem_flags;
+
+// memory object mapped into host address space by clEnqueueMap*().
+// unmapped when destroyed, after which data must not be touched
+struct D_OCL_API mapped_memory
+{
+    mapped_memory(cl_command_queue queue, cl_mem memObject, void* data);
+    ~mapped_memory();
+    mapped_memory(const mapped_memory&) = delete;
+    auto operator=(const mapped_memory&) -> mapped_memory& = delete;
+
+    cl_command_queue queue;
+    cl_mem memObject;
+    void* data;
+};
+// blocking map of size bytes of buffer from offset, once waitList completed.
+// mapFlags e.g. CL_MAP_READ or CL_MAP_WRITE_INVALIDATE_REGION.
+// empty shared_ptr on failure
+auto D_OCL_API mapBuffer(cl_command_queue queue,
+                         cl_mem buffer,
+                         cl_map_flags mapFlags,
+                         size_t offset,
+                         size_t size,
+                         const std::vector<cl_event>& waitList)
+    -> std::shared_ptr<mapped_memory>;
+// blocking map of the whole 2d image, once waitList completed.
+// view is set to a cv::Mat over the mapped pixels with the mapped row pitch,
+// valid as long as the returned mapping
+auto D_OCL_API mapImage(cl_command_queue queue,
+                        cl_mem image,
+                        cl_map_flags mapFlags,
+                        const std::vector<cl_event>& waitList,
+                        cv::Mat& view) -> std::shared_ptr<mapped_memory>;
+// 2d image contents on host once waitList completed.
+// if image was created with hostVisibleFlags() on a unified memory device,
+// hostMat is a view of the mapped image and valid as long as mapping.
+// otherwise the image is copied into a newly allocated hostMat and mapping is
+// left empty
+auto D_OCL_API readImage(cl_command_queue queue,
+                         cl_mem image,
+                         const std::vector<cl_event>& waitList,
+                         cv::Mat& hostMat,
+                         std::shared_ptr<mapped_memory>& mapping) -> bool;
+// every layer of a 2d image array on host in 1 copy once waitList completed.
+// layers are set to views of 1 newly allocated cv::Mat of all layers stacked
+// vertically
+auto D_OCL_API readImageArray(cl_command_queue queue,
+                              cl_mem image,
+                              const std::vector<cl_event>& waitList,
+                              std::vector<cv::Mat>& layers) -> bool;
+
+// read image at filePath with cv::imread() and apply matConverts to it
+// e.g. to upload it in parts yourself
+auto D_OCL_API loadImage(
+    const std::string& filePath,
+    const std::vector<utils::mat_convert_func>& matConverts,
+    cv::Mat& finalMat) -> bool;
+// apply matConverts to srcMat in turn, or in 1 fusedConvert() pass (see
+// d_ocl_convert.h) if they are all toRgba / toGreyscale / toFloat
+auto D_OCL_API convertImage(
+    const cv::Mat& srcMat,
+    const std::vector<utils::mat_convert_func>& matConverts,
+    cv::Mat& finalMat) -> bool;
+
 // read image at filePath and initialize device-side image object with the input
 // image. opencvMat will be set to the loaded image if not null.
 // CL_MEM_COPY_HOST_PTR will be bit-or'd to flags
@@ -54,11 +187,38 @@ auto D_OCL_API createInputImage(
     // before setting up cl_mem
     const std::vector<utils::mat_convert_func>& matConverts,
     cv::Mat* opencvMat = nullptr) -> std::shared_ptr<utils::manager<cl_mem>>;
+// same as above, but on a unified memory device the image is allocated
+// host-visible and the loaded image written straight into its mapping
+// instead of being copied by clCreateImage(). falls back to the above on
+// discrete devices.
+// device converts (utils::deviceToRgba etc.) at the end of matConverts run
+// on queue after uploading the 8-bit image as decoded; then opencvMat only
+// has the converted image's size and type, not its pixels.
+// they run by converter if not null, e.g. when loading many images, else by
+// one built for the call. converter must be for queue's context
+auto D_OCL_API createInputImage(
+    cl_command_queue queue,
+    cl_mem_flags flags,
+    const std::string& filePath,
+    const std::vector<utils::mat_convert_func>& matConverts,
+    cv::Mat* opencvMat = nullptr,
+    device_converter* converter = nullptr)
+    -> std::shared_ptr<utils::manager<cl_mem>>;
 // create device-side output buffer for image with same specification
-// (resolution, etc.) as opencvMat
+// (resolution, etc.) as opencvMat.
+// taken from and returned to pool if not null, e.g. when called per frame.
+// pool must be for context
 auto D_OCL_API createOutputImage(cl_context context,
                                  cl_mem_flags flags,
-                                 const cv::Mat& opencvMat)
+                                 const cv::Mat& opencvMat,
+                                 image_pool* pool = nullptr)
+    -> std::shared_ptr<utils::manager<cl_mem>>;
+// create device-side 2d image array of layers images with the same
+// specification as opencvMat, e.g. for d_ocl::warp::runBatch()
+auto D_OCL_API createOutputImageArray(cl_context context,
+                                      cl_mem_flags flags,
+                                      const cv::Mat& opencvMat,
+                                      size_t layers)
     -> std::shared_ptr<utils::manager<cl_mem>>;
 } // namespace d_ocl
 
@@ -0,0 +1,356 @@
+#include "d_ocl_batch.h"
+#include "d_ocl_handle.h"
+#include "d_ocl_memory_pool.h"
+#include "d_ocl_profiler.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <iostream>
+#include <mutex>
+#include <opencv2/imgcodecs.hpp>
+#include <thread>
+
+namespace {
+// decoded input or downloaded output of the index-th input path
+struct batch_item
+{
+    size_t index;
+    cv::Mat mat;
+};
+
+// fifo between 2 stages. push() blocks while full, which is what holds back
+// a stage faster than the next one
+class bounded_queue
+{
+public:
+    explicit bounded_queue(size_t capacity) : capacity(capacity) {}
+
+    // blocked seconds are added to stalled
+    auto push(batch_item item, double& stalled) -> void
+    {
+        const auto begin = std::chrono::steady_clock::now();
+        std::unique_lock<std::mutex> lock(mutex);
+        notFull.wait(lock, [this] { return items.size() < capacity; });
+        stalled += std::chrono::duration<double>(
+                       std::chrono::steady_clock::now() - begin)
+                       .count();
+        items.push_back(std::move(item));
+        notEmpty.notify_one();
+    }
+    // false once closed and drained. blocked seconds are added to starved
+    auto pop(batch_item& item, double& starved) -> bool
+    {
+        const auto begin = std::chrono::steady_clock::now();
+        std::unique_lock<std::mutex> lock(mutex);
+        notEmpty.wait(lock, [this] { return !items.empty() || closed; });
+        starved += std::chrono::duration<double>(
+                       std::chrono::steady_clock::now() - begin)
+                       .count();
+        if (items.empty()) {
+            return false;
+        }
+        item = std::move(items.front());
+        items.pop_front();
+        notFull.notify_one();
+        return true;
+    }
+    // no more push()es will come
+    auto close() -> void
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        closed = true;
+        notEmpty.notify_all();
+    }
+
+private:
+    const size_t capacity;
+    std::mutex mutex;
+    std::condition_variable notFull;
+    std::condition_variable notEmpty;
+    std::deque<batch_item> items;
+    bool closed{false};
+};
+
+// 1 image between upload and the end of its download
+struct device_job
+{
+    size_t index;
+    // read by the upload, written by the download until downloaded completes
+    cv::Mat inputMat;
+    cv::Mat outputMat;
+    // back to the image pool once the job is gone, which is only after
+    // finishJob() waited for the commands using them
+    std::shared_ptr<d_ocl::utils::manager<cl_mem>> inputImage;
+    std::shared_ptr<d_ocl::utils::manager<cl_mem>> outputImage;
+    d_ocl::handle<cl_event> uploaded;
+    d_ocl::handle<cl_event> computed;
+    d_ocl::handle<cl_event> downloaded;
+};
+} // namespace
+
+static auto secondsSince(std::chrono::steady_clock::time_point begin)
+    -> double
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now()
+                                         - begin)
+        .count();
+}
+
+// add the stats of 1 thread to the stage's
+static auto addStageStats(const d_ocl::batch_stage_stats& part,
+                          d_ocl::batch_stage_stats& stats) -> void
+{
+    stats.items += part.items;
+    stats.busy += part.busy;
+    stats.stalled += part.stalled;
+    stats.starved += part.starved;
+}
+
+// outputDirectory/<input file name with outputExtension>
+static auto outputPath(const std::string& inputPath,
+                       const std::string& outputDirectory,
+                       const std::string& outputExtension) -> std::string
+{
+    std::string fileName = inputPath.substr(inputPath.find_last_of('/') + 1);
+    const size_t dot = fileName.find_last_of('.');
+    if (dot != std::string::npos && dot > 0) {
+        fileName.resize(dot);
+    }
+    return outputDirectory + "/" + fileName + outputExtension;
+}
+
+// wait for whatever part of job was enqueued, e.g. before dropping it
+static auto finishJob(device_job& job) -> bool
+{
+    bool succeeded = true;
+    for (d_ocl::handle<cl_event>* event :
+         {&job.uploaded, &job.computed, &job.downloaded}) {
+        if (*event) {
+            succeeded = d_ocl::utils::checkRun(
+                            "clWaitForEvents",
+                            clWaitForEvents(1, event->address()))
+                        && succeeded;
+        }
+    }
+    return succeeded;
+}
+
+// upload job.inputMat, process it and download into job.outputMat without
+// blocking
+static auto enqueueJob(const d_ocl::context_set& contextSet,
+                       const std::string& name,
+                       const d_ocl::batch_process_func& process,
+                       device_job& job) -> bool
+{
+    const size_t origin[3] = {0, 0, 0};
+    const size_t region[3]
+        = {(size_t)job.inputMat.cols, (size_t)job.inputMat.rows, 1};
+    const uint64_t bytes = job.inputMat.step[0] * job.inputMat.rows;
+
+    if (!d_ocl::utils::checkRun(
+            "clEnqueueWriteImage",
+            clEnqueueWriteImage(contextSet.uploadQueue->openclObject,
+                                job.inputImage->openclObject,
+                                CL_FALSE,
+                                origin,
+                                region,
+                                job.inputMat.step[0],
+                                0,
+                                job.inputMat.data,
+                                0,
+                                nullptr,
+                                job.uploaded.outParam()))) {
+        return false;
+    }
+    d_ocl::recordEvent(name + " upload", job.uploaded.get(), bytes);
+
+    if (!process(contextSet.cmdQueue->openclObject,
+                 job.inputImage->openclObject,
+                 job.outputImage->openclObject,
+                 job.inputMat,
+                 {job.uploaded.get()},
+                 job.computed.outParam())
+        || !job.computed) {
+        return false;
+    }
+    d_ocl::recordEvent(name + " compute", job.computed.get());
+
+    if (!d_ocl::utils::checkRun(
+            "clEnqueueReadImage",
+            clEnqueueReadImage(contextSet.downloadQueue->openclObject,
+                               job.outputImage->openclObject,
+                               CL_FALSE,
+                               origin,
+                               region,
+                               job.outputMat.step[0],
+                               0,
+                               job.outputMat.data,
+                               1,
+                               job.computed.address(),
+                               job.downloaded.outParam()))) {
+        return false;
+    }
+    d_ocl::recordEvent(name + " download", job.downloaded.get(), bytes);
+    return true;
+}
+
+auto d_ocl::runImageBatch(const context_set& contextSet,
+                          const std::string& name,
+                          const std::vector<std::string>& inputPaths,
+                          const std::string& outputDirectory,
+                          const batch_options& options,
+                          const batch_process_func& process,
+                          batch_stats& stats) -> bool
+{
+    stats = batch_stats();
+    if (!contextSet.uploadQueue || !contextSet.cmdQueue
+        || !contextSet.downloadQueue || !process
+        || !utils::makeDirectories(outputDirectory)) {
+        std::cerr << "invalid image batch " << name << std::endl;
+        return false;
+    }
+    const auto begin = std::chrono::steady_clock::now();
+
+    bounded_queue decoded(std::max<size_t>(options.decodeDepth, 1));
+    bounded_queue downloaded(std::max<size_t>(options.encodeDepth, 1));
+    std::mutex statsMutex;
+    std::atomic<size_t> failed(0);
+
+    // decode pool. each thread takes the next path not taken yet
+    std::atomic<size_t> nextInput(0);
+    const size_t decodeThreads = std::max<size_t>(options.decodeThreads, 1);
+    std::atomic<size_t> decoding(decodeThreads);
+    std::vector<std::thread> decoders;
+    for (size_t i = 0; i < decodeThreads; i++) {
+        decoders.emplace_back([&]() {
+            batch_stage_stats part;
+            for (size_t index = nextInput++; index < inputPaths.size();
+                 index = nextInput++) {
+                const auto decodeBegin = std::chrono::steady_clock::now();
+                batch_item item{index, cv::Mat()};
+                const bool loaded = loadImage(
+                    inputPaths[index], options.decodeConverts, item.mat);
+                part.busy += secondsSince(decodeBegin);
+                if (!loaded) {
+                    failed++;
+                    continue;
+                }
+                part.items++;
+                decoded.push(std::move(item), part.stalled);
+            }
+            // the last decoder done ends the device stage's input
+            if (--decoding == 0) {
+                decoded.close();
+            }
+            std::lock_guard<std::mutex> lock(statsMutex);
+            addStageStats(part, stats.decode);
+        });
+    }
+
+    // encode pool
+    std::vector<std::thread> encoders;
+    for (size_t i = 0; i < std::max<size_t>(options.encodeThreads, 1); i++) {
+        encoders.emplace_back([&]() {
+            batch_stage_stats part;
+            batch_item item;
+            while (downloaded.pop(item, part.starved)) {
+                const auto encodeBegin = std::chrono::steady_clock::now();
+                cv::Mat srcMat = item.mat;
+                cv::Mat finalMat = srcMat;
+                for (const utils::mat_convert_func& convertFunc :
+                     options.encodeConverts) {
+                    convertFunc(&srcMat, &finalMat);
+                    srcMat = finalMat;
+                }
+                const std::string filePath
+                    = outputPath(inputPaths[item.index],
+                                 outputDirectory,
+                                 options.outputExtension);
+                const bool written = cv::imwrite(filePath, finalMat);
+                part.busy += secondsSince(encodeBegin);
+                if (!written) {
+                    std::cerr << "cv::imwrite(" << filePath << ") failed"
+                              << std::endl;
+                    failed++;
+                    continue;
+                }
+                part.items++;
+            }
+            std::lock_guard<std::mutex> lock(statsMutex);
+            addStageStats(part, stats.encode);
+        });
+    }
+
+    // device stage on this thread. up to deviceDepth images in flight, so
+    // image N uploads while image N-1 computes and N-2 downloads
+    image_pool pool(contextSet.context->openclObject);
+    const size_t deviceDepth = std::max<size_t>(options.deviceDepth, 1);
+    std::deque<device_job> inFlight;
+    // wait for the oldest image and hand it to the encoders
+    auto retire = [&]() {
+        const auto retireBegin = std::chrono::steady_clock::now();
+        device_job& job = inFlight.front();
+        const bool completed = finishJob(job);
+        stats.device.busy += secondsSince(retireBegin);
+        if (completed) {
+            stats.device.items++;
+            downloaded.push(batch_item{job.index, job.outputMat},
+                            stats.device.stalled);
+        } else {
+            failed++;
+        }
+        inFlight.pop_front();
+    };
+
+    batch_item item;
+    while (decoded.pop(item, stats.device.starved)) {
+        if (inFlight.size() >= deviceDepth) {
+            retire();
+        }
+
+        const auto enqueueBegin = std::chrono::steady_clock::now();
+        device_job job;
+        job.index = item.index;
+        job.inputMat = item.mat;
+        job.outputMat.create(item.mat.rows, item.mat.cols, item.mat.type());
+        job.inputImage = createOutputImage(contextSet.context->openclObject,
+                                           options.inputFlags,
+                                           item.mat,
+                                           &pool);
+        job.outputImage = createOutputImage(contextSet.context->openclObject,
+                                            options.outputFlags,
+                                            item.mat,
+                                            &pool);
+        const bool enqueued = job.inputImage && job.outputImage
+                              && enqueueJob(contextSet, name, process, job);
+        // start this image while the host takes the next one
+        clFlush(contextSet.uploadQueue->openclObject);
+        clFlush(contextSet.cmdQueue->openclObject);
+        clFlush(contextSet.downloadQueue->openclObject);
+        if (enqueued) {
+            inFlight.push_back(std::move(job));
+        } else {
+            std::cerr << name << ": " << inputPaths[item.index] << " failed"
+                      << std::endl;
+            finishJob(job);
+            failed++;
+        }
+        stats.device.busy += secondsSince(enqueueBegin);
+    }
+    while (!inFlight.empty()) {
+        retire();
+    }
+    downloaded.close();
+
+    for (std::thread& decoder : decoders) {
+        decoder.join();
+    }
+    for (std::thread& encoder : encoders) {
+        encoder.join();
+    }
+    stats.failed = failed;
+    stats.seconds = secondsSince(begin);
+    return stats.failed == 0;
+}
@@ -0,0 +1,91 @@
+#ifndef D_OCL_BATCH_H
+#define D_OCL_BATCH_H
+
+#include "d_ocl.h"
+#include "d_ocl_defines.h"
+#include "d_ocl_utils.h"
+#include <CL/cl.h>
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace d_ocl {
+// enqueue the device work of 1 image on queue after waitList, reading
+// inputImage and writing outputImage, and set event to the last command.
+// inputMat is the decoded and converted image, e.g. for its size
+using batch_process_func
+    = std::function<bool(cl_command_queue queue,
+                         cl_mem inputImage,
+                         cl_mem outputImage,
+                         const cv::Mat& inputMat,
+                         const std::vector<cl_event>& waitList,
+                         cl_event* event)>;
+
+struct D_OCL_API batch_options
+{
+    // threads running cv::imread() and decodeConverts
+    size_t decodeThreads{2};
+    // threads running encodeConverts and cv::imwrite()
+    size_t encodeThreads{2};
+    // decoded images waiting for upload. decoding pauses while full
+    size_t decodeDepth{4};
+    // images uploading, computing or downloading at once.
+    // the device stage waits for the oldest while full
+    size_t deviceDepth{2};
+    // results waiting for encoding. the device stage pauses while full
+    size_t encodeDepth{4};
+
+    // applied after decoding, e.g. toGreyscale, toFloat
+    std::vector<utils::mat_convert_func> decodeConverts;
+    // applied before encoding, e.g. back to 8-bit
+    std::vector<utils::mat_convert_func> encodeConverts;
+    cl_mem_flags inputFlags{CL_MEM_READ_ONLY | CL_MEM_HOST_WRITE_ONLY};
+    cl_mem_flags outputFlags{CL_MEM_WRITE_ONLY | CL_MEM_HOST_READ_ONLY};
+    // replaces the input file's extension in the output file name
+    std::string outputExtension{".png"};
+};
+
+// 1 stage of the batch, summed over its threads
+struct D_OCL_API batch_stage_stats
+{
+    size_t items{0};
+    // seconds doing the stage's work
+    double busy{0};
+    // seconds blocked on a full downstream queue, i.e. on a slower stage
+    double stalled{0};
+    // seconds blocked on an empty upstream queue, i.e. on a faster stage
+    double starved{0};
+};
+
+// throughput of a run. the stage with the most busy time per thread is the
+// bottleneck; per-command device times are recorded as name + " upload",
+// " compute" and " download" with profiling queues
+struct D_OCL_API batch_stats
+{
+    batch_stage_stats decode;
+    // upload + compute + download, enqueued on the calling thread
+    batch_stage_stats device;
+    batch_stage_stats encode;
+    // images that failed at any stage
+    size_t failed{0};
+    // wall-clock seconds of the whole run
+    double seconds{0};
+};
+
+// decode inputPaths on a thread pool, upload, process and download them
+// on contextSet's upload, command and download queues, and encode the
+// results into outputDirectory on another pool, all stages overlapping.
+// stages are connected by bounded queues so a slow stage holds back the
+// ones before it instead of buffering without limit.
+// device images are taken from an image_pool, so steady state allocates
+// none. returns false if any image failed; the others are still written
+auto D_OCL_API runImageBatch(const context_set& contextSet,
+                             const std::string& name,
+                             const std::vector<std::string>& inputPaths,
+                             const std::string& outputDirectory,
+                             const batch_options& options,
+                             const batch_process_func& process,
+                             batch_stats& stats) -> bool;
+} // namespace d_ocl
+
+#endif // D_OCL_BATCH_H
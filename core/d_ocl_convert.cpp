@@ -0,0 +1,398 @@
+#include "d_ocl_convert.h"
+#include "d_ocl.h"
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <opencv2/core.hpp>
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+#define D_OCL_CONVERT_PROGRAM                                                  \
+    D_OCL_RESOURCE_ROOT "/d_ocl_convert." D_OCL_KERN_EXT
+
+using convert_func_ptr = bool (*)(const cv::Mat*, cv::Mat*);
+
+namespace {
+// what 1 mat_convert_func does
+enum class convert_kind
+{
+    unknown,
+    rgba,
+    grey,
+    to_float
+};
+
+// a chain of converts as 1 pass from an 8-bit source
+struct fused_plan
+{
+    int srcChannels;
+    int dstChannels;
+    // dst channels r, g, b[, a] instead of b, g, r[, a]
+    bool swapRb;
+    bool grey;
+    // grey came before toFloat, so luma is rounded to 8 bits first as
+    // cv::COLOR_BGR2GRAY does on CV_8U
+    bool quantizeGrey;
+    bool toFloat;
+};
+} // namespace
+
+static auto convertKind(const d_ocl::utils::mat_convert_func& convertFunc)
+    -> convert_kind
+{
+    const convert_func_ptr* target = convertFunc.target<convert_func_ptr>();
+    if (target == nullptr) {
+        return convert_kind::unknown;
+    }
+    if (*target == &d_ocl::utils::toRgba
+        || *target == &d_ocl::utils::deviceToRgba) {
+        return convert_kind::rgba;
+    }
+    if (*target == &d_ocl::utils::toGreyscale
+        || *target == &d_ocl::utils::deviceToGreyscale) {
+        return convert_kind::grey;
+    }
+    if (*target == &d_ocl::utils::toFloat
+        || *target == &d_ocl::utils::deviceToFloat) {
+        return convert_kind::to_float;
+    }
+    return convert_kind::unknown;
+}
+
+// same rules as the host converts. false if any convert is unknown
+static auto makePlan(
+    int srcType,
+    const std::vector<d_ocl::utils::mat_convert_func>& matConverts,
+    fused_plan& plan) -> bool
+{
+    plan.srcChannels = CV_MAT_CN(srcType);
+    plan.dstChannels = plan.srcChannels;
+    plan.swapRb = false;
+    plan.grey = false;
+    plan.quantizeGrey = false;
+    plan.toFloat = false;
+    if (CV_MAT_DEPTH(srcType) != CV_8U
+        || (plan.srcChannels != 1 && plan.srcChannels != 3
+            && plan.srcChannels != 4)) {
+        return false;
+    }
+
+    for (const d_ocl::utils::mat_convert_func& convertFunc : matConverts) {
+        switch (convertKind(convertFunc)) {
+        case convert_kind::rgba:
+            // no channel reordering if not bgr[a]
+            if (plan.dstChannels >= 3) {
+                plan.dstChannels = 4;
+                plan.swapRb = !plan.swapRb;
+            }
+            break;
+        case convert_kind::grey:
+            // swapRb stays as it is here: later toRgba's are no-ops on 1
+            // channel, and the grey rows weigh the channels by it
+            if (plan.dstChannels >= 3) {
+                plan.dstChannels = 1;
+                plan.grey = true;
+                plan.quantizeGrey = !plan.toFloat;
+            }
+            break;
+        case convert_kind::to_float:
+            plan.toFloat = true;
+            break;
+        default:
+            return false;
+        }
+    }
+    return true;
+}
+
+auto d_ocl::isDeviceConvert(const utils::mat_convert_func& convertFunc) -> bool
+{
+    const convert_func_ptr* target = convertFunc.target<convert_func_ptr>();
+    return target != nullptr
+           && (*target == &utils::deviceToRgba
+               || *target == &utils::deviceToGreyscale
+               || *target == &utils::deviceToFloat);
+}
+
+auto d_ocl::hostConvertCount(
+    const std::vector<utils::mat_convert_func>& matConverts) -> size_t
+{
+    size_t count = matConverts.size();
+    while (count > 0 && isDeviceConvert(matConverts[count - 1])) {
+        count--;
+    }
+    return count;
+}
+
+auto d_ocl::deviceConvertedType(
+    int srcType,
+    const std::vector<utils::mat_convert_func>& deviceConverts,
+    int& type) -> bool
+{
+    for (const utils::mat_convert_func& convertFunc : deviceConverts) {
+        if (!isDeviceConvert(convertFunc)) {
+            return false;
+        }
+    }
+    return fusedConvertedType(srcType, deviceConverts, type);
+}
+
+auto d_ocl::fusedConvertedType(
+    int srcType,
+    const std::vector<utils::mat_convert_func>& matConverts,
+    int& type) -> bool
+{
+    fused_plan plan;
+    if (!makePlan(srcType, matConverts, plan)) {
+        return false;
+    }
+    type = CV_MAKETYPE(plan.toFloat ? CV_32F : CV_8U, plan.dstChannels);
+    return true;
+}
+
+// 0~255 -> 0.0~1.0 as toFloat
+template<typename T>
+static inline auto fromByte(int value) -> T;
+template<>
+inline auto fromByte<uint8_t>(int value) -> uint8_t
+{
+    return static_cast<uint8_t>(value);
+}
+template<>
+inline auto fromByte<float>(int value) -> float
+{
+    return value * (1.0f / 255);
+}
+
+// bt.601 luma as cv::COLOR_BGR2GRAY, in its 14-bit fixed point for 8-bit
+template<typename T>
+static inline auto luma(int b, int g, int r) -> T;
+template<>
+inline auto luma<uint8_t>(int b, int g, int r) -> uint8_t
+{
+    return static_cast<uint8_t>((b * 1868 + g * 9617 + r * 4899 + (1 << 13))
+                              >> 14);
+}
+template<>
+inline auto luma<float>(int b, int g, int r) -> float
+{
+    return (0.114f * b + 0.587f * g + 0.299f * r) * (1.0f / 255);
+}
+
+// channels kept as they are, so the row is just widened
+static auto widenRow(const uint8_t* src, uint8_t* dst, int count) -> void
+{
+    std::memcpy(dst, src, count);
+}
+
+static auto widenRow(const uint8_t* src, float* dst, int count) -> void
+{
+    const float scale = 1.0f / 255;
+    int i = 0;
+#if defined(__AVX2__)
+    const __m256 scale8 = _mm256_set1_ps(scale);
+    for (; i + 8 <= count; i += 8) {
+        const __m128i bytes
+            = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(src + i));
+        _mm256_storeu_ps(
+            dst + i,
+            _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(bytes)),
+                          scale8));
+    }
+#elif defined(__SSE2__)
+    const __m128 scale4 = _mm_set1_ps(scale);
+    const __m128i zero = _mm_setzero_si128();
+    for (; i + 16 <= count; i += 16) {
+        const __m128i bytes
+            = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+        // 16 bytes -> 2 x 8 words -> 4 x 4 ints
+        const __m128i words[2]
+            = {_mm_unpacklo_epi8(bytes, zero), _mm_unpackhi_epi8(bytes, zero)};
+        for (int half = 0; half < 2; half++) {
+            _mm_storeu_ps(dst + i + half * 8,
+                          _mm_mul_ps(_mm_cvtepi32_ps(
+                                         _mm_unpacklo_epi16(words[half], zero)),
+                                     scale4));
+            _mm_storeu_ps(dst + i + half * 8 + 4,
+                          _mm_mul_ps(_mm_cvtepi32_ps(
+                                         _mm_unpackhi_epi16(words[half], zero)),
+                                     scale4));
+        }
+    }
+#endif
+    for (; i < count; i++) {
+        dst[i] = src[i] * scale;
+    }
+}
+
+// fixed channel counts so the compiler can vectorize the interleaved loads.
+// SwapRb as toRgba before toGreyscale: the luma weights of r and b land on
+// the swapped channels, exactly as the chain computes it.
+// Quantize as toGreyscale before toFloat: 8-bit luma, then scaled
+template<int SrcChannels, bool SwapRb, bool Quantize, typename T>
+static auto greyRow(const uint8_t* src, T* dst, int cols) -> void
+{
+    for (int x = 0; x < cols; x++) {
+        const uint8_t* pixel = src + x * SrcChannels;
+        const int b = pixel[SwapRb ? 2 : 0];
+        const int g = pixel[1];
+        const int r = pixel[SwapRb ? 0 : 2];
+        dst[x] = Quantize ? fromByte<T>(luma<uint8_t>(b, g, r))
+                          : luma<T>(b, g, r);
+    }
+}
+
+template<bool Quantize, typename T>
+static auto greyRows(const fused_plan& plan,
+                     const uint8_t* src,
+                     T* dst,
+                     int cols) -> void
+{
+    if (plan.srcChannels == 3) {
+        plan.swapRb ? greyRow<3, true, Quantize>(src, dst, cols)
+                    : greyRow<3, false, Quantize>(src, dst, cols);
+    } else {
+        plan.swapRb ? greyRow<4, true, Quantize>(src, dst, cols)
+                    : greyRow<4, false, Quantize>(src, dst, cols);
+    }
+}
+
+template<int SrcChannels, bool SwapRb, typename T>
+static auto fourChannelRow(const uint8_t* src, T* dst, int cols) -> void
+{
+    for (int x = 0; x < cols; x++) {
+        const uint8_t* pixel = src + x * SrcChannels;
+        T* out = dst + x * 4;
+        out[0] = fromByte<T>(pixel[SwapRb ? 2 : 0]);
+        out[1] = fromByte<T>(pixel[1]);
+        out[2] = fromByte<T>(pixel[SwapRb ? 0 : 2]);
+        out[3] = fromByte<T>(SrcChannels == 4 ? pixel[3] : 255);
+    }
+}
+
+template<typename T>
+static auto convertRows(const fused_plan& plan,
+                        const cv::Mat& srcMat,
+                        cv::Mat& dstMat,
+                        const cv::Range& rows) -> void
+{
+    for (int y = rows.start; y < rows.end; y++) {
+        const uint8_t* src = srcMat.ptr(y);
+        T* dst = reinterpret_cast<T*>(dstMat.ptr(y));
+        if (plan.grey) {
+            plan.quantizeGrey ? greyRows<true>(plan, src, dst, srcMat.cols)
+                              : greyRows<false>(plan, src, dst, srcMat.cols);
+        } else if (plan.dstChannels == plan.srcChannels && !plan.swapRb) {
+            widenRow(src, dst, srcMat.cols * plan.srcChannels);
+        } else if (plan.srcChannels == 3) {
+            if (plan.swapRb) {
+                fourChannelRow<3, true>(src, dst, srcMat.cols);
+            } else {
+                fourChannelRow<3, false>(src, dst, srcMat.cols);
+            }
+        } else {
+            fourChannelRow<4, true>(src, dst, srcMat.cols);
+        }
+    }
+}
+
+auto d_ocl::fusedConvert(
+    const cv::Mat& srcMat,
+    const std::vector<utils::mat_convert_func>& matConverts,
+    cv::Mat& dstMat) -> bool
+{
+    fused_plan plan;
+    if (!makePlan(srcMat.type(), matConverts, plan)) {
+        return false;
+    }
+    if (dstMat.rows != srcMat.rows || dstMat.cols != srcMat.cols
+        || dstMat.type()
+               != CV_MAKETYPE(plan.toFloat ? CV_32F : CV_8U,
+                              plan.dstChannels)) {
+        std::cerr << "fusedConvert() destination has the wrong size or type"
+                  << std::endl;
+        return false;
+    }
+
+    // rows split over opencv's thread pool
+    cv::parallel_for_(cv::Range(0, srcMat.rows), [&](const cv::Range& rows) {
+        if (plan.toFloat) {
+            convertRows<float>(plan, srcMat, dstMat, rows);
+        } else {
+            convertRows<uint8_t>(plan, srcMat, dstMat, rows);
+        }
+    });
+    return true;
+}
+
+d_ocl::device_converter::device_converter(cl_context context)
+{
+    std::shared_ptr<utils::manager<cl_program>> program
+        = createProgram(context, D_OCL_CONVERT_PROGRAM);
+    if (!program) {
+        return;
+    }
+    toImage = launcher<cl_mem, int, int, int, int, int, int, int, cl_mem>(
+        program, "convert_bytes_to_image");
+    toBytes = launcher<cl_mem, int, int, cl_mem>(program,
+                                                 "convert_float_to_bytes");
+}
+
+d_ocl::device_converter::operator bool() const
+{
+    return static_cast<bool>(toImage) && static_cast<bool>(toBytes);
+}
+
+auto d_ocl::device_converter::bytesToImage(
+    cl_command_queue queue,
+    cl_mem srcBuffer,
+    size_t srcStep,
+    int srcType,
+    int cols,
+    int rows,
+    const std::vector<utils::mat_convert_func>& deviceConverts,
+    cl_mem dstImage,
+    const std::vector<cl_event>& waitList,
+    cl_event* event) -> bool
+{
+    int dstType;
+    fused_plan plan;
+    if (!deviceConvertedType(srcType, deviceConverts, dstType)
+        || !makePlan(srcType, deviceConverts, plan)) {
+        std::cerr << "invalid device converts for cv::Mat type " << srcType
+                  << std::endl;
+        return false;
+    }
+
+    nd_range range;
+    range.global = {(size_t)cols, (size_t)rows};
+    return toImage.run(queue,
+                       range,
+                       waitList,
+                       event,
+                       srcBuffer,
+                       static_cast<int>(srcStep),
+                       plan.srcChannels,
+                       cols,
+                       rows,
+                       plan.swapRb ? 1 : 0,
+                       plan.grey ? 1 : 0,
+                       plan.quantizeGrey ? 1 : 0,
+                       dstImage);
+}
+
+auto d_ocl::device_converter::floatToBytes(
+    cl_command_queue queue,
+    cl_mem srcImage,
+    int cols,
+    int rows,
+    cl_mem dstImage,
+    const std::vector<cl_event>& waitList,
+    cl_event* event) -> bool
+{
+    nd_range range;
+    range.global = {(size_t)cols, (size_t)rows};
+    return toBytes.run(
+        queue, range, waitList, event, srcImage, cols, rows, dstImage);
+}
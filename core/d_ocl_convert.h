@@ -0,0 +1,85 @@
+#ifndef D_OCL_CONVERT_H
+#define D_OCL_CONVERT_H
+
+#include "d_ocl_defines.h"
+#include "d_ocl_kernel.h"
+#include "d_ocl_utils.h"
+#include <CL/cl.h>
+#include <memory>
+#include <vector>
+
+namespace d_ocl {
+// true for utils::deviceToRgba, deviceToGreyscale and deviceToFloat
+auto D_OCL_API isDeviceConvert(const utils::mat_convert_func& convertFunc)
+    -> bool;
+// # leading matConverts to run on the host: everything up to and including
+// the last one that is not a device convert
+auto D_OCL_API hostConvertCount(
+    const std::vector<utils::mat_convert_func>& matConverts) -> size_t;
+// cv::Mat type of an image of srcType after deviceConverts, without
+// converting anything. false if srcType is not 8-bit or deviceConverts has
+// a host convert
+auto D_OCL_API deviceConvertedType(
+    int srcType,
+    const std::vector<utils::mat_convert_func>& deviceConverts,
+    int& type) -> bool;
+
+// cv::Mat type of an 8-bit image of srcType after matConverts (host or
+// device versions of toRgba, toGreyscale, toFloat), so they can run as
+// 1 fusedConvert(). false for other converts or source depths
+auto D_OCL_API fusedConvertedType(
+    int srcType,
+    const std::vector<utils::mat_convert_func>& matConverts,
+    int& type) -> bool;
+// matConverts in 1 multithreaded, vectorized pass over srcMat, without the
+// intermediate cv::Mats of running them in turn. results are within
+// rounding of running them in turn.
+// dstMat must already be of srcMat's size and fusedConvertedType(), e.g. a
+// view of a mapped memory object to convert straight into it
+auto D_OCL_API fusedConvert(
+    const cv::Mat& srcMat,
+    const std::vector<utils::mat_convert_func>& matConverts,
+    cv::Mat& dstMat) -> bool;
+
+// the conversion kernels of 1 context. keeps no buffers between runs, so
+// any queue may run it: keeping it only saves rebuilding the program
+struct D_OCL_API device_converter
+{
+    explicit device_converter(cl_context context);
+
+    // false if the program failed to build
+    explicit operator bool() const;
+
+    // convert 8-bit cols x rows image of srcType (e.g. CV_8UC3 bgr) in
+    // srcBuffer, with rows srcStep bytes apart, into dstImage by
+    // deviceConverts. dstImage must be of deviceConvertedType()
+    auto bytesToImage(
+        cl_command_queue queue,
+        cl_mem srcBuffer,
+        size_t srcStep,
+        int srcType,
+        int cols,
+        int rows,
+        const std::vector<utils::mat_convert_func>& deviceConverts,
+        cl_mem dstImage,
+        const std::vector<cl_event>& waitList,
+        cl_event* event) -> bool;
+    // convert float cols x rows srcImage to 8-bit dstImage with the same
+    // channels, e.g. before reading it back
+    auto floatToBytes(cl_command_queue queue,
+                      cl_mem srcImage,
+                      int cols,
+                      int rows,
+                      cl_mem dstImage,
+                      const std::vector<cl_event>& waitList,
+                      cl_event* event) -> bool;
+
+    // convert_bytes_to_image(src, srcStep, srcChannels, imageWidth,
+    //                        imageHeight, swapRb, grey, quantizeGrey, dst)
+    launcher<cl_mem, int, int, int, int, int, int, int, cl_mem> toImage;
+    // convert_float_to_bytes(src, imageWidth, imageHeight, dst)
+    launcher<cl_mem, int, int, cl_mem> toBytes;
+};
+} // namespace d_ocl
+
+#endif // D_OCL_CONVERT_H
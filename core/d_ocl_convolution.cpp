@@ -0,0 +1,432 @@
+#include "d_ocl_convolution.h"
+#include "d_ocl.h"
+#include "d_ocl_handle.h"
+#include "d_ocl_tuner.h"
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <memory>
+#include <string>
+
+#define D_OCL_CONVOLUTION_PROGRAM                                              \
+    D_OCL_RESOURCE_ROOT "/d_ocl_convolution." D_OCL_KERN_EXT
+// narrower filters never run faster by fft, so aren't timed
+#define D_OCL_FFT_MIN_FILTER_WIDTH 9
+
+// work-group sizes of the direct kernels, compiled in as the tile size.
+// tune() times them all, the first runs until then: 128 work-items fits
+// about every device
+static const size_t g_tileShapes[][2]
+    = {{16, 8}, {32, 8}, {16, 16}, {32, 4}, {8, 8}};
+static const size_t g_numTileShapes
+    = sizeof(g_tileShapes) / sizeof(g_tileShapes[0]);
+
+auto d_ocl::separateFilter(const std::vector<float>& filter,
+                           int filterWidth,
+                           std::vector<float>& row,
+                           std::vector<float>& column,
+                           float tolerance /*= 1e-5f*/) -> bool
+{
+    if (filterWidth <= 0
+        || filter.size() != (size_t)filterWidth * filterWidth) {
+        return false;
+    }
+
+    // a rank-1 filter is its pivot's column times its pivot's row scaled
+    // by the pivot, the largest coefficient being the stablest pivot
+    const size_t pivot
+        = std::max_element(filter.begin(),
+                           filter.end(),
+                           [](float a, float b) {
+                               return std::fabs(a) < std::fabs(b);
+                           })
+          - filter.begin();
+    const float largest = filter[pivot];
+    if (largest == 0.0f) {
+        return false;
+    }
+    const int pivotRow = static_cast<int>(pivot) / filterWidth;
+    const int pivotColumn = static_cast<int>(pivot) % filterWidth;
+    row.resize(filterWidth);
+    column.resize(filterWidth);
+    for (int k = 0; k < filterWidth; k++) {
+        row[k] = filter[pivotRow * filterWidth + k] / largest;
+        column[k] = filter[k * filterWidth + pivotColumn];
+    }
+
+    for (int i = 0; i < filterWidth; i++) {
+        for (int j = 0; j < filterWidth; j++) {
+            if (std::fabs(filter[i * filterWidth + j] - column[i] * row[j])
+                > tolerance * std::fabs(largest)) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+// read-only buffer of coefficients
+static auto createFilterBuffer(cl_context context,
+                               const std::vector<float>& coefficients)
+    -> std::shared_ptr<d_ocl::utils::manager<cl_mem>>
+{
+    return d_ocl::utils::createBuffer(
+        context,
+        CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR | CL_MEM_HOST_NO_ACCESS,
+        coefficients.size() * sizeof(float),
+        const_cast<float*>(coefficients.data()));
+}
+
+// the largest tile + halo of float4 fits every device in context
+static auto fitsLocalMemory(cl_context context, int filterWidth, size_t shape)
+    -> bool
+{
+    const size_t halo = 2 * (filterWidth / 2);
+    const cl_ulong bytes = (g_tileShapes[shape][0] + halo)
+                           * (g_tileShapes[shape][1] + halo) * 4
+                           * sizeof(float);
+    for (cl_device_id device : d_ocl::utils::contextDevices(context)) {
+        std::vector<cl_ulong> localMemory;
+        if (!d_ocl::utils::information<cl_ulong>(
+                device, CL_DEVICE_LOCAL_MEM_SIZE, localMemory, 0)
+            || localMemory[0] < bytes) {
+            return false;
+        }
+    }
+    return true;
+}
+
+d_ocl::convolution::convolution(
+    cl_context context,
+    const std::vector<float>& filter,
+    int filterWidth,
+    bool allowSeparable /*= true*/,
+    convolution_method method /*= convolution_method::automatic*/)
+    : context(context), filterWidth(filterWidth), method(method)
+{
+    if (filterWidth <= 0 || filterWidth % 2 == 0
+        || filter.size() != (size_t)filterWidth * filterWidth) {
+        std::cerr << "convolution filter must be odd x odd wide" << std::endl;
+        return;
+    }
+
+    const bool fits = fitsLocalMemory(context, filterWidth, 0);
+    if (method == convolution_method::fft
+        || (method == convolution_method::automatic
+            && (filterWidth >= D_OCL_FFT_MIN_FILTER_WIDTH || !fits))) {
+        spectral = std::make_shared<fft_convolution>(
+            context, filter, filterWidth);
+    }
+    if (method == convolution_method::fft) {
+        return;
+    }
+    if (!fits) {
+        std::cerr << "a " << filterWidth
+                  << " wide filter doesn't fit local memory for direct "
+                     "convolution"
+                  << std::endl;
+        return;
+    }
+
+    std::vector<float> row;
+    std::vector<float> column;
+    isSeparable = allowSeparable && filterWidth > 1
+                  && separateFilter(filter, filterWidth, row, column);
+    if (isSeparable) {
+        rowFilter = createFilterBuffer(context, row);
+        columnFilter = createFilterBuffer(context, column);
+        if (!rowFilter || !columnFilter) {
+            return;
+        }
+    } else {
+        filterBuffer = createFilterBuffer(context, filter);
+        if (!filterBuffer) {
+            return;
+        }
+    }
+
+    tilePrograms.resize(g_numTileShapes);
+    useTile(nullptr, 0);
+}
+
+d_ocl::convolution::operator bool() const
+{
+    return directReady() || (spectral && *spectral);
+}
+
+auto d_ocl::convolution::directReady() const -> bool
+{
+    return isSeparable ? static_cast<bool>(convolveRows)
+                             && static_cast<bool>(convolveColumns)
+                       : static_cast<bool>(convolve2d);
+}
+
+auto d_ocl::convolution::separable() const -> bool
+{
+    return isSeparable;
+}
+
+auto d_ocl::convolution::usesFft() const -> bool
+{
+    return lastFft;
+}
+
+auto d_ocl::convolution::tiledRange(int cols, int rows) const -> nd_range
+{
+    const size_t tileWidth = g_tileShapes[tileShape][0];
+    const size_t tileHeight = g_tileShapes[tileShape][1];
+    nd_range range;
+    range.local = {tileWidth, tileHeight};
+    range.global = {(cols + tileWidth - 1) / tileWidth * tileWidth,
+                    (rows + tileHeight - 1) / tileHeight * tileHeight};
+    return range;
+}
+
+auto d_ocl::convolution::useTile(cl_command_queue queue, size_t shape) -> bool
+{
+    if (shape == tileShape && directReady()) {
+        return true;
+    }
+    if (shape >= tilePrograms.size()
+        || !fitsLocalMemory(context, filterWidth, shape)) {
+        return false;
+    }
+
+    // filter width and tile size as compile-time constants, so the local
+    // arrays are sized and the filter loops unroll
+    std::shared_ptr<utils::manager<cl_program>>& program = tilePrograms[shape];
+    if (!program) {
+        program = createProgram(
+            context,
+            D_OCL_CONVOLUTION_PROGRAM,
+            std::string(),
+            {{"FILTER_WIDTH", std::to_string(filterWidth)},
+             {"TILE_W", std::to_string(g_tileShapes[shape][0])},
+             {"TILE_H", std::to_string(g_tileShapes[shape][1])}});
+        if (!program) {
+            return false;
+        }
+    }
+    launcher<cl_mem, cl_mem, int, int, cl_mem> first(
+        program, isSeparable ? "convolve_rows" : "convolve_2d");
+    launcher<cl_mem, cl_mem, int, int, cl_mem> second;
+    if (isSeparable) {
+        second = launcher<cl_mem, cl_mem, int, int, cl_mem>(
+            program, "convolve_columns");
+    }
+    if (!first || (isSeparable && !second)) {
+        return false;
+    }
+    // the kernels require their tile as work-group size, which may be more
+    // than the device runs them with
+    if (queue != nullptr) {
+        cl_device_id device = utils::queueDevice(queue);
+        const size_t groupSize = g_tileShapes[shape][0]
+                                 * g_tileShapes[shape][1];
+        if (utils::kernelWorkGroupSize(first.kernel(), device) < groupSize
+            || (isSeparable
+                && utils::kernelWorkGroupSize(second.kernel(), device)
+                       < groupSize)) {
+            return false;
+        }
+    }
+
+    if (isSeparable) {
+        convolveRows = first;
+        convolveColumns = second;
+    } else {
+        convolve2d = first;
+    }
+    tileShape = shape;
+    return true;
+}
+
+auto d_ocl::convolution::tune(cl_command_queue queue,
+                              cl_mem inputImage,
+                              cl_mem outputImage,
+                              int cols,
+                              int rows) -> bool
+{
+    if (!*this || cols <= 0 || rows <= 0) {
+        return false;
+    }
+    if (!directReady()) {
+        // fft only, no tiles
+        return true;
+    }
+
+    const std::string name = "convolution tile "
+                             + std::to_string(filterWidth)
+                             + (isSeparable ? " separable" : "");
+    const size_t previous = tileShape;
+    size_t choice = 0;
+    if (!tunedChoice(queue,
+                     name,
+                     {(size_t)cols, (size_t)rows},
+                     g_numTileShapes,
+                     [&](size_t candidate, cl_event* event) {
+                         return useTile(queue, candidate)
+                                && runDirect(queue,
+                                             inputImage,
+                                             outputImage,
+                                             cols,
+                                             rows,
+                                             {},
+                                             event);
+                     },
+                     choice)
+        || !useTile(queue, choice)) {
+        useTile(queue, previous);
+        return false;
+    }
+
+    // so automatic runs of this size don't block to time it
+    if (method == convolution_method::automatic && spectral && *spectral) {
+        chooseFft(queue, inputImage, outputImage, cols, rows, {});
+    }
+    return true;
+}
+
+auto d_ocl::convolution::chooseFft(cl_command_queue queue,
+                                   cl_mem inputImage,
+                                   cl_mem outputImage,
+                                   int cols,
+                                   int rows,
+                                   const std::vector<cl_event>& waitList)
+    -> bool
+{
+    if (cols == chosenCols && rows == chosenRows) {
+        return chosenFft;
+    }
+
+    // timed on the real images, so the input must be ready. writing the
+    // output is harmless as the real run overwrites it
+    if (!waitList.empty()
+        && !utils::checkRun(
+            "clWaitForEvents",
+            clWaitForEvents(static_cast<cl_uint>(waitList.size()),
+                            waitList.data()))) {
+        return false;
+    }
+    const std::string name = "convolution crossover "
+                             + std::to_string(filterWidth)
+                             + (isSeparable ? " separable" : "");
+    // direct if timing fails, e.g. the fft ran out of memory
+    size_t choice = 0;
+    tunedChoice(queue,
+                name,
+                {(size_t)cols, (size_t)rows},
+                2,
+                [&](size_t candidate, cl_event* event) {
+                    return candidate == 0 ? runDirect(queue,
+                                                      inputImage,
+                                                      outputImage,
+                                                      cols,
+                                                      rows,
+                                                      {},
+                                                      event)
+                                          : spectral->run(queue,
+                                                          inputImage,
+                                                          outputImage,
+                                                          cols,
+                                                          rows,
+                                                          {},
+                                                          event);
+                },
+                choice);
+    chosenCols = cols;
+    chosenRows = rows;
+    chosenFft = choice == 1;
+    return chosenFft;
+}
+
+auto d_ocl::convolution::run(cl_command_queue queue,
+                             cl_mem inputImage,
+                             cl_mem outputImage,
+                             int cols,
+                             int rows,
+                             const std::vector<cl_event>& waitList,
+                             cl_event* event) -> bool
+{
+    if (!*this || cols <= 0 || rows <= 0) {
+        return false;
+    }
+
+    const bool fftReady = spectral && *spectral;
+    if (!directReady()) {
+        lastFft = true;
+    } else if (!fftReady || method == convolution_method::direct) {
+        lastFft = false;
+    } else {
+        lastFft = chooseFft(
+            queue, inputImage, outputImage, cols, rows, waitList);
+    }
+    return lastFft ? spectral->run(queue,
+                                   inputImage,
+                                   outputImage,
+                                   cols,
+                                   rows,
+                                   waitList,
+                                   event)
+                   : runDirect(queue,
+                               inputImage,
+                               outputImage,
+                               cols,
+                               rows,
+                               waitList,
+                               event);
+}
+
+auto d_ocl::convolution::runDirect(cl_command_queue queue,
+                                   cl_mem inputImage,
+                                   cl_mem outputImage,
+                                   int cols,
+                                   int rows,
+                                   const std::vector<cl_event>& waitList,
+                                   cl_event* event) -> bool
+{
+    const nd_range range = tiledRange(cols, rows);
+    if (!isSeparable) {
+        return convolve2d.run(queue,
+                              range,
+                              waitList,
+                              event,
+                              inputImage,
+                              outputImage,
+                              cols,
+                              rows,
+                              filterBuffer->openclObject);
+    }
+
+    const size_t size = (size_t)cols * rows * 4 * sizeof(float);
+    if (size > intermediateSize) {
+        // the old buffer is released once the commands using it complete
+        intermediate = utils::createBuffer(
+            context, CL_MEM_READ_WRITE | CL_MEM_HOST_NO_ACCESS, size);
+        if (!intermediate) {
+            intermediateSize = 0;
+            return false;
+        }
+        intermediateSize = size;
+    }
+
+    handle<cl_event> rowsDone;
+    return convolveRows.run(queue,
+                            range,
+                            waitList,
+                            rowsDone.outParam(),
+                            inputImage,
+                            intermediate->openclObject,
+                            cols,
+                            rows,
+                            rowFilter->openclObject)
+           && convolveColumns.run(queue,
+                                  range,
+                                  after(waitList, rowsDone),
+                                  event,
+                                  intermediate->openclObject,
+                                  outputImage,
+                                  cols,
+                                  rows,
+                                  columnFilter->openclObject);
+}
@@ -0,0 +1,140 @@
+#ifndef D_OCL_CONVOLUTION_H
+#define D_OCL_CONVOLUTION_H
+
+#include "d_ocl_defines.h"
+#include "d_ocl_fft.h"
+#include "d_ocl_kernel.h"
+#include "d_ocl_utils.h"
+#include <CL/cl.h>
+#include <memory>
+#include <vector>
+
+namespace d_ocl {
+// factor filterWidth x filterWidth row-major filter into column x row,
+// i.e. filter[i * filterWidth + j] == column[i] * row[j] within tolerance
+// of the largest coefficient. false if it has no such factors
+auto D_OCL_API separateFilter(const std::vector<float>& filter,
+                              int filterWidth,
+                              std::vector<float>& row,
+                              std::vector<float>& column,
+                              float tolerance = 1e-5f) -> bool;
+
+// how convolution filters
+enum class convolution_method
+{
+    // the faster of the 2 on the device for the filter and image size,
+    // timed on first use and stored in the tuning database (see
+    // d_ocl_tuner.h). small filters always run direct
+    automatic,
+    // local-memory tiled kernels, separable or 2D
+    direct,
+    // through the spectra (see fft_convolution)
+    fft
+};
+
+// convolution of images by 1 filter in 1 context, on every channel.
+// separable filters run as a row pass then a column pass, 2 x filterWidth
+// taps per pixel instead of filterWidth^2.
+// keeps the filter taps on the device and the row pass's output grown to
+// the largest image so far, so later frames upload and allocate nothing
+struct D_OCL_API convolution
+{
+    // filterWidth x filterWidth row-major filter, filterWidth odd.
+    // allowSeparable = false always runs the 2D kernel directly
+    convolution(cl_context context,
+                const std::vector<float>& filter,
+                int filterWidth,
+                bool allowSeparable = true,
+                convolution_method method = convolution_method::automatic);
+
+    // false if no method could be built, e.g. the filter doesn't fit the
+    // device's local memory and there is no fft
+    explicit operator bool() const;
+    auto separable() const -> bool;
+    // method of the last run()
+    auto usesFft() const -> bool;
+
+    // filter the cols x rows origin of inputImage into outputImage, which
+    // are float or normalized images of any channel count. pixels outside
+    // cols x rows are clamped to its edges, so the images can be larger,
+    // e.g. strip or tile slots.
+    // every run writes the same intermediate and fft buffers: see the
+    // single-queue rule above launcher in d_ocl_kernel.h.
+    // the first automatic run of a size waits for waitList and times both
+    // methods if the tuning database doesn't know the faster one yet. tune()
+    // that size first to keep it out of e.g. pipeline stages
+    auto run(cl_command_queue queue,
+             cl_mem inputImage,
+             cl_mem outputImage,
+             int cols,
+             int rows,
+             const std::vector<cl_event>& waitList,
+             cl_event* event) -> bool;
+    // time the direct kernels' work-group sizes on cols x rows images on
+    // the queue's device (see tunedChoice()) and run with the fastest from
+    // now on, then if automatic whether direct or fft is faster for that
+    // size. read from the tuning database if known. the queue must be
+    // otherwise idle and inputImage ready; writes outputImage. without it
+    // runs use a 16 x 8 work-group
+    auto tune(cl_command_queue queue,
+              cl_mem inputImage,
+              cl_mem outputImage,
+              int cols,
+              int rows) -> bool;
+
+    // kernels of the current tile size.
+    // convolve_2d(input, output, imageWidth, imageHeight, filter)
+    launcher<cl_mem, cl_mem, int, int, cl_mem> convolve2d;
+    // convolve_rows(input, intermediate, imageWidth, imageHeight, filter)
+    launcher<cl_mem, cl_mem, int, int, cl_mem> convolveRows;
+    // convolve_columns(intermediate, output, imageWidth, imageHeight, filter)
+    launcher<cl_mem, cl_mem, int, int, cl_mem> convolveColumns;
+
+private:
+    // rounded up to whole work-groups of the current tile's size
+    auto tiledRange(int cols, int rows) const -> nd_range;
+    // launchers of the shape-th tile size, built on first use. false if
+    // it doesn't fit local memory, or is larger than the queue's device
+    // runs the kernels with if queue isn't null
+    auto useTile(cl_command_queue queue, size_t shape) -> bool;
+    auto directReady() const -> bool;
+    auto runDirect(cl_command_queue queue,
+                   cl_mem inputImage,
+                   cl_mem outputImage,
+                   int cols,
+                   int rows,
+                   const std::vector<cl_event>& waitList,
+                   cl_event* event) -> bool;
+    // whether cols x rows runs faster by fft on the queue's device
+    auto chooseFft(cl_command_queue queue,
+                   cl_mem inputImage,
+                   cl_mem outputImage,
+                   int cols,
+                   int rows,
+                   const std::vector<cl_event>& waitList) -> bool;
+
+    cl_context context{nullptr};
+    int filterWidth{0};
+    convolution_method method{convolution_method::automatic};
+    bool isSeparable{false};
+    size_t tileShape{0};
+    // per tile size, built once used
+    std::vector<std::shared_ptr<utils::manager<cl_program>>> tilePrograms;
+    std::shared_ptr<fft_convolution> spectral;
+    // last size chooseFft() decided, so later runs skip the lookup
+    int chosenCols{0};
+    int chosenRows{0};
+    bool chosenFft{false};
+    bool lastFft{false};
+    // filterWidth^2 coefficients, or filterWidth each of the row and
+    // column factors if separable
+    std::shared_ptr<utils::manager<cl_mem>> filterBuffer;
+    std::shared_ptr<utils::manager<cl_mem>> rowFilter;
+    std::shared_ptr<utils::manager<cl_mem>> columnFilter;
+    // float4 per pixel between the passes, grown as needed
+    std::shared_ptr<utils::manager<cl_mem>> intermediate;
+    size_t intermediateSize{0};
+};
+} // namespace d_ocl
+
+#endif // D_OCL_CONVOLUTION_H
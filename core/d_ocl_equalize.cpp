@@ -0,0 +1,210 @@
+#include "d_ocl_equalize.h"
+#include "d_ocl.h"
+#include "d_ocl_handle.h"
+#include <algorithm>
+#include <iostream>
+#include <opencv2/core.hpp>
+#include <string>
+
+#define D_OCL_EQUALIZE_PROGRAM                                                 \
+    D_OCL_RESOURCE_ROOT "/d_ocl_equalize." D_OCL_KERN_EXT
+// as BINS in the program
+#define D_OCL_EQUALIZE_BINS 256
+// pixels per work-item of equalize_apply
+#define D_OCL_EQUALIZE_VECTOR 16
+
+d_ocl::equalizer::equalizer(cl_context context, cl_device_id device)
+    : context(context),
+      counter(context, device, CV_8UC1)
+{
+    std::shared_ptr<utils::manager<cl_program>> program
+        = createProgram(context, D_OCL_EQUALIZE_PROGRAM);
+    if (!program) {
+        return;
+    }
+    lutKernel
+        = launcher<cl_mem, int, int, int, cl_mem>(program, "equalize_lut");
+    applyKernel
+        = launcher<cl_mem, cl_mem, int, cl_mem>(program, "equalize_apply");
+    tileHistogramKernel = launcher<cl_mem, int, int, int, int, cl_mem>(
+        program, "clahe_histograms");
+    claheApplyKernel
+        = launcher<cl_mem, cl_mem, int, int, int, int, float, float, cl_mem>(
+            program, "clahe_apply");
+}
+
+d_ocl::equalizer::operator bool() const
+{
+    return static_cast<bool>(counter) && static_cast<bool>(lutKernel)
+           && static_cast<bool>(applyKernel)
+           && static_cast<bool>(tileHistogramKernel)
+           && static_cast<bool>(claheApplyKernel);
+}
+
+auto d_ocl::equalizer::reserve(size_t histogramsSize, size_t lutsSize) -> bool
+{
+    if (histogramsCapacity < histogramsSize) {
+        histograms = utils::createBuffer(
+            context, CL_MEM_READ_WRITE | CL_MEM_HOST_NO_ACCESS, histogramsSize);
+        if (!histograms) {
+            histogramsCapacity = 0;
+            return false;
+        }
+        histogramsCapacity = histogramsSize;
+    }
+    if (lutsCapacity < lutsSize) {
+        luts = utils::createBuffer(
+            context, CL_MEM_READ_WRITE | CL_MEM_HOST_NO_ACCESS, lutsSize);
+        if (!luts) {
+            lutsCapacity = 0;
+            return false;
+        }
+        lutsCapacity = lutsSize;
+    }
+    return true;
+}
+
+auto d_ocl::equalizer::equalize(cl_command_queue queue,
+                                cl_mem input,
+                                cl_mem output,
+                                int cols,
+                                int rows,
+                                const std::vector<cl_event>& waitList,
+                                cl_event* event) -> bool
+{
+    if (!*this || cols <= 0 || rows <= 0) {
+        return false;
+    }
+    if (!reserve(D_OCL_EQUALIZE_BINS * sizeof(cl_uint),
+                 D_OCL_EQUALIZE_BINS)) {
+        return false;
+    }
+
+    // histogram, its lut, lut applied. the histogram engine adds to what's
+    // there, so it starts from zeros
+    const int count = cols * rows;
+    const cl_uint zero = 0;
+    handle<cl_event> cleared;
+    handle<cl_event> counted;
+    handle<cl_event> tabled;
+    nd_range lutRange;
+    lutRange.global = {D_OCL_EQUALIZE_BINS};
+    lutRange.local = {D_OCL_EQUALIZE_BINS};
+    nd_range applyRange;
+    applyRange.global = {(size_t)(count + D_OCL_EQUALIZE_VECTOR - 1)
+                         / D_OCL_EQUALIZE_VECTOR};
+    return utils::checkRun(
+               "clEnqueueFillBuffer",
+               clEnqueueFillBuffer(queue,
+                                   histograms->openclObject,
+                                   &zero,
+                                   sizeof(zero),
+                                   0,
+                                   D_OCL_EQUALIZE_BINS * sizeof(cl_uint),
+                                   static_cast<cl_uint>(waitList.size()),
+                                   waitList.empty() ? nullptr : waitList.data(),
+                                   cleared.outParam()))
+           && counter.run(queue,
+                          input,
+                          count,
+                          histograms->openclObject,
+                          after(waitList, cleared),
+                          counted.outParam())
+           && lutKernel.run(queue,
+                            lutRange,
+                            after(waitList, counted),
+                            tabled.outParam(),
+                            histograms->openclObject,
+                            0,
+                            count,
+                            1,
+                            luts->openclObject)
+           && applyKernel.run(queue,
+                              applyRange,
+                              after(waitList, tabled),
+                              event,
+                              input,
+                              output,
+                              count,
+                              luts->openclObject);
+}
+
+auto d_ocl::equalizer::clahe(cl_command_queue queue,
+                             cl_mem input,
+                             cl_mem output,
+                             int cols,
+                             int rows,
+                             const clahe_options& options,
+                             const std::vector<cl_event>& waitList,
+                             cl_event* event) -> bool
+{
+    if (!*this || cols <= 0 || rows <= 0 || options.tilesX <= 0
+        || options.tilesY <= 0 || options.tilesX > cols
+        || options.tilesY > rows) {
+        std::cerr << "clahe of " << cols << " x " << rows << " pixels in "
+                  << options.tilesX << " x " << options.tilesY << " tiles"
+                  << std::endl;
+        return false;
+    }
+    const size_t tiles = (size_t)options.tilesX * options.tilesY;
+    if (!reserve(tiles * D_OCL_EQUALIZE_BINS * sizeof(cl_uint),
+                 tiles * D_OCL_EQUALIZE_BINS)) {
+        return false;
+    }
+
+    // tiles overhanging the image count it reflected, as opencv pads it
+    const int tileWidth = (cols + options.tilesX - 1) / options.tilesX;
+    const int tileHeight = (rows + options.tilesY - 1) / options.tilesY;
+    const int tileArea = tileWidth * tileHeight;
+    int clipLimit = 0;
+    if (options.clipLimit > 0.0f) {
+        clipLimit = std::max(
+            static_cast<int>(options.clipLimit * tileArea
+                             / D_OCL_EQUALIZE_BINS),
+            1);
+    }
+
+    handle<cl_event> counted;
+    handle<cl_event> tabled;
+    nd_range tileRange;
+    tileRange.global = {(size_t)options.tilesX * D_OCL_EQUALIZE_BINS,
+                        (size_t)options.tilesY};
+    tileRange.local = {D_OCL_EQUALIZE_BINS, 1};
+    nd_range lutRange;
+    lutRange.global = {tiles * D_OCL_EQUALIZE_BINS};
+    lutRange.local = {D_OCL_EQUALIZE_BINS};
+    nd_range pixelRange;
+    pixelRange.global = {(size_t)cols, (size_t)rows};
+    return tileHistogramKernel.run(queue,
+                                   tileRange,
+                                   waitList,
+                                   counted.outParam(),
+                                   input,
+                                   cols,
+                                   rows,
+                                   tileWidth,
+                                   tileHeight,
+                                   histograms->openclObject)
+           && lutKernel.run(queue,
+                            lutRange,
+                            after(waitList, counted),
+                            tabled.outParam(),
+                            histograms->openclObject,
+                            clipLimit,
+                            tileArea,
+                            0,
+                            luts->openclObject)
+           && claheApplyKernel.run(queue,
+                                   pixelRange,
+                                   after(waitList, tabled),
+                                   event,
+                                   input,
+                                   output,
+                                   cols,
+                                   rows,
+                                   options.tilesX,
+                                   options.tilesY,
+                                   1.0f / tileWidth,
+                                   1.0f / tileHeight,
+                                   luts->openclObject);
+}
@@ -0,0 +1,81 @@
+#ifndef D_OCL_EQUALIZE_H
+#define D_OCL_EQUALIZE_H
+
+#include "d_ocl_defines.h"
+#include "d_ocl_histogram.h"
+#include "d_ocl_kernel.h"
+#include "d_ocl_utils.h"
+#include <CL/cl.h>
+#include <memory>
+#include <vector>
+
+namespace d_ocl {
+// as cv::createCLAHE()'s arguments
+struct D_OCL_API clahe_options
+{
+    // times the average bin count a tile's bin is clipped at, 0 for none
+    float clipLimit{40.0f};
+    // tiles across and down the image
+    int tilesX{8};
+    int tilesY{8};
+};
+
+// contrast normalization of 8-bit greyscale images on the device:
+// histograms, their cdfs and the lookup tables are built and applied by
+// kernels, so the image is uploaded once and the result downloaded once.
+// the histogram and lookup table buffers grow to the most tiles asked for
+// and stay, shared by every run (1 in-order queue, see d_ocl_kernel.h)
+struct D_OCL_API equalizer
+{
+    equalizer(cl_context context, cl_device_id device);
+
+    // false if the program failed to build
+    explicit operator bool() const;
+
+    // histogram equalization of the cols x rows pixels of input, tightly
+    // packed uchars, to output, which may be input. as cv::equalizeHist()
+    auto equalize(cl_command_queue queue,
+                  cl_mem input,
+                  cl_mem output,
+                  int cols,
+                  int rows,
+                  const std::vector<cl_event>& waitList,
+                  cl_event* event) -> bool;
+    // contrast-limited adaptive histogram equalization: each tile's own
+    // equalization, clipped, blended between tiles. as cv::CLAHE::apply()
+    auto clahe(cl_command_queue queue,
+               cl_mem input,
+               cl_mem output,
+               int cols,
+               int rows,
+               const clahe_options& options,
+               const std::vector<cl_event>& waitList,
+               cl_event* event) -> bool;
+
+    // equalize_lut(histograms, clipLimit, total, fromFirst, luts)
+    launcher<cl_mem, int, int, int, cl_mem> lutKernel;
+    // equalize_apply(input, output, count, lut)
+    launcher<cl_mem, cl_mem, int, cl_mem> applyKernel;
+    // clahe_histograms(image, cols, rows, tileWidth, tileHeight, histograms)
+    launcher<cl_mem, int, int, int, int, cl_mem> tileHistogramKernel;
+    // clahe_apply(input, output, cols, rows, tilesX, tilesY, invTileWidth,
+    //             invTileHeight, luts)
+    launcher<cl_mem, cl_mem, int, int, int, int, float, float, cl_mem>
+        claheApplyKernel;
+
+private:
+    // the buffers, grown to at least histogramsSize and lutsSize bytes
+    auto reserve(size_t histogramsSize, size_t lutsSize) -> bool;
+
+    cl_context context{nullptr};
+    // the whole image's histogram for equalize()
+    histogram counter;
+    // 1 histogram and lut per tile, or 1 for the whole image
+    std::shared_ptr<utils::manager<cl_mem>> histograms;
+    std::shared_ptr<utils::manager<cl_mem>> luts;
+    size_t histogramsCapacity{0};
+    size_t lutsCapacity{0};
+};
+} // namespace d_ocl
+
+#endif // D_OCL_EQUALIZE_H
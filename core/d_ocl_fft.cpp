@@ -0,0 +1,382 @@
+#include "d_ocl_fft.h"
+#include "d_ocl.h"
+#include "d_ocl_handle.h"
+#include <iostream>
+#include <string>
+#include <utility>
+
+#define D_OCL_FFT_PROGRAM D_OCL_RESOURCE_ROOT "/d_ocl_fft." D_OCL_KERN_EXT
+
+using pass_launcher
+    = d_ocl::launcher<cl_mem, cl_mem, int, int, int, int, int, int, float>;
+
+static auto isPowerOf2(int value) -> bool
+{
+    return value > 0 && (value & (value - 1)) == 0;
+}
+
+static auto nextPowerOf2(int value) -> int
+{
+    int power = 1;
+    while (power < value) {
+        power *= 2;
+    }
+    return power;
+}
+
+// the passes of all transforms of n points along 1 axis, ping-ponging src
+// and dst. src holds the result afterwards
+static auto transform1d(d_ocl::fft& transform,
+                        cl_command_queue queue,
+                        cl_mem& src,
+                        cl_mem& dst,
+                        int n,
+                        int pointStride,
+                        int transformStride,
+                        int transforms,
+                        int perPlane,
+                        int planeStride,
+                        float dir,
+                        const std::vector<cl_event>& waitList,
+                        d_ocl::handle<cl_event>& last) -> bool
+{
+    // radix 8 as long as it divides, then 1 radix 4 or 2 pass
+    for (int span = 1; span < n;) {
+        const int rest = n / span;
+        const int radix = rest % 8 == 0 ? 8 : (rest % 4 == 0 ? 4 : 2);
+        pass_launcher& pass = radix == 8 ? transform.pass8
+                              : radix == 4 ? transform.pass4
+                                           : transform.pass2;
+        d_ocl::nd_range range;
+        range.global = {(size_t)(n / radix), (size_t)transforms};
+        auto enqueue = [&](const std::vector<cl_event>& wait,
+                           cl_event* event) {
+            return pass.run(queue,
+                            range,
+                            wait,
+                            event,
+                            src,
+                            dst,
+                            n,
+                            span,
+                            pointStride,
+                            transformStride,
+                            perPlane,
+                            planeStride,
+                            dir);
+        };
+        if (!d_ocl::chain(waitList, last, enqueue)) {
+            return false;
+        }
+        std::swap(src, dst);
+        span *= radix;
+    }
+    return true;
+}
+
+d_ocl::fft::fft(cl_context context)
+{
+    // 1 program per radix, so each pass's loops unroll
+    for (int radix : {2, 4, 8}) {
+        std::shared_ptr<utils::manager<cl_program>> program
+            = createProgram(context,
+                            D_OCL_FFT_PROGRAM,
+                            std::string(),
+                            {{"RADIX", std::to_string(radix)}});
+        if (!program) {
+            return;
+        }
+        pass_launcher pass(program, "fft_pass");
+        if (radix == 2) {
+            pass2 = std::move(pass);
+            multiply = launcher<cl_mem, cl_mem, int, float>(program,
+                                                            "fft_multiply");
+            loadImage = launcher<cl_mem, int, int, int, cl_mem, int, int>(
+                program, "fft_load_image");
+            storeImage = launcher<cl_mem, int, int, cl_mem, int, int>(
+                program, "fft_store_image");
+        } else if (radix == 4) {
+            pass4 = std::move(pass);
+        } else {
+            pass8 = std::move(pass);
+        }
+    }
+}
+
+d_ocl::fft::operator bool() const
+{
+    return static_cast<bool>(pass2) && static_cast<bool>(pass4)
+           && static_cast<bool>(pass8) && static_cast<bool>(multiply)
+           && static_cast<bool>(loadImage) && static_cast<bool>(storeImage);
+}
+
+auto d_ocl::fft::transform2d(cl_command_queue queue,
+                             cl_mem data,
+                             cl_mem scratch,
+                             int width,
+                             int height,
+                             int planes,
+                             bool inverse,
+                             const std::vector<cl_event>& waitList,
+                             cl_event* event) -> bool
+{
+    if (!*this || !isPowerOf2(width) || !isPowerOf2(height) || planes < 1) {
+        std::cerr << "fft of " << width << " x " << height
+                  << " points, not powers of 2" << std::endl;
+        return false;
+    }
+
+    const float dir = inverse ? 1.0f : -1.0f;
+    cl_mem src = data;
+    cl_mem dst = scratch;
+    handle<cl_event> last;
+    // rows, all planes' one after another
+    if (!transform1d(*this,
+                     queue,
+                     src,
+                     dst,
+                     width,
+                     1,
+                     width,
+                     height * planes,
+                     height * planes,
+                     0,
+                     dir,
+                     waitList,
+                     last)
+        // columns, width per plane
+        || !transform1d(*this,
+                        queue,
+                        src,
+                        dst,
+                        height,
+                        width,
+                        1,
+                        width * planes,
+                        width,
+                        width * height,
+                        dir,
+                        waitList,
+                        last)) {
+        return false;
+    }
+
+    // odd # passes leave the result in scratch
+    auto copyBack = [&](const std::vector<cl_event>& wait, cl_event* copied) {
+        return utils::checkRun(
+            "clEnqueueCopyBuffer",
+            clEnqueueCopyBuffer(queue,
+                                src,
+                                data,
+                                0,
+                                0,
+                                sizeof(cl_float) * 2 * width * height * planes,
+                                static_cast<cl_uint>(wait.size()),
+                                wait.empty() ? nullptr : wait.data(),
+                                copied));
+    };
+    if (src != data && !chain(waitList, last, copyBack)) {
+        return false;
+    }
+    if (event != nullptr) {
+        *event = last.detach();
+    }
+    return true;
+}
+
+d_ocl::fft_convolution::fft_convolution(cl_context context,
+                                        const std::vector<float>& filter,
+                                        int filterWidth)
+    : transform(context),
+      context(context),
+      filter(filter),
+      filterWidth(filterWidth)
+{
+    if (filterWidth <= 0 || filterWidth % 2 == 0
+        || filter.size() != (size_t)filterWidth * filterWidth) {
+        std::cerr << "convolution filter must be odd x odd wide" << std::endl;
+        this->filterWidth = 0;
+    }
+}
+
+d_ocl::fft_convolution::operator bool() const
+{
+    return filterWidth > 0 && static_cast<bool>(transform);
+}
+
+auto d_ocl::fft_convolution::paddedSize(int cols,
+                                        int rows,
+                                        int& width,
+                                        int& height) const -> void
+{
+    // the filter reaches filterWidth / 2 beyond each edge
+    width = nextPowerOf2(cols + filterWidth - 1);
+    height = nextPowerOf2(rows + filterWidth - 1);
+}
+
+auto d_ocl::fft_convolution::prepare(cl_command_queue queue,
+                                     int width,
+                                     int height) -> bool
+{
+    const size_t points = (size_t)width * height;
+    const cl_mem_flags deviceOnly = CL_MEM_READ_WRITE | CL_MEM_HOST_NO_ACCESS;
+    data = utils::createBuffer(
+        context, deviceOnly, points * 2 * sizeof(cl_float) * 2);
+    scratch = utils::createBuffer(
+        context, deviceOnly, points * 2 * sizeof(cl_float) * 2);
+    // the filter's spectrum is uploaded through its own buffer
+    spectrum = utils::createBuffer(context,
+                                   CL_MEM_READ_WRITE | CL_MEM_HOST_WRITE_ONLY,
+                                   points * 2 * sizeof(cl_float));
+    if (!data || !scratch || !spectrum) {
+        this->width = 0;
+        return false;
+    }
+
+    // the padded image is the input shifted by radius, so output (x, y)
+    // = sum of padded (x + j, y + i) * filter[i][j]. as a circular
+    // convolution that's the filter mirrored to (-j, -i), wrapped around
+    std::vector<cl_float> padded(points * 2, 0.0f);
+    for (int i = 0; i < filterWidth; i++) {
+        for (int j = 0; j < filterWidth; j++) {
+            const size_t v = (height - i) % height;
+            const size_t u = (width - j) % width;
+            padded[(v * width + u) * 2] = filter[i * filterWidth + j];
+        }
+    }
+    handle<cl_event> transformed;
+    if (!utils::checkRun("clEnqueueWriteBuffer",
+                         clEnqueueWriteBuffer(queue,
+                                              spectrum->openclObject,
+                                              CL_TRUE,
+                                              0,
+                                              padded.size() * sizeof(cl_float),
+                                              padded.data(),
+                                              0,
+                                              nullptr,
+                                              nullptr))
+        || !transform.transform2d(queue,
+                                  spectrum->openclObject,
+                                  scratch->openclObject,
+                                  width,
+                                  height,
+                                  1,
+                                  false,
+                                  {},
+                                  transformed.outParam())
+        || !utils::checkRun("clWaitForEvents",
+                            clWaitForEvents(1, transformed.address()))) {
+        this->width = 0;
+        return false;
+    }
+
+    this->width = width;
+    this->height = height;
+    return true;
+}
+
+auto d_ocl::fft_convolution::run(cl_command_queue queue,
+                                 cl_mem inputImage,
+                                 cl_mem outputImage,
+                                 int cols,
+                                 int rows,
+                                 const std::vector<cl_event>& waitList,
+                                 cl_event* event) -> bool
+{
+    if (!*this || cols <= 0 || rows <= 0) {
+        return false;
+    }
+
+    int paddedWidth;
+    int paddedHeight;
+    paddedSize(cols, rows, paddedWidth, paddedHeight);
+    if ((paddedWidth != width || paddedHeight != height)
+        && !prepare(queue, paddedWidth, paddedHeight)) {
+        return false;
+    }
+
+    const int points = width * height;
+    nd_range paddedRange;
+    paddedRange.global = {(size_t)width, (size_t)height};
+    nd_range pointRange;
+    pointRange.global = {(size_t)points, 2};
+    nd_range imageRange;
+    imageRange.global = {(size_t)cols, (size_t)rows};
+    handle<cl_event> last;
+    const bool enqueued
+        = chain(waitList,
+                last,
+                [&](const std::vector<cl_event>& wait, cl_event* loaded) {
+                    return transform.loadImage.run(queue,
+                                                   paddedRange,
+                                                   wait,
+                                                   loaded,
+                                                   inputImage,
+                                                   cols,
+                                                   rows,
+                                                   filterWidth / 2,
+                                                   data->openclObject,
+                                                   width,
+                                                   height);
+                })
+          && chain(waitList,
+                   last,
+                   [&](const std::vector<cl_event>& wait, cl_event* done) {
+                       return transform.transform2d(queue,
+                                                    data->openclObject,
+                                                    scratch->openclObject,
+                                                    width,
+                                                    height,
+                                                    2,
+                                                    false,
+                                                    wait,
+                                                    done);
+                   })
+          // normalized here, so the inverse needs no extra pass
+          && chain(waitList,
+                   last,
+                   [&](const std::vector<cl_event>& wait, cl_event* done) {
+                       return transform.multiply.run(queue,
+                                                     pointRange,
+                                                     wait,
+                                                     done,
+                                                     data->openclObject,
+                                                     spectrum->openclObject,
+                                                     points,
+                                                     1.0f / points);
+                   })
+          && chain(waitList,
+                   last,
+                   [&](const std::vector<cl_event>& wait, cl_event* done) {
+                       return transform.transform2d(queue,
+                                                    data->openclObject,
+                                                    scratch->openclObject,
+                                                    width,
+                                                    height,
+                                                    2,
+                                                    true,
+                                                    wait,
+                                                    done);
+                   })
+          && chain(waitList,
+                   last,
+                   [&](const std::vector<cl_event>& wait, cl_event* stored) {
+                       return transform.storeImage.run(queue,
+                                                       imageRange,
+                                                       wait,
+                                                       stored,
+                                                       data->openclObject,
+                                                       width,
+                                                       height,
+                                                       outputImage,
+                                                       cols,
+                                                       rows);
+                   });
+    if (!enqueued) {
+        return false;
+    }
+    if (event != nullptr) {
+        *event = last.detach();
+    }
+    return true;
+}
@@ -0,0 +1,98 @@
+#ifndef D_OCL_FFT_H
+#define D_OCL_FFT_H
+
+#include "d_ocl_defines.h"
+#include "d_ocl_kernel.h"
+#include "d_ocl_utils.h"
+#include <CL/cl.h>
+#include <memory>
+#include <vector>
+
+namespace d_ocl {
+// 2D ffts of power-of-2 sized complex float2 data in 1 context, by radix
+// 8 stockham passes and 1 radix 2 or 4 pass for the rest.
+// callers pass data and scratch, so it keeps no buffers and any queue may
+// run it
+struct D_OCL_API fft
+{
+    explicit fft(cl_context context);
+
+    // false if a program failed to build
+    explicit operator bool() const;
+
+    // transform planes planes of width x height points in data, rows then
+    // columns. width and height are powers of 2, and scratch is a buffer of
+    // data's size. the result ends up in data. inverse is unscaled, i.e.
+    // forward then inverse multiplies by width x height
+    auto transform2d(cl_command_queue queue,
+                     cl_mem data,
+                     cl_mem scratch,
+                     int width,
+                     int height,
+                     int planes,
+                     bool inverse,
+                     const std::vector<cl_event>& waitList,
+                     cl_event* event) -> bool;
+
+    // fft_pass(src, dst, n, span, pointStride, transformStride, perPlane,
+    //          planeStride, dir) built with RADIX 2, 4 and 8
+    launcher<cl_mem, cl_mem, int, int, int, int, int, int, float> pass2;
+    launcher<cl_mem, cl_mem, int, int, int, int, int, int, float> pass4;
+    launcher<cl_mem, cl_mem, int, int, int, int, int, int, float> pass8;
+    // fft_multiply(data, spectrum, count, scale)
+    launcher<cl_mem, cl_mem, int, float> multiply;
+    // fft_load_image(input, imageWidth, imageHeight, radius, dst, width,
+    //                height)
+    launcher<cl_mem, int, int, int, cl_mem, int, int> loadImage;
+    // fft_store_image(src, width, height, output, imageWidth, imageHeight)
+    launcher<cl_mem, int, int, cl_mem, int, int> storeImage;
+};
+
+// convolution of images by 1 filter through their spectra: both are
+// transformed, multiplied and transformed back. the cost depends on the
+// image size only, so it beats direct convolution for large filters.
+// the filter's spectrum is kept for the last padded size, so frames of 1
+// size transform the filter only once
+struct D_OCL_API fft_convolution
+{
+    // filterWidth x filterWidth row-major filter, filterWidth odd
+    fft_convolution(cl_context context,
+                    const std::vector<float>& filter,
+                    int filterWidth);
+
+    explicit operator bool() const;
+
+    // same as convolution::run(), channels x, y, z and w filtered.
+    // the padded image and scratch buffers are reused by every run, see
+    // the single-queue rule in d_ocl_kernel.h
+    auto run(cl_command_queue queue,
+             cl_mem inputImage,
+             cl_mem outputImage,
+             int cols,
+             int rows,
+             const std::vector<cl_event>& waitList,
+             cl_event* event) -> bool;
+
+    // power-of-2 size a cols x rows image is padded to, so the filter
+    // doesn't wrap around into it
+    auto paddedSize(int cols, int rows, int& width, int& height) const
+        -> void;
+
+private:
+    // buffers and filter spectrum for width x height. blocks
+    auto prepare(cl_command_queue queue, int width, int height) -> bool;
+
+    fft transform;
+    cl_context context{nullptr};
+    std::vector<float> filter;
+    int filterWidth{0};
+    int width{0};
+    int height{0};
+    // 2 planes of width x height float2, and the filter's 1 plane
+    std::shared_ptr<utils::manager<cl_mem>> data;
+    std::shared_ptr<utils::manager<cl_mem>> scratch;
+    std::shared_ptr<utils::manager<cl_mem>> spectrum;
+};
+} // namespace d_ocl
+
+#endif // D_OCL_FFT_H
@@ -0,0 +1,110 @@
+template<typename T>
+d_ocl::handle<T>::handle(T object) : openclObject(object)
+{}
+
+template<typename T>
+d_ocl::handle<T>::~handle()
+{
+    reset();
+}
+
+template<typename T>
+d_ocl::handle<T>::handle(handle&& other) noexcept
+    : openclObject(other.openclObject)
+{
+    other.openclObject = nullptr;
+}
+
+template<typename T>
+auto d_ocl::handle<T>::operator=(handle&& other) noexcept -> handle&
+{
+    if (this != &other) {
+        reset(other.openclObject);
+        other.openclObject = nullptr;
+    }
+    return *this;
+}
+
+template<typename T>
+auto d_ocl::handle<T>::retain() const -> handle
+{
+    if (openclObject == nullptr
+        || utils::handle_traits<T>::retain(openclObject) != CL_SUCCESS) {
+        return handle();
+    }
+    return handle(openclObject);
+}
+
+template<typename T>
+auto d_ocl::handle<T>::detach() -> T
+{
+    T detached = openclObject;
+    openclObject = nullptr;
+    return detached;
+}
+
+template<typename T>
+auto d_ocl::handle<T>::reset(T object /*= nullptr*/) -> void
+{
+    if (openclObject != nullptr) {
+        utils::handle_traits<T>::release(openclObject);
+    }
+    openclObject = object;
+}
+
+template<typename T>
+auto d_ocl::handle<T>::outParam() -> T*
+{
+    reset();
+    return &openclObject;
+}
+
+template<typename T>
+auto d_ocl::handle<T>::get() const -> T
+{
+    return openclObject;
+}
+
+template<typename T>
+auto d_ocl::handle<T>::address() const -> const T*
+{
+    return &openclObject;
+}
+
+template<typename T>
+d_ocl::handle<T>::operator bool() const
+{
+    return openclObject != nullptr;
+}
+
+template<typename T>
+d_ocl::retained_handle<T>::retained_handle(T object)
+    : handle<T>(object)
+{}
+
+template<typename T>
+d_ocl::retained_handle<T>::retained_handle(handle<T>&& other)
+    : handle<T>(std::move(other))
+{}
+
+template<typename T>
+d_ocl::retained_handle<T>::retained_handle(const retained_handle& other)
+    : handle<T>(other.retain())
+{}
+
+template<typename T>
+auto d_ocl::retained_handle<T>::operator=(const retained_handle& other)
+    -> retained_handle&
+{
+    if (this != &other) {
+        handle<T>::operator=(other.retain());
+    }
+    return *this;
+}
+
+template<typename T>
+auto d_ocl::toShared(handle<T>&& object) -> std::shared_ptr<utils::manager<T>>
+{
+    return utils::manager<T>::makeShared(object.detach(),
+                                         &utils::handle_traits<T>::release);
+}
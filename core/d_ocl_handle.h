@@ -0,0 +1,176 @@
+#ifndef D_OCL_HANDLE_H
+#define D_OCL_HANDLE_H
+
+#include "d_ocl_defines.h"
+#include "d_ocl_utils.h"
+#include <CL/cl.h>
+#include <memory>
+#include <utility>
+
+namespace d_ocl {
+namespace utils {
+// clRetain* / clRelease* per opencl object type, resolved at compile time.
+// left undefined for types that are not opencl objects
+template<typename T>
+struct handle_traits;
+
+template<>
+struct handle_traits<cl_context>
+{
+    static auto retain(cl_context object) -> cl_int
+    {
+        return clRetainContext(object);
+    }
+    static auto release(cl_context object) -> cl_int
+    {
+        return clReleaseContext(object);
+    }
+};
+template<>
+struct handle_traits<cl_command_queue>
+{
+    static auto retain(cl_command_queue object) -> cl_int
+    {
+        return clRetainCommandQueue(object);
+    }
+    static auto release(cl_command_queue object) -> cl_int
+    {
+        return clReleaseCommandQueue(object);
+    }
+};
+template<>
+struct handle_traits<cl_mem>
+{
+    static auto retain(cl_mem object) -> cl_int
+    {
+        return clRetainMemObject(object);
+    }
+    static auto release(cl_mem object) -> cl_int
+    {
+        return clReleaseMemObject(object);
+    }
+};
+template<>
+struct handle_traits<cl_program>
+{
+    static auto retain(cl_program object) -> cl_int
+    {
+        return clRetainProgram(object);
+    }
+    static auto release(cl_program object) -> cl_int
+    {
+        return clReleaseProgram(object);
+    }
+};
+template<>
+struct handle_traits<cl_kernel>
+{
+    static auto retain(cl_kernel object) -> cl_int
+    {
+        return clRetainKernel(object);
+    }
+    static auto release(cl_kernel object) -> cl_int
+    {
+        return clReleaseKernel(object);
+    }
+};
+template<>
+struct handle_traits<cl_event>
+{
+    static auto retain(cl_event object) -> cl_int
+    {
+        return clRetainEvent(object);
+    }
+    static auto release(cl_event object) -> cl_int
+    {
+        return clReleaseEvent(object);
+    }
+};
+template<>
+struct handle_traits<cl_sampler>
+{
+    static auto retain(cl_sampler object) -> cl_int
+    {
+        return clRetainSampler(object);
+    }
+    static auto release(cl_sampler object) -> cl_int
+    {
+        return clReleaseSampler(object);
+    }
+};
+// no-op for root devices, counted for sub-devices
+template<>
+struct handle_traits<cl_device_id>
+{
+    static auto retain(cl_device_id object) -> cl_int
+    {
+        return clRetainDevice(object);
+    }
+    static auto release(cl_device_id object) -> cl_int
+    {
+        return clReleaseDevice(object);
+    }
+};
+} // namespace utils
+
+// owns 1 reference to an opencl object like cl_event and releases it when
+// destroyed. move-only, pointer-sized and allocation-free, unlike
+// shared_ptr<utils::manager<T>>.
+//
+// d_ocl::handle<cl_event> event;
+// launcher.run(queue, range, {}, event.outParam(), ...);
+template<typename T>
+struct handle
+{
+    handle() = default;
+    // takes over the reference the caller got from e.g. clCreateBuffer()
+    explicit handle(T object);
+    ~handle();
+
+    handle(handle&& other) noexcept;
+    auto operator=(handle&& other) noexcept -> handle&;
+    handle(const handle&) = delete;
+    auto operator=(const handle&) -> handle& = delete;
+
+    // another handle to the same object, via clRetain*()
+    auto retain() const -> handle;
+    // give up ownership without releasing
+    auto detach() -> T;
+    // release the current object and take over object instead
+    auto reset(T object = nullptr) -> void;
+    // release the current object and return where an opencl call can write a
+    // new one, e.g. the cl_event* of clEnqueueNDRangeKernel()
+    auto outParam() -> T*;
+
+    auto get() const -> T;
+    // e.g. as a wait list of 1 cl_event
+    auto address() const -> const T*;
+    explicit operator bool() const;
+
+private:
+    T openclObject{nullptr};
+};
+
+// copyable handle. each copy retains the object, each destruction releases it.
+// opt-in where sharing is needed, e.g. events waited on by several commands
+template<typename T>
+struct retained_handle : handle<T>
+{
+    retained_handle() = default;
+    explicit retained_handle(T object);
+    retained_handle(handle<T>&& other);
+
+    retained_handle(const retained_handle& other);
+    auto operator=(const retained_handle& other) -> retained_handle&;
+    retained_handle(retained_handle&& other) = default;
+    auto operator=(retained_handle&& other) -> retained_handle& = default;
+};
+
+// compatibility with the shared_ptr<utils::manager<T>> API.
+// empty shared_ptr if object is empty
+template<typename T>
+auto toShared(handle<T>&& object) -> std::shared_ptr<utils::manager<T>>;
+} // namespace d_ocl
+
+#include "d_ocl_handle.cpp"
+#endif // D_OCL_HANDLE_H
@@ -0,0 +1,183 @@
+#include "d_ocl_histogram.h"
+#include "d_ocl.h"
+#include "d_ocl_handle.h"
+#include <algorithm>
+#include <iostream>
+#include <limits>
+#include <opencv2/core.hpp>
+#include <string>
+#include <utility>
+
+#define D_OCL_HISTOGRAM_PROGRAM                                                \
+    D_OCL_RESOURCE_ROOT "/d_ocl_histogram." D_OCL_KERN_EXT
+
+d_ocl::histogram::histogram(cl_context context,
+                            cl_device_id device,
+                            int cvType,
+                            const histogram_options& options
+                            /*= histogram_options()*/)
+    : options(options)
+{
+    const int depth = CV_MAT_DEPTH(cvType);
+    const int channels = CV_MAT_CN(cvType);
+    if ((depth != CV_8U && depth != CV_32F) || channels < 1 || channels > 4
+        || options.bins < 1 || !(options.maxValue > options.minValue)) {
+        std::cerr << "unsupported histogram of cv::Mat type " << cvType
+                  << " in " << options.bins << " bins" << std::endl;
+        return;
+    }
+
+    // as many privatized copies as asked for and fit local memory
+    std::vector<cl_ulong> localMemory;
+    if (!utils::information<cl_ulong>(
+            device, CL_DEVICE_LOCAL_MEM_SIZE, localMemory, 0)) {
+        return;
+    }
+    const cl_ulong copyBytes = (cl_ulong)channels * options.bins
+                               * sizeof(cl_uint);
+    int subHistograms = 1;
+    while (subHistograms * 2 <= options.subHistograms
+           && copyBytes * subHistograms * 2 <= localMemory[0]) {
+        subHistograms *= 2;
+    }
+    if (copyBytes > localMemory[0]) {
+        std::cerr << channels << " x " << options.bins
+                  << " bins don't fit local memory" << std::endl;
+        return;
+    }
+
+    // 8-bit data loads 16 values at once, float 4
+    program_defines defines
+        = {{"T", depth == CV_8U ? "uchar" : "float"},
+           {"VEC", depth == CV_8U ? "16" : "4"},
+           {"CHANNELS", std::to_string(channels)},
+           {"BINS", std::to_string(options.bins)},
+           {"SUB_HISTOGRAMS", std::to_string(subHistograms)}};
+    if (depth == CV_8U && options.bins == 256 && options.minValue == 0.0f
+        && options.maxValue == 256.0f) {
+        defines["DIRECT_BINS"] = "";
+    }
+    std::shared_ptr<utils::manager<cl_program>> program = createProgram(
+        context, D_OCL_HISTOGRAM_PROGRAM, std::string(), defines);
+    if (!program) {
+        return;
+    }
+    countKernel = launcher<cl_mem, cl_uint, float, float, cl_mem>(
+        program, "histogram_count");
+    mergeKernel = launcher<cl_mem, int, int>(program, "histogram_merge");
+    accumulateKernel
+        = launcher<cl_mem, cl_mem>(program, "histogram_accumulate");
+    if (!countKernel || !mergeKernel || !accumulateKernel) {
+        return;
+    }
+
+    localSize = utils::powerOf2WorkGroupSize(device, countKernel.kernel(), 1);
+    groups = utils::gridStrideGroups(device);
+    if (localSize == 0) {
+        return;
+    }
+    partials = utils::createBuffer(
+        context, CL_MEM_READ_WRITE | CL_MEM_HOST_NO_ACCESS, groups * copyBytes);
+    if (!partials) {
+        return;
+    }
+    channelCount = channels;
+}
+
+d_ocl::histogram::operator bool() const
+{
+    return static_cast<bool>(partials);
+}
+
+auto d_ocl::histogram::channels() const -> int
+{
+    return channelCount;
+}
+
+auto d_ocl::histogram::bins() const -> int
+{
+    return options.bins;
+}
+
+auto d_ocl::histogram::histogramSize() const -> size_t
+{
+    return (size_t)channelCount * options.bins * sizeof(cl_uint);
+}
+
+auto d_ocl::histogram::maxCount() const -> size_t
+{
+    // the kernel's indices step by the global size past the last element
+    // without wrapping
+    const size_t limit
+        = std::numeric_limits<cl_uint>::max() - groups * localSize;
+    return channelCount == 0 ? 0 : limit - limit % channelCount;
+}
+
+auto d_ocl::histogram::run(cl_command_queue queue,
+                           cl_mem data,
+                           size_t count,
+                           cl_mem histograms,
+                           const std::vector<cl_event>& waitList,
+                           cl_event* event) -> bool
+{
+    if (!*this || count % channelCount != 0) {
+        std::cerr << "histogram of " << count << " elements, not whole "
+                  << channelCount << " channel pixels" << std::endl;
+        return false;
+    }
+    if (count > maxCount()) {
+        std::cerr << "histogram of " << count << " elements, over the "
+                  << maxCount() << " 1 run can count" << std::endl;
+        return false;
+    }
+
+    nd_range countRange;
+    countRange.global = {groups * localSize};
+    countRange.local = {localSize};
+    handle<cl_event> last;
+    if (!countKernel.run(queue,
+                         countRange,
+                         waitList,
+                         last.outParam(),
+                         data,
+                         static_cast<cl_uint>(count),
+                         options.minValue,
+                         options.maxValue,
+                         partials->openclObject)) {
+        return false;
+    }
+
+    // pairs of work-group histograms summed level by level, log2(groups)
+    // launches instead of groups atomics per bin
+    const size_t channelBins = (size_t)channelCount * options.bins;
+    size_t levels = 1;
+    while (levels < groups) {
+        levels *= 2;
+    }
+    for (size_t stride = levels / 2; stride > 0; stride /= 2) {
+        nd_range mergeRange;
+        mergeRange.global = {channelBins, stride};
+        auto merge = [&](const std::vector<cl_event>& wait,
+                         cl_event* merged) {
+            return mergeKernel.run(queue,
+                                   mergeRange,
+                                   wait,
+                                   merged,
+                                   partials->openclObject,
+                                   static_cast<int>(stride),
+                                   static_cast<int>(groups));
+        };
+        if (!chain(waitList, last, merge)) {
+            return false;
+        }
+    }
+
+    nd_range binRange;
+    binRange.global = {channelBins};
+    return accumulateKernel.run(queue,
+                                binRange,
+                                after(waitList, last),
+                                event,
+                                partials->openclObject,
+                                histograms);
+}
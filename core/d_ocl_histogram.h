@@ -0,0 +1,82 @@
+#ifndef D_OCL_HISTOGRAM_H
+#define D_OCL_HISTOGRAM_H
+
+#include "d_ocl_defines.h"
+#include "d_ocl_kernel.h"
+#include "d_ocl_utils.h"
+#include <CL/cl.h>
+#include <memory>
+#include <vector>
+
+namespace d_ocl {
+struct D_OCL_API histogram_options
+{
+    // bins per channel
+    int bins{256};
+    // values binned: [minValue, maxValue) in equal bins, with maxValue
+    // itself in the last bin. others aren't counted.
+    // e.g. 0 ~ 256 for 8-bit, 0 ~ 1 for float images
+    float minValue{0.0f};
+    float maxValue{256.0f};
+    // privatized copies per work-group, atomics of neighbouring work-items
+    // going to different ones. more help skewed images but take local
+    // memory. power of 2, lowered to what fits the device
+    int subHistograms{8};
+};
+
+// separate histograms of each channel of interleaved 8-bit or float
+// pixels, e.g. the b, g and r of a CV_8UC3 image.
+// the per-work-group histograms buffer is sized for the device once, when
+// created, so runs allocate nothing
+struct D_OCL_API histogram
+{
+    // cvType is the data's e.g. CV_8UC3 or CV_32FC1
+    histogram(cl_context context,
+              cl_device_id device,
+              int cvType,
+              const histogram_options& options = histogram_options());
+
+    // false if the type or options aren't supported, or the program failed
+    // to build
+    explicit operator bool() const;
+    auto channels() const -> int;
+    auto bins() const -> int;
+    // bytes of the cl_uint histograms run() adds to, channel c's bins
+    // starting at c * bins()
+    auto histogramSize() const -> size_t;
+    // most elements 1 run() takes, a multiple of channels()
+    auto maxCount() const -> size_t;
+
+    // add count elements (pixels x channels) of data to histograms. data
+    // must start at a pixel, e.g. chunks of an image a multiple of
+    // channels() elements long.
+    // every run counts into and merges that 1 buffer: 1 in-order queue only,
+    // see d_ocl_kernel.h.
+    // count is indexed and counted in 32 bits: split larger data into runs
+    // of maxCount() elements
+    auto run(cl_command_queue queue,
+             cl_mem data,
+             size_t count,
+             cl_mem histograms,
+             const std::vector<cl_event>& waitList,
+             cl_event* event) -> bool;
+
+    // histogram_count(data, count, minValue, maxValue, partials)
+    launcher<cl_mem, cl_uint, float, float, cl_mem> countKernel;
+    // histogram_merge(partials, stride, groups)
+    launcher<cl_mem, int, int> mergeKernel;
+    // histogram_accumulate(partials, histogram)
+    launcher<cl_mem, cl_mem> accumulateKernel;
+
+private:
+    histogram_options options;
+    int channelCount{0};
+    // counting work-groups and their size
+    size_t groups{0};
+    size_t localSize{0};
+    // 1 histogram per work-group
+    std::shared_ptr<utils::manager<cl_mem>> partials;
+};
+} // namespace d_ocl
+
+#endif // D_OCL_HISTOGRAM_H
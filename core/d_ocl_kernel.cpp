@@ -0,0 +1,77 @@
+#include "d_ocl_kernel.h"
+#include <iostream>
+#include <map>
+#include <utility>
+
+namespace {
+struct cache_entry
+{
+    // detects cl_program handle reuse after the program was released
+    std::weak_ptr<d_ocl::utils::manager<cl_program>> program;
+    std::shared_ptr<d_ocl::cached_kernel> kernel;
+};
+} // namespace
+
+static std::mutex g_cacheMutex;
+static std::map<std::pair<cl_program, std::string>, cache_entry> g_cache;
+
+auto d_ocl::cachedKernel(
+    const std::shared_ptr<utils::manager<cl_program>>& program,
+    const std::string& kernelName) -> std::shared_ptr<cached_kernel>
+{
+    if (!program) {
+        return std::shared_ptr<cached_kernel>();
+    }
+
+    std::lock_guard<std::mutex> lock(g_cacheMutex);
+
+    // drop kernels of programs that no longer exist
+    for (auto iter = g_cache.begin(); iter != g_cache.end();) {
+        if (iter->second.program.expired()) {
+            iter = g_cache.erase(iter);
+        } else {
+            iter++;
+        }
+    }
+
+    cache_entry& entry
+        = g_cache[std::make_pair(program->openclObject, kernelName)];
+    if (entry.kernel) {
+        return entry.kernel;
+    }
+
+    cl_int status;
+    std::shared_ptr<cached_kernel> kernel = std::make_shared<cached_kernel>();
+    kernel->kernel = utils::manager<cl_kernel>::makeShared(
+        clCreateKernel(program->openclObject, kernelName.c_str(), &status),
+        &clReleaseKernel);
+    if (!kernel->kernel
+        || !utils::checkRun("clGetKernelInfo",
+                            clGetKernelInfo(kernel->kernel->openclObject,
+                                            CL_KERNEL_NUM_ARGS,
+                                            sizeof(kernel->numArgs),
+                                            &kernel->numArgs,
+                                            nullptr))) {
+        std::cerr << "clCreateKernel(" << kernelName
+                  << ") failed: " << utils::errorString(status) << std::endl;
+        g_cache.erase(std::make_pair(program->openclObject, kernelName));
+        return std::shared_ptr<cached_kernel>();
+    }
+    kernel->argKeys.resize(kernel->numArgs);
+
+    entry.program = program;
+    entry.kernel = kernel;
+    return kernel;
+}
+
+auto d_ocl::clearKernelCache() -> void
+{
+    std::lock_guard<std::mutex> lock(g_cacheMutex);
+    g_cache.clear();
+}
+
+auto d_ocl::after(const std::vector<cl_event>& waitList,
+                  const handle<cl_event>& last) -> std::vector<cl_event>
+{
+    return last ? std::vector<cl_event>{last.get()} : waitList;
+}
@@ -0,0 +1,194 @@
+#ifndef D_OCL_KERNEL_H
+#define D_OCL_KERNEL_H
+
+#include "d_ocl_defines.h"
+#include "d_ocl_handle.h"
+#include "d_ocl_utils.h"
+#include <CL/cl.h>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+namespace d_ocl {
+// work-items topology for clEnqueueNDRangeKernel()
+struct D_OCL_API nd_range
+{
+    // # work-items in each of 1 ~ 3 dimensions
+    std::vector<size_t> global;
+    // work-group size in each dimension. empty to let the driver decide
+    std::vector<size_t> local;
+};
+
+// kernel arg for a __local buffer of count T's
+template<typename T>
+struct local_memory
+{
+    size_t count;
+};
+
+namespace utils {
+// true for types passed to clSetKernelArg() as plain bytes.
+// specialize to false_type for wrappers that need their own kernel_arg
+template<typename T>
+struct by_value_kernel_arg
+    : std::integral_constant<bool,
+                             std::is_trivially_copyable<T>::value
+                                 && !std::is_pointer<T>::value>
+{};
+template<typename T>
+struct by_value_kernel_arg<local_memory<T>> : std::false_type
+{};
+
+// how to clSetKernelArg() a host value of type T.
+// left undefined for types a kernel can't take, e.g. std::vector or int*,
+// so passing one is a compile error rather than garbage on the device
+template<typename T, typename Enable = void>
+struct kernel_arg;
+
+// scalars and cl vector types like cl_float4, passed by value
+template<typename T>
+struct kernel_arg<T,
+                  typename std::enable_if<by_value_kernel_arg<T>::value>::type>
+{
+    static auto set(cl_kernel kernel, cl_uint index, const T& value) -> cl_int
+    {
+        return clSetKernelArg(kernel, index, sizeof(T), &value);
+    }
+    // bytes identifying value, to skip setting the same value again.
+    // empty to always set it
+    static auto key(const T& value) -> std::string
+    {
+        return std::string(reinterpret_cast<const char*>(&value), sizeof(T));
+    }
+};
+
+// opencl object handles. the only pointers a kernel arg can be
+template<typename T>
+struct kernel_arg<T,
+                  typename std::enable_if<
+                      std::is_same<T, cl_mem>::value
+                      || std::is_same<T, cl_sampler>::value>::type>
+{
+    static auto set(cl_kernel kernel, cl_uint index, const T& value) -> cl_int
+    {
+        return clSetKernelArg(kernel, index, sizeof(T), &value);
+    }
+    // never cached: a released handle can be recycled for a new object at
+    // the same address, and drivers resolve the object when it's set
+    static auto key(const T&) -> std::string
+    {
+        return std::string();
+    }
+};
+
+template<typename T>
+struct kernel_arg<local_memory<T>>
+{
+    static auto set(cl_kernel kernel,
+                    cl_uint index,
+                    const local_memory<T>& value) -> cl_int
+    {
+        // null arg value allocates __local memory of this size
+        return clSetKernelArg(kernel, index, value.count * sizeof(T), nullptr);
+    }
+    static auto key(const local_memory<T>& value) -> std::string
+    {
+        return std::to_string(value.count * sizeof(T));
+    }
+};
+} // namespace utils
+
+// a cl_kernel shared by every launcher of the same program and kernel name,
+// with the args last set on it
+struct D_OCL_API cached_kernel
+{
+    std::shared_ptr<utils::manager<cl_kernel>> kernel;
+    // CL_KERNEL_NUM_ARGS
+    cl_uint numArgs{0};
+    // clSetKernelArg() is not thread-safe on the same cl_kernel
+    std::mutex mutex;
+    // utils::kernel_arg<T>::key() of each arg. empty if never set
+    std::vector<std::string> argKeys;
+};
+
+// clCreateKernel() once per program and kernel name.
+// returns empty shared_ptr if kernelName is not in program
+auto D_OCL_API cachedKernel(
+    const std::shared_ptr<utils::manager<cl_program>>& program,
+    const std::string& kernelName) -> std::shared_ptr<cached_kernel>;
+// release every cached cl_kernel, and with them the cl_programs they retain
+auto D_OCL_API clearKernelCache() -> void;
+
+// typed launcher for a kernel, e.g. for
+// __kernel void vector_add(__global int* A, __global int* B, __global int* C)
+//
+// launcher<cl_mem, cl_mem, cl_mem> vectorAdd(program, "vector_add");
+// vectorAdd.run(queue, range, {}, &event, a, b, c);
+//
+// args are checked against Args at compile time,
+// and the arg count against the kernel when constructed.
+// args unchanged since the last launch of the same kernel are not set again,
+// except cl_mem and cl_sampler args which are set every launch
+template<typename... Args>
+struct launcher
+{
+    launcher() = default;
+    launcher(const std::shared_ptr<utils::manager<cl_program>>& program,
+             const std::string& kernelName);
+
+    // false if kernel was not found or its arg count is not sizeof(Args)
+    explicit operator bool() const;
+    auto kernel() const -> cl_kernel;
+
+    // set args that changed since the last launch and enqueue the kernel.
+    // event may be null
+    auto run(cl_command_queue queue,
+             const nd_range& range,
+             const std::vector<cl_event>& waitList,
+             cl_event* event,
+             const Args&... args) -> bool;
+    // set args that changed since the last launch without enqueueing
+    auto setArgs(const Args&... args) -> bool;
+    // enqueue with whatever args were last set
+    auto enqueue(cl_command_queue queue,
+                 const nd_range& range,
+                 const std::vector<cl_event>& waitList,
+                 cl_event* event) -> bool;
+
+    std::shared_ptr<cached_kernel> cachedKernel;
+
+private:
+    template<typename T>
+    auto setArg(cl_uint index, const T& value) -> bool;
+    auto setArgsLocked(const Args&... args) -> bool;
+    auto enqueueLocked(cl_command_queue queue,
+                       const nd_range& range,
+                       const std::vector<cl_event>& waitList,
+                       cl_event* event) -> bool;
+};
+
+// types built on launchers, e.g. warp or histogram, build their program when
+// constructed: make 1 per context and keep it, e.g. for every frame.
+// the ones that keep device buffers between runs say so in their header.
+// they enqueue into those buffers without locking or waiting, so their runs
+// must go to 1 in-order queue, not to several at once
+
+// waitList of the next command in a chain: the last one enqueued,
+// else the caller's waitList when nothing is enqueued yet
+auto D_OCL_API after(const std::vector<cl_event>& waitList,
+                     const handle<cl_event>& last) -> std::vector<cl_event>;
+
+// enqueue(after(waitList, last), &next), then last = next.
+// Enqueue is callable as bool(const std::vector<cl_event>&, cl_event*),
+// e.g. a lambda around launcher::run()
+template<typename Enqueue>
+auto chain(const std::vector<cl_event>& waitList,
+           handle<cl_event>& last,
+           Enqueue enqueue) -> bool;
+} // namespace d_ocl
+
+#include "d_ocl_launcher.cpp"
+#endif // D_OCL_KERNEL_H
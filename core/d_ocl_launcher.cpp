@@ -0,0 +1,147 @@
+template<typename... Args>
+d_ocl::launcher<Args...>::launcher(
+    const std::shared_ptr<utils::manager<cl_program>>& program,
+    const std::string& kernelName)
+{
+    cachedKernel = d_ocl::cachedKernel(program, kernelName);
+    if (cachedKernel && cachedKernel->numArgs != sizeof...(Args)) {
+        std::cerr << kernelName << " takes " << cachedKernel->numArgs
+                  << " args but launcher has " << sizeof...(Args)
+                  << std::endl;
+        cachedKernel.reset();
+    }
+}
+
+template<typename... Args>
+d_ocl::launcher<Args...>::operator bool() const
+{
+    return static_cast<bool>(cachedKernel);
+}
+
+template<typename... Args>
+auto d_ocl::launcher<Args...>::kernel() const -> cl_kernel
+{
+    return cachedKernel ? cachedKernel->kernel->openclObject : nullptr;
+}
+
+template<typename... Args>
+auto d_ocl::launcher<Args...>::run(cl_command_queue queue,
+                                   const nd_range& range,
+                                   const std::vector<cl_event>& waitList,
+                                   cl_event* event,
+                                   const Args&... args) -> bool
+{
+    if (!cachedKernel) {
+        return false;
+    }
+
+    // the kernel captures its args at enqueue,
+    // so another launcher may set new ones right after
+    std::lock_guard<std::mutex> lock(cachedKernel->mutex);
+    return setArgsLocked(args...)
+           && enqueueLocked(queue, range, waitList, event);
+}
+
+template<typename... Args>
+auto d_ocl::launcher<Args...>::setArgs(const Args&... args) -> bool
+{
+    if (!cachedKernel) {
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(cachedKernel->mutex);
+    return setArgsLocked(args...);
+}
+
+template<typename... Args>
+auto d_ocl::launcher<Args...>::enqueue(cl_command_queue queue,
+                                       const nd_range& range,
+                                       const std::vector<cl_event>& waitList,
+                                       cl_event* event) -> bool
+{
+    if (!cachedKernel) {
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(cachedKernel->mutex);
+    return enqueueLocked(queue, range, waitList, event);
+}
+
+template<typename... Args>
+template<typename T>
+auto d_ocl::launcher<Args...>::setArg(cl_uint index, const T& value) -> bool
+{
+    std::string key = utils::kernel_arg<T>::key(value);
+    if (!key.empty() && cachedKernel->argKeys[index] == key) {
+        // same as last launch; kernel still holds it
+        return true;
+    }
+
+    if (!utils::checkRun(
+            "clSetKernelArg",
+            utils::kernel_arg<T>::set(
+                cachedKernel->kernel->openclObject, index, value))) {
+        std::cerr << "error setting arg " << index << std::endl;
+        // unknown state now; force set next time
+        cachedKernel->argKeys[index].clear();
+        return false;
+    }
+    cachedKernel->argKeys[index] = std::move(key);
+    return true;
+}
+
+template<typename... Args>
+auto d_ocl::launcher<Args...>::setArgsLocked(const Args&... args) -> bool
+{
+    bool success = true;
+    cl_uint index = 0;
+    // braced init list evaluates left to right, i.e. arg 0, 1, ...
+    // stops setting at the first failure
+    const bool unused[] = {
+        true, (success = success && setArg<Args>(index++, args))...};
+    (void)unused;
+    return success;
+}
+
+template<typename... Args>
+auto d_ocl::launcher<Args...>::enqueueLocked(
+    cl_command_queue queue,
+    const nd_range& range,
+    const std::vector<cl_event>& waitList,
+    cl_event* event) -> bool
+{
+    if (range.global.empty()
+        || (!range.local.empty()
+            && range.local.size() != range.global.size())) {
+        std::cerr << "invalid nd_range: " << range.global.size()
+                  << " global and " << range.local.size()
+                  << " local dimensions" << std::endl;
+        return false;
+    }
+
+    return utils::checkRun(
+        "clEnqueueNDRangeKernel",
+        clEnqueueNDRangeKernel(queue,
+                               cachedKernel->kernel->openclObject,
+                               range.global.size(),
+                               nullptr,
+                               range.global.data(),
+                               range.local.empty() ? nullptr
+                                                   : range.local.data(),
+                               waitList.size(),
+                               waitList.empty() ? nullptr : waitList.data(),
+                               event));
+}
+
+template<typename Enqueue>
+auto d_ocl::chain(const std::vector<cl_event>& waitList,
+                  handle<cl_event>& last,
+                  Enqueue enqueue) -> bool
+{
+    handle<cl_event> next;
+    if (!enqueue(after(waitList, last), next.outParam())) {
+        return false;
+    }
+    last = std::move(next);
+    return true;
+}
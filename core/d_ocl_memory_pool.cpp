@@ -0,0 +1,316 @@
+#include "d_ocl_memory_pool.h"
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <tuple>
+
+struct d_ocl::buffer_arena_state
+{
+    ~buffer_arena_state()
+    {
+        for (std::pair<const size_t, std::vector<region>>& freeList :
+             freeLists) {
+            for (region& freeRegion : freeList.second) {
+                clReleaseMemObject(freeRegion.subBuffer);
+            }
+        }
+        // slabs released with their managers
+    }
+
+    struct slab
+    {
+        std::shared_ptr<utils::manager<cl_mem>> buffer;
+        size_t size;
+        // bytes carved so far. regions are never returned to the slab,
+        // only to their size class's free list
+        size_t used;
+        // sub-buffers handed out and not yet returned
+        size_t inUse;
+    };
+    struct region
+    {
+        cl_mem subBuffer;
+        size_t slabId;
+    };
+
+    cl_context context;
+    cl_mem_flags flags;
+    size_t slabSize;
+    // CL_DEVICE_MEM_BASE_ADDR_ALIGN in bytes; sub-buffer origin alignment
+    size_t alignment;
+
+    std::mutex mutex;
+    size_t nextSlabId{0};
+    std::map<size_t, slab> slabs;
+    // size class -> sub-buffers not in use
+    std::map<size_t, std::vector<region>> freeLists;
+    memory_pool_stats stats;
+};
+
+static auto sizeClass(size_t size, size_t alignment) -> size_t
+{
+    size_t rounded = alignment;
+    while (rounded < size) {
+        rounded <<= 1;
+    }
+    return rounded;
+}
+
+d_ocl::buffer_arena::buffer_arena(cl_context context,
+                                  cl_mem_flags flags,
+                                  size_t slabSize /*= 1 << 26*/)
+    : state(std::make_shared<buffer_arena_state>())
+{
+    state->context = context;
+    state->flags = flags;
+    state->slabSize = slabSize;
+
+    // strictest alignment of any device in the context
+    state->alignment = 1;
+    for (cl_device_id device : utils::contextDevices(context)) {
+        std::vector<cl_uint> alignBits;
+        if (utils::information<cl_uint>(
+                device, CL_DEVICE_MEM_BASE_ADDR_ALIGN, alignBits, 0)) {
+            state->alignment
+                = std::max<size_t>(state->alignment, alignBits[0] / 8);
+        }
+    }
+}
+
+// called with state->mutex locked
+static auto handOut(const std::shared_ptr<d_ocl::buffer_arena_state>& arena,
+                    size_t classSize,
+                    d_ocl::buffer_arena_state::region region)
+    -> std::shared_ptr<d_ocl::utils::manager<cl_mem>>
+{
+    arena->slabs[region.slabId].inUse++;
+    // back to the free list instead of clReleaseMemObject().
+    // arena is kept alive by this functor until the sub-buffer is returned
+    return d_ocl::utils::manager<cl_mem>::makeShared(
+        region.subBuffer, [arena, classSize, region](cl_mem) -> cl_int {
+            std::lock_guard<std::mutex> lock(arena->mutex);
+            arena->slabs[region.slabId].inUse--;
+            arena->freeLists[classSize].push_back(region);
+            return CL_SUCCESS;
+        });
+}
+
+auto d_ocl::buffer_arena::allocate(size_t size)
+    -> std::shared_ptr<utils::manager<cl_mem>>
+{
+    if (size == 0) {
+        return std::shared_ptr<utils::manager<cl_mem>>();
+    }
+
+    const size_t classSize = sizeClass(size, state->alignment);
+    std::lock_guard<std::mutex> lock(state->mutex);
+
+    std::vector<buffer_arena_state::region>& freeList
+        = state->freeLists[classSize];
+    if (!freeList.empty()) {
+        buffer_arena_state::region region = freeList.back();
+        freeList.pop_back();
+        state->stats.reuses++;
+        return handOut(state, classSize, region);
+    }
+
+    // first slab with room for the region
+    size_t slabId = state->nextSlabId;
+    for (std::pair<const size_t, buffer_arena_state::slab>& candidate :
+         state->slabs) {
+        if (candidate.second.size - candidate.second.used >= classSize) {
+            slabId = candidate.first;
+            break;
+        }
+    }
+    if (slabId == state->nextSlabId) {
+        const size_t slabSize = std::max(state->slabSize, classSize);
+        cl_int status;
+        std::shared_ptr<utils::manager<cl_mem>> buffer
+            = utils::manager<cl_mem>::makeShared(
+                clCreateBuffer(
+                    state->context, state->flags, slabSize, nullptr, &status),
+                &clReleaseMemObject);
+        if (!buffer) {
+            std::cerr << "clCreateBuffer(" << slabSize
+                      << ") for arena slab failed: "
+                      << utils::errorString(status) << std::endl;
+            return buffer;
+        }
+        state->stats.driverAllocations++;
+        state->stats.reservedBytes += slabSize;
+        state->slabs[slabId] = {buffer, slabSize, 0, 0};
+        state->nextSlabId++;
+    }
+    buffer_arena_state::slab& slab = state->slabs[slabId];
+
+    // class sizes are multiples of alignment, so every origin is aligned
+    cl_buffer_region bufferRegion = {slab.used, classSize};
+    cl_int status;
+    cl_mem subBuffer = clCreateSubBuffer(slab.buffer->openclObject,
+                                         0,
+                                         CL_BUFFER_CREATE_TYPE_REGION,
+                                         &bufferRegion,
+                                         &status);
+    if (subBuffer == nullptr) {
+        std::cerr << "clCreateSubBuffer() failed: "
+                  << utils::errorString(status) << std::endl;
+        return std::shared_ptr<utils::manager<cl_mem>>();
+    }
+    slab.used += classSize;
+
+    return handOut(state, classSize, {subBuffer, slabId});
+}
+
+auto d_ocl::buffer_arena::trim() -> void
+{
+    std::lock_guard<std::mutex> lock(state->mutex);
+
+    // only slabs with nothing handed out can go back to the driver
+    for (std::pair<const size_t, std::vector<buffer_arena_state::region>>&
+             freeList : state->freeLists) {
+        std::vector<buffer_arena_state::region> kept;
+        for (buffer_arena_state::region& region : freeList.second) {
+            if (state->slabs[region.slabId].inUse == 0) {
+                clReleaseMemObject(region.subBuffer);
+            } else {
+                kept.push_back(region);
+            }
+        }
+        freeList.second.swap(kept);
+    }
+
+    for (auto iter = state->slabs.begin(); iter != state->slabs.end();) {
+        if (iter->second.inUse == 0) {
+            state->stats.reservedBytes -= iter->second.size;
+            iter = state->slabs.erase(iter);
+        } else {
+            iter++;
+        }
+    }
+}
+
+auto d_ocl::buffer_arena::stats() const -> memory_pool_stats
+{
+    std::lock_guard<std::mutex> lock(state->mutex);
+    return state->stats;
+}
+
+// every field that makes two images interchangeable
+using image_key = std::tuple<cl_mem_flags,
+                             cl_channel_order,
+                             cl_channel_type,
+                             cl_mem_object_type,
+                             size_t,
+                             size_t,
+                             size_t,
+                             size_t,
+                             cl_uint>;
+
+struct d_ocl::image_pool_state
+{
+    ~image_pool_state()
+    {
+        for (std::pair<const image_key, std::vector<cl_mem>>& images :
+             freeImages) {
+            for (cl_mem image : images.second) {
+                clReleaseMemObject(image);
+            }
+        }
+    }
+
+    cl_context context;
+    std::mutex mutex;
+    std::map<image_key, std::vector<cl_mem>> freeImages;
+    // byte size of each pooled image, to keep reservedBytes
+    std::map<cl_mem, size_t> imageBytes;
+    memory_pool_stats stats;
+};
+
+d_ocl::image_pool::image_pool(cl_context context)
+    : state(std::make_shared<image_pool_state>())
+{
+    state->context = context;
+}
+
+auto d_ocl::image_pool::acquire(cl_mem_flags flags,
+                                const cl_image_format& format,
+                                const cl_image_desc& description)
+    -> std::shared_ptr<utils::manager<cl_mem>>
+{
+    // images with host pointers or backing buffers are not interchangeable
+    if (description.buffer != nullptr
+        || (flags & (CL_MEM_USE_HOST_PTR | CL_MEM_COPY_HOST_PTR)) != 0) {
+        std::cerr << "image_pool can't pool images initialized from host or "
+                     "buffer memory"
+                  << std::endl;
+        return std::shared_ptr<utils::manager<cl_mem>>();
+    }
+
+    const image_key key(flags,
+                        format.image_channel_order,
+                        format.image_channel_data_type,
+                        description.image_type,
+                        description.image_width,
+                        description.image_height,
+                        description.image_depth,
+                        description.image_array_size,
+                        description.num_mip_levels);
+    std::shared_ptr<image_pool_state> pool = state;
+    auto recycle = [pool, key](cl_mem image) -> cl_int {
+        std::lock_guard<std::mutex> lock(pool->mutex);
+        pool->freeImages[key].push_back(image);
+        return CL_SUCCESS;
+    };
+
+    std::lock_guard<std::mutex> lock(state->mutex);
+
+    std::vector<cl_mem>& freeImages = state->freeImages[key];
+    if (!freeImages.empty()) {
+        cl_mem image = freeImages.back();
+        freeImages.pop_back();
+        state->stats.reuses++;
+        return utils::manager<cl_mem>::makeShared(image, recycle);
+    }
+
+    cl_int status;
+    cl_mem image = clCreateImage(
+        state->context, flags, &format, &description, nullptr, &status);
+    if (image == nullptr) {
+        std::cerr << "clCreateImage() for image pool failed: "
+                  << utils::errorString(status) << std::endl;
+        return std::shared_ptr<utils::manager<cl_mem>>();
+    }
+
+    size_t bytes = 0;
+    clGetMemObjectInfo(image, CL_MEM_SIZE, sizeof(bytes), &bytes, nullptr);
+    state->imageBytes[image] = bytes;
+    state->stats.driverAllocations++;
+    state->stats.reservedBytes += bytes;
+    return utils::manager<cl_mem>::makeShared(image, recycle);
+}
+
+auto d_ocl::image_pool::context() const -> cl_context
+{
+    return state->context;
+}
+
+auto d_ocl::image_pool::trim() -> void
+{
+    std::lock_guard<std::mutex> lock(state->mutex);
+    for (std::pair<const image_key, std::vector<cl_mem>>& images :
+         state->freeImages) {
+        for (cl_mem image : images.second) {
+            state->stats.reservedBytes -= state->imageBytes[image];
+            state->imageBytes.erase(image);
+            clReleaseMemObject(image);
+        }
+        images.second.clear();
+    }
+}
+
+auto d_ocl::image_pool::stats() const -> memory_pool_stats
+{
+    std::lock_guard<std::mutex> lock(state->mutex);
+    return state->stats;
+}
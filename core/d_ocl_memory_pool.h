@@ -0,0 +1,77 @@
+#ifndef D_OCL_MEMORY_POOL_H
+#define D_OCL_MEMORY_POOL_H
+
+#include "d_ocl_defines.h"
+#include "d_ocl_utils.h"
+#include <CL/cl.h>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace d_ocl {
+struct D_OCL_API memory_pool_stats
+{
+    // clCreateBuffer() / clCreateImage() calls
+    size_t driverAllocations{0};
+    // requests served from a free list
+    size_t reuses{0};
+    // bytes held in slabs or pooled images
+    size_t reservedBytes{0};
+};
+
+// state shared by a pool and every cl_mem it handed out,
+// so handles may outlive the pool object.
+// unlike clReleaseMemObject(), giving a cl_mem back to a pool doesn't wait
+// for commands using it: it may be handed out and overwritten at once. keep
+// the shared_ptr until those commands completed, e.g. until after waiting
+// for their events
+struct buffer_arena_state;
+struct image_pool_state;
+
+// device memory arena.
+// allocates large slabs with clCreateBuffer() once and hands out aligned
+// clCreateSubBuffer() regions, rounded up to power-of-2 size classes.
+// released regions go back to their size class's free list rather than to the
+// driver, so steady-state allocate() does no driver allocation
+struct D_OCL_API buffer_arena
+{
+    // flags apply to every slab e.g. CL_MEM_READ_WRITE.
+    // requests bigger than slabSize get a slab of their own
+    buffer_arena(cl_context context,
+                 cl_mem_flags flags,
+                 size_t slabSize = 1 << 26);
+
+    // sub-buffer of at least size bytes, back in its free list when the
+    // last shared_ptr goes (see above).
+    // empty shared_ptr on failure
+    auto allocate(size_t size) -> std::shared_ptr<utils::manager<cl_mem>>;
+    // release slabs none of whose sub-buffers are in use
+    auto trim() -> void;
+    auto stats() const -> memory_pool_stats;
+
+    std::shared_ptr<buffer_arena_state> state;
+};
+
+// reuses image objects with identical format, description and flags,
+// e.g. the output image of every frame in a stream
+struct D_OCL_API image_pool
+{
+    explicit image_pool(cl_context context);
+
+    // image from the pool, else clCreateImage().
+    // returned to the pool when the last shared_ptr goes (see above)
+    auto acquire(cl_mem_flags flags,
+                 const cl_image_format& format,
+                 const cl_image_desc& description)
+        -> std::shared_ptr<utils::manager<cl_mem>>;
+    // release every pooled image not currently in use
+    auto trim() -> void;
+    auto stats() const -> memory_pool_stats;
+    auto context() const -> cl_context;
+
+    std::shared_ptr<image_pool_state> state;
+};
+} // namespace d_ocl
+
+#endif // D_OCL_MEMORY_POOL_H
@@ -0,0 +1,108 @@
+#include "d_ocl_pipeline.h"
+#include "d_ocl_handle.h"
+#include "d_ocl_profiler.h"
+#include <iostream>
+
+// enqueue stage if not empty, after the non-null events in waitList
+static auto runStage(const d_ocl::chunk_stage_func& stage,
+                     const std::string& name,
+                     size_t chunk,
+                     size_t slot,
+                     cl_command_queue queue,
+                     const std::vector<cl_event>& waitList,
+                     d_ocl::handle<cl_event>& event) -> bool
+{
+    if (!stage) {
+        event.reset();
+        return true;
+    }
+
+    std::vector<cl_event> events;
+    for (cl_event waitEvent : waitList) {
+        if (waitEvent != nullptr) {
+            events.push_back(waitEvent);
+        }
+    }
+    cl_event newEvent = nullptr;
+    if (!stage(chunk, slot, queue, events, &newEvent) || newEvent == nullptr) {
+        std::cerr << name << " of chunk " << chunk << " failed" << std::endl;
+        return false;
+    }
+    event.reset(newEvent);
+    d_ocl::recordEvent(name, newEvent);
+    return true;
+}
+
+auto d_ocl::runChunkPipeline(const context_set& contextSet,
+                             const std::string& name,
+                             size_t numChunks,
+                             size_t depth,
+                             const chunk_pipeline_stages& stages,
+                             const std::vector<cl_event>& waitList
+                             /*= std::vector<cl_event>()*/) -> bool
+{
+    if (depth == 0 || !contextSet.uploadQueue || !contextSet.cmdQueue
+        || !contextSet.downloadQueue) {
+        std::cerr << "invalid pipeline for " << name << std::endl;
+        return false;
+    }
+
+    // latest event of each stage per slot. before a chunk's stage replaces
+    // one, it still belongs to the chunk depth chunks earlier
+    std::vector<handle<cl_event>> uploaded(depth);
+    std::vector<handle<cl_event>> computed(depth);
+    std::vector<handle<cl_event>> downloaded(depth);
+
+    bool succeeded = true;
+    for (size_t chunk = 0; chunk < numChunks && succeeded; chunk++) {
+        const size_t slot = chunk % depth;
+
+        // input buffers are free once the previous chunk in the slot computed
+        succeeded = runStage(stages.upload,
+                             name + " upload",
+                             chunk,
+                             slot,
+                             contextSet.uploadQueue->openclObject,
+                             {computed[slot].get()},
+                             uploaded[slot]);
+        // output buffers are free once the previous chunk in the slot
+        // downloaded
+        std::vector<cl_event> computeWaitList = waitList;
+        computeWaitList.push_back(uploaded[slot].get());
+        computeWaitList.push_back(downloaded[slot].get());
+        succeeded = succeeded
+                    && runStage(stages.compute,
+                                name + " compute",
+                                chunk,
+                                slot,
+                                contextSet.cmdQueue->openclObject,
+                                computeWaitList,
+                                computed[slot]);
+        succeeded = succeeded
+                    && runStage(stages.download,
+                                name + " download",
+                                chunk,
+                                slot,
+                                contextSet.downloadQueue->openclObject,
+                                {computed[slot].get()},
+                                downloaded[slot]);
+
+        // start this chunk while the host enqueues the next
+        clFlush(contextSet.uploadQueue->openclObject);
+        clFlush(contextSet.cmdQueue->openclObject);
+        clFlush(contextSet.downloadQueue->openclObject);
+    }
+
+    // also after a failure, so nothing still uses the caller's buffers
+    for (std::vector<handle<cl_event>>* events :
+         {&uploaded, &computed, &downloaded}) {
+        for (handle<cl_event>& event : *events) {
+            if (event) {
+                succeeded = utils::checkRun("clWaitForEvents",
+                                            clWaitForEvents(1, event.address()))
+                            && succeeded;
+            }
+        }
+    }
+    return succeeded;
+}
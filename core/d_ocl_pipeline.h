@@ -0,0 +1,50 @@
+#ifndef D_OCL_PIPELINE_H
+#define D_OCL_PIPELINE_H
+
+#include "d_ocl.h"
+#include "d_ocl_defines.h"
+#include <CL/cl.h>
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace d_ocl {
+// enqueue 1 stage of chunk on queue after waitList, and set event to it.
+// slot is which of the pipeline's depth sets of device buffers chunk uses
+using chunk_stage_func
+    = std::function<bool(size_t chunk,
+                         size_t slot,
+                         cl_command_queue queue,
+                         const std::vector<cl_event>& waitList,
+                         cl_event* event)>;
+
+// stages of every chunk. any may be empty, e.g. no download when chunks
+// accumulate into one result read afterwards
+struct D_OCL_API chunk_pipeline_stages
+{
+    // on context_set::uploadQueue. writes the slot's input buffers
+    chunk_stage_func upload;
+    // on context_set::cmdQueue. reads the slot's input buffers, writes its
+    // output buffers
+    chunk_stage_func compute;
+    // on context_set::downloadQueue. reads the slot's output buffers
+    chunk_stage_func download;
+};
+
+// run numChunks chunks through upload -> compute -> download with depth
+// slots of device buffers (2 = double, 3 = triple buffering), so chunk N+1
+// uploads while chunk N computes and chunk N-1 downloads.
+// a slot is reused once the chunk depth chunks before is done with it.
+// every compute also waits for waitList, e.g. for a buffer being zeroed.
+// stage events are passed to recordEvent() as name + " upload" etc.
+// returns after every chunk is done
+auto D_OCL_API runChunkPipeline(const context_set& contextSet,
+                                const std::string& name,
+                                size_t numChunks,
+                                size_t depth,
+                                const chunk_pipeline_stages& stages,
+                                const std::vector<cl_event>& waitList
+                                = std::vector<cl_event>()) -> bool;
+} // namespace d_ocl
+
+#endif // D_OCL_PIPELINE_H
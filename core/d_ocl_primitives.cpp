@@ -0,0 +1,368 @@
+#include "d_ocl_primitives.h"
+#include <algorithm>
+#include <climits>
+#include <iostream>
+#include <string>
+#include <utility>
+
+#define D_OCL_PRIMITIVES_PROGRAM                                               \
+    D_OCL_RESOURCE_ROOT "/d_ocl_primitives." D_OCL_KERN_EXT
+// radix_count() clears 1 digit per work-item
+#define D_OCL_PRIMITIVES_MIN_LOCAL_SIZE 16
+#define D_OCL_RADIX_BITS 4
+
+d_ocl::primitive_kernels::primitive_kernels(cl_context context,
+                                            cl_device_id device,
+                                            program_defines defines,
+                                            size_t elementSize)
+    : context(context),
+      device(device),
+      elementSize(elementSize)
+{
+    const size_t size = utils::powerOf2WorkGroupSize(
+        device, nullptr, D_OCL_PRIMITIVES_MIN_LOCAL_SIZE);
+    if (size == 0) {
+        std::cerr << "primitives need work-groups of "
+                  << D_OCL_PRIMITIVES_MIN_LOCAL_SIZE << std::endl;
+        return;
+    }
+
+    defines["LOCAL_SIZE"] = std::to_string(size);
+    defines["RADIX_BITS"] = std::to_string(D_OCL_RADIX_BITS);
+    std::shared_ptr<utils::manager<cl_program>> program = createProgram(
+        context, D_OCL_PRIMITIVES_PROGRAM, std::string(), defines);
+    if (!program) {
+        return;
+    }
+    reduceKernel = launcher<cl_mem, int, cl_mem>(program, "reduce_groups");
+    scanKernel
+        = launcher<cl_mem, cl_mem, int, int, cl_mem>(program, "scan_blocks");
+    addOffsetsKernel
+        = launcher<cl_mem, int, cl_mem>(program, "scan_add_offsets");
+    compactKernel = launcher<cl_mem, cl_mem, cl_mem, int, cl_mem, cl_mem>(
+        program, "compact_scatter");
+    countKernel = launcher<cl_mem, int, int, cl_mem>(program, "radix_count");
+    scatterKernel = launcher<cl_mem, cl_mem, int, int, cl_mem, cl_mem, cl_mem>(
+        program, "radix_scatter");
+    if (!reduceKernel || !scanKernel || !addOffsetsKernel || !compactKernel
+        || !countKernel || !scatterKernel) {
+        return;
+    }
+
+    // e.g. register pressure can leave a kernel below the device's maximum
+    for (cl_kernel kernel : {reduceKernel.kernel(),
+                             scanKernel.kernel(),
+                             countKernel.kernel(),
+                             scatterKernel.kernel()}) {
+        if (utils::kernelWorkGroupSize(kernel, device) < size) {
+            std::cerr << "primitives kernels can't run " << size
+                      << " work-items per work-group" << std::endl;
+            return;
+        }
+    }
+    reduceGroups = utils::gridStrideGroups(device);
+    localSize = size;
+}
+
+d_ocl::primitive_kernels::operator bool() const
+{
+    return localSize > 0;
+}
+
+auto d_ocl::primitive_kernels::checkCount(size_t count) const -> bool
+{
+    if (!*this || count == 0 || count > INT_MAX) {
+        std::cerr << "primitives of " << count << " elements" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+auto d_ocl::primitive_kernels::scratch(size_t slot, size_t size) -> cl_mem
+{
+    if (slot >= buffers.size()) {
+        buffers.resize(slot + 1);
+        bufferSizes.resize(slot + 1, 0);
+    }
+    if (bufferSizes[slot] < size) {
+        buffers[slot] = utils::createBuffer(
+            context, CL_MEM_READ_WRITE | CL_MEM_HOST_NO_ACCESS, size);
+        if (!buffers[slot]) {
+            bufferSizes[slot] = 0;
+            return nullptr;
+        }
+        bufferSizes[slot] = size;
+    }
+    return buffers[slot]->openclObject;
+}
+
+auto d_ocl::primitive_kernels::offsetScan() -> primitive_kernels*
+{
+    if (!offsets) {
+        offsets = std::make_shared<primitives<cl_uint, plus_op>>(context,
+                                                                 device);
+    }
+    return *offsets ? offsets.get() : nullptr;
+}
+
+auto d_ocl::primitive_kernels::reduce(cl_command_queue queue,
+                                      cl_mem src,
+                                      size_t count,
+                                      cl_mem result,
+                                      const std::vector<cl_event>& waitList,
+                                      cl_event* event) -> bool
+{
+    if (!checkCount(count)) {
+        return false;
+    }
+    cl_mem partials = scratch(partialSlot, reduceGroups * elementSize);
+    if (partials == nullptr) {
+        return false;
+    }
+
+    // a partial per work-group, then 1 work-group over the partials
+    const size_t groups = std::min(reduceGroups,
+                                   (count + localSize - 1) / localSize);
+    nd_range groupsRange;
+    groupsRange.global = {groups * localSize};
+    groupsRange.local = {localSize};
+    nd_range lastRange;
+    lastRange.global = {localSize};
+    lastRange.local = {localSize};
+    handle<cl_event> reduced;
+    return reduceKernel.run(queue,
+                            groupsRange,
+                            waitList,
+                            reduced.outParam(),
+                            src,
+                            static_cast<int>(count),
+                            partials)
+           && reduceKernel.run(queue,
+                               lastRange,
+                               after(waitList, reduced),
+                               event,
+                               partials,
+                               static_cast<int>(groups),
+                               result);
+}
+
+auto d_ocl::primitive_kernels::scan(cl_command_queue queue,
+                                    cl_mem src,
+                                    cl_mem dst,
+                                    size_t count,
+                                    bool inclusive,
+                                    size_t level,
+                                    const std::vector<cl_event>& waitList,
+                                    handle<cl_event>& last) -> bool
+{
+    // 2 elements per work-item
+    const size_t blocks = (count + 2 * localSize - 1) / (2 * localSize);
+    cl_mem blockSums = scratch(levelSlot + level, blocks * elementSize);
+    if (blockSums == nullptr) {
+        return false;
+    }
+    nd_range blockRange;
+    blockRange.global = {blocks * localSize};
+    blockRange.local = {localSize};
+    if (!chain(waitList,
+               last,
+               [&](const std::vector<cl_event>& wait, cl_event* scanned) {
+                   return scanKernel.run(queue,
+                                         blockRange,
+                                         wait,
+                                         scanned,
+                                         src,
+                                         dst,
+                                         static_cast<int>(count),
+                                         inclusive ? 1 : 0,
+                                         blockSums);
+               })) {
+        return false;
+    }
+    if (blocks == 1) {
+        return true;
+    }
+
+    // each block offset by the exclusive scan of the totals before it,
+    // 512 times fewer elements per level at 256 work-items
+    if (!scan(
+            queue, blockSums, blockSums, blocks, false, level + 1, {}, last)) {
+        return false;
+    }
+    nd_range elementRange;
+    elementRange.global = {count};
+    return chain(waitList,
+                 last,
+                 [&](const std::vector<cl_event>& wait, cl_event* added) {
+                     return addOffsetsKernel.run(queue,
+                                                 elementRange,
+                                                 wait,
+                                                 added,
+                                                 dst,
+                                                 static_cast<int>(count),
+                                                 blockSums);
+                 });
+}
+
+auto d_ocl::primitive_kernels::exclusiveScan(
+    cl_command_queue queue,
+    cl_mem src,
+    cl_mem dst,
+    size_t count,
+    const std::vector<cl_event>& waitList,
+    cl_event* event) -> bool
+{
+    handle<cl_event> last;
+    if (!checkCount(count)
+        || !scan(queue, src, dst, count, false, 0, waitList, last)) {
+        return false;
+    }
+    if (event != nullptr) {
+        *event = last.detach();
+    }
+    return true;
+}
+
+auto d_ocl::primitive_kernels::inclusiveScan(
+    cl_command_queue queue,
+    cl_mem src,
+    cl_mem dst,
+    size_t count,
+    const std::vector<cl_event>& waitList,
+    cl_event* event) -> bool
+{
+    handle<cl_event> last;
+    if (!checkCount(count)
+        || !scan(queue, src, dst, count, true, 0, waitList, last)) {
+        return false;
+    }
+    if (event != nullptr) {
+        *event = last.detach();
+    }
+    return true;
+}
+
+auto d_ocl::primitive_kernels::compact(cl_command_queue queue,
+                                       cl_mem src,
+                                       cl_mem flags,
+                                       size_t count,
+                                       cl_mem dst,
+                                       cl_mem dstCount,
+                                       const std::vector<cl_event>& waitList,
+                                       cl_event* event) -> bool
+{
+    if (!checkCount(count)) {
+        return false;
+    }
+    primitive_kernels* offsetKernels = offsetScan();
+    cl_mem flagOffsets = scratch(offsetSlot, count * sizeof(cl_uint));
+    if (offsetKernels == nullptr || flagOffsets == nullptr) {
+        return false;
+    }
+
+    // where each kept element goes is how many are kept before it
+    nd_range elementRange;
+    elementRange.global = {count};
+    handle<cl_event> scanned;
+    return offsetKernels->exclusiveScan(queue,
+                                        flags,
+                                        flagOffsets,
+                                        count,
+                                        waitList,
+                                        scanned.outParam())
+           && compactKernel.run(queue,
+                                elementRange,
+                                after(waitList, scanned),
+                                event,
+                                src,
+                                flags,
+                                flagOffsets,
+                                static_cast<int>(count),
+                                dst,
+                                dstCount);
+}
+
+auto d_ocl::primitive_kernels::sort(cl_command_queue queue,
+                                    cl_mem keys,
+                                    cl_mem values,
+                                    size_t count,
+                                    const std::vector<cl_event>& waitList,
+                                    cl_event* event) -> bool
+{
+    if (!checkCount(count)) {
+        return false;
+    }
+    if (elementSize != sizeof(cl_uint)) {
+        std::cerr << "radix sort of " << elementSize << " byte keys"
+                  << std::endl;
+        return false;
+    }
+    const size_t blocks = (count + 2 * localSize - 1) / (2 * localSize);
+    const size_t digits = (size_t)1 << D_OCL_RADIX_BITS;
+    primitive_kernels* offsetKernels = offsetScan();
+    cl_mem keyScratch = scratch(keySlot, count * elementSize);
+    cl_mem valueScratch = values != nullptr
+                              ? scratch(valueSlot, count * sizeof(cl_uint))
+                              : nullptr;
+    cl_mem counts = scratch(countSlot, digits * blocks * sizeof(cl_uint));
+    if (offsetKernels == nullptr || keyScratch == nullptr
+        || (values != nullptr && valueScratch == nullptr)
+        || counts == nullptr) {
+        return false;
+    }
+
+    // per pass: count each block's digits, scan the counts into where
+    // each block's keys of each digit start, scatter. the passes ping-pong
+    // between keys and the scratch, an even number ending in keys
+    nd_range blockRange;
+    blockRange.global = {blocks * localSize};
+    blockRange.local = {localSize};
+    cl_mem src = keys;
+    cl_mem dst = keyScratch;
+    cl_mem srcValues = values;
+    cl_mem dstValues = valueScratch;
+    handle<cl_event> last;
+    for (int shift = 0; shift < 32; shift += D_OCL_RADIX_BITS) {
+        auto countDigits = [&](const std::vector<cl_event>& wait,
+                               cl_event* counted) {
+            return countKernel.run(queue,
+                                   blockRange,
+                                   wait,
+                                   counted,
+                                   src,
+                                   static_cast<int>(count),
+                                   shift,
+                                   counts);
+        };
+        auto scanCounts = [&](const std::vector<cl_event>& wait,
+                              cl_event* scanned) {
+            return offsetKernels->exclusiveScan(
+                queue, counts, counts, digits * blocks, wait, scanned);
+        };
+        auto scatter = [&](const std::vector<cl_event>& wait,
+                           cl_event* scattered) {
+            return scatterKernel.run(queue,
+                                     blockRange,
+                                     wait,
+                                     scattered,
+                                     src,
+                                     srcValues,
+                                     static_cast<int>(count),
+                                     shift,
+                                     counts,
+                                     dst,
+                                     dstValues);
+        };
+        if (!chain(waitList, last, countDigits)
+            || !chain(waitList, last, scanCounts)
+            || !chain(waitList, last, scatter)) {
+            return false;
+        }
+        std::swap(src, dst);
+        std::swap(srcValues, dstValues);
+    }
+    if (event != nullptr) {
+        *event = last.detach();
+    }
+    return true;
+}
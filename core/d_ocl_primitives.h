@@ -0,0 +1,255 @@
+#ifndef D_OCL_PRIMITIVES_H
+#define D_OCL_PRIMITIVES_H
+
+#include "d_ocl.h"
+#include "d_ocl_defines.h"
+#include "d_ocl_handle.h"
+#include "d_ocl_kernel.h"
+#include "d_ocl_utils.h"
+#include <CL/cl.h>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace d_ocl {
+// opencl c names of the element types primitives take: the type, its
+// lowest and highest values, and how radix sort orders its bits
+template<typename T>
+struct primitive_type;
+
+template<>
+struct primitive_type<cl_int>
+{
+    static auto name() -> std::string
+    {
+        return "int";
+    }
+    static auto lowest() -> std::string
+    {
+        return "INT_MIN";
+    }
+    static auto highest() -> std::string
+    {
+        return "INT_MAX";
+    }
+    static auto keys() -> std::string
+    {
+        return "INT_KEYS";
+    }
+};
+template<>
+struct primitive_type<cl_uint>
+{
+    static auto name() -> std::string
+    {
+        return "uint";
+    }
+    static auto lowest() -> std::string
+    {
+        return "0";
+    }
+    static auto highest() -> std::string
+    {
+        return "UINT_MAX";
+    }
+    static auto keys() -> std::string
+    {
+        return "UINT_KEYS";
+    }
+};
+template<>
+struct primitive_type<cl_float>
+{
+    static auto name() -> std::string
+    {
+        return "float";
+    }
+    static auto lowest() -> std::string
+    {
+        return "-INFINITY";
+    }
+    static auto highest() -> std::string
+    {
+        return "INFINITY";
+    }
+    static auto keys() -> std::string
+    {
+        return "FLOAT_KEYS";
+    }
+};
+
+// operators of reductions and scans: OP(a,b) as opencl c, without spaces
+// since it's passed as a build option, and its identity for T.
+// others can be written the same way, they must be associative (and
+// commutative to reduce)
+struct plus_op
+{
+    static auto expression() -> std::string
+    {
+        return "(a)+(b)";
+    }
+    template<typename T>
+    static auto identity() -> std::string
+    {
+        return "0";
+    }
+};
+struct min_op
+{
+    static auto expression() -> std::string
+    {
+        return "min(a,b)";
+    }
+    template<typename T>
+    static auto identity() -> std::string
+    {
+        return primitive_type<T>::highest();
+    }
+};
+struct max_op
+{
+    static auto expression() -> std::string
+    {
+        return "max(a,b)";
+    }
+    template<typename T>
+    static auto identity() -> std::string
+    {
+        return primitive_type<T>::lowest();
+    }
+};
+
+// the kernels of core/res/d_ocl_primitives.cl built for 1 element type and
+// operator, see primitives<T, Op>.
+// the block sums, flag offsets and radix sort scratch are grown to the
+// largest count so far and kept, so repeated runs allocate nothing; as they
+// are shared, see the single-queue rule in d_ocl_kernel.h
+struct D_OCL_API primitive_kernels
+{
+    // defines holds T, OP(a,b), IDENTITY and the keys define of
+    // d_ocl_primitives.cl, the work-group size is picked for device
+    primitive_kernels(cl_context context,
+                      cl_device_id device,
+                      program_defines defines,
+                      size_t elementSize);
+
+    // false if the program failed to build or the device can't run its
+    // work-group size
+    explicit operator bool() const;
+
+    // OP of the count elements of src to result[0]
+    auto reduce(cl_command_queue queue,
+                cl_mem src,
+                size_t count,
+                cl_mem result,
+                const std::vector<cl_event>& waitList,
+                cl_event* event) -> bool;
+    // dst[i] = OP of src[0] ~ src[i - 1], dst[0] = IDENTITY.
+    // dst may be src
+    auto exclusiveScan(cl_command_queue queue,
+                       cl_mem src,
+                       cl_mem dst,
+                       size_t count,
+                       const std::vector<cl_event>& waitList,
+                       cl_event* event) -> bool;
+    // dst[i] = OP of src[0] ~ src[i]. dst may be src
+    auto inclusiveScan(cl_command_queue queue,
+                       cl_mem src,
+                       cl_mem dst,
+                       size_t count,
+                       const std::vector<cl_event>& waitList,
+                       cl_event* event) -> bool;
+    // the elements of src whose cl_uint flag is 1 (others 0) to the front
+    // of dst in order, and how many to dstCount[0], a cl_uint
+    auto compact(cl_command_queue queue,
+                 cl_mem src,
+                 cl_mem flags,
+                 size_t count,
+                 cl_mem dst,
+                 cl_mem dstCount,
+                 const std::vector<cl_event>& waitList,
+                 cl_event* event) -> bool;
+    // sort count keys ascending in place, stable, 4 bits per pass.
+    // values, unless null, are count cl_uints moved along with their keys,
+    // e.g. indices to gather other data by
+    auto sort(cl_command_queue queue,
+              cl_mem keys,
+              cl_mem values,
+              size_t count,
+              const std::vector<cl_event>& waitList,
+              cl_event* event) -> bool;
+
+    // reduce_groups(src, count, partials)
+    launcher<cl_mem, int, cl_mem> reduceKernel;
+    // scan_blocks(src, dst, count, inclusive, blockSums)
+    launcher<cl_mem, cl_mem, int, int, cl_mem> scanKernel;
+    // scan_add_offsets(dst, count, offsets)
+    launcher<cl_mem, int, cl_mem> addOffsetsKernel;
+    // compact_scatter(src, flags, offsets, count, dst, dstCount)
+    launcher<cl_mem, cl_mem, cl_mem, int, cl_mem, cl_mem> compactKernel;
+    // radix_count(keys, count, shift, counts)
+    launcher<cl_mem, int, int, cl_mem> countKernel;
+    // radix_scatter(keys, values, count, shift, offsets, keysOut, valuesOut)
+    launcher<cl_mem, cl_mem, int, int, cl_mem, cl_mem, cl_mem> scatterKernel;
+
+private:
+    // the intermediate buffers, levels of a scan from levelSlot up
+    enum scratch_slot
+    {
+        partialSlot,
+        offsetSlot,
+        keySlot,
+        valueSlot,
+        countSlot,
+        levelSlot
+    };
+
+    auto checkCount(size_t count) const -> bool;
+    // the buffer of slot, grown to at least size bytes. null if that failed
+    auto scratch(size_t slot, size_t size) -> cl_mem;
+    // scan of 1 level: the blocks, then the blocks' totals 1 level up
+    // added back. enqueued after last, or waitList if last is empty
+    auto scan(cl_command_queue queue,
+              cl_mem src,
+              cl_mem dst,
+              size_t count,
+              bool inclusive,
+              size_t level,
+              const std::vector<cl_event>& waitList,
+              handle<cl_event>& last) -> bool;
+    // cl_uint additions, for the offsets compact() and sort() write to.
+    // built on first use
+    auto offsetScan() -> primitive_kernels*;
+
+    cl_context context{nullptr};
+    cl_device_id device{nullptr};
+    size_t elementSize{0};
+    size_t localSize{0};
+    // work-groups of the first reduce pass
+    size_t reduceGroups{0};
+    std::vector<std::shared_ptr<utils::manager<cl_mem>>> buffers;
+    std::vector<size_t> bufferSizes;
+    std::shared_ptr<primitive_kernels> offsets;
+};
+
+// reduce, scan, compaction and radix sort of device buffers of T (cl_int,
+// cl_uint or cl_float) under Op, e.g. primitives<cl_float, max_op> finds
+// the largest of a buffer of floats.
+// the program is built for T and Op when created, so keep 1 per element
+// type, operator and context
+template<typename T, typename Op = plus_op>
+struct primitives : primitive_kernels
+{
+    primitives(cl_context context, cl_device_id device)
+        : primitive_kernels(context,
+                            device,
+                            {{"T", primitive_type<T>::name()},
+                             {"OP(a,b)", Op::expression()},
+                             {"IDENTITY", Op::template identity<T>()},
+                             {primitive_type<T>::keys(), ""}},
+                            sizeof(T))
+    {}
+};
+} // namespace d_ocl
+
+#endif // D_OCL_PRIMITIVES_H
@@ -0,0 +1,133 @@
+#include "d_ocl_profiler.h"
+#include <algorithm>
+#include <mutex>
+#include <vector>
+
+// durations kept per name for percentiles. older ones are overwritten so a
+// long-running process profiles in constant memory
+#define D_OCL_PROFILE_SAMPLES 4096
+
+namespace {
+struct command_samples
+{
+    d_ocl::command_stats stats;
+    std::vector<double> durations;
+    // next slot to overwrite once durations is full
+    size_t next{0};
+};
+
+// heap-allocated per recordEvent() and freed by its callback
+struct pending_event
+{
+    std::string name;
+    uint64_t bytes;
+};
+} // namespace
+
+static std::mutex g_mutex;
+static std::map<std::string, command_samples> g_samples;
+
+auto d_ocl::eventTimes(cl_event event, event_times& times) -> bool
+{
+    const std::pair<cl_profiling_info, cl_ulong*> queries[] = {
+        {CL_PROFILING_COMMAND_QUEUED, &times.queued},
+        {CL_PROFILING_COMMAND_SUBMIT, &times.submit},
+        {CL_PROFILING_COMMAND_START, &times.start},
+        {CL_PROFILING_COMMAND_END, &times.end}};
+    for (const std::pair<cl_profiling_info, cl_ulong*>& query : queries) {
+        // CL_PROFILING_INFO_NOT_AVAILABLE without profiling or until complete
+        if (clGetEventProfilingInfo(
+                event, query.first, sizeof(cl_ulong), query.second, nullptr)
+            != CL_SUCCESS) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static auto addSample(const std::string& name, double seconds, uint64_t bytes)
+    -> void
+{
+    std::lock_guard<std::mutex> lock(g_mutex);
+    command_samples& samples = g_samples[name];
+    samples.stats.min = samples.stats.count == 0
+                            ? seconds
+                            : std::min(samples.stats.min, seconds);
+    samples.stats.count++;
+    samples.stats.bytes += bytes;
+
+    if (samples.durations.size() < D_OCL_PROFILE_SAMPLES) {
+        samples.durations.push_back(seconds);
+    } else {
+        samples.durations[samples.next] = seconds;
+        samples.next = (samples.next + 1) % D_OCL_PROFILE_SAMPLES;
+    }
+}
+
+// runs on a driver thread once the command completed or failed
+static void CL_CALLBACK onComplete(cl_event event,
+                                   cl_int status,
+                                   void* userData)
+{
+    pending_event* pending = static_cast<pending_event*>(userData);
+    d_ocl::event_times times;
+    // negative status = command was aborted
+    if (status == CL_COMPLETE && d_ocl::eventTimes(event, times)) {
+        addSample(
+            pending->name, (times.end - times.start) * 1e-9, pending->bytes);
+    }
+    delete pending;
+    clReleaseEvent(event);
+}
+
+auto d_ocl::recordEvent(const std::string& name,
+                        cl_event event,
+                        uint64_t bytes /*= 0*/) -> void
+{
+    if (event == nullptr) {
+        return;
+    }
+
+    // the caller may release event before it completes
+    clRetainEvent(event);
+    pending_event* pending = new pending_event{name, bytes};
+    if (clSetEventCallback(event, CL_COMPLETE, &onComplete, pending)
+        != CL_SUCCESS) {
+        delete pending;
+        clReleaseEvent(event);
+    }
+}
+
+// nearest-rank percentile of sorted
+static auto percentile(const std::vector<double>& sorted, double fraction)
+    -> double
+{
+    if (sorted.empty()) {
+        return 0;
+    }
+    const size_t rank = static_cast<size_t>(fraction * (sorted.size() - 1));
+    return sorted[rank];
+}
+
+auto d_ocl::profileStats() -> std::map<std::string, command_stats>
+{
+    std::lock_guard<std::mutex> lock(g_mutex);
+    std::map<std::string, command_stats> allStats;
+    for (const std::pair<const std::string, command_samples>& samples :
+         g_samples) {
+        std::vector<double> sorted = samples.second.durations;
+        std::sort(sorted.begin(), sorted.end());
+
+        command_stats stats = samples.second.stats;
+        stats.p50 = percentile(sorted, 0.5);
+        stats.p99 = percentile(sorted, 0.99);
+        allStats[samples.first] = stats;
+    }
+    return allStats;
+}
+
+auto d_ocl::resetProfileStats() -> void
+{
+    std::lock_guard<std::mutex> lock(g_mutex);
+    g_samples.clear();
+}
@@ -0,0 +1,53 @@
+#ifndef D_OCL_PROFILER_H
+#define D_OCL_PROFILER_H
+
+#include "d_ocl_defines.h"
+#include <CL/cl.h>
+#include <cstdint>
+#include <map>
+#include <string>
+
+namespace d_ocl {
+// CL_PROFILING_COMMAND_* of a command, in device nanoseconds
+struct D_OCL_API event_times
+{
+    // enqueued by the host
+    cl_ulong queued{0};
+    // submitted to the device
+    cl_ulong submit{0};
+    // started executing
+    cl_ulong start{0};
+    // finished executing
+    cl_ulong end{0};
+};
+// timestamps of a completed command.
+// false if the queue was not created with CL_QUEUE_PROFILING_ENABLE or the
+// command has not completed
+auto D_OCL_API eventTimes(cl_event event, event_times& times) -> bool;
+
+// start -> end durations of every command recorded under 1 name
+struct D_OCL_API command_stats
+{
+    size_t count{0};
+    // seconds. percentiles are over the most recent samples
+    double min{0};
+    double p50{0};
+    double p99{0};
+    // total, for transfers
+    uint64_t bytes{0};
+};
+
+// add event's duration to the stats of name, e.g. a kernel name or
+// "read output". bytes is the size of a transfer, 0 for kernels.
+// recorded when the command completes, without blocking the caller.
+// commands on queues without profiling are ignored
+auto D_OCL_API recordEvent(const std::string& name,
+                           cl_event event,
+                           uint64_t bytes = 0) -> void;
+// stats of every name recorded so far.
+// finish the queues first to include commands still running
+auto D_OCL_API profileStats() -> std::map<std::string, command_stats>;
+auto D_OCL_API resetProfileStats() -> void;
+} // namespace d_ocl
+
+#endif // D_OCL_PROFILER_H
@@ -0,0 +1,342 @@
+#include "d_ocl_program_cache.h"
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <mutex>
+
+// first bytes of every cache file; bump on format change
+static const char g_cacheMagic[] = "DOCLBIN1";
+
+static std::atomic<size_t> g_hits{0};
+static std::atomic<size_t> g_misses{0};
+static std::atomic<size_t> g_stores{0};
+static std::atomic<size_t> g_invalidations{0};
+
+static std::mutex g_directoryMutex;
+static bool g_directoryInitialized = false;
+static std::string g_directory;
+
+auto d_ocl::programCacheStats() -> program_cache_stats
+{
+    program_cache_stats stats;
+    stats.hits = g_hits;
+    stats.misses = g_misses;
+    stats.stores = g_stores;
+    stats.invalidations = g_invalidations;
+    return stats;
+}
+
+auto d_ocl::resetProgramCacheStats() -> void
+{
+    g_hits = 0;
+    g_misses = 0;
+    g_stores = 0;
+    g_invalidations = 0;
+}
+
+auto d_ocl::programCacheDirectory() -> std::string
+{
+    std::lock_guard<std::mutex> lock(g_directoryMutex);
+    if (!g_directoryInitialized) {
+        const std::string root = utils::cacheDirectory();
+        g_directory = root.empty() ? root : root + "/programs";
+        g_directoryInitialized = true;
+    }
+    return g_directory;
+}
+
+auto d_ocl::setProgramCacheDirectory(const std::string& path) -> void
+{
+    std::lock_guard<std::mutex> lock(g_directoryMutex);
+    g_directory = path;
+    g_directoryInitialized = true;
+}
+
+static auto deviceString(cl_device_id device, cl_device_info paramName)
+    -> std::string
+{
+    std::vector<char> value;
+    if (!d_ocl::utils::information<char>(device, paramName, value, '\0')) {
+        return std::string();
+    }
+    return value.data();
+}
+
+// full text the cache file must match. also guards against hash collisions
+static auto cacheKey(const std::vector<cl_device_id>& devices,
+                     const std::vector<const char*>& sources,
+                     const std::vector<size_t>& lengths,
+                     const std::string& options,
+                     const std::string& includedSources) -> std::string
+{
+    uint64_t sourceHash = d_ocl::utils::hash64(nullptr, 0);
+    for (size_t i = 0; i < sources.size(); i++) {
+        sourceHash = d_ocl::utils::hash64(sources[i], lengths[i], sourceHash);
+    }
+    sourceHash = d_ocl::utils::hash64(
+        includedSources.data(), includedSources.size(), sourceHash);
+
+    std::string key = "source: " + d_ocl::utils::hashString(sourceHash)
+                      + "\noptions: " + options + "\n";
+    // driver upgrades change the key so old binaries are never loaded
+    for (cl_device_id device : devices) {
+        key += "device: " + deviceString(device, CL_DEVICE_NAME) + " | "
+               + deviceString(device, CL_DRIVER_VERSION) + " | "
+               + deviceString(device, CL_DEVICE_VERSION) + "\n";
+    }
+    return key;
+}
+
+template<typename T>
+static auto appendValue(std::string& buffer, T value) -> void
+{
+    buffer.append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+template<typename T>
+static auto readValue(const std::string& buffer, size_t& pos, T& value) -> bool
+{
+    if (buffer.size() < pos + sizeof(value)) {
+        return false;
+    }
+    std::memcpy(&value, buffer.data() + pos, sizeof(value));
+    pos += sizeof(value);
+    return true;
+}
+
+// file layout:
+// magic | key size | key | binary count | (binary size | binary) ...
+static auto parseEntry(const std::string& contents,
+                       const std::string& key,
+                       std::vector<std::string>& binaries) -> bool
+{
+    const size_t magicSize = sizeof(g_cacheMagic) - 1;
+    if (contents.compare(0, magicSize, g_cacheMagic) != 0) {
+        return false;
+    }
+
+    size_t pos = magicSize;
+    uint64_t keySize;
+    if (!readValue(contents, pos, keySize) || keySize != key.size()
+        || contents.compare(pos, keySize, key) != 0) {
+        return false;
+    }
+    pos += keySize;
+
+    uint32_t count;
+    if (!readValue(contents, pos, count)) {
+        return false;
+    }
+    binaries.resize(count);
+    for (std::string& binary : binaries) {
+        uint64_t size;
+        if (!readValue(contents, pos, size) || contents.size() < pos + size) {
+            return false;
+        }
+        binary.assign(contents, pos, size);
+        pos += size;
+    }
+
+    // trailing garbage means a corrupt file
+    return pos == contents.size();
+}
+
+static auto printBuildLog(cl_program program,
+                          const std::vector<cl_device_id>& devices) -> void
+{
+    for (cl_device_id device : devices) {
+        size_t logSize = 0;
+        if (clGetProgramBuildInfo(
+                program, device, CL_PROGRAM_BUILD_LOG, 0, nullptr, &logSize)
+                != CL_SUCCESS
+            || logSize <= 1) {
+            continue;
+        }
+
+        std::vector<char> log(logSize + 1, '\0');
+        if (clGetProgramBuildInfo(program,
+                                  device,
+                                  CL_PROGRAM_BUILD_LOG,
+                                  logSize,
+                                  log.data(),
+                                  nullptr)
+            == CL_SUCCESS) {
+            std::cerr << "build log for " << d_ocl::utils::deviceName(device)
+                      << ":" << std::endl
+                      << log.data() << std::endl;
+        }
+    }
+}
+
+static auto loadCached(cl_context context,
+                       const std::vector<cl_device_id>& devices,
+                       const std::string& filePath,
+                       const std::string& key,
+                       const std::string& options)
+    -> std::shared_ptr<d_ocl::utils::manager<cl_program>>
+{
+    std::string contents;
+    if (!d_ocl::utils::readFile(filePath, contents)) {
+        // simply not cached yet
+        return std::shared_ptr<d_ocl::utils::manager<cl_program>>();
+    }
+
+    std::vector<std::string> binaries;
+    std::shared_ptr<d_ocl::utils::manager<cl_program>> program;
+    if (parseEntry(contents, key, binaries)
+        && binaries.size() == devices.size()) {
+        std::vector<size_t> sizes;
+        std::vector<const unsigned char*> data;
+        for (const std::string& binary : binaries) {
+            sizes.push_back(binary.size());
+            data.push_back(
+                reinterpret_cast<const unsigned char*>(binary.data()));
+        }
+
+        program = d_ocl::utils::manager<cl_program>::makeShared(
+            clCreateProgramWithBinary(context,
+                                      devices.size(),
+                                      devices.data(),
+                                      sizes.data(),
+                                      data.data(),
+                                      nullptr,
+                                      nullptr),
+            &clReleaseProgram);
+        // binaries still need to be "built", though this is only a link
+        if (program
+            && clBuildProgram(program->openclObject,
+                              0,
+                              nullptr,
+                              options.c_str(),
+                              nullptr,
+                              nullptr)
+                   != CL_SUCCESS) {
+            program.reset();
+        }
+    }
+
+    if (!program) {
+        // corrupt, truncated, or rejected by the driver.
+        // remove so the rebuilt program replaces it
+        std::cerr << "invalidating cached program " << filePath << std::endl;
+        std::remove(filePath.c_str());
+        g_invalidations++;
+    }
+    return program;
+}
+
+static auto storeCached(cl_program program,
+                        size_t numDevices,
+                        const std::string& directory,
+                        const std::string& filePath,
+                        const std::string& key) -> void
+{
+    // sizes and binaries are in the order of CL_PROGRAM_DEVICES,
+    // which is the device order of the context we created the program with
+    std::vector<size_t> sizes(numDevices, 0);
+    if (!d_ocl::utils::checkRun("clGetProgramInfo",
+                                clGetProgramInfo(program,
+                                                 CL_PROGRAM_BINARY_SIZES,
+                                                 sizes.size() * sizeof(size_t),
+                                                 sizes.data(),
+                                                 nullptr))) {
+        return;
+    }
+
+    std::vector<std::string> binaries(numDevices);
+    std::vector<unsigned char*> data(numDevices, nullptr);
+    for (size_t i = 0; i < numDevices; i++) {
+        if (sizes[i] == 0) {
+            // e.g. a device that doesn't support binaries; skip caching
+            return;
+        }
+        binaries[i].resize(sizes[i]);
+        data[i] = reinterpret_cast<unsigned char*>(&binaries[i][0]);
+    }
+    if (!d_ocl::utils::checkRun(
+            "clGetProgramInfo",
+            clGetProgramInfo(program,
+                             CL_PROGRAM_BINARIES,
+                             data.size() * sizeof(unsigned char*),
+                             data.data(),
+                             nullptr))) {
+        return;
+    }
+
+    std::string contents(g_cacheMagic, sizeof(g_cacheMagic) - 1);
+    appendValue<uint64_t>(contents, key.size());
+    contents += key;
+    appendValue<uint32_t>(contents, binaries.size());
+    for (const std::string& binary : binaries) {
+        appendValue<uint64_t>(contents, binary.size());
+        contents += binary;
+    }
+
+    if (d_ocl::utils::makeDirectories(directory)
+        && d_ocl::utils::writeFileAtomic(filePath, contents)) {
+        g_stores++;
+    }
+}
+
+auto d_ocl::buildProgram(cl_context context,
+                         const std::vector<const char*>& sources,
+                         const std::vector<size_t>& lengths,
+                         const std::string& options,
+                         const std::string& includedSources
+                         /*= std::string()*/)
+    -> std::shared_ptr<utils::manager<cl_program>>
+{
+    std::vector<cl_device_id> devices = utils::contextDevices(context);
+    const std::string directory = programCacheDirectory();
+
+    std::string key;
+    std::string filePath;
+    if (!directory.empty() && !devices.empty()) {
+        key = cacheKey(devices, sources, lengths, options, includedSources);
+        filePath = directory + "/"
+                   + utils::hashString(
+                       utils::hash64(key.data(), key.size()))
+                   + ".bin";
+
+        std::shared_ptr<utils::manager<cl_program>> program
+            = loadCached(context, devices, filePath, key, options);
+        if (program) {
+            g_hits++;
+            return program;
+        }
+    }
+    g_misses++;
+
+    std::shared_ptr<utils::manager<cl_program>> program
+        = utils::manager<cl_program>::makeShared(
+            clCreateProgramWithSource(context,
+                                      sources.size(),
+                                      const_cast<const char**>(sources.data()),
+                                      lengths.data(),
+                                      nullptr),
+            &clReleaseProgram);
+    if (!program) {
+        return program;
+    }
+
+    // compile and link the program
+    if (!utils::checkRun("clBuildProgram",
+                         clBuildProgram(program->openclObject,
+                                        0,
+                                        nullptr,
+                                        options.c_str(),
+                                        nullptr,
+                                        nullptr))) {
+        printBuildLog(program->openclObject, devices);
+        // clReleaseProgram if build failed
+        program.reset();
+        return program;
+    }
+
+    if (!filePath.empty()) {
+        storeCached(
+            program->openclObject, devices.size(), directory, filePath, key);
+    }
+    return program;
+}
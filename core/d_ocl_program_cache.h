@@ -0,0 +1,48 @@
+#ifndef D_OCL_PROGRAM_CACHE_H
+#define D_OCL_PROGRAM_CACHE_H
+
+#include "d_ocl_defines.h"
+#include "d_ocl_utils.h"
+#include <CL/cl.h>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace d_ocl {
+// process-wide counters since start or last resetProgramCacheStats()
+struct D_OCL_API program_cache_stats
+{
+    // program loaded from cached CL_PROGRAM_BINARIES
+    size_t hits{0};
+    // no usable cache entry; built from source
+    size_t misses{0};
+    // cache entries written after building from source
+    size_t stores{0};
+    // cache entries removed because they were corrupt or failed to build
+    size_t invalidations{0};
+};
+
+auto D_OCL_API programCacheStats() -> program_cache_stats;
+auto D_OCL_API resetProgramCacheStats() -> void;
+
+// directory for the cached binaries.
+// defaults to utils::cacheDirectory() + "/programs".
+// set to empty to disable the cache
+auto D_OCL_API programCacheDirectory() -> std::string;
+auto D_OCL_API setProgramCacheDirectory(const std::string& path) -> void;
+
+// build program from source strings for every device in context.
+// cache key is a hash of the sources, includedSources, the build options
+// and every device's name, driver version and opencl version.
+// includedSources is the text of the files the sources #include, which the
+// compiler reads itself: without it editing them alone loads stale binaries.
+// on hit the program is created from the cached binaries instead
+auto D_OCL_API buildProgram(cl_context context,
+                            const std::vector<const char*>& sources,
+                            const std::vector<size_t>& lengths,
+                            const std::string& options,
+                            const std::string& includedSources = std::string())
+    -> std::shared_ptr<utils::manager<cl_program>>;
+} // namespace d_ocl
+
+#endif // D_OCL_PROGRAM_CACHE_H
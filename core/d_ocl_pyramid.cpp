@@ -0,0 +1,445 @@
+#include "d_ocl_pyramid.h"
+#include "d_ocl.h"
+#include "d_ocl_handle.h"
+#include <cstring>
+#include <iostream>
+#include <string>
+
+#define D_OCL_PYRAMID_PROGRAM                                                  \
+    D_OCL_RESOURCE_ROOT "/d_ocl_pyramid." D_OCL_KERN_EXT
+
+d_ocl::resizer::resizer(cl_context context)
+{
+    std::shared_ptr<utils::manager<cl_program>> program
+        = createProgram(context, D_OCL_PYRAMID_PROGRAM);
+    if (!program) {
+        return;
+    }
+    areaKernel = launcher<cl_mem, cl_mem, int, int, float, float>(
+        program, "resize_area");
+    linearKernel = launcher<cl_mem, cl_mem, int, int, float, float>(
+        program, "resize_linear");
+    cubicKernel = launcher<cl_mem, cl_mem, int, int, float, float>(
+        program, "resize_cubic");
+}
+
+d_ocl::resizer::operator bool() const
+{
+    return static_cast<bool>(areaKernel) && static_cast<bool>(linearKernel)
+           && static_cast<bool>(cubicKernel);
+}
+
+auto d_ocl::resizer::run(cl_command_queue queue,
+                         cl_mem inputImage,
+                         int inputCols,
+                         int inputRows,
+                         cl_mem outputImage,
+                         int cols,
+                         int rows,
+                         resize_interpolation interpolation,
+                         const std::vector<cl_event>& waitList,
+                         cl_event* event) -> bool
+{
+    if (!*this || inputCols <= 0 || inputRows <= 0 || cols <= 0
+        || rows <= 0) {
+        std::cerr << "resize of " << inputCols << " x " << inputRows
+                  << " pixels to " << cols << " x " << rows << std::endl;
+        return false;
+    }
+    const float scaleX = static_cast<float>(inputCols) / cols;
+    const float scaleY = static_cast<float>(inputRows) / rows;
+    launcher<cl_mem, cl_mem, int, int, float, float>* kernel = &linearKernel;
+    if (interpolation == resize_interpolation::bicubic) {
+        kernel = &cubicKernel;
+    } else if (interpolation == resize_interpolation::area && scaleX >= 1.0f
+               && scaleY >= 1.0f) {
+        kernel = &areaKernel;
+    }
+
+    nd_range range;
+    range.global = {(size_t)cols, (size_t)rows};
+    return kernel->run(queue,
+                       range,
+                       waitList,
+                       event,
+                       inputImage,
+                       outputImage,
+                       cols,
+                       rows,
+                       scaleX,
+                       scaleY);
+}
+
+auto d_ocl::readPyramidLevel(cl_command_queue queue,
+                             const image_pyramid& pyramid,
+                             size_t level,
+                             int type,
+                             const std::vector<cl_event>& waitList,
+                             cv::Mat& hostMat) -> bool
+{
+    if (level >= pyramid.sizes.size()) {
+        std::cerr << "pyramid level " << level << " of "
+                  << pyramid.sizes.size() << std::endl;
+        return false;
+    }
+    // the mip level of a 2d image is origin[2], see cl_khr_mipmap_image
+    cl_mem image = pyramid.mipmap ? pyramid.mipmap->openclObject
+                                  : pyramid.levels[level]->openclObject;
+    const cv::Size& size = pyramid.sizes[level];
+    hostMat.create(size, type);
+    std::vector<size_t> origin = {0, 0, pyramid.mipmap ? level : 0};
+    std::vector<size_t> region = {(size_t)size.width, (size_t)size.height, 1};
+    return utils::checkRun(
+        "clEnqueueReadImage",
+        clEnqueueReadImage(queue,
+                           image,
+                           CL_TRUE,
+                           origin.data(),
+                           region.data(),
+                           hostMat.step[0],
+                           0,
+                           hostMat.data,
+                           static_cast<cl_uint>(waitList.size()),
+                           waitList.empty() ? nullptr : waitList.data(),
+                           nullptr));
+}
+
+d_ocl::pyramid::pyramid(cl_context context,
+                        cl_device_id device,
+                        bool mipmaps /*= true*/)
+    : context(context),
+      mipmaps(mipmaps && utils::hasExtension(device, "cl_khr_mipmap_image")
+              && utils::hasExtension(device, "cl_khr_mipmap_image_writes"))
+{
+    program_defines defines;
+    if (this->mipmaps) {
+        defines["MIPMAP"] = std::string();
+    }
+    std::shared_ptr<utils::manager<cl_program>> program = createProgram(
+        context, D_OCL_PYRAMID_PROGRAM, std::string(), defines);
+    if (!program) {
+        return;
+    }
+    downKernel
+        = launcher<cl_mem, cl_mem, int, int, int, int>(program, "pyr_down");
+    laplacianKernel = launcher<cl_mem, cl_mem, cl_mem, int, int, int, int>(
+        program, "laplacian");
+    if (this->mipmaps) {
+        downMipKernel
+            = launcher<cl_mem, cl_mem, cl_mem, int, int, int, int, int>(
+                program, "pyr_down_mip");
+        laplacianMipKernel
+            = launcher<cl_mem, cl_mem, cl_mem, int, int, int, int, int>(
+                program, "laplacian_mip");
+    }
+}
+
+d_ocl::pyramid::operator bool() const
+{
+    return static_cast<bool>(downKernel) && static_cast<bool>(laplacianKernel)
+           && (!mipmaps
+               || (static_cast<bool>(downMipKernel)
+                   && static_cast<bool>(laplacianMipKernel)));
+}
+
+auto d_ocl::pyramid::mipmapped() const -> bool
+{
+    return mipmaps;
+}
+
+auto d_ocl::pyramid::createImage(int cols, int rows, cl_uint mipLevels)
+    -> std::shared_ptr<utils::manager<cl_mem>>
+{
+    cl_image_desc imageDesc;
+    memset(&imageDesc, 0, sizeof(imageDesc));
+    imageDesc.image_type = CL_MEM_OBJECT_IMAGE2D;
+    imageDesc.image_width = cols;
+    imageDesc.image_height = rows;
+    imageDesc.num_mip_levels = mipLevels;
+    cl_int status;
+    std::shared_ptr<utils::manager<cl_mem>> image
+        = utils::manager<cl_mem>::makeShared(
+            clCreateImage(context,
+                          CL_MEM_READ_WRITE | CL_MEM_HOST_READ_ONLY,
+                          &format,
+                          &imageDesc,
+                          nullptr,
+                          &status),
+            clReleaseMemObject);
+    if (!utils::checkRun("clCreateImage", status)) {
+        return std::shared_ptr<utils::manager<cl_mem>>();
+    }
+    return image;
+}
+
+auto d_ocl::pyramid::prepare(cl_mem inputImage,
+                             int levels,
+                             bool withScratch,
+                             image_pyramid& result) -> bool
+{
+    size_t cols = 0;
+    size_t rows = 0;
+    if (!utils::checkRun("clGetImageInfo",
+                         clGetImageInfo(inputImage,
+                                        CL_IMAGE_FORMAT,
+                                        sizeof(format),
+                                        &format,
+                                        nullptr))
+        || !utils::checkRun(
+            "clGetImageInfo",
+            clGetImageInfo(
+                inputImage, CL_IMAGE_WIDTH, sizeof(cols), &cols, nullptr))
+        || !utils::checkRun(
+            "clGetImageInfo",
+            clGetImageInfo(
+                inputImage, CL_IMAGE_HEIGHT, sizeof(rows), &rows, nullptr))) {
+        return false;
+    }
+
+    result = image_pyramid();
+    result.sizes.push_back(cv::Size((int)cols, (int)rows));
+    while ((int)result.sizes.size() < levels && result.sizes.back().width > 1
+           && result.sizes.back().height > 1) {
+        result.sizes.push_back(cv::Size(result.sizes.back().width / 2,
+                                        result.sizes.back().height / 2));
+    }
+
+    const size_t count = result.sizes.size();
+    if (mipmaps) {
+        result.mipmap = createImage(
+            (int)cols, (int)rows, static_cast<cl_uint>(count));
+        if (!result.mipmap) {
+            return false;
+        }
+    } else {
+        // level 0 is left to the caller
+        result.levels.resize(count);
+        for (size_t i = 1; i < count; i++) {
+            result.levels[i] = createImage(
+                result.sizes[i].width, result.sizes[i].height, 0);
+            if (!result.levels[i]) {
+                return false;
+            }
+        }
+    }
+
+    if (!withScratch || count < 2
+        || (scratch[0] && scratchSize == result.sizes[1]
+            && memcmp(&scratchFormat, &format, sizeof(format)) == 0)) {
+        return true;
+    }
+    for (int i = 0; i < 2; i++) {
+        scratch[i]
+            = createImage(result.sizes[1].width, result.sizes[1].height, 0);
+        if (!scratch[i]) {
+            return false;
+        }
+    }
+    scratchSize = result.sizes[1];
+    scratchFormat = format;
+    return true;
+}
+
+auto d_ocl::pyramid::gaussian(cl_command_queue queue,
+                              cl_mem inputImage,
+                              int levels,
+                              image_pyramid& result,
+                              const std::vector<cl_event>& waitList,
+                              cl_event* event) -> bool
+{
+    if (!*this || levels < 1 || !prepare(inputImage, levels, mipmaps, result)) {
+        return false;
+    }
+    const int count = static_cast<int>(result.sizes.size());
+
+    handle<cl_event> last;
+    if (mipmaps) {
+        std::vector<size_t> origin(3, 0);
+        std::vector<size_t> region = {(size_t)result.sizes[0].width,
+                                      (size_t)result.sizes[0].height,
+                                      1};
+        if (!utils::checkRun(
+                "clEnqueueCopyImage",
+                clEnqueueCopyImage(queue,
+                                   inputImage,
+                                   result.mipmap->openclObject,
+                                   origin.data(),
+                                   origin.data(),
+                                   region.data(),
+                                   static_cast<cl_uint>(waitList.size()),
+                                   waitList.empty() ? nullptr
+                                                    : waitList.data(),
+                                   count == 1 ? event : last.outParam()))) {
+            return false;
+        }
+    } else {
+        // level 0 is the input itself
+        clRetainMemObject(inputImage);
+        result.levels[0] = utils::manager<cl_mem>::makeShared(
+            inputImage, clReleaseMemObject);
+        if (count == 1 && event != nullptr
+            && !utils::checkRun(
+                "clEnqueueMarkerWithWaitList",
+                clEnqueueMarkerWithWaitList(
+                    queue,
+                    static_cast<cl_uint>(waitList.size()),
+                    waitList.empty() ? nullptr : waitList.data(),
+                    event))) {
+            return false;
+        }
+    }
+
+    // every level waits only for the one before: no host round trips
+    for (int level = 1; level < count; level++) {
+        const cv::Size& source = result.sizes[level - 1];
+        const cv::Size& size = result.sizes[level];
+        nd_range range;
+        range.global = {(size_t)size.width, (size_t)size.height};
+        handle<cl_event> next;
+        cl_event* done = level == count - 1 ? event : next.outParam();
+        bool ran;
+        if (mipmaps) {
+            ran = downMipKernel.run(
+                queue,
+                range,
+                after(waitList, last),
+                done,
+                level == 1 ? inputImage
+                           : scratch[(level - 1) % 2]->openclObject,
+                scratch[level % 2]->openclObject,
+                result.mipmap->openclObject,
+                level,
+                source.width,
+                source.height,
+                size.width,
+                size.height);
+        } else {
+            ran = downKernel.run(queue,
+                                 range,
+                                 after(waitList, last),
+                                 done,
+                                 result.levels[level - 1]->openclObject,
+                                 result.levels[level]->openclObject,
+                                 source.width,
+                                 source.height,
+                                 size.width,
+                                 size.height);
+        }
+        if (!ran) {
+            return false;
+        }
+        last = std::move(next);
+    }
+    return utils::checkRun("clFlush", clFlush(queue));
+}
+
+auto d_ocl::pyramid::laplacian(cl_command_queue queue,
+                               cl_mem inputImage,
+                               int levels,
+                               image_pyramid& result,
+                               const std::vector<cl_event>& waitList,
+                               cl_event* event) -> bool
+{
+    if (!*this || levels < 1 || !prepare(inputImage, levels, true, result)) {
+        return false;
+    }
+    if (format.image_channel_data_type != CL_FLOAT) {
+        // differences are signed
+        std::cerr << "laplacian pyramid of a non-CL_FLOAT image" << std::endl;
+        return false;
+    }
+    const int count = static_cast<int>(result.sizes.size());
+    if (count == 1) {
+        // just the input, as its gaussian pyramid
+        return gaussian(queue, inputImage, 1, result, waitList, event);
+    }
+    if (!mipmaps) {
+        result.levels[0]
+            = createImage(result.sizes[0].width, result.sizes[0].height, 0);
+        if (!result.levels[0]) {
+            return false;
+        }
+    }
+
+    // gaussian level by level through the scratch images, each laplacian
+    // level taken from the 2 latest before the next overwrites 1
+    handle<cl_event> last;
+    for (int level = 1; level < count; level++) {
+        const cv::Size& fineSize = result.sizes[level - 1];
+        const cv::Size& size = result.sizes[level];
+        const bool top = level == count - 1;
+        cl_mem fine = level == 1 ? inputImage
+                                 : scratch[(level - 1) % 2]->openclObject;
+        // without mipmaps the top gaussian level is the top laplacian one
+        cl_mem coarse = top && !mipmaps ? result.levels[level]->openclObject
+                                        : scratch[level % 2]->openclObject;
+        nd_range range;
+        range.global = {(size_t)size.width, (size_t)size.height};
+        handle<cl_event> downsampled;
+        bool ran;
+        if (top && mipmaps) {
+            ran = downMipKernel.run(queue,
+                                    range,
+                                    after(waitList, last),
+                                    downsampled.outParam(),
+                                    fine,
+                                    coarse,
+                                    result.mipmap->openclObject,
+                                    level,
+                                    fineSize.width,
+                                    fineSize.height,
+                                    size.width,
+                                    size.height);
+        } else {
+            ran = downKernel.run(queue,
+                                 range,
+                                 after(waitList, last),
+                                 downsampled.outParam(),
+                                 fine,
+                                 coarse,
+                                 fineSize.width,
+                                 fineSize.height,
+                                 size.width,
+                                 size.height);
+        }
+        if (!ran) {
+            return false;
+        }
+
+        nd_range fineRange;
+        fineRange.global = {(size_t)fineSize.width, (size_t)fineSize.height};
+        handle<cl_event> next;
+        cl_event* done = top ? event : next.outParam();
+        if (mipmaps) {
+            ran = laplacianMipKernel.run(queue,
+                                         fineRange,
+                                         after(waitList, downsampled),
+                                         done,
+                                         fine,
+                                         coarse,
+                                         result.mipmap->openclObject,
+                                         level - 1,
+                                         fineSize.width,
+                                         fineSize.height,
+                                         size.width,
+                                         size.height);
+        } else {
+            ran = laplacianKernel.run(queue,
+                                      fineRange,
+                                      after(waitList, downsampled),
+                                      done,
+                                      fine,
+                                      coarse,
+                                      result.levels[level - 1]->openclObject,
+                                      fineSize.width,
+                                      fineSize.height,
+                                      size.width,
+                                      size.height);
+        }
+        if (!ran) {
+            return false;
+        }
+        last = std::move(next);
+    }
+    return utils::checkRun("clFlush", clFlush(queue));
+}
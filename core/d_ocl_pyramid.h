@@ -0,0 +1,145 @@
+#ifndef D_OCL_PYRAMID_H
+#define D_OCL_PYRAMID_H
+
+#include "d_ocl_defines.h"
+#include "d_ocl_kernel.h"
+#include "d_ocl_utils.h"
+#include <CL/cl.h>
+#include <memory>
+#include <opencv2/core.hpp>
+#include <vector>
+
+namespace d_ocl {
+enum class resize_interpolation
+{
+    // mean of the source pixels each destination pixel covers, as opencv's
+    // INTER_AREA when shrinking. bilinear when enlarging
+    area,
+    // by the sampler, CLK_FILTER_LINEAR
+    bilinear,
+    // 4 x 4 pixels, as opencv's INTER_CUBIC
+    bicubic
+};
+
+// resizes float or normalized images as cv::resize(), borders replicated.
+// holds only its kernels, no buffers, so any queue may run it
+struct D_OCL_API resizer
+{
+    explicit resizer(cl_context context);
+
+    // false if the program failed to build
+    explicit operator bool() const;
+
+    // the inputCols x inputRows origin of inputImage scaled into the
+    // cols x rows origin of outputImage
+    auto run(cl_command_queue queue,
+             cl_mem inputImage,
+             int inputCols,
+             int inputRows,
+             cl_mem outputImage,
+             int cols,
+             int rows,
+             resize_interpolation interpolation,
+             const std::vector<cl_event>& waitList,
+             cl_event* event) -> bool;
+
+    // resize_area(input, output, cols, rows, scaleX, scaleY)
+    launcher<cl_mem, cl_mem, int, int, float, float> areaKernel;
+    // resize_linear(input, output, cols, rows, scaleX, scaleY)
+    launcher<cl_mem, cl_mem, int, int, float, float> linearKernel;
+    // resize_cubic(input, output, cols, rows, scaleX, scaleY)
+    launcher<cl_mem, cl_mem, int, int, float, float> cubicKernel;
+};
+
+// levels of a pyramid on the device, either as the mip levels of 1 image or
+// as 1 image each
+struct D_OCL_API image_pyramid
+{
+    // every level, level i at mip level i, if built with mipmaps.
+    // read with the cl_khr_mipmap_image built-ins, e.g. for trilinear
+    // sampling between scales
+    std::shared_ptr<utils::manager<cl_mem>> mipmap;
+    // level i as its own image otherwise
+    std::vector<std::shared_ptr<utils::manager<cl_mem>>> levels;
+    // each half the last, rounded down as mip levels are. level 0 is the
+    // input's
+    std::vector<cv::Size> sizes;
+};
+// level of pyramid copied into a newly allocated hostMat of type, the cv::Mat
+// type of its images e.g. the input's, once waitList completed
+auto D_OCL_API readPyramidLevel(cl_command_queue queue,
+                                const image_pyramid& pyramid,
+                                size_t level,
+                                int type,
+                                const std::vector<cl_event>& waitList,
+                                cv::Mat& hostMat) -> bool;
+
+// gaussian and laplacian pyramids as cv::buildPyramid() and cv::pyrUp(),
+// every level enqueued at once, chained by events and flushed in 1
+// submission instead of uploaded level by level from the host.
+// mipmapped where the device has cl_khr_mipmap_image and
+// cl_khr_mipmap_image_writes, else 1 image per level.
+// the gaussian levels go through 2 scratch images of level 1's size,
+// allocated again only when the input size or format changes: frames of a
+// multiscale detector reuse them. calls share them, see d_ocl_kernel.h
+struct D_OCL_API pyramid
+{
+    // mipmaps false always builds 1 image per level
+    pyramid(cl_context context, cl_device_id device, bool mipmaps = true);
+
+    // false if the program failed to build
+    explicit operator bool() const;
+    // true if results are mipmapped
+    auto mipmapped() const -> bool;
+
+    // levels levels of inputImage's gaussian pyramid, level 0 inputImage
+    // itself, fewer if it runs out of pixels first
+    auto gaussian(cl_command_queue queue,
+                  cl_mem inputImage,
+                  int levels,
+                  image_pyramid& result,
+                  const std::vector<cl_event>& waitList,
+                  cl_event* event) -> bool;
+    // levels levels of the laplacian pyramid of a CL_FLOAT inputImage: level
+    // i is gaussian level i minus level i + 1 upsampled, the last level the
+    // last gaussian one
+    auto laplacian(cl_command_queue queue,
+                   cl_mem inputImage,
+                   int levels,
+                   image_pyramid& result,
+                   const std::vector<cl_event>& waitList,
+                   cl_event* event) -> bool;
+
+    // pyr_down(input, output, sourceCols, sourceRows, cols, rows)
+    launcher<cl_mem, cl_mem, int, int, int, int> downKernel;
+    // laplacian(fine, coarse, output, cols, rows, coarseCols, coarseRows)
+    launcher<cl_mem, cl_mem, cl_mem, int, int, int, int> laplacianKernel;
+    // pyr_down_mip(input, output, pyramid, level, sourceCols, sourceRows,
+    // cols, rows)
+    launcher<cl_mem, cl_mem, cl_mem, int, int, int, int, int> downMipKernel;
+    // laplacian_mip(fine, coarse, pyramid, level, cols, rows, coarseCols,
+    // coarseRows)
+    launcher<cl_mem, cl_mem, cl_mem, int, int, int, int, int>
+        laplacianMipKernel;
+
+private:
+    // result's sizes and images for inputImage, and the gaussian levels'
+    // scratch images if withScratch
+    auto prepare(cl_mem inputImage,
+                 int levels,
+                 bool withScratch,
+                 image_pyramid& result) -> bool;
+    auto createImage(int cols, int rows, cl_uint mipLevels)
+        -> std::shared_ptr<utils::manager<cl_mem>>;
+
+    cl_context context;
+    bool mipmaps;
+    cl_image_format format{};
+    // ping-pong gaussian levels, of level 1's size. kept between calls
+    std::shared_ptr<utils::manager<cl_mem>> scratch[2];
+    cv::Size scratchSize;
+    cl_image_format scratchFormat{};
+};
+} // namespace d_ocl
+
+#endif // D_OCL_PYRAMID_H
@@ -0,0 +1,102 @@
+#include "d_ocl_svm.h"
+#include <iostream>
+
+auto d_ocl::svmCapabilities(cl_device_id device) -> cl_device_svm_capabilities
+{
+    cl_device_svm_capabilities capabilities = 0;
+    // opencl 1.x devices reject the query
+    if (clGetDeviceInfo(device,
+                        CL_DEVICE_SVM_CAPABILITIES,
+                        sizeof(capabilities),
+                        &capabilities,
+                        nullptr)
+        != CL_SUCCESS) {
+        return 0;
+    }
+    return capabilities;
+}
+
+auto d_ocl::contextSupportsSvm(cl_context context,
+                               cl_device_svm_capabilities capabilities) -> bool
+{
+    std::vector<cl_device_id> devices = utils::contextDevices(context);
+    if (devices.empty()) {
+        return false;
+    }
+    for (cl_device_id device : devices) {
+        if ((svmCapabilities(device) & capabilities) != capabilities) {
+            return false;
+        }
+    }
+    return true;
+}
+
+d_ocl::svm_mapping::svm_mapping(cl_command_queue queue,
+                                void* pointer,
+                                bool mapped)
+    : queue(queue), pointer(pointer), mapped(mapped)
+{
+    clRetainCommandQueue(queue);
+}
+
+d_ocl::svm_mapping::~svm_mapping()
+{
+    if (mapped) {
+        // clSVMFree() doesn't wait for enqueued commands, so the unmap must
+        // have completed before the svm can be freed, e.g. by the
+        // svm_allocator of a vector destroyed right after its mapping
+        cl_event unmapped = nullptr;
+        if (utils::checkRun("clEnqueueSVMUnmap",
+                            clEnqueueSVMUnmap(
+                                queue, pointer, 0, nullptr, &unmapped))) {
+            utils::checkRun("clWaitForEvents", clWaitForEvents(1, &unmapped));
+            clReleaseEvent(unmapped);
+        }
+    }
+    clReleaseCommandQueue(queue);
+}
+
+auto d_ocl::mapSvm(cl_command_queue queue,
+                   cl_svm_mem_flags svmFlags,
+                   void* pointer,
+                   size_t size,
+                   cl_map_flags mapFlags,
+                   const std::vector<cl_event>& waitList)
+    -> std::shared_ptr<svm_mapping>
+{
+    if ((svmFlags & CL_MEM_SVM_FINE_GRAIN_BUFFER) != 0) {
+        // host and device see each other's writes once kernels finished
+        if (!waitList.empty()
+            && !utils::checkRun("clWaitForEvents",
+                                clWaitForEvents(
+                                    static_cast<cl_uint>(waitList.size()),
+                                    waitList.data()))) {
+            return std::shared_ptr<svm_mapping>();
+        }
+        return std::make_shared<svm_mapping>(queue, pointer, false);
+    }
+
+    if (!utils::checkRun(
+            "clEnqueueSVMMap",
+            clEnqueueSVMMap(queue,
+                            CL_TRUE,
+                            mapFlags,
+                            pointer,
+                            size,
+                            static_cast<cl_uint>(waitList.size()),
+                            waitList.empty() ? nullptr : waitList.data(),
+                            nullptr))) {
+        return std::shared_ptr<svm_mapping>();
+    }
+    return std::make_shared<svm_mapping>(queue, pointer, true);
+}
+
+auto d_ocl::setIndirectSvmPointers(cl_kernel kernel,
+                                   const std::vector<void*>& pointers) -> bool
+{
+    return utils::checkRun("clSetKernelExecInfo",
+                           clSetKernelExecInfo(kernel,
+                                               CL_KERNEL_EXEC_INFO_SVM_PTRS,
+                                               pointers.size() * sizeof(void*),
+                                               pointers.data()));
+}
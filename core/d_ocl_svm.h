@@ -0,0 +1,124 @@
+#ifndef D_OCL_SVM_H
+#define D_OCL_SVM_H
+
+#include "d_ocl_defines.h"
+#include "d_ocl_kernel.h"
+#include "d_ocl_utils.h"
+#include <CL/cl.h>
+#include <memory>
+#include <new>
+#include <string>
+#include <vector>
+
+namespace d_ocl {
+// CL_DEVICE_SVM_CAPABILITIES e.g. CL_DEVICE_SVM_COARSE_GRAIN_BUFFER.
+// 0 for devices without shared virtual memory e.g. opencl 1.2 devices
+auto D_OCL_API svmCapabilities(cl_device_id device)
+    -> cl_device_svm_capabilities;
+// true if every device in context has all of capabilities
+auto D_OCL_API contextSupportsSvm(cl_context context,
+                                  cl_device_svm_capabilities capabilities)
+    -> bool;
+
+// STL allocator on clSVMAlloc(), so e.g.
+// std::vector<int, svm_allocator<int>> is shared with kernels as is.
+//
+// coarse-grain svm (default) must be mapped with mapSvm() while the host
+// touches it, including when the vector constructs elements.
+// fine-grain svm (CL_MEM_SVM_FINE_GRAIN_BUFFER in flags) only needs the
+// kernels touching it to have finished.
+// deallocate() is clSVMFree(), which doesn't wait for enqueued commands:
+// every command using the memory must have completed before the container
+// frees it
+template<typename T>
+struct svm_allocator
+{
+    using value_type = T;
+
+    // context is kept alive by the allocator and its copies
+    explicit svm_allocator(
+        const std::shared_ptr<utils::manager<cl_context>>& context,
+        cl_svm_mem_flags flags = CL_MEM_READ_WRITE);
+    template<typename U>
+    svm_allocator(const svm_allocator<U>& other);
+
+    // throws std::bad_alloc as STL containers expect
+    auto allocate(size_t count) -> T*;
+    auto deallocate(T* pointer, size_t count) -> void;
+
+    std::shared_ptr<utils::manager<cl_context>> context;
+    cl_svm_mem_flags flags;
+};
+template<typename T, typename U>
+auto operator==(const svm_allocator<T>& lhs, const svm_allocator<U>& rhs)
+    -> bool;
+template<typename T, typename U>
+auto operator!=(const svm_allocator<T>& lhs, const svm_allocator<U>& rhs)
+    -> bool;
+
+// host access to svm, unmapped when destroyed. waits for the unmap, so the
+// svm may be freed right after
+struct D_OCL_API svm_mapping
+{
+    svm_mapping(cl_command_queue queue, void* pointer, bool mapped);
+    ~svm_mapping();
+    svm_mapping(const svm_mapping&) = delete;
+    auto operator=(const svm_mapping&) -> svm_mapping& = delete;
+
+    cl_command_queue queue;
+    void* pointer;
+    // false for fine-grain svm, which has nothing to unmap
+    bool mapped;
+};
+// blocking clEnqueueSVMMap() of size bytes at pointer once waitList completed.
+// svmFlags are the flags pointer was allocated with. fine-grain svm is not
+// mapped, only waitList is waited for.
+// empty shared_ptr on failure
+auto D_OCL_API mapSvm(cl_command_queue queue,
+                      cl_svm_mem_flags svmFlags,
+                      void* pointer,
+                      size_t size,
+                      cl_map_flags mapFlags,
+                      const std::vector<cl_event>& waitList)
+    -> std::shared_ptr<svm_mapping>;
+
+// kernel arg for a __global pointer into svm, e.g.
+// launcher<svm_pointer<int>> with svm_pointer<int>{vector.data()}
+template<typename T>
+struct svm_pointer
+{
+    T* pointer;
+};
+
+// svm reachable by kernel only through pointers stored in other svm,
+// e.g. nodes of a linked list. CL_KERNEL_EXEC_INFO_SVM_PTRS
+auto D_OCL_API setIndirectSvmPointers(cl_kernel kernel,
+                                      const std::vector<void*>& pointers)
+    -> bool;
+
+namespace utils {
+template<typename T>
+struct by_value_kernel_arg<svm_pointer<T>> : std::false_type
+{};
+
+template<typename T>
+struct kernel_arg<svm_pointer<T>>
+{
+    static auto set(cl_kernel kernel,
+                    cl_uint index,
+                    const svm_pointer<T>& value) -> cl_int
+    {
+        return clSetKernelArgSVMPointer(kernel, index, value.pointer);
+    }
+    // never cached, as cl_mem args: freed svm can be reallocated at the
+    // same address
+    static auto key(const svm_pointer<T>&) -> std::string
+    {
+        return std::string();
+    }
+};
+} // namespace utils
+} // namespace d_ocl
+
+#include "d_ocl_svm_allocator.cpp"
+#endif // D_OCL_SVM_H
@@ -0,0 +1,49 @@
+template<typename T>
+d_ocl::svm_allocator<T>::svm_allocator(
+    const std::shared_ptr<utils::manager<cl_context>>& context,
+    cl_svm_mem_flags flags /*= CL_MEM_READ_WRITE*/)
+    : context(context), flags(flags)
+{}
+
+template<typename T>
+template<typename U>
+d_ocl::svm_allocator<T>::svm_allocator(const svm_allocator<U>& other)
+    : context(other.context), flags(other.flags)
+{}
+
+template<typename T>
+auto d_ocl::svm_allocator<T>::allocate(size_t count) -> T*
+{
+    // alignment 0 = at least the largest opencl type, i.e. any T
+    void* pointer = clSVMAlloc(context->openclObject,
+                               flags,
+                               count * sizeof(T),
+                               alignof(T) > 128 ? alignof(T) : 0);
+    if (pointer == nullptr) {
+        std::cerr << "clSVMAlloc(" << count * sizeof(T) << ") failed"
+                  << std::endl;
+        throw std::bad_alloc();
+    }
+    return static_cast<T*>(pointer);
+}
+
+template<typename T>
+auto d_ocl::svm_allocator<T>::deallocate(T* pointer, size_t /*count*/) -> void
+{
+    clSVMFree(context->openclObject, pointer);
+}
+
+template<typename T, typename U>
+auto d_ocl::operator==(const svm_allocator<T>& lhs,
+                       const svm_allocator<U>& rhs) -> bool
+{
+    // either can free what the other allocated
+    return lhs.context == rhs.context && lhs.flags == rhs.flags;
+}
+
+template<typename T, typename U>
+auto d_ocl::operator!=(const svm_allocator<T>& lhs,
+                       const svm_allocator<U>& rhs) -> bool
+{
+    return !(lhs == rhs);
+}
@@ -0,0 +1,261 @@
+#include "d_ocl_task_graph.h"
+#include "d_ocl.h"
+#include "d_ocl_profiler.h"
+#include <algorithm>
+#include <cstdint>
+#include <iostream>
+
+auto d_ocl::createOutOfOrderQueue(cl_device_id device,
+                                  cl_context context,
+                                  cl_command_queue_properties properties
+                                  /*= 0*/)
+    -> std::shared_ptr<utils::manager<cl_command_queue>>
+{
+    cl_command_queue_properties supported = 0;
+    clGetDeviceInfo(device,
+                    CL_DEVICE_QUEUE_ON_HOST_PROPERTIES,
+                    sizeof(supported),
+                    &supported,
+                    nullptr);
+    if ((supported & CL_QUEUE_OUT_OF_ORDER_EXEC_MODE_ENABLE) != 0) {
+        properties |= CL_QUEUE_OUT_OF_ORDER_EXEC_MODE_ENABLE;
+    }
+    return createCmdQueue(device, context, properties);
+}
+
+d_ocl::task_graph::task_graph(cl_command_queue queue) : queue(queue) {}
+
+static auto addUnique(std::vector<size_t>& ids, size_t id) -> void
+{
+    if (std::find(ids.begin(), ids.end(), id) == ids.end()) {
+        ids.push_back(id);
+    }
+}
+
+auto d_ocl::task_graph::add(const std::string& name,
+                            const std::vector<cl_mem>& reads,
+                            const std::vector<cl_mem>& writes,
+                            const task_enqueue_func& enqueue,
+                            uint64_t bytes /*= 0*/) -> size_t
+{
+    const size_t id = nodes.size();
+    std::vector<size_t> dependencies;
+
+    for (cl_mem memObject : reads) {
+        auto iter = accesses.find(memObject);
+        if (iter == accesses.end()) {
+            iter = accesses.insert({memObject, {SIZE_MAX, {}}}).first;
+        }
+        // read after write
+        if (iter->second.lastWriter != SIZE_MAX) {
+            addUnique(dependencies, iter->second.lastWriter);
+        }
+        addUnique(iter->second.readers, id);
+    }
+    for (cl_mem memObject : writes) {
+        auto iter = accesses.find(memObject);
+        if (iter == accesses.end()) {
+            iter = accesses.insert({memObject, {SIZE_MAX, {}}}).first;
+        }
+        // write after write
+        if (iter->second.lastWriter != SIZE_MAX) {
+            addUnique(dependencies, iter->second.lastWriter);
+        }
+        // write after read
+        for (size_t reader : iter->second.readers) {
+            if (reader != id) {
+                addUnique(dependencies, reader);
+            }
+        }
+        iter->second.lastWriter = id;
+        iter->second.readers.clear();
+    }
+
+    task_node newNode;
+    newNode.name = name;
+    newNode.enqueue = enqueue;
+    newNode.dependencies = dependencies;
+    newNode.bytes = bytes;
+    newNode.enqueued = false;
+    nodes.push_back(std::move(newNode));
+    return id;
+}
+
+auto d_ocl::task_graph::addFill(const std::string& name,
+                                cl_mem buffer,
+                                const void* pattern,
+                                size_t patternSize,
+                                size_t offset,
+                                size_t size) -> size_t
+{
+    const char* patternBytes = static_cast<const char*>(pattern);
+    std::vector<char> patternCopy(patternBytes, patternBytes + patternSize);
+    return add(
+        name,
+        {},
+        {buffer},
+        [buffer, patternCopy, offset, size](
+            cl_command_queue queue,
+            const std::vector<cl_event>& waitList,
+            cl_event* event) -> bool {
+            return utils::checkRun(
+                "clEnqueueFillBuffer",
+                clEnqueueFillBuffer(queue,
+                                    buffer,
+                                    patternCopy.data(),
+                                    patternCopy.size(),
+                                    offset,
+                                    size,
+                                    static_cast<cl_uint>(waitList.size()),
+                                    waitList.empty() ? nullptr
+                                                     : waitList.data(),
+                                    event));
+        },
+        size);
+}
+
+auto d_ocl::task_graph::addCopy(const std::string& name,
+                                cl_mem source,
+                                cl_mem destination,
+                                size_t sourceOffset,
+                                size_t destinationOffset,
+                                size_t size) -> size_t
+{
+    return add(
+        name,
+        {source},
+        {destination},
+        [source, destination, sourceOffset, destinationOffset, size](
+            cl_command_queue queue,
+            const std::vector<cl_event>& waitList,
+            cl_event* event) -> bool {
+            return utils::checkRun(
+                "clEnqueueCopyBuffer",
+                clEnqueueCopyBuffer(queue,
+                                    source,
+                                    destination,
+                                    sourceOffset,
+                                    destinationOffset,
+                                    size,
+                                    static_cast<cl_uint>(waitList.size()),
+                                    waitList.empty() ? nullptr
+                                                     : waitList.data(),
+                                    event));
+        },
+        size);
+}
+
+auto d_ocl::task_graph::addRead(const std::string& name,
+                                cl_mem buffer,
+                                size_t offset,
+                                size_t size,
+                                void* hostData) -> size_t
+{
+    return add(
+        name,
+        {buffer},
+        {},
+        [buffer, offset, size, hostData](cl_command_queue queue,
+                                         const std::vector<cl_event>& waitList,
+                                         cl_event* event) -> bool {
+            return utils::checkRun(
+                "clEnqueueReadBuffer",
+                clEnqueueReadBuffer(queue,
+                                    buffer,
+                                    CL_FALSE,
+                                    offset,
+                                    size,
+                                    hostData,
+                                    static_cast<cl_uint>(waitList.size()),
+                                    waitList.empty() ? nullptr
+                                                     : waitList.data(),
+                                    event));
+        },
+        size);
+}
+
+auto d_ocl::task_graph::addWrite(const std::string& name,
+                                 cl_mem buffer,
+                                 size_t offset,
+                                 size_t size,
+                                 const void* hostData) -> size_t
+{
+    return add(
+        name,
+        {},
+        {buffer},
+        [buffer, offset, size, hostData](cl_command_queue queue,
+                                         const std::vector<cl_event>& waitList,
+                                         cl_event* event) -> bool {
+            return utils::checkRun(
+                "clEnqueueWriteBuffer",
+                clEnqueueWriteBuffer(queue,
+                                     buffer,
+                                     CL_FALSE,
+                                     offset,
+                                     size,
+                                     hostData,
+                                     static_cast<cl_uint>(waitList.size()),
+                                     waitList.empty() ? nullptr
+                                                      : waitList.data(),
+                                     event));
+        },
+        size);
+}
+
+auto d_ocl::task_graph::addDependency(size_t node, size_t dependency) -> bool
+{
+    // nodes are enqueued in order, so only earlier nodes can be waited for
+    if (node >= nodes.size() || dependency >= node || nodes[node].enqueued) {
+        std::cerr << "invalid task dependency " << node << " -> " << dependency
+                  << std::endl;
+        return false;
+    }
+    addUnique(nodes[node].dependencies, dependency);
+    return true;
+}
+
+auto d_ocl::task_graph::run() -> bool
+{
+    for (task_node& task : nodes) {
+        if (task.enqueued) {
+            continue;
+        }
+
+        std::vector<cl_event> waitList;
+        for (size_t dependency : task.dependencies) {
+            waitList.push_back(nodes[dependency].event.get());
+        }
+        if (!task.enqueue(queue, waitList, task.event.outParam())
+            || !task.event) {
+            std::cerr << "error enqueueing task " << task.name << std::endl;
+            return false;
+        }
+        task.enqueued = true;
+        recordEvent(task.name, task.event.get(), task.bytes);
+    }
+
+    // start the device on them while the host goes on
+    return utils::checkRun("clFlush", clFlush(queue));
+}
+
+auto d_ocl::task_graph::wait() -> bool
+{
+    std::vector<cl_event> events;
+    for (const task_node& task : nodes) {
+        if (task.enqueued) {
+            events.push_back(task.event.get());
+        }
+    }
+    if (events.empty()) {
+        return true;
+    }
+    return utils::checkRun(
+        "clWaitForEvents",
+        clWaitForEvents(static_cast<cl_uint>(events.size()), events.data()));
+}
+
+auto d_ocl::task_graph::event(size_t node) const -> cl_event
+{
+    return node < nodes.size() ? nodes[node].event.get() : nullptr;
+}
@@ -0,0 +1,123 @@
+#ifndef D_OCL_TASK_GRAPH_H
+#define D_OCL_TASK_GRAPH_H
+
+#include "d_ocl_defines.h"
+#include "d_ocl_handle.h"
+#include "d_ocl_kernel.h"
+#include "d_ocl_utils.h"
+#include <CL/cl.h>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace d_ocl {
+// command queue with CL_QUEUE_OUT_OF_ORDER_EXEC_MODE_ENABLE if the device
+// supports it, else a regular in-order queue.
+// properties are added to the queue's, as in createCmdQueue()
+auto D_OCL_API createOutOfOrderQueue(cl_device_id device,
+                                     cl_context context,
+                                     cl_command_queue_properties properties
+                                     = 0)
+    -> std::shared_ptr<utils::manager<cl_command_queue>>;
+
+// enqueue 1 command on queue after waitList, and set event to it
+using task_enqueue_func
+    = std::function<bool(cl_command_queue queue,
+                         const std::vector<cl_event>& waitList,
+                         cl_event* event)>;
+
+// commands (kernels, copies, fills, transfers) whose wait lists are derived
+// from the memory objects each reads and writes:
+// read after write, write after read and write after write of the same
+// cl_mem are ordered, anything else may overlap on an out-of-order queue.
+// sub-buffers of the same buffer are not recognized as aliases.
+//
+// nodes are enqueued in the order they were added, so run() can be called
+// as nodes are added, e.g. to start a fill before building a program.
+// every node's event is passed to recordEvent() under the node's name
+struct D_OCL_API task_graph
+{
+    explicit task_graph(cl_command_queue queue);
+
+    // returns node id
+    auto add(const std::string& name,
+             const std::vector<cl_mem>& reads,
+             const std::vector<cl_mem>& writes,
+             const task_enqueue_func& enqueue,
+             uint64_t bytes = 0) -> size_t;
+    // launcher.run() with args, captured by value.
+    // launcher must outlive run()
+    template<typename... Args>
+    auto addKernel(const std::string& name,
+                   launcher<Args...>& launcher,
+                   const nd_range& range,
+                   const std::vector<cl_mem>& reads,
+                   const std::vector<cl_mem>& writes,
+                   const Args&... args) -> size_t;
+    // fill size bytes of buffer from offset with pattern, which is copied
+    auto addFill(const std::string& name,
+                 cl_mem buffer,
+                 const void* pattern,
+                 size_t patternSize,
+                 size_t offset,
+                 size_t size) -> size_t;
+    auto addCopy(const std::string& name,
+                 cl_mem source,
+                 cl_mem destination,
+                 size_t sourceOffset,
+                 size_t destinationOffset,
+                 size_t size) -> size_t;
+    // non-blocking. hostData must stay valid until run() and is filled
+    // once wait() returns
+    auto addRead(const std::string& name,
+                 cl_mem buffer,
+                 size_t offset,
+                 size_t size,
+                 void* hostData) -> size_t;
+    // non-blocking. hostData must stay valid until wait() returns
+    auto addWrite(const std::string& name,
+                  cl_mem buffer,
+                  size_t offset,
+                  size_t size,
+                  const void* hostData) -> size_t;
+    // order node after dependency in addition to its data dependencies.
+    // dependency must have been added before node
+    auto addDependency(size_t node, size_t dependency) -> bool;
+
+    // enqueue every node not enqueued yet and flush the queue
+    auto run() -> bool;
+    // wait for every node enqueued so far
+    auto wait() -> bool;
+    // event of an enqueued node, e.g. for work outside the graph
+    auto event(size_t node) const -> cl_event;
+
+private:
+    struct task_node
+    {
+        std::string name;
+        task_enqueue_func enqueue;
+        // earlier nodes to wait for
+        std::vector<size_t> dependencies;
+        uint64_t bytes;
+        handle<cl_event> event;
+        bool enqueued;
+    };
+    // nodes accessing a memory object since its last write
+    struct memory_access
+    {
+        // SIZE_MAX if not written by the graph
+        size_t lastWriter;
+        std::vector<size_t> readers;
+    };
+
+    cl_command_queue queue;
+    std::vector<task_node> nodes;
+    std::map<cl_mem, memory_access> accesses;
+};
+} // namespace d_ocl
+
+#include "d_ocl_task_graph_kernel.cpp"
+#endif // D_OCL_TASK_GRAPH_H
@@ -0,0 +1,20 @@
+template<typename... Args>
+auto d_ocl::task_graph::addKernel(const std::string& name,
+                                  launcher<Args...>& launcher,
+                                  const nd_range& range,
+                                  const std::vector<cl_mem>& reads,
+                                  const std::vector<cl_mem>& writes,
+                                  const Args&... args) -> size_t
+{
+    d_ocl::launcher<Args...>* kernelLauncher = &launcher;
+    return add(name,
+               reads,
+               writes,
+               [kernelLauncher, range, args...](
+                   cl_command_queue queue,
+                   const std::vector<cl_event>& waitList,
+                   cl_event* event) -> bool {
+                   return kernelLauncher->run(
+                       queue, range, waitList, event, args...);
+               });
+}
@@ -0,0 +1,193 @@
+#include "d_ocl_tiling.h"
+#include "d_ocl_pipeline.h"
+#include "d_ocl_utils.h"
+#include <algorithm>
+#include <iostream>
+#include <opencv2/core.hpp>
+
+auto d_ocl::planTiles(cl_device_id device,
+                      int cols,
+                      int rows,
+                      size_t inputPixelBytes,
+                      size_t outputPixelBytes,
+                      const tiling_options& options,
+                      std::vector<image_tile>& tiles) -> bool
+{
+    tiles.clear();
+    const utils::image_limits limits = utils::imageLimits(device);
+    if (cols <= 0 || rows <= 0 || limits.maxWidth == 0
+        || limits.maxHeight == 0) {
+        return false;
+    }
+
+    const cl_ulong budget = options.memoryBudget > 0 ? options.memoryBudget
+                                                     : limits.globalMemory / 4;
+    const cl_ulong depth = std::max<size_t>(options.depth, 1);
+    const int halo = std::max(options.halo, 0);
+    const cl_ulong pixelBytes = inputPixelBytes + outputPixelBytes;
+    const cl_ulong largestPixel = std::max(inputPixelBytes, outputPixelBytes);
+
+    // as wide as possible so tiles read whole rows, then as many rows as fit.
+    // halve the width until at least 1 row does
+    long tileCols = cols;
+    if (options.maxTileCols > 0) {
+        tileCols = std::min<long>(tileCols, options.maxTileCols);
+    }
+    tileCols = std::min<long>(tileCols, (long)limits.maxWidth - 2 * halo);
+    long tileRows = 0;
+    while (tileCols >= 1) {
+        const cl_ulong inCols = std::min<long>(cols, tileCols + 2 * halo);
+        // depth slots of input and output images within the budget, and
+        // every image within the largest allocation
+        const cl_ulong inRows
+            = std::min(std::min(budget / (depth * inCols * pixelBytes),
+                                limits.maxAllocation / (inCols * largestPixel)),
+                       (cl_ulong)limits.maxHeight);
+        tileRows = std::min<long>(rows, (long)inRows - 2 * halo);
+        if (options.maxTileRows > 0) {
+            tileRows = std::min<long>(tileRows, options.maxTileRows);
+        }
+        if (tileRows >= 1) {
+            break;
+        }
+        tileCols /= 2;
+    }
+    if (tileCols < 1 || tileRows < 1) {
+        std::cerr << "no tile with a halo of " << halo
+                  << " fits the device's image limits and memory budget"
+                  << std::endl;
+        return false;
+    }
+
+    for (int y = 0; y < rows; y += tileRows) {
+        for (int x = 0; x < cols; x += tileCols) {
+            image_tile tile;
+            tile.x = x;
+            tile.y = y;
+            tile.cols = std::min<int>(tileCols, cols - x);
+            tile.rows = std::min<int>(tileRows, rows - y);
+            tile.inX = std::max(0, x - halo);
+            tile.inY = std::max(0, y - halo);
+            tile.inCols = std::min(cols, x + tile.cols + halo) - tile.inX;
+            tile.inRows = std::min(rows, y + tile.rows + halo) - tile.inY;
+            tiles.push_back(tile);
+        }
+    }
+    return true;
+}
+
+auto d_ocl::processTiled(const context_set& contextSet,
+                         const std::string& name,
+                         const cv::Mat& srcMat,
+                         cv::Mat& dstMat,
+                         const tiling_options& options,
+                         const tile_process_func& process) -> bool
+{
+    if (dstMat.rows != srcMat.rows || dstMat.cols != srcMat.cols
+        || !process) {
+        std::cerr << "invalid tiled processing of " << name << std::endl;
+        return false;
+    }
+
+    std::vector<image_tile> tiles;
+    if (!planTiles(contextSet.device,
+                   srcMat.cols,
+                   srcMat.rows,
+                   srcMat.elemSize(),
+                   dstMat.elemSize(),
+                   options,
+                   tiles)) {
+        return false;
+    }
+
+    // every slot's images fit the largest tile
+    int maxInCols = 0;
+    int maxInRows = 0;
+    for (const image_tile& tile : tiles) {
+        maxInCols = std::max(maxInCols, tile.inCols);
+        maxInRows = std::max(maxInRows, tile.inRows);
+    }
+    const cv::Mat inputSpec(maxInRows, maxInCols, srcMat.type());
+    const cv::Mat outputSpec(maxInRows, maxInCols, dstMat.type());
+    const size_t depth = std::max<size_t>(options.depth, 1);
+    std::vector<std::shared_ptr<utils::manager<cl_mem>>> inputImages;
+    std::vector<std::shared_ptr<utils::manager<cl_mem>>> outputImages;
+    for (size_t slot = 0; slot < std::min(depth, tiles.size()); slot++) {
+        inputImages.push_back(
+            createOutputImage(contextSet.context->openclObject,
+                              CL_MEM_READ_ONLY | CL_MEM_HOST_WRITE_ONLY,
+                              inputSpec));
+        outputImages.push_back(
+            createOutputImage(contextSet.context->openclObject,
+                              CL_MEM_WRITE_ONLY | CL_MEM_HOST_READ_ONLY,
+                              outputSpec));
+        if (!inputImages.back() || !outputImages.back()) {
+            return false;
+        }
+    }
+
+    chunk_pipeline_stages stages;
+    // the tile with its halo
+    stages.upload = [&](size_t chunk,
+                        size_t slot,
+                        cl_command_queue queue,
+                        const std::vector<cl_event>& waitList,
+                        cl_event* event) -> bool {
+        const image_tile& tile = tiles[chunk];
+        const size_t origin[3] = {0, 0, 0};
+        const size_t region[3] = {(size_t)tile.inCols, (size_t)tile.inRows, 1};
+        return utils::checkRun(
+            "clEnqueueWriteImage",
+            clEnqueueWriteImage(queue,
+                                inputImages[slot]->openclObject,
+                                CL_FALSE,
+                                origin,
+                                region,
+                                srcMat.step[0],
+                                0,
+                                srcMat.ptr(tile.inY)
+                                    + tile.inX * srcMat.elemSize(),
+                                static_cast<cl_uint>(waitList.size()),
+                                waitList.empty() ? nullptr : waitList.data(),
+                                event));
+    };
+    stages.compute = [&](size_t chunk,
+                         size_t slot,
+                         cl_command_queue queue,
+                         const std::vector<cl_event>& waitList,
+                         cl_event* event) -> bool {
+        return process(queue,
+                       tiles[chunk],
+                       inputImages[slot]->openclObject,
+                       outputImages[slot]->openclObject,
+                       waitList,
+                       event);
+    };
+    // the tile without its halo, stitched into place
+    stages.download = [&](size_t chunk,
+                          size_t slot,
+                          cl_command_queue queue,
+                          const std::vector<cl_event>& waitList,
+                          cl_event* event) -> bool {
+        const image_tile& tile = tiles[chunk];
+        const size_t origin[3]
+            = {(size_t)(tile.x - tile.inX), (size_t)(tile.y - tile.inY), 0};
+        const size_t region[3] = {(size_t)tile.cols, (size_t)tile.rows, 1};
+        return utils::checkRun(
+            "clEnqueueReadImage",
+            clEnqueueReadImage(queue,
+                               outputImages[slot]->openclObject,
+                               CL_FALSE,
+                               origin,
+                               region,
+                               dstMat.step[0],
+                               0,
+                               dstMat.ptr(tile.y) + tile.x * dstMat.elemSize(),
+                               static_cast<cl_uint>(waitList.size()),
+                               waitList.empty() ? nullptr : waitList.data(),
+                               event));
+    };
+
+    return runChunkPipeline(
+        contextSet, name, tiles.size(), inputImages.size(), stages);
+}
@@ -0,0 +1,80 @@
+#ifndef D_OCL_TILING_H
+#define D_OCL_TILING_H
+
+#include "d_ocl.h"
+#include "d_ocl_defines.h"
+#include <CL/cl.h>
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace d_ocl {
+// 1 tile of an image, in pixels
+struct D_OCL_API image_tile
+{
+    // region of the output the tile produces
+    int x{0};
+    int y{0};
+    int cols{0};
+    int rows{0};
+    // region of the input it reads: the above grown by the halo on every
+    // side, cut off at the image borders
+    int inX{0};
+    int inY{0};
+    int inCols{0};
+    int inRows{0};
+};
+
+struct D_OCL_API tiling_options
+{
+    // pixels of input around each tile a stencil needs, e.g. filter width / 2
+    int halo{0};
+    // upper limit of a tile's output size. 0 = as large as the device's
+    // image limits and memoryBudget allow
+    int maxTileCols{0};
+    int maxTileRows{0};
+    // bytes of device memory all tile images together may use.
+    // 0 = a quarter of CL_DEVICE_GLOBAL_MEM_SIZE
+    cl_ulong memoryBudget{0};
+    // tiles on the device at once, 2 = double buffered (see
+    // runChunkPipeline())
+    size_t depth{2};
+};
+
+// split a cols x rows image into row-major tiles whose input and output
+// images of inputPixelBytes and outputPixelBytes per pixel fit device's
+// real image limits and options.memoryBudget
+auto D_OCL_API planTiles(cl_device_id device,
+                         int cols,
+                         int rows,
+                         size_t inputPixelBytes,
+                         size_t outputPixelBytes,
+                         const tiling_options& options,
+                         std::vector<image_tile>& tiles) -> bool;
+
+// enqueue the work of tile on queue after waitList, reading the tile's
+// input from the origin of inputImage and writing its output, including the
+// halo, to the origin of outputImage, and set event to the last command.
+// the images can be larger than tile.inCols x tile.inRows, so a stencil must
+// clamp to those instead of relying on the sampler
+using tile_process_func
+    = std::function<bool(cl_command_queue queue,
+                         const image_tile& tile,
+                         cl_mem inputImage,
+                         cl_mem outputImage,
+                         const std::vector<cl_event>& waitList,
+                         cl_event* event)>;
+
+// stream srcMat through the device tile by tile and stitch the tiles'
+// outputs without their halo into dstMat, which must be allocated with
+// srcMat's size. device memory use is bounded by the tiles, not the image.
+// tiles upload, process and download on contextSet's queues overlapping
+auto D_OCL_API processTiled(const context_set& contextSet,
+                            const std::string& name,
+                            const cv::Mat& srcMat,
+                            cv::Mat& dstMat,
+                            const tiling_options& options,
+                            const tile_process_func& process) -> bool;
+} // namespace d_ocl
+
+#endif // D_OCL_TILING_H
@@ -0,0 +1,447 @@
+#include "d_ocl_tuner.h"
+#include "d_ocl_handle.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <map>
+#include <mutex>
+#include <set>
+#include <sstream>
+
+// timed runs per candidate, after 1 warm-up run. fastest run counts
+#define D_OCL_TUNING_RUNS 3
+
+// work-groups per compute unit to try for grid-stride global sizes
+static const std::vector<size_t> g_groupsPerUnit = {1, 2, 4, 8};
+
+static std::mutex g_mutex;
+static bool g_pathInitialized = false;
+static std::string g_path;
+// tuning key -> serialized nd_range or choice. loaded from g_path on first
+// use
+static bool g_loaded = false;
+static std::map<std::string, std::string> g_database;
+
+auto d_ocl::tuningDatabasePath() -> std::string
+{
+    std::lock_guard<std::mutex> lock(g_mutex);
+    if (!g_pathInitialized) {
+        const std::string root = utils::cacheDirectory();
+        g_path = root.empty() ? root : root + "/tuning.db";
+        g_pathInitialized = true;
+    }
+    return g_path;
+}
+
+auto d_ocl::setTuningDatabasePath(const std::string& path) -> void
+{
+    std::lock_guard<std::mutex> lock(g_mutex);
+    g_path = path;
+    g_pathInitialized = true;
+    // read the new file on next lookup
+    g_loaded = false;
+    g_database.clear();
+}
+
+// "g0,g1 l0,l1". local part is empty if the driver decides
+static auto serialize(const d_ocl::nd_range& range) -> std::string
+{
+    std::ostringstream stream;
+    for (size_t i = 0; i < range.global.size(); i++) {
+        stream << (i == 0 ? "" : ",") << range.global[i];
+    }
+    stream << " ";
+    for (size_t i = 0; i < range.local.size(); i++) {
+        stream << (i == 0 ? "" : ",") << range.local[i];
+    }
+    return stream.str();
+}
+
+static auto parseSizes(const std::string& text) -> std::vector<size_t>
+{
+    std::vector<size_t> sizes;
+    std::istringstream stream(text);
+    std::string item;
+    while (std::getline(stream, item, ',')) {
+        if (!item.empty()) {
+            sizes.push_back(std::stoull(item));
+        }
+    }
+    return sizes;
+}
+
+static auto deserialize(const std::string& text, d_ocl::nd_range& range)
+    -> bool
+{
+    const size_t space = text.find(' ');
+    if (space == std::string::npos) {
+        return false;
+    }
+
+    try {
+        range.global = parseSizes(text.substr(0, space));
+        range.local = parseSizes(text.substr(space + 1));
+    } catch (const std::exception&) {
+        return false;
+    }
+    return !range.global.empty()
+           && (range.local.empty()
+               || range.local.size() == range.global.size());
+}
+
+// one "key\tvalue" per line
+static auto readDatabase(const std::string& path,
+                         std::map<std::string, std::string>& database) -> void
+{
+    std::ifstream stream(path);
+    std::string line;
+    while (std::getline(stream, line)) {
+        const size_t tab = line.find('\t');
+        if (tab != std::string::npos) {
+            database[line.substr(0, tab)] = line.substr(tab + 1);
+        }
+    }
+}
+
+// called with g_mutex locked
+static auto lookup(const std::string& path,
+                   const std::string& key,
+                   std::string& value) -> bool
+{
+    if (!g_loaded) {
+        if (!path.empty()) {
+            readDatabase(path, g_database);
+        }
+        g_loaded = true;
+    }
+
+    auto iter = g_database.find(key);
+    if (iter == g_database.end()) {
+        return false;
+    }
+    value = iter->second;
+    return true;
+}
+
+// called with g_mutex locked
+static auto store(const std::string& path,
+                  const std::string& key,
+                  const std::string& value) -> void
+{
+    g_database[key] = value;
+    if (path.empty()) {
+        return;
+    }
+
+    // merge in what other processes stored since we loaded
+    std::map<std::string, std::string> database;
+    readDatabase(path, database);
+    for (const std::pair<const std::string, std::string>& entry : g_database) {
+        database[entry.first] = entry.second;
+    }
+
+    std::string contents;
+    for (const std::pair<const std::string, std::string>& entry : database) {
+        contents += entry.first + "\t" + entry.second + "\n";
+    }
+
+    const size_t slash = path.rfind('/');
+    if (slash != std::string::npos && slash > 0) {
+        d_ocl::utils::makeDirectories(path.substr(0, slash));
+    }
+    d_ocl::utils::writeFileAtomic(path, contents);
+}
+
+static auto tuningKey(cl_device_id device,
+                      const std::string& kernelName,
+                      const std::vector<size_t>& problemSize) -> std::string
+{
+    std::vector<char> driverVersion;
+    d_ocl::utils::information<char>(
+        device, CL_DRIVER_VERSION, driverVersion, '\0');
+
+    std::ostringstream stream;
+    stream << kernelName << " | " << d_ocl::utils::deviceName(device) << " | "
+           << (driverVersion.empty() ? "" : driverVersion.data()) << " | ";
+    for (size_t i = 0; i < problemSize.size(); i++) {
+        stream << (i == 0 ? "" : "x") << problemSize[i];
+    }
+    return stream.str();
+}
+
+static auto roundUp(size_t value, size_t multiple) -> size_t
+{
+    return (value + multiple - 1) / multiple * multiple;
+}
+
+// work-group shapes with x no narrower than y, since rows are contiguous
+static auto localSizes(size_t dimensions,
+                       size_t multiple,
+                       size_t maxGroupSize,
+                       const std::vector<size_t>& maxItems)
+    -> std::vector<std::vector<size_t>>
+{
+    std::vector<std::vector<size_t>> sizes;
+    for (size_t total = multiple; total <= maxGroupSize; total *= 2) {
+        if (dimensions == 1) {
+            if (total <= maxItems[0]) {
+                sizes.push_back({total});
+            }
+            continue;
+        }
+
+        for (size_t y = 1; y * y <= total; y *= 2) {
+            const size_t x = total / y;
+            if (x * y != total || x > maxItems[0] || y > maxItems[1]) {
+                continue;
+            }
+            std::vector<size_t> size = {x, y};
+            // 3rd dimension is usually a batch index; keep it 1 deep
+            size.resize(dimensions, 1);
+            sizes.push_back(size);
+        }
+    }
+    return sizes;
+}
+
+auto d_ocl::workSizeCandidates(cl_kernel kernel,
+                               cl_device_id device,
+                               const std::vector<size_t>& problemSize)
+    -> std::vector<nd_range>
+{
+    std::vector<nd_range> candidates;
+    const std::vector<size_t> maxItems = utils::maxWorkGroupSize(device);
+    const size_t maxGroupSize = utils::kernelWorkGroupSize(kernel, device);
+    const size_t multiple
+        = std::min(utils::preferredWorkGroupSizeMultiple(kernel, device),
+                   std::max<size_t>(maxGroupSize, 1));
+    const size_t numComputeUnits = utils::maxComputeUnits(device);
+    const size_t dimensions = problemSize.size();
+    if (dimensions == 0 || dimensions > 3 || maxItems.size() < dimensions
+        || maxGroupSize == 0 || numComputeUnits == 0) {
+        return candidates;
+    }
+
+    // let the driver decide, as the examples used to
+    candidates.push_back({problemSize, {}});
+
+    std::set<std::string> seen;
+    for (const std::vector<size_t>& local :
+         localSizes(dimensions, multiple, maxGroupSize, maxItems)) {
+        // # work-groups per dimension to give every element a work-item
+        std::vector<size_t> groups(dimensions);
+        size_t totalGroups = 1;
+        for (size_t i = 0; i < dimensions; i++) {
+            groups[i] = roundUp(problemSize[i], local[i]) / local[i];
+            totalGroups *= groups[i];
+        }
+
+        // 0 means 1 work-item per element.
+        // otherwise at most this many work-groups per compute unit,
+        // with the kernel striding over the rest
+        std::vector<size_t> groupsPerUnit(1, 0);
+        groupsPerUnit.insert(groupsPerUnit.end(),
+                             g_groupsPerUnit.begin(),
+                             g_groupsPerUnit.end());
+        for (size_t perUnit : groupsPerUnit) {
+            const size_t maxGroups = perUnit * numComputeUnits;
+            // shrink every dimension by the same factor
+            const double scale
+                = perUnit == 0 || totalGroups <= maxGroups
+                      ? 1.0
+                      : std::pow(static_cast<double>(maxGroups) / totalGroups,
+                                 1.0 / dimensions);
+
+            nd_range range = {std::vector<size_t>(dimensions), local};
+            for (size_t i = 0; i < dimensions; i++) {
+                size_t dimensionGroups = static_cast<size_t>(
+                    std::ceil(groups[i] * scale));
+                dimensionGroups = std::max<size_t>(
+                    std::min(dimensionGroups, groups[i]), 1);
+                range.global[i] = dimensionGroups * local[i];
+            }
+
+            if (seen.insert(serialize(range)).second) {
+                candidates.push_back(range);
+            }
+        }
+    }
+
+    return candidates;
+}
+
+// seconds from kernel start to end.
+// wall clock around the launch if the queue was not created for profiling
+static auto timeLaunch(const d_ocl::tuning_launch_func& launch,
+                       const d_ocl::nd_range& range,
+                       double& seconds) -> bool
+{
+    d_ocl::handle<cl_event> event;
+    const auto begin = std::chrono::steady_clock::now();
+    if (!launch(range, event.outParam()) || !event) {
+        return false;
+    }
+    cl_event waitEvent = event.get();
+    const bool finished = clWaitForEvents(1, &waitEvent) == CL_SUCCESS;
+    const auto end = std::chrono::steady_clock::now();
+
+    cl_ulong startNs = 0;
+    cl_ulong endNs = 0;
+    if (finished
+        && clGetEventProfilingInfo(event.get(),
+                                   CL_PROFILING_COMMAND_START,
+                                   sizeof(startNs),
+                                   &startNs,
+                                   nullptr)
+               == CL_SUCCESS
+        && clGetEventProfilingInfo(event.get(),
+                                   CL_PROFILING_COMMAND_END,
+                                   sizeof(endNs),
+                                   &endNs,
+                                   nullptr)
+               == CL_SUCCESS) {
+        seconds = (endNs - startNs) * 1e-9;
+    } else {
+        seconds = std::chrono::duration<double>(end - begin).count();
+    }
+
+    return finished;
+}
+
+auto d_ocl::tunedRange(cl_command_queue queue,
+                       cl_kernel kernel,
+                       const std::string& kernelName,
+                       const std::vector<size_t>& problemSize,
+                       const tuning_launch_func& launch,
+                       nd_range& range) -> bool
+{
+    cl_device_id device = utils::queueDevice(queue);
+    if (device == nullptr) {
+        return false;
+    }
+
+    const std::string path = tuningDatabasePath();
+    const std::string key = tuningKey(device, kernelName, problemSize);
+    {
+        std::lock_guard<std::mutex> lock(g_mutex);
+        std::string value;
+        if (lookup(path, key, value) && deserialize(value, range)) {
+            return true;
+        }
+    }
+
+    double bestSeconds = std::numeric_limits<double>::max();
+    for (const nd_range& candidate :
+         workSizeCandidates(kernel, device, problemSize)) {
+        double seconds;
+        // warm up e.g. caches and lazy driver allocations
+        if (!timeLaunch(launch, candidate, seconds)) {
+            // e.g. too many resources for this local size; not a candidate
+            continue;
+        }
+
+        double fastest = std::numeric_limits<double>::max();
+        for (int run = 0; run < D_OCL_TUNING_RUNS; run++) {
+            if (timeLaunch(launch, candidate, seconds)) {
+                fastest = std::min(fastest, seconds);
+            }
+        }
+        if (fastest < bestSeconds) {
+            bestSeconds = fastest;
+            range = candidate;
+        }
+    }
+
+    if (bestSeconds == std::numeric_limits<double>::max()) {
+        std::cerr << "no work size could launch " << kernelName << std::endl;
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(g_mutex);
+    store(path, key, serialize(range));
+    return true;
+}
+
+// seconds from enqueue to the completion of the last command, since the
+// launch can be several commands
+static auto timeChoice(const d_ocl::choice_launch_func& launch,
+                       size_t choice,
+                       double& seconds) -> bool
+{
+    d_ocl::handle<cl_event> event;
+    const auto begin = std::chrono::steady_clock::now();
+    if (!launch(choice, event.outParam()) || !event) {
+        return false;
+    }
+    cl_event waitEvent = event.get();
+    if (clWaitForEvents(1, &waitEvent) != CL_SUCCESS) {
+        return false;
+    }
+    seconds = std::chrono::duration<double>(std::chrono::steady_clock::now()
+                                            - begin)
+                  .count();
+    return true;
+}
+
+auto d_ocl::tunedChoice(cl_command_queue queue,
+                        const std::string& name,
+                        const std::vector<size_t>& problemSize,
+                        size_t count,
+                        const choice_launch_func& launch,
+                        size_t& choice) -> bool
+{
+    cl_device_id device = utils::queueDevice(queue);
+    if (device == nullptr || count == 0) {
+        return false;
+    }
+
+    const std::string path = tuningDatabasePath();
+    const std::string key = tuningKey(device, name, problemSize);
+    {
+        std::lock_guard<std::mutex> lock(g_mutex);
+        std::string value;
+        if (lookup(path, key, value)) {
+            try {
+                choice = std::stoull(value);
+                if (choice < count) {
+                    return true;
+                }
+            } catch (const std::exception&) {
+                // re-time below
+            }
+        }
+    }
+
+    double bestSeconds = std::numeric_limits<double>::max();
+    for (size_t candidate = 0; candidate < count; candidate++) {
+        double seconds;
+        // warm up e.g. program builds and lazy allocations
+        if (!timeChoice(launch, candidate, seconds)) {
+            continue;
+        }
+
+        double fastest = std::numeric_limits<double>::max();
+        for (int run = 0; run < D_OCL_TUNING_RUNS; run++) {
+            if (timeChoice(launch, candidate, seconds)) {
+                fastest = std::min(fastest, seconds);
+            }
+        }
+        if (fastest < bestSeconds) {
+            bestSeconds = fastest;
+            choice = candidate;
+        }
+    }
+
+    if (bestSeconds == std::numeric_limits<double>::max()) {
+        std::cerr << "no alternative of " << name << " could launch"
+                  << std::endl;
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(g_mutex);
+    store(path, key, std::to_string(choice));
+    return true;
+}
@@ -0,0 +1,63 @@
+#ifndef D_OCL_TUNER_H
+#define D_OCL_TUNER_H
+
+#include "d_ocl_defines.h"
+#include "d_ocl_kernel.h"
+#include <CL/cl.h>
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace d_ocl {
+// enqueue the kernel once over range, with its args already set.
+// event must be set so the launch can be timed
+using tuning_launch_func
+    = std::function<bool(const nd_range& range, cl_event* event)>;
+
+// enqueue the choice-th of several alternatives once, e.g. algorithms with
+// the same result, and set event to its last command
+using choice_launch_func
+    = std::function<bool(size_t choice, cl_event* event)>;
+
+// file holding the best nd_range per (kernel, device, problem size), and
+// the best alternative of tunedChoice().
+// defaults to utils::cacheDirectory() + "/tuning.db".
+// set to empty to tune in memory only
+auto D_OCL_API tuningDatabasePath() -> std::string;
+auto D_OCL_API setTuningDatabasePath(const std::string& path) -> void;
+
+// local sizes from CL_KERNEL_PREFERRED_WORK_GROUP_SIZE_MULTIPLE up to
+// CL_KERNEL_WORK_GROUP_SIZE, each with global sizes from 1 work-item per
+// element down to a few work-groups per compute unit.
+// problemSize is # elements in each of 1 ~ 3 dimensions
+auto D_OCL_API workSizeCandidates(cl_kernel kernel,
+                                  cl_device_id device,
+                                  const std::vector<size_t>& problemSize)
+    -> std::vector<nd_range>;
+
+// best nd_range for kernelName on the queue's device and problemSize.
+// read from the tuning database if known, else every candidate is timed with
+// launch and the fastest is stored.
+// the kernel must cope with any global size, e.g. with a grid-stride loop,
+// and launching it repeatedly must be harmless
+auto D_OCL_API tunedRange(cl_command_queue queue,
+                          cl_kernel kernel,
+                          const std::string& kernelName,
+                          const std::vector<size_t>& problemSize,
+                          const tuning_launch_func& launch,
+                          nd_range& range) -> bool;
+
+// fastest of count alternatives for name on the queue's device and
+// problemSize, timed from enqueue to completion of the last command.
+// read from the tuning database if known, else every alternative is timed
+// with launch and the fastest is stored.
+// the queue must be otherwise idle, and launching repeatedly harmless
+auto D_OCL_API tunedChoice(cl_command_queue queue,
+                           const std::string& name,
+                           const std::vector<size_t>& problemSize,
+                           size_t count,
+                           const choice_launch_func& launch,
+                           size_t& choice) -> bool;
+} // namespace d_ocl
+
+#endif // D_OCL_TUNER_H
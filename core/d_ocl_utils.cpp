@@ -1,8 +1,22 @@
 #include "d_ocl_utils.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <dirent.h>
+#include <fstream>
+#include <iomanip>
 #include <iostream>
 #include <limits>
 #include <opencv2/imgcodecs.hpp>
 #include <opencv2/imgproc.hpp>
+#include <sstream>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+
+// work-groups per compute unit of gridStrideGroups()
+#define D_OCL_GRID_STRIDE_GROUPS_PER_UNIT 4
 
 auto d_ocl::utils::errorString(cl_int code) -> std::string
 {
@@ -163,6 +177,20 @@ auto d_ocl::utils::checkRun(const std::string& funcName, cl_int funcRetval)
     return false;
 }
 
+auto d_ocl::utils::createBuffer(cl_context context,
+                                cl_mem_flags flags,
+                                size_t size,
+                                void* hostPtr /*= nullptr*/)
+    -> std::shared_ptr<manager<cl_mem>>
+{
+    cl_int status;
+    cl_mem buffer = clCreateBuffer(context, flags, size, hostPtr, &status);
+    if (!checkRun("clCreateBuffer", status)) {
+        return std::shared_ptr<manager<cl_mem>>();
+    }
+    return manager<cl_mem>::makeShared(buffer, clReleaseMemObject);
+}
+
 auto d_ocl::utils::toRgba(const cv::Mat* bgraMat, cv::Mat* rgbaMat) -> bool
 {
     *rgbaMat = *bgraMat;
@@ -246,6 +274,24 @@ auto d_ocl::utils::toFloat(const cv::Mat* inMat, cv::Mat* floatMat) -> bool
     return true;
 }
 
+auto d_ocl::utils::deviceToRgba(const cv::Mat* bgraMat, cv::Mat* rgbaMat)
+    -> bool
+{
+    return toRgba(bgraMat, rgbaMat);
+}
+
+auto d_ocl::utils::deviceToGreyscale(const cv::Mat* inMat, cv::Mat* greyMat)
+    -> bool
+{
+    return toGreyscale(inMat, greyMat);
+}
+
+auto d_ocl::utils::deviceToFloat(const cv::Mat* inMat, cv::Mat* floatMat)
+    -> bool
+{
+    return toFloat(inMat, floatMat);
+}
+
 // wrapper around clGetDeviceInfo()
 template<typename T>
 auto d_ocl::utils::information(cl_device_id device,
@@ -270,6 +316,21 @@ auto d_ocl::utils::information(cl_device_id device,
             device, param_name, requiredSize, param_value.data(), nullptr));
 };
 
+// instantiate for the value types of the clGetDeviceInfo() params we query
+template auto d_ocl::utils::information<char>(cl_device_id,
+                                              cl_device_info,
+                                              std::vector<char>&,
+                                              char) -> bool;
+template auto d_ocl::utils::information<cl_uint>(cl_device_id,
+                                                 cl_device_info,
+                                                 std::vector<cl_uint>&,
+                                                 cl_uint) -> bool;
+// cl_ulong is also size_t on the x86_64 linux we build for
+template auto d_ocl::utils::information<cl_ulong>(cl_device_id,
+                                                  cl_device_info,
+                                                  std::vector<cl_ulong>&,
+                                                  cl_ulong) -> bool;
+
 auto d_ocl::utils::description(cl_device_id device) -> std::string
 {
     std::ostringstream stream;
@@ -315,6 +376,148 @@ auto d_ocl::utils::description(cl_device_id device) -> std::string
     return stream.str();
 }
 
+auto d_ocl::utils::contextDevices(cl_context context)
+    -> std::vector<cl_device_id>
+{
+    size_t requiredSize = 0;
+    if (!checkRun(
+            "clGetContextInfo",
+            clGetContextInfo(
+                context, CL_CONTEXT_DEVICES, 0, nullptr, &requiredSize))) {
+        return std::vector<cl_device_id>();
+    }
+
+    std::vector<cl_device_id> devices(requiredSize / sizeof(cl_device_id));
+    if (!checkRun("clGetContextInfo",
+                  clGetContextInfo(context,
+                                   CL_CONTEXT_DEVICES,
+                                   requiredSize,
+                                   devices.data(),
+                                   nullptr))) {
+        devices.clear();
+    }
+    return devices;
+}
+
+auto d_ocl::utils::deviceName(cl_device_id device) -> std::string
+{
+    std::vector<char> name;
+    if (!information<char>(device, CL_DEVICE_NAME, name, '\0')) {
+        return std::string();
+    }
+    return name.data();
+}
+
+auto d_ocl::utils::queueDevice(cl_command_queue queue) -> cl_device_id
+{
+    cl_device_id device = nullptr;
+    checkRun("clGetCommandQueueInfo",
+             clGetCommandQueueInfo(
+                 queue, CL_QUEUE_DEVICE, sizeof(device), &device, nullptr));
+    return device;
+}
+
+auto d_ocl::utils::queueContext(cl_command_queue queue) -> cl_context
+{
+    cl_context context = nullptr;
+    checkRun("clGetCommandQueueInfo",
+             clGetCommandQueueInfo(
+                 queue, CL_QUEUE_CONTEXT, sizeof(context), &context, nullptr));
+    return context;
+}
+
+auto d_ocl::utils::kernelWorkGroupSize(cl_kernel kernel, cl_device_id device)
+    -> size_t
+{
+    size_t size = 0;
+    checkRun("clGetKernelWorkGroupInfo",
+             clGetKernelWorkGroupInfo(kernel,
+                                      device,
+                                      CL_KERNEL_WORK_GROUP_SIZE,
+                                      sizeof(size),
+                                      &size,
+                                      nullptr));
+    return size;
+}
+
+auto d_ocl::utils::preferredWorkGroupSizeMultiple(cl_kernel kernel,
+                                                  cl_device_id device)
+    -> size_t
+{
+    size_t multiple = 1;
+    if (!checkRun("clGetKernelWorkGroupInfo",
+                  clGetKernelWorkGroupInfo(
+                      kernel,
+                      device,
+                      CL_KERNEL_PREFERRED_WORK_GROUP_SIZE_MULTIPLE,
+                      sizeof(multiple),
+                      &multiple,
+                      nullptr))
+        || multiple == 0) {
+        return 1;
+    }
+    return multiple;
+}
+
+auto d_ocl::utils::hostUnifiedMemory(cl_device_id device) -> bool
+{
+    std::vector<cl_ulong> deviceType;
+    if (information<cl_ulong>(device, CL_DEVICE_TYPE, deviceType, 0)
+        && (deviceType[0] & CL_DEVICE_TYPE_CPU) != 0) {
+        return true;
+    }
+
+    // deprecated by opencl 2.0 but still reported by every driver we target
+    std::vector<cl_uint> unified;
+    return information<cl_uint>(
+               device, CL_DEVICE_HOST_UNIFIED_MEMORY, unified, CL_FALSE)
+           && unified[0] == CL_TRUE;
+}
+
+auto d_ocl::utils::hasExtension(cl_device_id device,
+                                const std::string& extension) -> bool
+{
+    std::vector<char> extensions;
+    if (!information<char>(device, CL_DEVICE_EXTENSIONS, extensions, '\0')) {
+        return false;
+    }
+    // space-separated names, some prefixes of others
+    std::istringstream names(extensions.data());
+    std::string name;
+    while (names >> name) {
+        if (name == extension) {
+            return true;
+        }
+    }
+    return false;
+}
+
+auto d_ocl::utils::imageLimits(cl_device_id device) -> image_limits
+{
+    image_limits limits;
+    std::vector<size_t> maxWidth;
+    std::vector<size_t> maxHeight;
+    std::vector<cl_ulong> maxAllocation;
+    std::vector<cl_ulong> globalMemory;
+    if (!information<size_t>(
+            device, CL_DEVICE_IMAGE2D_MAX_WIDTH, maxWidth, 0)
+        || !information<size_t>(
+            device, CL_DEVICE_IMAGE2D_MAX_HEIGHT, maxHeight, 0)
+        || !information<cl_ulong>(
+            device, CL_DEVICE_MAX_MEM_ALLOC_SIZE, maxAllocation, 0)
+        || !information<cl_ulong>(
+            device, CL_DEVICE_GLOBAL_MEM_SIZE, globalMemory, 0)) {
+        std::cerr << "error querying image limits" << std::endl;
+        return limits;
+    }
+
+    limits.maxWidth = maxWidth[0];
+    limits.maxHeight = maxHeight[0];
+    limits.maxAllocation = maxAllocation[0];
+    limits.globalMemory = globalMemory[0];
+    return limits;
+}
+
 auto d_ocl::utils::maxComputeUnits(cl_device_id device) -> cl_uint
 {
     // # parallel compute units
@@ -362,3 +565,171 @@ auto d_ocl::utils::maxWorkGroupSize(cl_device_id device) -> std::vector<size_t>
 
     return maxWorkItemsByDim;
 }
+
+auto d_ocl::utils::powerOf2WorkGroupSize(cl_device_id device,
+                                         cl_kernel kernel,
+                                         size_t minSize,
+                                         size_t maxSize /*= 256*/) -> size_t
+{
+    std::vector<size_t> maxSizes = maxWorkGroupSize(device);
+    if (maxSizes.empty()) {
+        return 0;
+    }
+    size_t limit = std::min(maxSizes[0], maxSize);
+    if (kernel) {
+        limit = std::min(limit, kernelWorkGroupSize(kernel, device));
+    }
+    if (minSize == 0 || limit < minSize) {
+        return 0;
+    }
+    size_t size = minSize;
+    while (size * 2 <= limit) {
+        size *= 2;
+    }
+    return size;
+}
+
+auto d_ocl::utils::gridStrideGroups(cl_device_id device) -> size_t
+{
+    return std::max<size_t>(maxComputeUnits(device), 1)
+           * D_OCL_GRID_STRIDE_GROUPS_PER_UNIT;
+}
+
+auto d_ocl::utils::hash64(const void* data,
+                          size_t size,
+                          uint64_t seed /*= 14695981039346656037ULL*/)
+    -> uint64_t
+{
+    const uint64_t prime = 1099511628211ULL;
+    const unsigned char* bytes = reinterpret_cast<const unsigned char*>(data);
+
+    uint64_t hash = seed;
+    for (size_t i = 0; i < size; i++) {
+        hash ^= bytes[i];
+        hash *= prime;
+    }
+    return hash;
+}
+
+auto d_ocl::utils::hashString(uint64_t hash) -> std::string
+{
+    std::ostringstream stream;
+    stream << std::hex << std::setw(16) << std::setfill('0') << hash;
+    return stream.str();
+}
+
+auto d_ocl::utils::cacheDirectory() -> std::string
+{
+    const char* path = std::getenv("D_OCL_CACHE_DIR");
+    if (path != nullptr && path[0] != '\0') {
+        return path;
+    }
+
+    path = std::getenv("XDG_CACHE_HOME");
+    if (path != nullptr && path[0] != '\0') {
+        return std::string(path) + "/d-ocl";
+    }
+
+    path = std::getenv("HOME");
+    if (path != nullptr && path[0] != '\0') {
+        return std::string(path) + "/.cache/d-ocl";
+    }
+
+    return std::string();
+}
+
+auto d_ocl::utils::makeDirectories(const std::string& path) -> bool
+{
+    if (path.empty()) {
+        return false;
+    }
+
+    // create each parent in turn. EEXIST is fine,
+    // e.g. another process may have just created it
+    for (size_t pos = path.find('/', 1); ; pos = path.find('/', pos + 1)) {
+        const std::string parent = path.substr(0, pos);
+        if (mkdir(parent.c_str(), 0755) != 0 && errno != EEXIST) {
+            std::cerr << "mkdir(" << parent << ") failed: " << errno
+                      << std::endl;
+            return false;
+        }
+        if (pos == std::string::npos) {
+            break;
+        }
+    }
+    return true;
+}
+
+auto d_ocl::utils::listFiles(const std::string& directory,
+                             std::vector<std::string>& filePaths) -> bool
+{
+    DIR* dir = opendir(directory.c_str());
+    if (dir == nullptr) {
+        std::cerr << "opendir(" << directory << ") failed: " << errno
+                  << std::endl;
+        return false;
+    }
+
+    filePaths.clear();
+    for (dirent* entry = readdir(dir); entry != nullptr; entry = readdir(dir)) {
+        const std::string filePath = directory + "/" + entry->d_name;
+        // d_type is DT_UNKNOWN on some file systems, so stat() instead
+        struct stat info;
+        if (stat(filePath.c_str(), &info) == 0 && S_ISREG(info.st_mode)) {
+            filePaths.push_back(filePath);
+        }
+    }
+    closedir(dir);
+
+    // readdir() order is arbitrary
+    std::sort(filePaths.begin(), filePaths.end());
+    return true;
+}
+
+auto d_ocl::utils::readFile(const std::string& filePath, std::string& contents)
+    -> bool
+{
+    std::ifstream stream(filePath, std::ios::binary | std::ios::ate);
+    if (!stream) {
+        return false;
+    }
+
+    const std::streamoff size = stream.tellg();
+    if (size < 0) {
+        return false;
+    }
+    contents.resize(static_cast<size_t>(size));
+    stream.seekg(0);
+    return static_cast<bool>(stream.read(&contents[0], size));
+}
+
+auto d_ocl::utils::writeFileAtomic(const std::string& filePath,
+                                   const std::string& contents) -> bool
+{
+    // unique per process and thread so concurrent writers don't clobber
+    // each other's temporary file
+    std::ostringstream tempPath;
+    tempPath << filePath << ".tmp." << getpid() << "."
+             << std::hash<std::thread::id>()(std::this_thread::get_id());
+
+    {
+        std::ofstream stream(tempPath.str(),
+                             std::ios::binary | std::ios::trunc);
+        if (!stream
+            || !stream.write(contents.data(), contents.size()).flush()) {
+            std::cerr << "error writing " << tempPath.str() << std::endl;
+            std::remove(tempPath.str().c_str());
+            return false;
+        }
+    }
+
+    // rename() replaces filePath atomically.
+    // last writer wins, which is fine since every writer has the same data
+    if (std::rename(tempPath.str().c_str(), filePath.c_str()) != 0) {
+        std::cerr << "error renaming " << tempPath.str() << " to " << filePath
+                  << std::endl;
+        std::remove(tempPath.str().c_str());
+        return false;
+    }
+    return true;
+}
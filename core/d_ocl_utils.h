@@ -3,7 +3,10 @@
 
 #include "d_ocl_defines.h"
 #include <CL/cl.h>
+#include <cstdint>
 #include <functional>
+#include <memory>
+#include <string>
 #include <vector>
 
 namespace cv {
@@ -36,6 +39,15 @@ struct manager
     opencl_release_func releaseFunc{nullptr};
 };
 
+// clCreateBuffer() of size bytes, released by the returned manager.
+// hostPtr as in clCreateBuffer(), e.g. for CL_MEM_COPY_HOST_PTR.
+// empty shared_ptr if it failed
+auto D_OCL_API createBuffer(cl_context context,
+                            cl_mem_flags flags,
+                            size_t size,
+                            void* hostPtr = nullptr)
+    -> std::shared_ptr<manager<cl_mem>>;
+
 using mat_convert_func = std::function<bool(const cv::Mat*, cv::Mat*)>;
 // change channel order from opencv-default bgra to rgba
 // rgbaMat will always be 1 or 4 channels.
@@ -44,6 +56,14 @@ auto D_OCL_API toRgba(const cv::Mat* bgraMat, cv::Mat* rgbaMat) -> bool;
 auto D_OCL_API toGreyscale(const cv::Mat* inMat, cv::Mat* greyMat) -> bool;
 // convert data depth to 32-bit float 0.0~1.0
 auto D_OCL_API toFloat(const cv::Mat* inMat, cv::Mat* floatMat) -> bool;
+// device-side versions of the above for 8-bit images.
+// at the end of createInputImage(queue, ...)'s matConverts the raw decoded
+// image is uploaded and a kernel converts it (see d_ocl_convert.h).
+// called on the host, e.g. by loadImage(), they run the host versions
+auto D_OCL_API deviceToRgba(const cv::Mat* bgraMat, cv::Mat* rgbaMat) -> bool;
+auto D_OCL_API deviceToGreyscale(const cv::Mat* inMat, cv::Mat* greyMat)
+    -> bool;
+auto D_OCL_API deviceToFloat(const cv::Mat* inMat, cv::Mat* floatMat) -> bool;
 
 // wrapper around clGetDeviceInfo()
 // will query value count for param_name first then call param_value.resize()
@@ -54,12 +74,85 @@ auto D_OCL_API information(cl_device_id device,
                            T default_value) -> bool;
 // generate human-readable description
 auto D_OCL_API description(cl_device_id device) -> std::string;
+// CL_CONTEXT_DEVICES
+auto D_OCL_API contextDevices(cl_context context) -> std::vector<cl_device_id>;
+// CL_DEVICE_NAME e.g. "Intel(R) Gen9 HD Graphics NEO"
+auto D_OCL_API deviceName(cl_device_id device) -> std::string;
+
+// 64-bit fnv-1a. pass the previous return value as seed to hash in pieces.
+// stable across runs and hosts unlike std::hash, so usable for disk keys
+auto D_OCL_API hash64(const void* data,
+                      size_t size,
+                      uint64_t seed = 14695981039346656037ULL) -> uint64_t;
+// zero-padded 16 digit hex of hash64()
+auto D_OCL_API hashString(uint64_t hash) -> std::string;
+
+// root directory for on-disk caches like program binaries.
+// $D_OCL_CACHE_DIR, else $XDG_CACHE_HOME/d-ocl, else $HOME/.cache/d-ocl.
+// empty if none of the above could be determined
+auto D_OCL_API cacheDirectory() -> std::string;
+// mkdir -p
+auto D_OCL_API makeDirectories(const std::string& path) -> bool;
+// regular files directly in directory, sorted by name.
+// paths are directory + "/" + file name
+auto D_OCL_API listFiles(const std::string& directory,
+                         std::vector<std::string>& filePaths) -> bool;
+// read whole file at filePath into contents
+auto D_OCL_API readFile(const std::string& filePath, std::string& contents)
+    -> bool;
+// write to a temporary file next to filePath then rename it over filePath,
+// so concurrent readers (also in other processes) never see a partial file
+auto D_OCL_API writeFileAtomic(const std::string& filePath,
+                               const std::string& contents) -> bool;
+
+// CL_QUEUE_DEVICE, CL_QUEUE_CONTEXT of queue
+auto D_OCL_API queueDevice(cl_command_queue queue) -> cl_device_id;
+auto D_OCL_API queueContext(cl_command_queue queue) -> cl_context;
+
+// CL_KERNEL_WORK_GROUP_SIZE i.e. max work-group size for this kernel,
+// which can be less than the device's due to e.g. register usage
+auto D_OCL_API kernelWorkGroupSize(cl_kernel kernel, cl_device_id device)
+    -> size_t;
+// CL_KERNEL_PREFERRED_WORK_GROUP_SIZE_MULTIPLE e.g. simd / warp width
+auto D_OCL_API preferredWorkGroupSizeMultiple(cl_kernel kernel,
+                                              cl_device_id device) -> size_t;
+
+// true if device and host share physical memory, e.g. integrated gpus and
+// cpu devices, so mapping a host-visible memory object copies nothing
+auto D_OCL_API hostUnifiedMemory(cl_device_id device) -> bool;
+// true if CL_DEVICE_EXTENSIONS lists extension e.g. "cl_khr_mipmap_image"
+auto D_OCL_API hasExtension(cl_device_id device, const std::string& extension)
+    -> bool;
+
+// real size limits of memory objects on a device
+struct D_OCL_API image_limits
+{
+    // CL_DEVICE_IMAGE2D_MAX_WIDTH / HEIGHT in pixels
+    size_t maxWidth{0};
+    size_t maxHeight{0};
+    // CL_DEVICE_MAX_MEM_ALLOC_SIZE i.e. the largest single memory object
+    cl_ulong maxAllocation{0};
+    // CL_DEVICE_GLOBAL_MEM_SIZE
+    cl_ulong globalMemory{0};
+};
+auto D_OCL_API imageLimits(cl_device_id device) -> image_limits;
 
 // max compute units = max work groups
 auto D_OCL_API maxComputeUnits(cl_device_id device) -> cl_uint;
 // convenience func for maximum possible # work-items in a work-group per
 // dimension
 auto D_OCL_API maxWorkGroupSize(cl_device_id device) -> std::vector<size_t>;
+// the largest power of 2 work-group size from minSize up to maxSize that
+// device takes in dimension 0, and kernel too unless it is nullptr.
+// 0 if not even minSize fits
+auto D_OCL_API powerOf2WorkGroupSize(cl_device_id device,
+                                     cl_kernel kernel,
+                                     size_t minSize,
+                                     size_t maxSize = 256) -> size_t;
+// # work-groups for a kernel that strides over all its input, e.g. a
+// reduction or histogram: a few per compute unit, enough to hide memory
+// latency
+auto D_OCL_API gridStrideGroups(cl_device_id device) -> size_t;
 } // namespace utils
 } // namespace d_ocl
 
@@ -0,0 +1,597 @@
+#include "d_ocl_warp.h"
+#include "d_ocl.h"
+#include "d_ocl_tuner.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <string>
+
+#define D_OCL_WARP_PROGRAM D_OCL_RESOURCE_ROOT "/d_ocl_warp." D_OCL_KERN_EXT
+// most fractional bits of fixed16 maps, as many as samplers interpolate by
+#define D_OCL_REMAP_FIXED_BITS 8
+
+auto d_ocl::warp_matrix::fromMat(const cv::Mat& matrix) -> warp_matrix
+{
+    warp_matrix result;
+    if ((matrix.rows != 2 && matrix.rows != 3) || matrix.cols != 3
+        || (matrix.type() != CV_32FC1 && matrix.type() != CV_64FC1)) {
+        std::cerr << "warp matrix must be 2 x 3 or 3 x 3" << std::endl;
+        return result;
+    }
+    for (int row = 0; row < matrix.rows; row++) {
+        for (int col = 0; col < 3; col++) {
+            result.m[row * 3 + col] = matrix.type() == CV_32FC1
+                                          ? matrix.at<float>(row, col)
+                                          : matrix.at<double>(row, col);
+        }
+    }
+    return result;
+}
+
+auto d_ocl::warp_matrix::rotation(double centerX,
+                                  double centerY,
+                                  double degrees,
+                                  double scale /*= 1.0*/) -> warp_matrix
+{
+    const double radians = degrees * CV_PI / 180.0;
+    const double alpha = std::cos(radians) * scale;
+    const double beta = std::sin(radians) * scale;
+    warp_matrix result;
+    result.m[0] = alpha;
+    result.m[1] = beta;
+    result.m[2] = (1.0 - alpha) * centerX - beta * centerY;
+    result.m[3] = -beta;
+    result.m[4] = alpha;
+    result.m[5] = beta * centerX + (1.0 - alpha) * centerY;
+    return result;
+}
+
+auto d_ocl::warp_matrix::translation(double x, double y) -> warp_matrix
+{
+    warp_matrix result;
+    result.m[2] = x;
+    result.m[5] = y;
+    return result;
+}
+
+auto d_ocl::warp_matrix::scaling(double x, double y) -> warp_matrix
+{
+    warp_matrix result;
+    result.m[0] = x;
+    result.m[4] = y;
+    return result;
+}
+
+auto d_ocl::warp_matrix::operator*(const warp_matrix& other) const
+    -> warp_matrix
+{
+    warp_matrix result;
+    for (int row = 0; row < 3; row++) {
+        for (int col = 0; col < 3; col++) {
+            result.m[row * 3 + col] = m[row * 3] * other.m[col]
+                                      + m[row * 3 + 1] * other.m[3 + col]
+                                      + m[row * 3 + 2] * other.m[6 + col];
+        }
+    }
+    return result;
+}
+
+auto d_ocl::warp_matrix::affine() const -> bool
+{
+    return m[6] == 0.0 && m[7] == 0.0 && m[8] == 1.0;
+}
+
+auto d_ocl::warp_matrix::inverse(warp_matrix& result) const -> bool
+{
+    // adjugate over determinant
+    const double cofactors[9] = {m[4] * m[8] - m[5] * m[7],
+                                 m[2] * m[7] - m[1] * m[8],
+                                 m[1] * m[5] - m[2] * m[4],
+                                 m[5] * m[6] - m[3] * m[8],
+                                 m[0] * m[8] - m[2] * m[6],
+                                 m[2] * m[3] - m[0] * m[5],
+                                 m[3] * m[7] - m[4] * m[6],
+                                 m[1] * m[6] - m[0] * m[7],
+                                 m[0] * m[4] - m[1] * m[3]};
+    const double determinant
+        = m[0] * cofactors[0] + m[1] * cofactors[3] + m[2] * cofactors[6];
+    if (determinant == 0.0) {
+        return false;
+    }
+    for (int i = 0; i < 9; i++) {
+        result.m[i] = cofactors[i] / determinant;
+    }
+    return true;
+}
+
+// rows of the inverse of transform, as the kernels take it: they map
+// destination pixels back to the source
+static auto inverseRows(const d_ocl::warp_matrix& transform,
+                        cl_float4 matrixRows[3]) -> bool
+{
+    d_ocl::warp_matrix inverse;
+    if (!transform.inverse(inverse)) {
+        std::cerr << "warp by a singular matrix" << std::endl;
+        return false;
+    }
+    for (int row = 0; row < 3; row++) {
+        matrixRows[row].s[0] = static_cast<cl_float>(inverse.m[row * 3]);
+        matrixRows[row].s[1] = static_cast<cl_float>(inverse.m[row * 3 + 1]);
+        matrixRows[row].s[2] = static_cast<cl_float>(inverse.m[row * 3 + 2]);
+        matrixRows[row].s[3] = 0.0f;
+    }
+    return true;
+}
+
+d_ocl::warp::warp(cl_context context,
+                  warp_interpolation interpolation
+                  /*= warp_interpolation::bilinear*/)
+    : context(context), interpolation(interpolation)
+{
+    std::shared_ptr<utils::manager<cl_program>> program = createProgram(
+        context,
+        D_OCL_WARP_PROGRAM,
+        std::string(),
+        {{"INTERPOLATION", std::to_string(static_cast<int>(interpolation))}});
+    if (!program) {
+        return;
+    }
+    affineKernel
+        = launcher<cl_mem, cl_mem, int, int, cl_float4, cl_float4, cl_float4>(
+            program, "warp_affine");
+    perspectiveKernel
+        = launcher<cl_mem, cl_mem, int, int, cl_float4, cl_float4, cl_float4>(
+            program, "warp_perspective");
+    batchKernel = launcher<cl_mem, cl_mem, int, int, cl_mem>(program,
+                                                             "warp_batch");
+}
+
+d_ocl::warp::operator bool() const
+{
+    return static_cast<bool>(affineKernel)
+           && static_cast<bool>(perspectiveKernel)
+           && static_cast<bool>(batchKernel);
+}
+
+auto d_ocl::warp::run(cl_command_queue queue,
+                      cl_mem inputImage,
+                      cl_mem outputImage,
+                      int cols,
+                      int rows,
+                      const warp_matrix& transform,
+                      const std::vector<cl_event>& waitList,
+                      cl_event* event) -> bool
+{
+    cl_float4 matrixRows[3];
+    if (!*this || !inverseRows(transform, matrixRows)) {
+        return false;
+    }
+
+    const tuned_range& tuned
+        = transform.affine() ? tunedAffine : tunedPerspective;
+    nd_range range;
+    if (tuned.cols == cols && tuned.rows == rows) {
+        range = tuned.range;
+    } else {
+        range.global = {(size_t)cols, (size_t)rows};
+    }
+    return (transform.affine() ? affineKernel : perspectiveKernel)
+        .run(queue,
+             range,
+             waitList,
+             event,
+             inputImage,
+             outputImage,
+             cols,
+             rows,
+             matrixRows[0],
+             matrixRows[1],
+             matrixRows[2]);
+}
+
+auto d_ocl::warp::tune(cl_command_queue queue,
+                       cl_mem inputImage,
+                       cl_mem outputImage,
+                       int cols,
+                       int rows,
+                       const warp_matrix& transform) -> bool
+{
+    cl_float4 matrixRows[3];
+    if (!*this || cols <= 0 || rows <= 0
+        || !inverseRows(transform, matrixRows)) {
+        return false;
+    }
+
+    auto& kernel = transform.affine() ? affineKernel : perspectiveKernel;
+    if (!kernel.setArgs(inputImage,
+                        outputImage,
+                        cols,
+                        rows,
+                        matrixRows[0],
+                        matrixRows[1],
+                        matrixRows[2])) {
+        return false;
+    }
+    // per interpolation, which costs differently
+    const std::string name
+        = std::string(transform.affine() ? "warp_affine" : "warp_perspective")
+          + " " + std::to_string(static_cast<int>(interpolation));
+    tuned_range& tuned = transform.affine() ? tunedAffine : tunedPerspective;
+    nd_range range;
+    if (!tunedRange(
+            queue,
+            kernel.kernel(),
+            name,
+            {(size_t)cols, (size_t)rows},
+            [&](const nd_range& candidate, cl_event* event) {
+                return kernel.enqueue(queue, candidate, {}, event);
+            },
+            range)) {
+        return false;
+    }
+    tuned.cols = cols;
+    tuned.rows = rows;
+    tuned.range = range;
+    return true;
+}
+
+auto d_ocl::warp::runBatch(cl_command_queue queue,
+                           cl_mem inputImage,
+                           cl_mem outputArray,
+                           int cols,
+                           int rows,
+                           const std::vector<warp_matrix>& transforms,
+                           const std::vector<cl_event>& waitList,
+                           cl_event* event) -> bool
+{
+    if (!*this || transforms.empty()) {
+        return false;
+    }
+    // 3 rows per transform, as run() passes them
+    std::vector<cl_float4> inverses(transforms.size() * 3);
+    for (size_t i = 0; i < transforms.size(); i++) {
+        if (!inverseRows(transforms[i], &inverses[i * 3])) {
+            return false;
+        }
+    }
+
+    // released here, but kept by the runtime until the kernel has read it
+    std::shared_ptr<utils::manager<cl_mem>> matrices = utils::createBuffer(
+        context,
+        CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR | CL_MEM_HOST_NO_ACCESS,
+        inverses.size() * sizeof(cl_float4),
+        inverses.data());
+    if (!matrices) {
+        return false;
+    }
+
+    nd_range range;
+    range.global = {(size_t)cols, (size_t)rows, transforms.size()};
+    return batchKernel.run(queue,
+                           range,
+                           waitList,
+                           event,
+                           inputImage,
+                           outputArray,
+                           cols,
+                           rows,
+                           matrices->openclObject);
+}
+
+d_ocl::remap::remap(cl_context context,
+                    warp_interpolation interpolation
+                    /*= warp_interpolation::bilinear*/,
+                    remap_format format /*= remap_format::fixed16*/,
+                    size_t capacity /*= 16*/)
+    : context(context),
+      mapFormat(format),
+      maxCached(std::max<size_t>(capacity, 1))
+{
+    std::shared_ptr<utils::manager<cl_program>> program = createProgram(
+        context,
+        D_OCL_WARP_PROGRAM,
+        std::string(),
+        {{"INTERPOLATION", std::to_string(static_cast<int>(interpolation))}});
+    if (!program) {
+        return;
+    }
+    buildFloatKernel
+        = launcher<cl_mem, int, int, cl_float4, cl_float4, cl_float4>(
+            program, "remap_build_float");
+    buildFixedKernel = launcher<cl_mem,
+                                int,
+                                int,
+                                cl_float4,
+                                cl_float4,
+                                cl_float4,
+                                int,
+                                int,
+                                float>(program, "remap_build_fixed");
+    applyFloatKernel = launcher<cl_mem, cl_mem, cl_mem, int, int>(
+        program, "remap_apply_float");
+    applyFixedKernel = launcher<cl_mem, cl_mem, cl_mem, int, int, float>(
+        program, "remap_apply_fixed");
+}
+
+d_ocl::remap::operator bool() const
+{
+    return static_cast<bool>(buildFloatKernel)
+           && static_cast<bool>(buildFixedKernel)
+           && static_cast<bool>(applyFloatKernel)
+           && static_cast<bool>(applyFixedKernel);
+}
+
+// scale of fixed16 coordinates into a sourceCols x sourceRows source: the
+// most fractional bits that leave -2 and the size + 1 in 16 bits
+static auto fixedScale(int sourceCols, int sourceRows, float& scale) -> bool
+{
+    const int extent = std::max(sourceCols, sourceRows) + 2;
+    int bits = D_OCL_REMAP_FIXED_BITS;
+    while (bits > 0 && (extent << bits) > 32767) {
+        bits--;
+    }
+    if ((extent << bits) > 32767) {
+        std::cerr << "source of " << sourceCols << " x " << sourceRows
+                  << " pixels too large for a fixed16 map" << std::endl;
+        return false;
+    }
+    scale = static_cast<float>(1 << bits);
+    return true;
+}
+
+auto d_ocl::remap::createMap(int cols,
+                             int rows,
+                             int sourceCols,
+                             int sourceRows,
+                             const void* hostData)
+    -> std::shared_ptr<remap_map>
+{
+    std::shared_ptr<remap_map> map = std::make_shared<remap_map>();
+    map->format = mapFormat;
+    map->cols = cols;
+    map->rows = rows;
+    if (mapFormat == remap_format::fixed16
+        && !fixedScale(sourceCols, sourceRows, map->scale)) {
+        return std::shared_ptr<remap_map>();
+    }
+
+    cl_image_format imageFormat;
+    imageFormat.image_channel_order = CL_RG;
+    imageFormat.image_channel_data_type
+        = mapFormat == remap_format::fixed16 ? CL_SIGNED_INT16 : CL_FLOAT;
+    cl_image_desc imageDesc;
+    memset(&imageDesc, 0, sizeof(imageDesc));
+    imageDesc.image_type = CL_MEM_OBJECT_IMAGE2D;
+    imageDesc.image_width = cols;
+    imageDesc.image_height = rows;
+    cl_int status;
+    map->image = utils::manager<cl_mem>::makeShared(
+        clCreateImage(context,
+                      (hostData != nullptr
+                           ? CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR
+                           : CL_MEM_READ_WRITE)
+                          | CL_MEM_HOST_NO_ACCESS,
+                      &imageFormat,
+                      &imageDesc,
+                      const_cast<void*>(hostData),
+                      &status),
+        clReleaseMemObject);
+    if (!utils::checkRun("clCreateImage", status)) {
+        return std::shared_ptr<remap_map>();
+    }
+    return map;
+}
+
+auto d_ocl::remap::map(cl_command_queue queue,
+                       int cols,
+                       int rows,
+                       int sourceCols,
+                       int sourceRows,
+                       const warp_matrix& transform,
+                       const std::vector<cl_event>& waitList)
+    -> std::shared_ptr<remap_map>
+{
+    if (!*this || cols <= 0 || rows <= 0) {
+        return std::shared_ptr<remap_map>();
+    }
+    for (cache_entry& entry : entries) {
+        if (entry.cols == cols && entry.rows == rows
+            && entry.sourceCols == sourceCols && entry.sourceRows == sourceRows
+            && std::equal(transform.m, transform.m + 9, entry.transform.m)) {
+            entry.lastUse = ++uses;
+            return entry.map;
+        }
+    }
+
+    cl_float4 matrixRows[3];
+    if (!inverseRows(transform, matrixRows)) {
+        return std::shared_ptr<remap_map>();
+    }
+    std::shared_ptr<remap_map> map
+        = createMap(cols, rows, sourceCols, sourceRows, nullptr);
+    if (!map) {
+        return map;
+    }
+    nd_range range;
+    range.global = {(size_t)cols, (size_t)rows};
+    const bool built
+        = mapFormat == remap_format::fixed16
+              ? buildFixedKernel.run(queue,
+                                     range,
+                                     waitList,
+                                     map->built.outParam(),
+                                     map->image->openclObject,
+                                     cols,
+                                     rows,
+                                     matrixRows[0],
+                                     matrixRows[1],
+                                     matrixRows[2],
+                                     sourceCols,
+                                     sourceRows,
+                                     map->scale)
+              : buildFloatKernel.run(queue,
+                                     range,
+                                     waitList,
+                                     map->built.outParam(),
+                                     map->image->openclObject,
+                                     cols,
+                                     rows,
+                                     matrixRows[0],
+                                     matrixRows[1],
+                                     matrixRows[2]);
+    if (!built) {
+        return std::shared_ptr<remap_map>();
+    }
+
+    if (entries.size() >= maxCached) {
+        entries.erase(std::min_element(
+            entries.begin(),
+            entries.end(),
+            [](const cache_entry& a, const cache_entry& b) {
+                return a.lastUse < b.lastUse;
+            }));
+    }
+    cache_entry entry;
+    entry.transform = transform;
+    entry.cols = cols;
+    entry.rows = rows;
+    entry.sourceCols = sourceCols;
+    entry.sourceRows = sourceRows;
+    entry.lastUse = ++uses;
+    entry.map = map;
+    entries.push_back(entry);
+    return map;
+}
+
+auto d_ocl::remap::upload(const cv::Mat& coordinates,
+                          int sourceCols,
+                          int sourceRows) -> std::shared_ptr<remap_map>
+{
+    if (coordinates.type() != CV_32FC2 || coordinates.empty()) {
+        std::cerr << "remap coordinates must be CV_32FC2" << std::endl;
+        return std::shared_ptr<remap_map>();
+    }
+    const cv::Mat floats
+        = coordinates.isContinuous() ? coordinates : coordinates.clone();
+    if (mapFormat == remap_format::float2) {
+        return createMap(
+            floats.cols, floats.rows, sourceCols, sourceRows, floats.data);
+    }
+
+    float scale;
+    if (!fixedScale(sourceCols, sourceRows, scale)) {
+        return std::shared_ptr<remap_map>();
+    }
+    cv::Mat fixed(floats.size(), CV_16SC2);
+    const float* source = floats.ptr<float>();
+    short* destination = fixed.ptr<short>();
+    const float highest[2] = {static_cast<float>(sourceCols + 1),
+                              static_cast<float>(sourceRows + 1)};
+    for (size_t i = 0; i < floats.total() * 2; i++) {
+        const float coordinate
+            = std::min(std::max(source[i], -2.0f), highest[i % 2]);
+        destination[i] = static_cast<short>(
+            std::lround(coordinate * scale));
+    }
+    return createMap(
+        fixed.cols, fixed.rows, sourceCols, sourceRows, fixed.data);
+}
+
+auto d_ocl::remap::run(cl_command_queue queue,
+                       cl_mem inputImage,
+                       cl_mem outputImage,
+                       int cols,
+                       int rows,
+                       const warp_matrix& transform,
+                       const std::vector<cl_event>& waitList,
+                       cl_event* event) -> bool
+{
+    size_t sourceCols = 0;
+    size_t sourceRows = 0;
+    if (!utils::checkRun("clGetImageInfo",
+                         clGetImageInfo(inputImage,
+                                        CL_IMAGE_WIDTH,
+                                        sizeof(sourceCols),
+                                        &sourceCols,
+                                        nullptr))
+        || !utils::checkRun("clGetImageInfo",
+                            clGetImageInfo(inputImage,
+                                           CL_IMAGE_HEIGHT,
+                                           sizeof(sourceRows),
+                                           &sourceRows,
+                                           nullptr))) {
+        return false;
+    }
+    // the map needs nothing from waitList; only applying it does
+    std::shared_ptr<remap_map> cachedMap
+        = map(queue,
+              cols,
+              rows,
+              static_cast<int>(sourceCols),
+              static_cast<int>(sourceRows),
+              transform,
+              {});
+    return cachedMap
+           && apply(
+               queue, inputImage, outputImage, *cachedMap, waitList, event);
+}
+
+auto d_ocl::remap::apply(cl_command_queue queue,
+                         cl_mem inputImage,
+                         cl_mem outputImage,
+                         const remap_map& map,
+                         const std::vector<cl_event>& waitList,
+                         cl_event* event) -> bool
+{
+    if (!*this || !map.image) {
+        return false;
+    }
+    std::vector<cl_event> after = waitList;
+    if (map.built) {
+        after.push_back(map.built.get());
+    }
+    nd_range range;
+    range.global = {(size_t)map.cols, (size_t)map.rows};
+    if (map.format == remap_format::fixed16) {
+        return applyFixedKernel.run(queue,
+                                    range,
+                                    after,
+                                    event,
+                                    inputImage,
+                                    outputImage,
+                                    map.image->openclObject,
+                                    map.cols,
+                                    map.rows,
+                                    1.0f / map.scale);
+    }
+    return applyFloatKernel.run(queue,
+                                range,
+                                after,
+                                event,
+                                inputImage,
+                                outputImage,
+                                map.image->openclObject,
+                                map.cols,
+                                map.rows);
+}
+
+auto d_ocl::remap::cached() const -> size_t
+{
+    return entries.size();
+}
+
+auto d_ocl::remap::clear() -> void
+{
+    entries.clear();
+}
+
+auto d_ocl::remap::format() const -> remap_format
+{
+    return mapFormat;
+}
+
+auto d_ocl::remap::capacity() const -> size_t
+{
+    return maxCached;
+}
@@ -0,0 +1,256 @@
+#ifndef D_OCL_WARP_H
+#define D_OCL_WARP_H
+
+#include "d_ocl_defines.h"
+#include "d_ocl_handle.h"
+#include "d_ocl_kernel.h"
+#include "d_ocl_utils.h"
+#include <CL/cl.h>
+#include <cstdint>
+#include <memory>
+#include <opencv2/core.hpp>
+#include <vector>
+
+namespace d_ocl {
+enum class warp_interpolation
+{
+    nearest,
+    // by the sampler, CLK_FILTER_LINEAR
+    bilinear,
+    // 4 x 4 pixels, as opencv's INTER_CUBIC
+    bicubic
+};
+
+// row-major 3 x 3 matrix of a transform of pixel coordinates (x, y, 1) from
+// the source image to the destination, as cv::warpAffine() and
+// cv::warpPerspective() take. affine while the last row is 0 0 1.
+// multiply to chain e.g. crop, rotate and scale into 1 warp
+struct D_OCL_API warp_matrix
+{
+    double m[9]{1.0, 0.0, 0.0, 0.0, 1.0, 0.0, 0.0, 0.0, 1.0};
+
+    // 2 x 3 (affine) or 3 x 3 CV_32F or CV_64F matrix, e.g. from
+    // cv::getRotationMatrix2D(). identity if it's neither
+    static auto fromMat(const cv::Mat& matrix) -> warp_matrix;
+    // degrees counter-clockwise about (centerX, centerY) and scale, as
+    // cv::getRotationMatrix2D()
+    static auto rotation(double centerX,
+                         double centerY,
+                         double degrees,
+                         double scale = 1.0) -> warp_matrix;
+    static auto translation(double x, double y) -> warp_matrix;
+    static auto scaling(double x, double y) -> warp_matrix;
+
+    // other, then this
+    auto operator*(const warp_matrix& other) const -> warp_matrix;
+    auto affine() const -> bool;
+    // false if not invertible
+    auto inverse(warp_matrix& result) const -> bool;
+};
+
+// affine and perspective warps of images in 1 pass: the matrix is inverted
+// on the host once, each pixel maps itself back to the source with 6 (or 9)
+// multiply-adds and samples it.
+// keeps no buffers, runBatch() uploads its matrices per call, so any queue
+// may run it
+struct D_OCL_API warp
+{
+    warp(cl_context context,
+         warp_interpolation interpolation = warp_interpolation::bilinear);
+
+    // false if the program failed to build
+    explicit operator bool() const;
+
+    // the cols x rows origin of outputImage from inputImage, float or
+    // normalized images, through transform. pixels mapped from outside
+    // inputImage are transparent black
+    auto run(cl_command_queue queue,
+             cl_mem inputImage,
+             cl_mem outputImage,
+             int cols,
+             int rows,
+             const warp_matrix& transform,
+             const std::vector<cl_event>& waitList,
+             cl_event* event) -> bool;
+    // time work sizes for cols x rows outputs by transforms of transform's
+    // kind, affine or perspective, on the queue's device (see
+    // tunedRange()). run() uses the fastest for that size from now on, else
+    // the driver's choice. read from the tuning database if known. the
+    // queue must be otherwise idle and inputImage ready; writes outputImage
+    auto tune(cl_command_queue queue,
+              cl_mem inputImage,
+              cl_mem outputImage,
+              int cols,
+              int rows,
+              const warp_matrix& transform) -> bool;
+    // as run(), once per transform in 1 dispatch: layer i of outputArray, a
+    // 2d image array of at least transforms.size() layers (see
+    // createOutputImageArray()), is inputImage through transforms[i].
+    // e.g. many rotations of 1 uploaded image, read back with
+    // readImageArray()
+    auto runBatch(cl_command_queue queue,
+                  cl_mem inputImage,
+                  cl_mem outputArray,
+                  int cols,
+                  int rows,
+                  const std::vector<warp_matrix>& transforms,
+                  const std::vector<cl_event>& waitList,
+                  cl_event* event) -> bool;
+
+    // warp_affine(input, output, cols, rows, row0, row1, row2)
+    launcher<cl_mem, cl_mem, int, int, cl_float4, cl_float4, cl_float4>
+        affineKernel;
+    // warp_perspective(input, output, cols, rows, row0, row1, row2)
+    launcher<cl_mem, cl_mem, int, int, cl_float4, cl_float4, cl_float4>
+        perspectiveKernel;
+    // warp_batch(input, outputArray, cols, rows, matrices), 3 rows each
+    launcher<cl_mem, cl_mem, int, int, cl_mem> batchKernel;
+
+private:
+    // work sizes tune() found for cols x rows
+    struct tuned_range
+    {
+        int cols{0};
+        int rows{0};
+        nd_range range;
+    };
+
+    // to upload runBatch()'s matrices
+    cl_context context;
+    warp_interpolation interpolation;
+    tuned_range tunedAffine;
+    tuned_range tunedPerspective;
+};
+
+enum class remap_format
+{
+    // CL_RG CL_FLOAT, 8 bytes per pixel
+    float2,
+    // CL_RG CL_SIGNED_INT16, 4 bytes per pixel, with as many fractional bits
+    // (up to 8) as the source's size leaves, e.g. 5 up to 1021 pixels
+    fixed16
+};
+
+// source coordinates of every pixel of a cols x rows destination, on the
+// device
+struct D_OCL_API remap_map
+{
+    std::shared_ptr<utils::manager<cl_mem>> image;
+    remap_format format{remap_format::float2};
+    int cols{0};
+    int rows{0};
+    // fixed16 entries are coordinates times scale
+    float scale{1.0f};
+    // completes once image is written. applies wait for it
+    retained_handle<cl_event> built;
+};
+
+// warps through coordinate maps rather than per-pixel arithmetic, for
+// transforms repeated every frame. the map of a transform is built on the
+// device once and cached by the transform and sizes, then each run costs 1
+// map read and 1 sample per pixel.
+// also applies maps made on the host, e.g. cv::initUndistortRectifyMap()'s.
+// not thread-safe
+struct D_OCL_API remap
+{
+    // capacity maps are cached, the least recently used dropped beyond it
+    remap(cl_context context,
+          warp_interpolation interpolation = warp_interpolation::bilinear,
+          remap_format format = remap_format::fixed16,
+          size_t capacity = 16);
+
+    // false if the program failed to build
+    explicit operator bool() const;
+
+    // map of transform into a cols x rows destination from a
+    // sourceCols x sourceRows source, built on queue after waitList unless
+    // cached. empty shared_ptr on failure
+    auto map(cl_command_queue queue,
+             int cols,
+             int rows,
+             int sourceCols,
+             int sourceRows,
+             const warp_matrix& transform,
+             const std::vector<cl_event>& waitList)
+        -> std::shared_ptr<remap_map>;
+    // map from CV_32FC2 source coordinates per destination pixel, e.g. of
+    // cv::initUndistortRectifyMap(), in this remap's format. not cached;
+    // keep it for as long as it's applied. blocks until uploaded
+    auto upload(const cv::Mat& coordinates, int sourceCols, int sourceRows)
+        -> std::shared_ptr<remap_map>;
+
+    // as warp::run(), through the cached map of transform
+    auto run(cl_command_queue queue,
+             cl_mem inputImage,
+             cl_mem outputImage,
+             int cols,
+             int rows,
+             const warp_matrix& transform,
+             const std::vector<cl_event>& waitList,
+             cl_event* event) -> bool;
+    // the map.cols x map.rows origin of outputImage from inputImage
+    // through map
+    auto apply(cl_command_queue queue,
+               cl_mem inputImage,
+               cl_mem outputImage,
+               const remap_map& map,
+               const std::vector<cl_event>& waitList,
+               cl_event* event) -> bool;
+
+    // cached maps
+    auto cached() const -> size_t;
+    auto clear() -> void;
+    // of the maps built
+    auto format() const -> remap_format;
+    // most maps cached
+    auto capacity() const -> size_t;
+
+    // remap_build_float(map, cols, rows, row0, row1, row2)
+    launcher<cl_mem, int, int, cl_float4, cl_float4, cl_float4>
+        buildFloatKernel;
+    // remap_build_fixed(map, cols, rows, row0, row1, row2, sourceCols,
+    // sourceRows, scale)
+    launcher<cl_mem,
+             int,
+             int,
+             cl_float4,
+             cl_float4,
+             cl_float4,
+             int,
+             int,
+             float>
+        buildFixedKernel;
+    // remap_apply_float(input, output, map, cols, rows)
+    launcher<cl_mem, cl_mem, cl_mem, int, int> applyFloatKernel;
+    // remap_apply_fixed(input, output, map, cols, rows, inverseScale)
+    launcher<cl_mem, cl_mem, cl_mem, int, int, float> applyFixedKernel;
+
+private:
+    struct cache_entry
+    {
+        warp_matrix transform;
+        int cols;
+        int rows;
+        int sourceCols;
+        int sourceRows;
+        uint64_t lastUse;
+        std::shared_ptr<remap_map> map;
+    };
+
+    // remap_map of this format for cols x rows, scale set for the source's
+    // size. initialized from tightly packed hostData if not null
+    auto createMap(int cols,
+                   int rows,
+                   int sourceCols,
+                   int sourceRows,
+                   const void* hostData) -> std::shared_ptr<remap_map>;
+
+    cl_context context;
+    remap_format mapFormat;
+    size_t maxCached;
+    std::vector<cache_entry> entries;
+    uint64_t uses{0};
+};
+} // namespace d_ocl
+
+#endif // D_OCL_WARP_H
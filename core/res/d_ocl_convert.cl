@@ -0,0 +1,88 @@
+/* device-side utils::toRgba / toGreyscale / toFloat.
+ * opencv images are bgr[a], and rgb isn't a valid image format for 8-bit
+ * channels, so source pixels are read from a buffer instead of an image */
+
+/* bt.601 luma, as cv::COLOR_BGR2GRAY */
+#define LUMA(r, g, b)    (0.299f * (r) + 0.587f * (g) + 0.114f * (b))
+/* the same of 8-bit channels, in cv::COLOR_BGR2GRAY's 14-bit fixed point,
+ * rounded to 8 bits */
+#define LUMA_8U(r, g, b)                                                       \
+    (((r) * 4899 + (g) * 9617 + (b) * 1868 + (1 << 13)) >> 14)
+
+/* float 0.0~1.0 channels to image of any channel data type.
+ * unsigned 8-bit images are written as 0~255 like the host converters do */
+void write_normalized(__write_only image2d_t image, int2 coords, float4 value)
+{
+    if (get_image_channel_data_type(image) == CLK_UNSIGNED_INT8) {
+        write_imageui(image, coords, convert_uint4_sat_rte(value * 255.0f));
+    } else {
+        write_imagef(image, coords, value);
+    }
+}
+
+__kernel
+void convert_bytes_to_image(
+    __global const uchar* src,
+                      int srcStep,
+                      int srcChannels,
+                      int imageWidth,
+                      int imageHeight,
+                      int swapRb,
+                      int grey,
+                      int quantizeGrey,
+   __write_only image2d_t dst)
+{
+    int column = get_global_id(0);
+    int row = get_global_id(1);
+    if (column >= imageWidth || row >= imageHeight) {
+        return;
+    }
+
+    __global const uchar* pixel = src + row * srcStep + column * srcChannels;
+    float b = pixel[0] / 255.0f;
+    float g = srcChannels >= 3 ? pixel[1] / 255.0f : b;
+    float r = srcChannels >= 3 ? pixel[2] / 255.0f : b;
+    float a = srcChannels == 4 ? pixel[3] / 255.0f : 1.0f;
+
+    float4 value;
+    if (grey && quantizeGrey) {
+        /* grey before toFloat rounds luma to 8 bits, as the host chain */
+        int b8 = pixel[swapRb ? 2 : 0];
+        int r8 = pixel[swapRb ? 0 : 2];
+        value = (float4)(LUMA_8U(r8, (int)pixel[1], b8) / 255.0f,
+                         0.0f,
+                         0.0f,
+                         1.0f);
+    } else if (grey) {
+        /* grey after toRgba weighs the swapped channels, as the host chain */
+        value = (float4)(swapRb ? LUMA(b, g, r) : LUMA(r, g, b),
+                         0.0f,
+                         0.0f,
+                         1.0f);
+    } else if (srcChannels == 1) {
+        value = (float4)(b, 0.0f, 0.0f, 1.0f);
+    } else if (swapRb) {
+        value = (float4)(r, g, b, a);
+    } else {
+        value = (float4)(b, g, r, a);
+    }
+    write_normalized(dst, (int2)(column, row), value);
+}
+
+/* float image back to 8-bit, e.g. so a quarter of the bytes are read back */
+__kernel
+void convert_float_to_bytes(
+    __read_only image2d_t src,
+                      int imageWidth,
+                      int imageHeight,
+   __write_only image2d_t dst)
+{
+    int2 coords = (int2)(get_global_id(0), get_global_id(1));
+    if (coords.x >= imageWidth || coords.y >= imageHeight) {
+        return;
+    }
+
+    const sampler_t sampler = CLK_NORMALIZED_COORDS_FALSE
+                              | CLK_ADDRESS_NONE | CLK_FILTER_NEAREST;
+    write_normalized(dst, coords, read_imagef(src, sampler, coords));
+}
@@ -0,0 +1,131 @@
+/* convolution of every channel of a float or normalized image.
+ * built with -D FILTER_WIDTH (odd), -D TILE_W and -D TILE_H, the
+ * work-group size. each work-group loads its tile of the input plus the
+ * filter's halo into local memory once, so every input pixel is fetched
+ * once per work-group instead of once per filter tap */
+
+#define RADIUS    (FILTER_WIDTH / 2)
+
+__constant sampler_t clampSampler = CLK_NORMALIZED_COORDS_FALSE
+                                    | CLK_ADDRESS_CLAMP_TO_EDGE
+                                    | CLK_FILTER_NEAREST;
+
+/* clamped here, not by the sampler, as the image may be larger than
+ * imageWidth x imageHeight when filtered in strips or tiles */
+float4 read_clamped(__read_only image2d_t image,
+                    int x,
+                    int y,
+                    int imageWidth,
+                    int imageHeight)
+{
+    int2 coords = (int2)(clamp(x, 0, imageWidth - 1),
+                         clamp(y, 0, imageHeight - 1));
+    return read_imagef(image, clampSampler, coords);
+}
+
+/* FILTER_WIDTH x FILTER_WIDTH taps from the local tile */
+__kernel __attribute__((reqd_work_group_size(TILE_W, TILE_H, 1)))
+void convolve_2d(
+     __read_only image2d_t input,
+    __write_only image2d_t output,
+                       int imageWidth,
+                       int imageHeight,
+         __constant float* filter)
+{
+    __local float4 tile[TILE_H + 2 * RADIUS][TILE_W + 2 * RADIUS];
+    int localX = get_local_id(0);
+    int localY = get_local_id(1);
+    int originX = get_group_id(0) * TILE_W - RADIUS;
+    int originY = get_group_id(1) * TILE_H - RADIUS;
+
+    for (int y = localY; y < TILE_H + 2 * RADIUS; y += TILE_H) {
+        for (int x = localX; x < TILE_W + 2 * RADIUS; x += TILE_W) {
+            tile[y][x] = read_clamped(
+                input, originX + x, originY + y, imageWidth, imageHeight);
+        }
+    }
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    /* the grid is rounded up to whole work-groups */
+    int column = get_global_id(0);
+    int row = get_global_id(1);
+    if (column >= imageWidth || row >= imageHeight) {
+        return;
+    }
+
+    float4 sum = (float4)(0.0f);
+    for (int i = 0; i < FILTER_WIDTH; i++) {
+        for (int j = 0; j < FILTER_WIDTH; j++) {
+            sum += tile[localY + i][localX + j] * filter[i * FILTER_WIDTH + j];
+        }
+    }
+    write_imagef(output, (int2)(column, row), sum);
+}
+
+/* first pass of a separable filter: FILTER_WIDTH taps along the row into
+ * a float4 buffer of imageWidth x imageHeight */
+__kernel __attribute__((reqd_work_group_size(TILE_W, TILE_H, 1)))
+void convolve_rows(
+     __read_only image2d_t input,
+        __global float4* intermediate,
+                       int imageWidth,
+                       int imageHeight,
+         __constant float* filter)
+{
+    __local float4 tile[TILE_H][TILE_W + 2 * RADIUS];
+    int localX = get_local_id(0);
+    int localY = get_local_id(1);
+    int originX = get_group_id(0) * TILE_W - RADIUS;
+    int column = get_global_id(0);
+    int row = get_global_id(1);
+
+    for (int x = localX; x < TILE_W + 2 * RADIUS; x += TILE_W) {
+        tile[localY][x] = read_clamped(
+            input, originX + x, row, imageWidth, imageHeight);
+    }
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    if (column >= imageWidth || row >= imageHeight) {
+        return;
+    }
+
+    float4 sum = (float4)(0.0f);
+    for (int j = 0; j < FILTER_WIDTH; j++) {
+        sum += tile[localY][localX + j] * filter[j];
+    }
+    intermediate[row * imageWidth + column] = sum;
+}
+
+/* second pass: FILTER_WIDTH taps along the column of the first's result */
+__kernel __attribute__((reqd_work_group_size(TILE_W, TILE_H, 1)))
+void convolve_columns(
+  __global const float4* intermediate,
+    __write_only image2d_t output,
+                       int imageWidth,
+                       int imageHeight,
+         __constant float* filter)
+{
+    __local float4 tile[TILE_H + 2 * RADIUS][TILE_W];
+    int localX = get_local_id(0);
+    int localY = get_local_id(1);
+    int originY = get_group_id(1) * TILE_H - RADIUS;
+    int column = get_global_id(0);
+    int row = get_global_id(1);
+    int clampedColumn = min(column, imageWidth - 1);
+
+    for (int y = localY; y < TILE_H + 2 * RADIUS; y += TILE_H) {
+        int clampedRow = clamp(originY + y, 0, imageHeight - 1);
+        tile[y][localX] = intermediate[clampedRow * imageWidth + clampedColumn];
+    }
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    if (column >= imageWidth || row >= imageHeight) {
+        return;
+    }
+
+    float4 sum = (float4)(0.0f);
+    for (int i = 0; i < FILTER_WIDTH; i++) {
+        sum += tile[localY + i][localX] * filter[i];
+    }
+    write_imagef(output, (int2)(column, row), sum);
+}
@@ -0,0 +1,22 @@
+/* cubic interpolation shared by d_ocl_warp.cl and d_ocl_pyramid.cl.
+ * createProgram() builds with -I of this directory */
+
+#ifndef D_OCL_CUBIC_H
+#define D_OCL_CUBIC_H
+
+/* weights of the 4 pixels around t in [0, 1) of the cubic convolution
+ * kernel with a = -0.75, as opencv's INTER_CUBIC */
+void cubic_weights(float t, float* weights)
+{
+    const float a = -0.75f;
+    weights[0] = ((a * (t + 1.0f) - 5.0f * a) * (t + 1.0f) + 8.0f * a)
+                     * (t + 1.0f)
+                 - 4.0f * a;
+    weights[1] = ((a + 2.0f) * t - (a + 3.0f)) * t * t + 1.0f;
+    weights[2] = ((a + 2.0f) * (1.0f - t) - (a + 3.0f)) * (1.0f - t)
+                     * (1.0f - t)
+                 + 1.0f;
+    weights[3] = 1.0f - weights[0] - weights[1] - weights[2];
+}
+
+#endif
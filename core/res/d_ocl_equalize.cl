@@ -0,0 +1,191 @@
+/* histogram equalization and clahe of 8-bit greyscale images, the results
+ * matching cv::equalizeHist() and cv::CLAHE */
+
+#define BINS    256
+/* privatized copies of each tile's histogram, as in d_ocl_histogram.cl */
+#define SUB_HISTOGRAMS    4
+
+/* lut of each histogram, 1 per work-group of BINS work-items:
+ * clipped at clipLimit counts if positive with the excess spread over all
+ * bins as opencv's clahe does, then the cdf scaled to 0 ~ 255. fromFirst
+ * maps the first non-empty bin to 0, as equalizeHist() does */
+__kernel __attribute__((reqd_work_group_size(BINS, 1, 1)))
+void equalize_lut(__global const uint* histograms,
+                  int clipLimit,
+                  int total,
+                  int fromFirst,
+                  __global uchar* luts)
+{
+    __local uint cdf[2][BINS];
+    __local uint clipped;
+    __local int first;
+    int bin = get_local_id(0);
+    int offset = get_group_id(0) * BINS;
+    uint count = histograms[offset + bin];
+
+    if (bin == 0) {
+        clipped = 0;
+        first = BINS - 1;
+    }
+    barrier(CLK_LOCAL_MEM_FENCE);
+    if (clipLimit > 0) {
+        if (count > (uint)clipLimit) {
+            atomic_add(&clipped, count - clipLimit);
+            count = clipLimit;
+        }
+        barrier(CLK_LOCAL_MEM_FENCE);
+        /* evenly, then 1 more for every step-th bin of the remainder */
+        uint batch = clipped / BINS;
+        uint residual = clipped - batch * BINS;
+        count += batch;
+        if (residual > 0) {
+            uint step = max(BINS / residual, 1u);
+            if (bin % step == 0 && bin / step < residual) {
+                count++;
+            }
+        }
+    }
+    if (count > 0) {
+        atomic_min(&first, bin);
+    }
+
+    /* inclusive scan of the counts, log2(BINS) steps between 2 buffers */
+    int in = 0;
+    cdf[in][bin] = count;
+    for (int stride = 1; stride < BINS; stride *= 2) {
+        barrier(CLK_LOCAL_MEM_FENCE);
+        uint sum = cdf[in][bin];
+        if (bin >= stride) {
+            sum += cdf[in][bin - stride];
+        }
+        cdf[1 - in][bin] = sum;
+        in = 1 - in;
+    }
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    int base = fromFirst ? cdf[in][first] : 0;
+    uchar value;
+    if (total == base) {
+        /* 1 value only, which stays */
+        value = first;
+    } else {
+        float scale = (BINS - 1.0f) / (total - base);
+        value = convert_uchar_sat_rte((float)((int)cdf[in][bin] - base)
+                                      * scale);
+    }
+    luts[offset + bin] = value;
+}
+
+/* output[i] = lut[input[i]], 16 pixels per work-item */
+__kernel
+void equalize_apply(__global const uchar* input,
+                    __global uchar* output,
+                    int count,
+                    __global const uchar* lut)
+{
+    __local uchar table[BINS];
+    for (int i = get_local_id(0); i < BINS; i += get_local_size(0)) {
+        table[i] = lut[i];
+    }
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    int i = get_global_id(0) * 16;
+    if (i + 16 <= count) {
+        uchar16 pixels = vload16(0, input + i);
+        uchar values[16];
+        vstore16(pixels, 0, values);
+        for (int e = 0; e < 16; e++) {
+            values[e] = table[values[e]];
+        }
+        vstore16(vload16(0, values), 0, output + i);
+        return;
+    }
+    for (; i < count; i++) {
+        output[i] = table[input[i]];
+    }
+}
+
+/* x past the end of size reflected back without repeating the edge, as
+ * opencv's BORDER_REFLECT_101 */
+int reflect_101(int x, int size)
+{
+    return x < size ? x : max(2 * size - 2 - x, 0);
+}
+
+/* the histogram of each tileWidth x tileHeight tile, 1 work-group of BINS
+ * work-items per tile. tiles overhanging the image's right and bottom edges
+ * count the image reflected, like opencv's padding */
+__kernel __attribute__((reqd_work_group_size(BINS, 1, 1)))
+void clahe_histograms(__global const uchar* image,
+                      int cols,
+                      int rows,
+                      int tileWidth,
+                      int tileHeight,
+                      __global uint* histograms)
+{
+    __local uint sub[SUB_HISTOGRAMS * BINS];
+    int localId = get_local_id(0);
+    int tileX = get_group_id(0);
+    int tileY = get_group_id(1);
+
+    for (int i = localId; i < SUB_HISTOGRAMS * BINS; i += BINS) {
+        sub[i] = 0;
+    }
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    __local uint* mine = sub + (localId % SUB_HISTOGRAMS) * BINS;
+    for (int i = localId; i < tileWidth * tileHeight; i += BINS) {
+        int x = reflect_101(tileX * tileWidth + i % tileWidth, cols);
+        int y = reflect_101(tileY * tileHeight + i / tileWidth, rows);
+        atomic_inc(mine + image[y * cols + x]);
+    }
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    uint count = 0;
+    for (int s = 0; s < SUB_HISTOGRAMS; s++) {
+        count += sub[s * BINS + localId];
+    }
+    int tile = tileY * get_num_groups(0) + tileX;
+    histograms[tile * BINS + localId] = count;
+}
+
+/* each pixel through the luts of the 4 nearest tiles, bilinearly weighted
+ * by the distance to their centres */
+__kernel
+void clahe_apply(__global const uchar* input,
+                 __global uchar* output,
+                 int cols,
+                 int rows,
+                 int tilesX,
+                 int tilesY,
+                 float invTileWidth,
+                 float invTileHeight,
+                 __global const uchar* luts)
+{
+    int x = get_global_id(0);
+    int y = get_global_id(1);
+    if (x >= cols || y >= rows) {
+        return;
+    }
+
+    float txf = x * invTileWidth - 0.5f;
+    int tx1 = floor(txf);
+    float xa = txf - tx1;
+    int tx2 = min(tx1 + 1, tilesX - 1);
+    tx1 = max(tx1, 0);
+    float tyf = y * invTileHeight - 0.5f;
+    int ty1 = floor(tyf);
+    float ya = tyf - ty1;
+    int ty2 = min(ty1 + 1, tilesY - 1);
+    ty1 = max(ty1, 0);
+
+    int value = input[y * cols + x];
+    __global const uchar* top = luts + ty1 * tilesX * BINS + value;
+    __global const uchar* bottom = luts + ty2 * tilesX * BINS + value;
+    float result = (top[tx1 * BINS] * (1.0f - xa) + top[tx2 * BINS] * xa)
+                       * (1.0f - ya)
+                   + (bottom[tx1 * BINS] * (1.0f - xa)
+                      + bottom[tx2 * BINS] * xa)
+                         * ya;
+    output[y * cols + x] = convert_uchar_sat_rte(result);
+}
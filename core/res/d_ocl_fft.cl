@@ -0,0 +1,165 @@
+/* power-of-2 fft of complex float2 data by stockham passes, which need no
+ * bit reversal as every pass writes its outputs in order.
+ * built with -D RADIX=2, 4 or 8, the points each work-item of fft_pass
+ * combines */
+
+#ifndef RADIX
+#define RADIX    2
+#endif
+
+#define TWO_PI    6.28318530717958647692f
+#define SQRT_HALF    0.70710678118654752440f
+
+float2 complex_mul(float2 a, float2 b)
+{
+    return (float2)(a.x * b.x - a.y * b.y, a.x * b.y + a.y * b.x);
+}
+
+/* v * i for dir 1, v * -i for dir -1 */
+float2 mul_i(float2 v, float dir)
+{
+    return (float2)(-v.y, v.x) * dir;
+}
+
+void dft2(float2* x)
+{
+    float2 a = x[0];
+    x[0] = a + x[1];
+    x[1] = a - x[1];
+}
+
+void dft4(float2* x0, float2* x1, float2* x2, float2* x3, float dir)
+{
+    float2 a = *x0 + *x2;
+    float2 b = *x0 - *x2;
+    float2 c = *x1 + *x3;
+    float2 d = mul_i(*x1 - *x3, dir);
+    *x0 = a + c;
+    *x1 = b + d;
+    *x2 = a - c;
+    *x3 = b - d;
+}
+
+/* 2 dft4s of the even and odd points, combined */
+void dft8(float2* x, float dir)
+{
+    float2 even[4] = {x[0], x[2], x[4], x[6]};
+    float2 odd[4] = {x[1], x[3], x[5], x[7]};
+    dft4(&even[0], &even[1], &even[2], &even[3], dir);
+    dft4(&odd[0], &odd[1], &odd[2], &odd[3], dir);
+    odd[1] = complex_mul(odd[1], (float2)(SQRT_HALF, dir * SQRT_HALF));
+    odd[2] = mul_i(odd[2], dir);
+    odd[3] = complex_mul(odd[3], (float2)(-SQRT_HALF, dir * SQRT_HALF));
+    for (int m = 0; m < 4; m++) {
+        x[m] = even[m] + odd[m];
+        x[m + 4] = even[m] - odd[m];
+    }
+}
+
+/* 1 pass over transforms of n points. point e of transform t is at
+ * (t / perPlane) * planeStride + (t % perPlane) * transformStride
+ * + e * pointStride, so the same kernel transforms rows and columns.
+ * span is the product of the radices of the passes before.
+ * dir -1 forward, 1 inverse (unscaled) */
+__kernel
+void fft_pass(
+  __global const float2* src,
+        __global float2* dst,
+                     int n,
+                     int span,
+                     int pointStride,
+                     int transformStride,
+                     int perPlane,
+                     int planeStride,
+                   float dir)
+{
+    int i = get_global_id(0);
+    int t = get_global_id(1);
+    int base = (t / perPlane) * planeStride + (t % perPlane) * transformStride;
+    int k = i & (span - 1);
+
+    float2 x[RADIX];
+    for (int r = 0; r < RADIX; r++) {
+        x[r] = src[base + (i + r * (n / RADIX)) * pointStride];
+    }
+    for (int r = 1; r < RADIX; r++) {
+        float c;
+        float s = sincos(dir * TWO_PI * (r * k) / (span * RADIX), &c);
+        x[r] = complex_mul(x[r], (float2)(c, s));
+    }
+
+#if RADIX == 2
+    dft2(x);
+#elif RADIX == 4
+    dft4(&x[0], &x[1], &x[2], &x[3], dir);
+#elif RADIX == 8
+    dft8(x, dir);
+#else
+#error RADIX must be 2, 4 or 8
+#endif
+
+    int j = (i - k) * RADIX + k;
+    for (int r = 0; r < RADIX; r++) {
+        dst[base + (j + r * span) * pointStride] = x[r];
+    }
+}
+
+/* each of planes planes of count points times spectrum, and scale, e.g.
+ * 1 / count so the inverse transform comes back normalized */
+__kernel
+void fft_multiply(
+        __global float2* data,
+  __global const float2* spectrum,
+                     int count,
+                   float scale)
+{
+    int i = get_global_id(0);
+    int index = get_global_id(1) * count + i;
+    data[index] = complex_mul(data[index], spectrum[i]) * scale;
+}
+
+/* width x height padded image into 2 planes: channels x, y as 1 complex
+ * signal, z, w as another. a real filter convolves the real and imaginary
+ * parts independently, so 2 transforms carry all 4 channels.
+ * shifted by radius and clamped to imageWidth x imageHeight, so wrapping
+ * around the padding gives the clamped border */
+__kernel
+void fft_load_image(
+     __read_only image2d_t input,
+                       int imageWidth,
+                       int imageHeight,
+                       int radius,
+          __global float2* dst,
+                       int width,
+                       int height)
+{
+    const sampler_t sampler = CLK_NORMALIZED_COORDS_FALSE
+                              | CLK_ADDRESS_CLAMP_TO_EDGE | CLK_FILTER_NEAREST;
+    int u = get_global_id(0);
+    int v = get_global_id(1);
+    int2 coords = (int2)(clamp(u - radius, 0, imageWidth - 1),
+                         clamp(v - radius, 0, imageHeight - 1));
+    float4 pixel = read_imagef(input, sampler, coords);
+    dst[v * width + u] = pixel.xy;
+    dst[width * height + v * width + u] = pixel.zw;
+}
+
+/* the 2 planes back into imageWidth x imageHeight of the output */
+__kernel
+void fft_store_image(
+    __global const float2* src,
+                       int width,
+                       int height,
+    __write_only image2d_t output,
+                       int imageWidth,
+                       int imageHeight)
+{
+    int x = get_global_id(0);
+    int y = get_global_id(1);
+    if (x >= imageWidth || y >= imageHeight) {
+        return;
+    }
+    float2 first = src[y * width + x];
+    float2 second = src[width * height + y * width + x];
+    write_imagef(output, (int2)(x, y), (float4)(first, second));
+}
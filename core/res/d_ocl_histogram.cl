@@ -0,0 +1,121 @@
+/* per-channel histograms of interleaved image data.
+ * built with
+ *   -D T=uchar or float, the element type
+ *   -D VEC=16 or 4, the elements each vector load reads
+ *   -D CHANNELS=1~4, elements of a pixel
+ *   -D BINS, bins per channel
+ *   -D SUB_HISTOGRAMS, privatized copies per work-group (power of 2)
+ *   -D DIRECT_BINS if each 8-bit value is its own bin */
+
+#define CAT_(a, b)    a##b
+#define CAT(a, b)    CAT_(a, b)
+#define VLOAD    CAT(vload, VEC)
+#define VSTORE    CAT(vstore, VEC)
+
+#define CHANNEL_BINS    (CHANNELS * BINS)
+
+/* [minValue, maxValue) split into BINS, maxValue itself in the last bin so
+ * e.g. 1.0 of a float image counts. -1 if outside */
+int bin_of(T value, float minValue, float maxValue, float scale)
+{
+#ifdef DIRECT_BINS
+    return value;
+#else
+    float x = (float)value;
+    if (!(x >= minValue && x <= maxValue)) {
+        return -1;
+    }
+    return min((int)((x - minValue) * scale), BINS - 1);
+#endif
+}
+
+void count_value(__local uint* histogram,
+                 int channel,
+                 T value,
+                 float minValue,
+                 float maxValue,
+                 float scale)
+{
+    int bin = bin_of(value, minValue, maxValue, scale);
+    if (bin >= 0) {
+        atomic_inc(histogram + channel * BINS + bin);
+    }
+}
+
+/* count elements of data into SUB_HISTOGRAMS local copies, so work-items
+ * next to each other update different copies, then tree-merge the copies
+ * and write the work-group's histograms to partials without atomics */
+__kernel
+void histogram_count(
+    __global const T* data,
+                 uint count,
+                float minValue,
+                float maxValue,
+     __global uint* partials)
+{
+    __local uint sub[SUB_HISTOGRAMS * CHANNEL_BINS];
+    int localId = get_local_id(0);
+    int localSize = get_local_size(0);
+    float scale = BINS / (maxValue - minValue);
+
+    for (int i = localId; i < SUB_HISTOGRAMS * CHANNEL_BINS; i += localSize) {
+        sub[i] = 0;
+    }
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    __local uint* mine = sub + (localId % SUB_HISTOGRAMS) * CHANNEL_BINS;
+    /* uint, as images can have more than 2^31 elements */
+    uint vectors = count / VEC;
+    for (uint v = get_global_id(0); v < vectors; v += get_global_size(0)) {
+        T values[VEC];
+        VSTORE(VLOAD(v, data), 0, values);
+        for (int e = 0; e < VEC; e++) {
+            count_value(mine,
+                        (v * VEC + e) % CHANNELS,
+                        values[e],
+                        minValue,
+                        maxValue,
+                        scale);
+        }
+    }
+    /* the elements after the last whole vector */
+    for (uint i = vectors * VEC + get_global_id(0); i < count;
+         i += get_global_size(0)) {
+        count_value(mine, i % CHANNELS, data[i], minValue, maxValue, scale);
+    }
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    for (int half = SUB_HISTOGRAMS / 2; half > 0; half /= 2) {
+        for (int i = localId; i < half * CHANNEL_BINS; i += localSize) {
+            sub[i] += sub[i + half * CHANNEL_BINS];
+        }
+        barrier(CLK_LOCAL_MEM_FENCE);
+    }
+
+    __global uint* partial = partials + get_group_id(0) * CHANNEL_BINS;
+    for (int i = localId; i < CHANNEL_BINS; i += localSize) {
+        partial[i] = sub[i];
+    }
+}
+
+/* 1 level of the tree merge of the work-groups' histograms: partial g
+ * += partial g + stride, for g < stride and g + stride < groups */
+__kernel
+void histogram_merge(__global uint* partials, int stride, int groups)
+{
+    int i = get_global_id(0);
+    int g = get_global_id(1);
+    if (g + stride < groups) {
+        partials[g * CHANNEL_BINS + i]
+            += partials[(g + stride) * CHANNEL_BINS + i];
+    }
+}
+
+/* the merged histograms onto histogram, e.g. across chunks of an image */
+__kernel
+void histogram_accumulate(__global const uint* partials,
+                          __global uint* histogram)
+{
+    int i = get_global_id(0);
+    histogram[i] += partials[i];
+}
@@ -0,0 +1,271 @@
+/* reduce, scan, stream compaction and radix sort of device buffers.
+ * built with
+ *   -D T=int, uint or float, the element type
+ *   -D OP(a,b), the associative operator, e.g. OP(a,b)=(a)+(b)
+ *   -D IDENTITY, OP's identity element, e.g. 0
+ *   -D LOCAL_SIZE, the fixed work-group size (power of 2, at least 16)
+ *   -D RADIX_BITS, key bits sorted per pass
+ *   -D UINT_KEYS, INT_KEYS or FLOAT_KEYS, how T's bits sort */
+
+/* elements of a scanned or sorted block, 2 per work-item */
+#define BLOCK    (2 * LOCAL_SIZE)
+
+#define DIGITS    (1 << RADIX_BITS)
+
+#define ADD(a, b)    ((a) + (b))
+
+/* exclusive scan of the BLOCK values of data in place by the work-efficient
+ * up-sweep and down-sweep, 2 x BLOCK operations. returns the block's total
+ * to every work-item */
+#define DEFINE_SCAN_LOCAL(name, type, op, identity)                           \
+    type name(__local type* data)                                             \
+    {                                                                         \
+        int localId = get_local_id(0);                                        \
+        int offset = 1;                                                       \
+        for (int d = LOCAL_SIZE; d > 0; d >>= 1) {                            \
+            barrier(CLK_LOCAL_MEM_FENCE);                                     \
+            if (localId < d) {                                                \
+                int left = offset * (2 * localId + 1) - 1;                    \
+                int right = offset * (2 * localId + 2) - 1;                   \
+                data[right] = op(data[left], data[right]);                    \
+            }                                                                 \
+            offset *= 2;                                                      \
+        }                                                                     \
+        barrier(CLK_LOCAL_MEM_FENCE);                                         \
+        type total = data[BLOCK - 1];                                         \
+        barrier(CLK_LOCAL_MEM_FENCE);                                         \
+        if (localId == 0) {                                                   \
+            data[BLOCK - 1] = identity;                                       \
+        }                                                                     \
+        for (int d = 1; d < BLOCK; d *= 2) {                                  \
+            offset >>= 1;                                                     \
+            barrier(CLK_LOCAL_MEM_FENCE);                                     \
+            if (localId < d) {                                                \
+                int left = offset * (2 * localId + 1) - 1;                    \
+                int right = offset * (2 * localId + 2) - 1;                   \
+                type prefix = data[right];                                    \
+                data[right] = op(prefix, data[left]);                         \
+                data[left] = prefix;                                          \
+            }                                                                 \
+        }                                                                     \
+        barrier(CLK_LOCAL_MEM_FENCE);                                         \
+        return total;                                                         \
+    }
+
+DEFINE_SCAN_LOCAL(scan_local, T, OP, IDENTITY)
+DEFINE_SCAN_LOCAL(count_local, uint, ADD, 0)
+
+/* each work-group's share of count elements of src, every
+ * get_global_size(0)th, reduced to partials[group].
+ * the order is grid-stride, so OP must commute as well */
+__kernel __attribute__((reqd_work_group_size(LOCAL_SIZE, 1, 1)))
+void reduce_groups(__global const T* src, int count, __global T* partials)
+{
+    __local T sums[LOCAL_SIZE];
+    int localId = get_local_id(0);
+
+    T sum = IDENTITY;
+    for (int i = get_global_id(0); i < count; i += get_global_size(0)) {
+        sum = OP(sum, src[i]);
+    }
+    sums[localId] = sum;
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    for (int half = LOCAL_SIZE / 2; half > 0; half /= 2) {
+        if (localId < half) {
+            sums[localId] = OP(sums[localId], sums[localId + half]);
+        }
+        barrier(CLK_LOCAL_MEM_FENCE);
+    }
+    if (localId == 0) {
+        partials[get_group_id(0)] = sums[0];
+    }
+}
+
+/* scan of each BLOCK elements of src into dst, which may be src, and the
+ * blocks' totals into blockSums to offset them by */
+__kernel __attribute__((reqd_work_group_size(LOCAL_SIZE, 1, 1)))
+void scan_blocks(__global const T* src,
+                 __global T* dst,
+                 int count,
+                 int inclusive,
+                 __global T* blockSums)
+{
+    __local T block[BLOCK];
+    int base = get_group_id(0) * BLOCK;
+    int first = get_local_id(0);
+    int second = first + LOCAL_SIZE;
+
+    T firstValue = base + first < count ? src[base + first] : IDENTITY;
+    T secondValue = base + second < count ? src[base + second] : IDENTITY;
+    block[first] = firstValue;
+    block[second] = secondValue;
+    T total = scan_local(block);
+
+    if (base + first < count) {
+        dst[base + first]
+            = inclusive ? OP(block[first], firstValue) : block[first];
+    }
+    if (base + second < count) {
+        dst[base + second]
+            = inclusive ? OP(block[second], secondValue) : block[second];
+    }
+    if (first == 0) {
+        blockSums[get_group_id(0)] = total;
+    }
+}
+
+/* the exclusive scan of the blocks' totals onto each block's elements */
+__kernel
+void scan_add_offsets(__global T* dst,
+                      int count,
+                      __global const T* offsets)
+{
+    int i = get_global_id(0);
+    if (i < count) {
+        dst[i] = OP(offsets[i / BLOCK], dst[i]);
+    }
+}
+
+/* src[i] to dst[offsets[i]] where flags[i] is 1, offsets being the
+ * exclusive scan of flags, and the number kept to dstCount */
+__kernel
+void compact_scatter(__global const T* src,
+                     __global const uint* flags,
+                     __global const uint* offsets,
+                     int count,
+                     __global T* dst,
+                     __global uint* dstCount)
+{
+    int i = get_global_id(0);
+    if (i >= count) {
+        return;
+    }
+    uint offset = offsets[i];
+    if (flags[i]) {
+        dst[offset] = src[i];
+    }
+    if (i == count - 1) {
+        *dstCount = offset + (flags[i] ? 1 : 0);
+    }
+}
+
+/* unsigned bits in the same order as the values */
+uint key_of(T value)
+{
+#if defined(FLOAT_KEYS)
+    /* negatives reversed below the positives */
+    uint bits = as_uint(value);
+    return bits ^ ((bits >> 31) ? 0xffffffffu : 0x80000000u);
+#elif defined(INT_KEYS)
+    return as_uint(value) ^ 0x80000000u;
+#else /* UINT_KEYS */
+    return (uint)value;
+#endif
+}
+
+uint digit_of(T value, int shift)
+{
+    return (key_of(value) >> shift) & (DIGITS - 1);
+}
+
+/* how many of each BLOCK keys have each digit, digit-major so the exclusive
+ * scan of counts is where each work-group's keys of a digit go */
+__kernel __attribute__((reqd_work_group_size(LOCAL_SIZE, 1, 1)))
+void radix_count(__global const T* keys,
+                 int count,
+                 int shift,
+                 __global uint* counts)
+{
+    __local uint digits[DIGITS];
+    int localId = get_local_id(0);
+    int base = get_group_id(0) * BLOCK;
+
+    if (localId < DIGITS) {
+        digits[localId] = 0;
+    }
+    barrier(CLK_LOCAL_MEM_FENCE);
+    for (int i = localId; i < BLOCK && base + i < count; i += LOCAL_SIZE) {
+        atomic_inc(digits + digit_of(keys[base + i], shift));
+    }
+    barrier(CLK_LOCAL_MEM_FENCE);
+    if (localId < DIGITS) {
+        counts[localId * get_num_groups(0) + get_group_id(0)]
+            = digits[localId];
+    }
+}
+
+/* each BLOCK keys, and values if not null, to offsets of their digit.
+ * the block is first sorted by digit in local memory with a stable 1-bit
+ * split per digit bit, so keys of a digit are written next to each other */
+__kernel __attribute__((reqd_work_group_size(LOCAL_SIZE, 1, 1)))
+void radix_scatter(__global const T* keys,
+                   __global const uint* values,
+                   int count,
+                   int shift,
+                   __global const uint* offsets,
+                   __global T* keysOut,
+                   __global uint* valuesOut)
+{
+    __local uint falses[BLOCK];
+    __local uint digits[BLOCK];
+    /* which key of the block is at each sorted position */
+    __local uint order[BLOCK];
+    __local uint digitStart[DIGITS];
+    int localId = get_local_id(0);
+    int base = get_group_id(0) * BLOCK;
+    int size = min(BLOCK, count - base);
+
+    /* positions past the end sort last as the highest digit */
+    for (int e = localId; e < BLOCK; e += LOCAL_SIZE) {
+        digits[e] = e < size ? digit_of(keys[base + e], shift) : DIGITS - 1;
+        order[e] = e;
+    }
+
+    for (int bit = 0; bit < RADIX_BITS; bit++) {
+        barrier(CLK_LOCAL_MEM_FENCE);
+        uint digit[2];
+        uint index[2];
+        for (int k = 0; k < 2; k++) {
+            int e = localId + k * LOCAL_SIZE;
+            digit[k] = digits[e];
+            index[k] = order[e];
+            falses[e] = (digit[k] >> bit) & 1 ? 0 : 1;
+        }
+        uint totalFalses = count_local(falses);
+        int position[2];
+        for (int k = 0; k < 2; k++) {
+            int e = localId + k * LOCAL_SIZE;
+            position[k] = (digit[k] >> bit) & 1
+                              ? e - falses[e] + totalFalses
+                              : falses[e];
+        }
+        barrier(CLK_LOCAL_MEM_FENCE);
+        for (int k = 0; k < 2; k++) {
+            digits[position[k]] = digit[k];
+            order[position[k]] = index[k];
+        }
+    }
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    for (int p = localId; p < BLOCK; p += LOCAL_SIZE) {
+        if (p == 0 || digits[p] != digits[p - 1]) {
+            digitStart[digits[p]] = p;
+        }
+    }
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    for (int p = localId; p < BLOCK; p += LOCAL_SIZE) {
+        int e = order[p];
+        if (e >= size) {
+            continue;
+        }
+        uint digit = digits[p];
+        uint to = offsets[digit * get_num_groups(0) + get_group_id(0)] + p
+                  - digitStart[digit];
+        keysOut[to] = keys[base + e];
+        if (values) {
+            valuesOut[to] = values[base + e];
+        }
+    }
+}
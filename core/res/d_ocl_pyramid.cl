@@ -0,0 +1,260 @@
+/* resizing, gaussian and laplacian pyramids of float or normalized images,
+ * as cv::resize(), cv::pyrDown() and cv::pyrUp().
+ * built with -D MIPMAP where the device has cl_khr_mipmap_image and
+ * cl_khr_mipmap_image_writes, adding the kernels that also write a level of
+ * a mipmapped image */
+
+#ifdef MIPMAP
+#pragma OPENCL EXTENSION cl_khr_mipmap_image : enable
+#pragma OPENCL EXTENSION cl_khr_mipmap_image_writes : enable
+#endif
+
+#include "d_ocl_cubic.h"
+
+/* pixels read from outside the image repeat its edge, as opencv's resize */
+__constant sampler_t edgeSampler = CLK_NORMALIZED_COORDS_FALSE
+                                   | CLK_FILTER_NEAREST
+                                   | CLK_ADDRESS_CLAMP_TO_EDGE;
+__constant sampler_t linearEdgeSampler = CLK_NORMALIZED_COORDS_FALSE
+                                         | CLK_FILTER_LINEAR
+                                         | CLK_ADDRESS_CLAMP_TO_EDGE;
+
+/* 1 4 6 4 1 binomial of cv::pyrDown() */
+__constant float pyramidWeights[5] = {
+    1.0f / 16.0f, 4.0f / 16.0f, 6.0f / 16.0f, 4.0f / 16.0f, 1.0f / 16.0f};
+
+/* gfedcb|abcdefgh|gfedcba, as opencv's BORDER_REFLECT_101 */
+int reflect_101(int i, int size)
+{
+    i = abs(i);
+    i = i >= size ? 2 * size - 2 - i : i;
+    return clamp(i, 0, size - 1);
+}
+
+/* destination pixel (x, y) covers source pixels from
+ * (x, y) * scale to (x + 1, y + 1) * scale: their mean, each weighted by
+ * how much of it is covered. for shrinking */
+__kernel
+void resize_area(__read_only image2d_t input,
+                 __write_only image2d_t output,
+                 int cols,
+                 int rows,
+                 float scaleX,
+                 float scaleY)
+{
+    int x = get_global_id(0);
+    int y = get_global_id(1);
+    if (x >= cols || y >= rows) {
+        return;
+    }
+    float x0 = x * scaleX;
+    float x1 = x0 + scaleX;
+    float y0 = y * scaleY;
+    float y1 = y0 + scaleY;
+    float4 sum = 0.0f;
+    for (int sy = (int)y0; sy < (int)ceil(y1); sy++) {
+        float wy = fmin(sy + 1.0f, y1) - fmax((float)sy, y0);
+        float4 row = 0.0f;
+        for (int sx = (int)x0; sx < (int)ceil(x1); sx++) {
+            float wx = fmin(sx + 1.0f, x1) - fmax((float)sx, x0);
+            row += wx * read_imagef(input, edgeSampler, (int2)(sx, sy));
+        }
+        sum += wy * row;
+    }
+    write_imagef(output, (int2)(x, y), sum / (scaleX * scaleY));
+}
+
+/* pixel centres aligned as opencv's: destination x maps to source
+ * (x + 0.5) * scale - 0.5 */
+__kernel
+void resize_linear(__read_only image2d_t input,
+                   __write_only image2d_t output,
+                   int cols,
+                   int rows,
+                   float scaleX,
+                   float scaleY)
+{
+    int x = get_global_id(0);
+    int y = get_global_id(1);
+    if (x >= cols || y >= rows) {
+        return;
+    }
+    float2 coord = ((float2)(x, y) + 0.5f) * (float2)(scaleX, scaleY);
+    write_imagef(
+        output, (int2)(x, y), read_imagef(input, linearEdgeSampler, coord));
+}
+
+__kernel
+void resize_cubic(__read_only image2d_t input,
+                  __write_only image2d_t output,
+                  int cols,
+                  int rows,
+                  float scaleX,
+                  float scaleY)
+{
+    int x = get_global_id(0);
+    int y = get_global_id(1);
+    if (x >= cols || y >= rows) {
+        return;
+    }
+    float2 coord = ((float2)(x, y) + 0.5f) * (float2)(scaleX, scaleY) - 0.5f;
+    float2 base = floor(coord);
+    float wx[4];
+    float wy[4];
+    cubic_weights(coord.x - base.x, wx);
+    cubic_weights(coord.y - base.y, wy);
+    int2 origin = convert_int2(base) - 1;
+    float4 sum = 0.0f;
+    for (int j = 0; j < 4; j++) {
+        float4 row = 0.0f;
+        for (int i = 0; i < 4; i++) {
+            row += wx[i]
+                   * read_imagef(input, edgeSampler, origin + (int2)(i, j));
+        }
+        sum += wy[j] * row;
+    }
+    write_imagef(output, (int2)(x, y), sum);
+}
+
+/* pyramid levels may be read from the origin of a larger scratch image, so
+ * borders are reflected by the level's own size, not the sampler */
+
+/* the 5 x 5 binomial around source pixel (2x, 2y) */
+float4 pyr_down_at(__read_only image2d_t input,
+                   int x,
+                   int y,
+                   int sourceCols,
+                   int sourceRows)
+{
+    float4 sum = 0.0f;
+    for (int j = 0; j < 5; j++) {
+        int sy = reflect_101(2 * y + j - 2, sourceRows);
+        float4 row = 0.0f;
+        for (int i = 0; i < 5; i++) {
+            int sx = reflect_101(2 * x + i - 2, sourceCols);
+            row += pyramidWeights[i]
+                   * read_imagef(input, edgeSampler, (int2)(sx, sy));
+        }
+        sum += pyramidWeights[j] * row;
+    }
+    return sum;
+}
+
+/* coarse at (x, y) of the fine grid: zeros between its pixels smoothed by
+ * the binomial times 4 */
+float4 pyr_up_at(__read_only image2d_t coarse,
+                 int x,
+                 int y,
+                 int cols,
+                 int rows,
+                 int coarseCols,
+                 int coarseRows)
+{
+    float4 sum = 0.0f;
+    for (int j = 0; j < 5; j++) {
+        int fy = reflect_101(y + j - 2, rows);
+        if ((fy & 1) != 0) {
+            continue;
+        }
+        int cy = min(fy / 2, coarseRows - 1);
+        float4 row = 0.0f;
+        for (int i = 0; i < 5; i++) {
+            int fx = reflect_101(x + i - 2, cols);
+            if ((fx & 1) != 0) {
+                continue;
+            }
+            int cx = min(fx / 2, coarseCols - 1);
+            row += pyramidWeights[i]
+                   * read_imagef(coarse, edgeSampler, (int2)(cx, cy));
+        }
+        sum += pyramidWeights[j] * row;
+    }
+    return 4.0f * sum;
+}
+
+/* next gaussian level, cols x rows, of sourceCols x sourceRows input */
+__kernel
+void pyr_down(__read_only image2d_t input,
+              __write_only image2d_t output,
+              int sourceCols,
+              int sourceRows,
+              int cols,
+              int rows)
+{
+    int x = get_global_id(0);
+    int y = get_global_id(1);
+    if (x >= cols || y >= rows) {
+        return;
+    }
+    write_imagef(
+        output, (int2)(x, y), pyr_down_at(input, x, y, sourceCols, sourceRows));
+}
+
+/* laplacian level: fine gaussian level minus the next one upsampled */
+__kernel
+void laplacian(__read_only image2d_t fine,
+               __read_only image2d_t coarse,
+               __write_only image2d_t output,
+               int cols,
+               int rows,
+               int coarseCols,
+               int coarseRows)
+{
+    int x = get_global_id(0);
+    int y = get_global_id(1);
+    if (x >= cols || y >= rows) {
+        return;
+    }
+    write_imagef(output,
+                 (int2)(x, y),
+                 read_imagef(fine, edgeSampler, (int2)(x, y))
+                     - pyr_up_at(
+                         coarse, x, y, cols, rows, coarseCols, coarseRows));
+}
+
+#ifdef MIPMAP
+/* pyr_down, also written to mip level of pyramid */
+__kernel
+void pyr_down_mip(__read_only image2d_t input,
+                  __write_only image2d_t output,
+                  __write_only image2d_t pyramid,
+                  int level,
+                  int sourceCols,
+                  int sourceRows,
+                  int cols,
+                  int rows)
+{
+    int x = get_global_id(0);
+    int y = get_global_id(1);
+    if (x >= cols || y >= rows) {
+        return;
+    }
+    float4 value = pyr_down_at(input, x, y, sourceCols, sourceRows);
+    write_imagef(output, (int2)(x, y), value);
+    write_imagef(pyramid, (int2)(x, y), level, value);
+}
+
+/* laplacian, written to mip level of pyramid */
+__kernel
+void laplacian_mip(__read_only image2d_t fine,
+                   __read_only image2d_t coarse,
+                   __write_only image2d_t pyramid,
+                   int level,
+                   int cols,
+                   int rows,
+                   int coarseCols,
+                   int coarseRows)
+{
+    int x = get_global_id(0);
+    int y = get_global_id(1);
+    if (x >= cols || y >= rows) {
+        return;
+    }
+    write_imagef(pyramid,
+                 (int2)(x, y),
+                 level,
+                 read_imagef(fine, edgeSampler, (int2)(x, y))
+                     - pyr_up_at(
+                         coarse, x, y, cols, rows, coarseCols, coarseRows));
+}
+#endif
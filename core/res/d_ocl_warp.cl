@@ -0,0 +1,200 @@
+/* affine and perspective warps of float or normalized images.
+ * built with
+ *   -D INTERPOLATION=0 nearest, 1 bilinear or 2 bicubic
+ * the matrix maps destination pixels to source ones, its rows passed as
+ * float4s with x, y, z used, inverted on the host once per transform.
+ * warp_batch takes 3 rows per transform from a buffer, 1 output layer each.
+ * remap_build_* write the source coordinates of every destination pixel
+ * into a map once, remap_apply_* warp by reading them back */
+
+#include "d_ocl_cubic.h"
+
+/* coordinates are [0...size), not [0...1].
+ * pixels read from outside the image are transparent black */
+__constant sampler_t nearestSampler = CLK_NORMALIZED_COORDS_FALSE
+                                      | CLK_FILTER_NEAREST
+                                      | CLK_ADDRESS_CLAMP;
+/* linear interpolation by the sampler when reading between pixels */
+__constant sampler_t linearSampler = CLK_NORMALIZED_COORDS_FALSE
+                                     | CLK_FILTER_LINEAR
+                                     | CLK_ADDRESS_CLAMP;
+
+/* input at pixel coordinates, pixel centres at whole numbers as opencv's */
+float4 sample(__read_only image2d_t input, float2 coord)
+{
+#if INTERPOLATION == 0
+    return read_imagef(input, nearestSampler, coord + 0.5f);
+#elif INTERPOLATION == 1
+    return read_imagef(input, linearSampler, coord + 0.5f);
+#else
+    float2 base = floor(coord);
+    float wx[4];
+    float wy[4];
+    cubic_weights(coord.x - base.x, wx);
+    cubic_weights(coord.y - base.y, wy);
+    int2 origin = convert_int2(base) - 1;
+    float4 sum = 0.0f;
+    for (int j = 0; j < 4; j++) {
+        float4 row = 0.0f;
+        for (int i = 0; i < 4; i++) {
+            row += wx[i]
+                   * read_imagef(input, nearestSampler, origin + (int2)(i, j));
+        }
+        sum += wy[j] * row;
+    }
+    return sum;
+#endif
+}
+
+/* source coordinates of destination pixel (x, y) */
+float2 project(int x, int y, float4 row0, float4 row1, float4 row2)
+{
+    float w = row2.x * x + row2.y * y + row2.z;
+    w = w != 0.0f ? 1.0f / w : 0.0f;
+    return (float2)(row0.x * x + row0.y * y + row0.z,
+                    row1.x * x + row1.y * y + row1.z)
+           * w;
+}
+
+/* warp_affine and warp_perspective take any global size, looping over the
+ * pixels beyond it, so their work sizes can be tuned */
+__kernel
+void warp_affine(__read_only image2d_t input,
+                 __write_only image2d_t output,
+                 int cols,
+                 int rows,
+                 float4 row0,
+                 float4 row1,
+                 float4 row2)
+{
+    for (int y = get_global_id(1); y < rows; y += get_global_size(1)) {
+        for (int x = get_global_id(0); x < cols; x += get_global_size(0)) {
+            float2 coord = (float2)(row0.x * x + row0.y * y + row0.z,
+                                    row1.x * x + row1.y * y + row1.z);
+            write_imagef(output, (int2)(x, y), sample(input, coord));
+        }
+    }
+}
+
+__kernel
+void warp_perspective(__read_only image2d_t input,
+                      __write_only image2d_t output,
+                      int cols,
+                      int rows,
+                      float4 row0,
+                      float4 row1,
+                      float4 row2)
+{
+    for (int y = get_global_id(1); y < rows; y += get_global_size(1)) {
+        for (int x = get_global_id(0); x < cols; x += get_global_size(0)) {
+            write_imagef(output,
+                         (int2)(x, y),
+                         sample(input, project(x, y, row0, row1, row2)));
+        }
+    }
+}
+
+/* layer z of output by the z-th matrix. perspective division is exact for
+ * affine matrices, so 1 kernel serves both */
+__kernel
+void warp_batch(__read_only image2d_t input,
+                __write_only image2d_array_t output,
+                int cols,
+                int rows,
+                __global const float4* matrices)
+{
+    int x = get_global_id(0);
+    int y = get_global_id(1);
+    int layer = get_global_id(2);
+    if (x >= cols || y >= rows) {
+        return;
+    }
+    __global const float4* m = matrices + 3 * layer;
+    write_imagef(output,
+                 (int4)(x, y, layer, 0),
+                 sample(input, project(x, y, m[0], m[1], m[2])));
+}
+
+/* map entries are read exactly at their pixel */
+__constant sampler_t mapSampler = CLK_NORMALIZED_COORDS_FALSE
+                                  | CLK_FILTER_NEAREST
+                                  | CLK_ADDRESS_NONE;
+
+/* CL_RG CL_FLOAT map */
+__kernel
+void remap_build_float(__write_only image2d_t map,
+                       int cols,
+                       int rows,
+                       float4 row0,
+                       float4 row1,
+                       float4 row2)
+{
+    int x = get_global_id(0);
+    int y = get_global_id(1);
+    if (x >= cols || y >= rows) {
+        return;
+    }
+    float2 coord = project(x, y, row0, row1, row2);
+    write_imagef(map, (int2)(x, y), (float4)(coord, 0.0f, 0.0f));
+}
+
+/* CL_RG CL_SIGNED_INT16 map of coordinates times scale. coordinates over 1
+ * pixel outside the source all sample transparent black, so they are
+ * clamped to fit 16 bits */
+__kernel
+void remap_build_fixed(__write_only image2d_t map,
+                       int cols,
+                       int rows,
+                       float4 row0,
+                       float4 row1,
+                       float4 row2,
+                       int sourceCols,
+                       int sourceRows,
+                       float scale)
+{
+    int x = get_global_id(0);
+    int y = get_global_id(1);
+    if (x >= cols || y >= rows) {
+        return;
+    }
+    float2 coord = clamp(project(x, y, row0, row1, row2),
+                         (float2)(-2.0f),
+                         (float2)(sourceCols + 1, sourceRows + 1));
+    write_imagei(
+        map, (int2)(x, y), (int4)(convert_int2_rte(coord * scale), 0, 0));
+}
+
+__kernel
+void remap_apply_float(__read_only image2d_t input,
+                       __write_only image2d_t output,
+                       __read_only image2d_t map,
+                       int cols,
+                       int rows)
+{
+    int x = get_global_id(0);
+    int y = get_global_id(1);
+    if (x >= cols || y >= rows) {
+        return;
+    }
+    float2 coord = read_imagef(map, mapSampler, (int2)(x, y)).xy;
+    write_imagef(output, (int2)(x, y), sample(input, coord));
+}
+
+__kernel
+void remap_apply_fixed(__read_only image2d_t input,
+                       __write_only image2d_t output,
+                       __read_only image2d_t map,
+                       int cols,
+                       int rows,
+                       float inverseScale)
+{
+    int x = get_global_id(0);
+    int y = get_global_id(1);
+    if (x >= cols || y >= rows) {
+        return;
+    }
+    float2 coord
+        = convert_float2(read_imagei(map, mapSampler, (int2)(x, y)).xy)
+          * inverseScale;
+    write_imagef(output, (int2)(x, y), sample(input, coord));
+}
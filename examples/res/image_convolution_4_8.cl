@@ -1,3 +1,12 @@
+/* filter width baked in at build time with -D FILTER_WIDTH=... */
+/* lets the compiler unroll the filter loops. */
+/* otherwise fall back to the filterWidth kernel arg */
+#ifdef FILTER_WIDTH
+#define FILTER_W    FILTER_WIDTH
+#else
+#define FILTER_W    filterWidth
+#endif
+
 __kernel
 void image_convolution_4_8(
                        int imageWidth,
@@ -10,7 +19,7 @@ void image_convolution_4_8(
 {
     /* Half the width of the filter is needed for indexing
      * memory later */
-    int halfWidth = filterWidth / 2.0;
+    int halfWidth = FILTER_W / 2;
 
     /* Store each work-item’s unique row and column */
     for (int column = get_global_id(0); column < imageWidth; column += get_global_size(0)) {
@@ -25,10 +34,13 @@ void image_convolution_4_8(
 
             /* Iterate the filter rows */
             for (int i = -halfWidth; i <= halfWidth; i++) {
-                coords.y = row + i;
+                /* clamped here, not by the sampler, as the image may be
+                 * larger than imageWidth x imageHeight when filtered in
+                 * strips or tiles */
+                coords.y = clamp(row + i, 0, imageHeight - 1);
                 /* Iterate over the filter columns */
                 for (int j = -halfWidth; j <= halfWidth; j++) {
-                    coords.x = column + j;
+                    coords.x = clamp(column + j, 0, imageWidth - 1);
                     /* Read a pixel from the image */
                     float4 pixel = read_imagef(inputImage, sampler, coords);
 
@@ -1,18 +1,217 @@
 #include "histogram_4_2.h"
 #include "../../core/d_ocl.h"
+#include "../../core/d_ocl_equalize.h"
+#include "../../core/d_ocl_handle.h"
+#include "../../core/d_ocl_histogram.h"
+#include "../../core/d_ocl_pipeline.h"
+#include "../../core/d_ocl_task_graph.h"
 #include "programs_defines.h"
 #include <CL/cl.h>
+#include <algorithm>
 #include <iostream>
 #include <opencv2/imgcodecs.hpp>
+#include <opencv2/imgproc.hpp>
 
 #define EX_NAME_HISTOGRAM_4_2 "histogram_4_2"
 #define EX_KERN_HISTOGRAM_4_2 histogram_4_2
-// must match HIST_BINS in the opencl kernel
+// bins per channel of the 8-bit image
 #define HIST_BINS 256
+// bins of the float greyscale histogram, over 0.0 ~ 1.0
+#define HIST_FLOAT_BINS 64
+// # parts the input image is uploaded in
+#define HIST_CHUNKS 4
+// 2 = double buffered chunks
+#define HIST_PIPELINE_DEPTH 2
+// as cv::createCLAHE()'s defaults
+#define HIST_CLAHE_CLIP_LIMIT 40.0f
+#define HIST_CLAHE_TILES 8
+
+// histograms of a float image, all at once, compared with the host's
+static auto floatHistogram(const d_ocl::context_set& contextSet,
+                           const cv::Mat& bmp) -> bool
+{
+    cv::Mat greyMat;
+    if (!d_ocl::convertImage(
+            bmp, {d_ocl::utils::toGreyscale, d_ocl::utils::toFloat}, greyMat)) {
+        return false;
+    }
+    d_ocl::histogram_options options;
+    options.bins = HIST_FLOAT_BINS;
+    options.minValue = 0.0f;
+    options.maxValue = 1.0f;
+    d_ocl::histogram histogram(contextSet.context->openclObject,
+                               contextSet.device,
+                               greyMat.type(),
+                               options);
+    if (!histogram) {
+        return false;
+    }
+
+    const size_t count = greyMat.total() * greyMat.channels();
+    std::vector<cl_uint> hostHistogram(HIST_FLOAT_BINS, 0);
+    std::shared_ptr<d_ocl::utils::manager<cl_mem>> data
+        = d_ocl::utils::manager<cl_mem>::makeShared(
+            clCreateBuffer(contextSet.context->openclObject,
+                           CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR
+                               | CL_MEM_HOST_NO_ACCESS,
+                           count * sizeof(float),
+                           greyMat.data,
+                           nullptr),
+            &clReleaseMemObject);
+    // starts from zero, as the engine adds to it
+    std::shared_ptr<d_ocl::utils::manager<cl_mem>> deviceHistogram
+        = d_ocl::utils::manager<cl_mem>::makeShared(
+            clCreateBuffer(contextSet.context->openclObject,
+                           CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR,
+                           histogram.histogramSize(),
+                           hostHistogram.data(),
+                           nullptr),
+            &clReleaseMemObject);
+    if (!data || !deviceHistogram) {
+        return false;
+    }
+
+    d_ocl::handle<cl_event> counted;
+    if (!histogram.run(contextSet.cmdQueue->openclObject,
+                       data->openclObject,
+                       count,
+                       deviceHistogram->openclObject,
+                       {},
+                       counted.outParam())
+        || !d_ocl::utils::checkRun(
+            "clEnqueueReadBuffer",
+            clEnqueueReadBuffer(contextSet.cmdQueue->openclObject,
+                                deviceHistogram->openclObject,
+                                CL_TRUE,
+                                0,
+                                histogram.histogramSize(),
+                                hostHistogram.data(),
+                                1,
+                                counted.address(),
+                                nullptr))) {
+        return false;
+    }
+
+    // same binning as the kernel: equal bins, 1.0 in the last
+    std::vector<cl_uint> expected(HIST_FLOAT_BINS, 0);
+    const float* values = reinterpret_cast<const float*>(greyMat.data);
+    for (size_t i = 0; i < count; i++) {
+        expected[std::min<int>(values[i] * HIST_FLOAT_BINS,
+                               HIST_FLOAT_BINS - 1)]++;
+    }
+    for (size_t bin = 0; bin < HIST_FLOAT_BINS; bin++) {
+        if (expected[bin] != hostHistogram[bin]) {
+            std::cerr << "opencl float histogram[" << bin
+                      << "] = " << hostHistogram[bin] << " != "
+                      << expected[bin] << " = c++ float histogram[" << bin
+                      << "]" << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+// equalization and clahe of the greyscale image, each on the device from
+// 1 upload to 1 download, compared with opencv's. rounding may differ by 1
+static auto equalization(const d_ocl::context_set& contextSet,
+                         const cv::Mat& bmp) -> bool
+{
+    cv::Mat greyMat;
+    if (!d_ocl::convertImage(bmp, {d_ocl::utils::toGreyscale}, greyMat)) {
+        return false;
+    }
+    d_ocl::equalizer equalizer(contextSet.context->openclObject,
+                               contextSet.device);
+    if (!equalizer) {
+        return false;
+    }
+
+    const size_t imageSize = greyMat.total();
+    std::shared_ptr<d_ocl::utils::manager<cl_mem>> input
+        = d_ocl::utils::manager<cl_mem>::makeShared(
+            clCreateBuffer(contextSet.context->openclObject,
+                           CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR
+                               | CL_MEM_HOST_NO_ACCESS,
+                           imageSize,
+                           greyMat.data,
+                           nullptr),
+            &clReleaseMemObject);
+    std::vector<std::shared_ptr<d_ocl::utils::manager<cl_mem>>> outputs;
+    for (int output = 0; output < 2; output++) {
+        outputs.push_back(d_ocl::utils::manager<cl_mem>::makeShared(
+            clCreateBuffer(contextSet.context->openclObject,
+                           CL_MEM_WRITE_ONLY | CL_MEM_HOST_READ_ONLY,
+                           imageSize,
+                           nullptr,
+                           nullptr),
+            &clReleaseMemObject));
+    }
+    if (!input || !outputs[0] || !outputs[1]) {
+        return false;
+    }
+
+    cl_command_queue queue = contextSet.cmdQueue->openclObject;
+    d_ocl::clahe_options options;
+    options.clipLimit = HIST_CLAHE_CLIP_LIMIT;
+    options.tilesX = HIST_CLAHE_TILES;
+    options.tilesY = HIST_CLAHE_TILES;
+    d_ocl::handle<cl_event> equalized;
+    d_ocl::handle<cl_event> adapted;
+    if (!equalizer.equalize(queue,
+                            input->openclObject,
+                            outputs[0]->openclObject,
+                            greyMat.cols,
+                            greyMat.rows,
+                            {},
+                            equalized.outParam())
+        || !equalizer.clahe(queue,
+                            input->openclObject,
+                            outputs[1]->openclObject,
+                            greyMat.cols,
+                            greyMat.rows,
+                            options,
+                            {},
+                            adapted.outParam())) {
+        return false;
+    }
+
+    cv::Mat expected[2];
+    cv::equalizeHist(greyMat, expected[0]);
+    cv::createCLAHE(HIST_CLAHE_CLIP_LIMIT,
+                    cv::Size(HIST_CLAHE_TILES, HIST_CLAHE_TILES))
+        ->apply(greyMat, expected[1]);
+    const cl_event* done[2] = {equalized.address(), adapted.address()};
+    const char* names[2] = {"equalized", "clahe"};
+    for (int output = 0; output < 2; output++) {
+        cv::Mat result(greyMat.rows, greyMat.cols, CV_8UC1);
+        if (!d_ocl::utils::checkRun(
+                "clEnqueueReadBuffer",
+                clEnqueueReadBuffer(queue,
+                                    outputs[output]->openclObject,
+                                    CL_TRUE,
+                                    0,
+                                    imageSize,
+                                    result.data,
+                                    1,
+                                    done[output],
+                                    nullptr))) {
+            return false;
+        }
+        const double maxDifference
+            = cv::norm(expected[output], result, cv::NORM_INF);
+        if (maxDifference > 1) {
+            std::cerr << names[output] << " image differs from opencv's by "
+                      << maxDifference << std::endl;
+            return false;
+        }
+    }
+    std::cout << "equalized and clahe images match opencv's" << std::endl;
+    return true;
+}
 
 auto histogram_4_2() -> bool
 {
-    // gpu context and command queue for the first gpu device found
+    // context and command queue for the best device found
     d_ocl::context_set contextSet;
     if (!d_ocl::createContextSet(contextSet)) {
         return false;
@@ -34,165 +233,161 @@ auto histogram_4_2() -> bool
     const size_t imageSize = bmp.step[0] * bmp.rows;
     // total sample count (pixels * channels per pixel)
     const size_t imageElements = bmp.rows * bmp.cols * bmp.channels();
-    // host-side histogram
-    std::vector<int> hostHistogram(HIST_BINS, 0);
-    const size_t histogramSize = hostHistogram.size() * sizeof(int);
+    // host-side histograms, channel c's bins from c * HIST_BINS
+    std::vector<cl_uint> hostHistogram(bmp.channels() * HIST_BINS, 0);
+    const size_t histogramSize = hostHistogram.size() * sizeof(cl_uint);
 
-    // buffer object for the input image
-    // initialized with pixel data from bmp
-    std::shared_ptr<d_ocl::utils::manager<cl_mem>> deviceImg
-        = d_ocl::utils::manager<cl_mem>::makeShared(
+    // the image is uploaded in chunks, each chunk's histograms computed
+    // while the next uploads. chunks start at whole pixels
+    const size_t pixelSize = bmp.elemSize();
+    const size_t chunkSize = (imageSize / pixelSize + HIST_CHUNKS - 1)
+                             / HIST_CHUNKS * pixelSize;
+    const size_t numChunks = (imageSize + chunkSize - 1) / chunkSize;
+    // double-buffered device-side chunks of the input image
+    std::vector<std::shared_ptr<d_ocl::utils::manager<cl_mem>>> deviceChunks;
+    for (size_t slot = 0; slot < HIST_PIPELINE_DEPTH; slot++) {
+        deviceChunks.push_back(d_ocl::utils::manager<cl_mem>::makeShared(
             clCreateBuffer(contextSet.context->openclObject,
-                           CL_MEM_READ_ONLY | CL_MEM_HOST_WRITE_ONLY
-                               | CL_MEM_COPY_HOST_PTR,
-                           imageSize,
-                           bmp.data,
+                           CL_MEM_READ_ONLY | CL_MEM_HOST_WRITE_ONLY,
+                           chunkSize,
+                           nullptr,
                            nullptr),
-            &clReleaseMemObject);
+            &clReleaseMemObject));
+        if (!deviceChunks.back()) {
+            std::cerr << "error creating buffers for input image chunks"
+                      << std::endl;
+            return false;
+        }
+    }
     // to get histogram from device to host accessible memory
     std::shared_ptr<d_ocl::utils::manager<cl_mem>> deviceHistogram
         = d_ocl::utils::manager<cl_mem>::makeShared(
             clCreateBuffer(contextSet.context->openclObject,
-                           CL_MEM_WRITE_ONLY | CL_MEM_HOST_READ_ONLY,
+                           CL_MEM_READ_WRITE | CL_MEM_HOST_READ_ONLY,
                            histogramSize,
                            nullptr,
                            nullptr),
             &clReleaseMemObject);
-    if (!deviceImg || !deviceHistogram) {
-        std::cerr << "error creating buffers for input image and histogram"
-                  << std::endl;
+    if (!deviceHistogram) {
+        std::cerr << "error creating buffers for histogram" << std::endl;
+        return false;
+    }
+
+    // commands without data dependencies between them may overlap
+    std::shared_ptr<d_ocl::utils::manager<cl_command_queue>> queue
+        = d_ocl::createOutOfOrderQueue(contextSet.device,
+                                       contextSet.context->openclObject);
+    if (!queue) {
         return false;
     }
+    d_ocl::task_graph graph(queue->openclObject);
 
     // initialize the output histogram with zeros
-    const int zero = 0;
-    cl_event histogramInitialized;
-    if (!d_ocl::utils::checkRun(
-            "clEnqueueFillBuffer",
-            clEnqueueFillBuffer(contextSet.cmdQueue->openclObject,
-                                deviceHistogram->openclObject,
-                                &zero,
-                                sizeof(zero),
-                                0,
-                                histogramSize,
-                                0,
-                                nullptr,
-                                &histogramInitialized))) {
-        return false;
-    }
-
-    // compile and link the program
-    std::shared_ptr<d_ocl::utils::manager<cl_program>> program
-        = d_ocl::createProgram(contextSet.context->openclObject,
-                               EX_RESOURCE_ROOT "/" EX_NAME_HISTOGRAM_4_2
-                                                "." D_OCL_KERN_EXT);
-
-    std::shared_ptr<d_ocl::utils::manager<cl_kernel>> kernel;
-    if (program) {
-        // make a kernel out of the program
-        kernel = d_ocl::utils::manager<cl_kernel>::makeShared(
-            // specify the kernel name, decorated with __kernel in the source
-            clCreateKernel(
-                program->openclObject, EX_NAME_HISTOGRAM_4_2, nullptr),
-            &clReleaseKernel);
-    }
-
-    if (!program
-        || !kernel
-        // arguments for
-        // histogram_4_2(
-        //     __global unsigned char* data, int numData, __global int*
-        //     histogram)
-        || !d_ocl::utils::checkRun("clSetKernelArg",
-                                   clSetKernelArg(kernel->openclObject,
-                                                  0,
-                                                  sizeof(cl_mem),
-                                                  &deviceImg->openclObject))
-        || !d_ocl::utils::checkRun(
-            "clSetKernelArg",
-            clSetKernelArg(
-                kernel->openclObject, 1, sizeof(imageElements), &imageElements))
-        || !d_ocl::utils::checkRun(
-            "clSetKernelArg",
-            clSetKernelArg(kernel->openclObject,
-                           2,
-                           sizeof(cl_mem),
-                           &deviceHistogram->openclObject))) {
-        std::cerr << "error creating program kernel" << std::endl;
+    const cl_uint zero = 0;
+    const size_t fillNode = graph.addFill(EX_NAME_HISTOGRAM_4_2 " fill",
+                                          deviceHistogram->openclObject,
+                                          &zero,
+                                          sizeof(zero),
+                                          0,
+                                          histogramSize);
+    if (!graph.run()) {
         return false;
     }
 
-    // max # work-items per compute unit
-    std::vector<size_t> workGroupSize
-        = d_ocl::utils::maxWorkGroupSize(contextSet.device);
-    // # parallel compute units
-    // keep in mind a work-group executes on a single compute unit
-    cl_uint numComputeUnits = d_ocl::utils::maxComputeUnits(contextSet.device);
-    if (numComputeUnits == 0) {
+    // separate b, g and r histograms.
+    // the program builds while the device zeroes the histogram
+    d_ocl::histogram histogram(
+        contextSet.context->openclObject, contextSet.device, bmp.type());
+    if (!histogram) {
+        std::cerr << "error creating histogram engine" << std::endl;
         return false;
     }
 
-    // will read at most this many pixel data points concurrently
-    // max # parallel compute units (work-groups)
-    // * max # work-items in work-group
-    size_t globalSize = numComputeUnits * workGroupSize[0];
+    std::cout << "input image: " << imageElements << " elements in "
+              << numChunks << " chunks" << std::endl;
 
-    std::cout << "input image: " << imageElements << " elements" << std::endl
-              << "global size: " << globalSize << std::endl
-              << "work-groups: "
-              << std::ceil((float)imageElements / workGroupSize[0]) << std::endl
-              << "work-items per work-group (local size): " << workGroupSize[0]
-              << std::endl;
+    // bytes of the image in chunk
+    auto chunkBytes = [&](size_t chunk) -> size_t {
+        return std::min(chunkSize, imageSize - chunk * chunkSize);
+    };
+    d_ocl::chunk_pipeline_stages stages;
+    stages.upload = [&](size_t chunk,
+                        size_t slot,
+                        cl_command_queue uploadQueue,
+                        const std::vector<cl_event>& waitList,
+                        cl_event* event) -> bool {
+        return d_ocl::utils::checkRun(
+            "clEnqueueWriteBuffer",
+            clEnqueueWriteBuffer(uploadQueue,
+                                 deviceChunks[slot]->openclObject,
+                                 CL_FALSE,
+                                 0,
+                                 chunkBytes(chunk),
+                                 bmp.data + chunk * chunkSize,
+                                 static_cast<cl_uint>(waitList.size()),
+                                 waitList.empty() ? nullptr : waitList.data(),
+                                 event));
+    };
+    // every chunk accumulates into deviceHistogram
+    stages.compute = [&](size_t chunk,
+                         size_t slot,
+                         cl_command_queue computeQueue,
+                         const std::vector<cl_event>& waitList,
+                         cl_event* event) -> bool {
+        return histogram.run(computeQueue,
+                             deviceChunks[slot]->openclObject,
+                             chunkBytes(chunk),
+                             deviceHistogram->openclObject,
+                             waitList,
+                             event);
+    };
+    // computing starts once the histogram is zeroed
+    if (!d_ocl::runChunkPipeline(contextSet,
+                                 EX_NAME_HISTOGRAM_4_2,
+                                 numChunks,
+                                 HIST_PIPELINE_DEPTH,
+                                 stages,
+                                 {graph.event(fillNode)})) {
+        return false;
+    }
 
-    cl_event kernel_event;
-    // queue the kernel onto the device
-    // read the answer into host buffer after kernel is finished
+    // read the answer into host buffer after every chunk is counted
     if (!d_ocl::utils::checkRun(
-            "clEnqueueNDRangeKernel",
-            clEnqueueNDRangeKernel(contextSet.cmdQueue->openclObject,
-                                   kernel->openclObject,
-                                   1,
-                                   nullptr,
-                                   &globalSize,
-                                   workGroupSize.data(),
-                                   0,
-                                   nullptr,
-                                   &kernel_event))
-        || !d_ocl::utils::checkRun(
             "clEnqueueReadBuffer",
-            clEnqueueReadBuffer(contextSet.cmdQueue->openclObject,
+            clEnqueueReadBuffer(contextSet.downloadQueue->openclObject,
                                 deviceHistogram->openclObject,
                                 CL_TRUE,
                                 0,
                                 histogramSize,
                                 hostHistogram.data(),
-                                1,
-                                &kernel_event,
+                                0,
+                                nullptr,
                                 nullptr))) {
         return false;
     }
 
     // brute-force histogram
-    std::vector<int> histogram(HIST_BINS, 0);
+    std::vector<cl_uint> histograms(hostHistogram.size(), 0);
     // each item is a component in the given pixel
-    // e.g. for RGB: {pixel 0 R, pixel 0 G, pixel 0 B, pixel 1 R, ...}
+    // e.g. for BGR: {pixel 0 B, pixel 0 G, pixel 0 R, pixel 1 B, ...}
     const uint8_t* pixelData = reinterpret_cast<uint8_t*>(bmp.data);
-    for (size_t pixel = 0; pixel < imageElements; pixel++) {
-        histogram[pixelData[pixel]]++;
+    for (size_t element = 0; element < imageElements; element++) {
+        const size_t channel = element % bmp.channels();
+        histograms[channel * HIST_BINS + pixelData[element]]++;
     }
 
     // compare answers
-    for (size_t bin = 0; bin < HIST_BINS; bin++) {
-        if (histogram[bin] != hostHistogram[bin]) {
+    for (size_t bin = 0; bin < histograms.size(); bin++) {
+        if (histograms[bin] != hostHistogram[bin]) {
             std::cerr << "opencl histogram[" << bin
                       << "] = " << hostHistogram[bin]
-                      << " != " << histogram[bin] << " = c++ histogram[" << bin
-                      << "]" << std::endl;
+                      << " != " << histograms[bin] << " = c++ histogram["
+                      << bin << "]" << std::endl;
             return false;
         }
     }
 
-    return true;
+    return floatHistogram(contextSet, bmp) && equalization(contextSet, bmp);
 }
 
 // append to g_exampleNames and g_exampleFunctions
@@ -0,0 +1,156 @@
+#include "image_batch_4_8.h"
+#include "../../core/d_ocl.h"
+#include "../../core/d_ocl_batch.h"
+#include "../../core/d_ocl_kernel.h"
+#include "programs_defines.h"
+#include <iostream>
+#include <opencv2/imgcodecs.hpp>
+#include <vector>
+
+#define EX_NAME_IMG_BATCH_4_8 "image_batch_4_8"
+#define EX_KERN_IMG_BATCH_4_8 image_batch_4_8
+// same filter as image_convolution_4_8, applied to every image in a directory
+#define EX_NAME_IMG_CONVOLUTION_4_8 "image_convolution_4_8"
+
+static std::vector<float> gaussianBlurFilter
+    = {1.0f,  4.0f, 7.0f,  4.0f,  1.0f,  4.0f, 16.0f, 26.0f, 16.0f,
+       4.0f,  7.0f, 26.0f, 41.0f, 26.0f, 7.0f, 4.0f,  16.0f, 26.0f,
+       16.0f, 4.0f, 1.0f,  4.0f,  7.0f,  4.0f, 1.0f};
+static const int gaussianBlurFilterWidth = 5;
+
+// per-stage throughput of a batch run
+static auto printStage(const char* stage,
+                       const d_ocl::batch_stage_stats& stageStats,
+                       double seconds) -> void
+{
+    std::cout << stage << ": " << stageStats.items << " images, "
+              << stageStats.items / seconds << " images/s, busy "
+              << stageStats.busy << " s, stalled " << stageStats.stalled
+              << " s, starved " << stageStats.starved << " s" << std::endl;
+}
+
+auto image_batch_4_8() -> bool
+{
+    // context and command queues for the best device found
+    d_ocl::context_set contextSet;
+    if (!d_ocl::createContextSet(contextSet)) {
+        return false;
+    }
+
+    // every bitmap in the resources directory
+    std::vector<std::string> filePaths;
+    if (!d_ocl::utils::listFiles(EX_RESOURCE_ROOT, filePaths)) {
+        return false;
+    }
+    std::vector<std::string> inputPaths;
+    for (const std::string& filePath : filePaths) {
+        if (filePath.size() > 4
+            && filePath.compare(filePath.size() - 4, 4, ".bmp") == 0) {
+            inputPaths.push_back(filePath);
+        }
+    }
+
+    // normalized filter so the output stays in 0.0~1.0
+    std::vector<float> filterCoefficients;
+    float filterSum = 0.0f;
+    for (float coefficient : gaussianBlurFilter) {
+        filterSum += coefficient;
+    }
+    for (float coefficient : gaussianBlurFilter) {
+        filterCoefficients.push_back(coefficient / filterSum);
+    }
+    std::shared_ptr<d_ocl::utils::manager<cl_mem>> filter
+        = d_ocl::utils::manager<cl_mem>::makeShared(
+            clCreateBuffer(contextSet.context->openclObject,
+                           CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR
+                               | CL_MEM_HOST_NO_ACCESS,
+                           filterCoefficients.size() * sizeof(float),
+                           filterCoefficients.data(),
+                           nullptr),
+            clReleaseMemObject);
+    std::vector<cl_sampler_properties> samplerProps
+        = {CL_SAMPLER_NORMALIZED_COORDS,
+           CL_FALSE,
+           CL_SAMPLER_ADDRESSING_MODE,
+           CL_ADDRESS_CLAMP_TO_EDGE,
+           CL_SAMPLER_FILTER_MODE,
+           CL_FILTER_NEAREST,
+           0};
+    std::shared_ptr<d_ocl::utils::manager<cl_sampler>> sampler
+        = d_ocl::utils::manager<cl_sampler>::makeShared(
+            clCreateSamplerWithProperties(
+                contextSet.context->openclObject, samplerProps.data(), nullptr),
+            clReleaseSampler);
+    if (!filter || !sampler) {
+        return false;
+    }
+
+    std::shared_ptr<d_ocl::utils::manager<cl_program>> program
+        = d_ocl::createProgram(
+            contextSet.context->openclObject,
+            EX_RESOURCE_ROOT "/" EX_NAME_IMG_CONVOLUTION_4_8 "." D_OCL_KERN_EXT,
+            std::string(),
+            {{"FILTER_WIDTH", std::to_string(gaussianBlurFilterWidth)}});
+    if (!program) {
+        return false;
+    }
+    d_ocl::launcher<int, int, cl_mem, cl_mem, cl_mem, int, cl_sampler>
+        convolution(program, EX_NAME_IMG_CONVOLUTION_4_8);
+    if (!convolution) {
+        return false;
+    }
+
+    d_ocl::batch_options options;
+    // greyscale 32-bit float as expected by the kernel, back to 8-bit to save
+    options.decodeConverts = {d_ocl::utils::toGreyscale, d_ocl::utils::toFloat};
+    options.encodeConverts
+        = {[](const cv::Mat* floatMat, cv::Mat* byteMat) -> bool {
+              floatMat->convertTo(*byteMat, CV_8U, 255.0);
+              return true;
+          }};
+    // images may differ in size, so the driver picks the work-groups
+    d_ocl::batch_process_func process
+        = [&](cl_command_queue queue,
+              cl_mem inputImage,
+              cl_mem outputImage,
+              const cv::Mat& inputMat,
+              const std::vector<cl_event>& waitList,
+              cl_event* event) -> bool {
+        d_ocl::nd_range range;
+        range.global = {(size_t)inputMat.cols, (size_t)inputMat.rows};
+        return convolution.run(queue,
+                               range,
+                               waitList,
+                               event,
+                               inputMat.cols,
+                               inputMat.rows,
+                               inputImage,
+                               outputImage,
+                               filter->openclObject,
+                               gaussianBlurFilterWidth,
+                               sampler->openclObject);
+    };
+
+    d_ocl::batch_stats stats;
+    if (!d_ocl::runImageBatch(contextSet,
+                              EX_NAME_IMG_BATCH_4_8,
+                              inputPaths,
+                              EX_NAME_IMG_BATCH_4_8,
+                              options,
+                              process,
+                              stats)) {
+        std::cerr << stats.failed << " images failed" << std::endl;
+        return false;
+    }
+
+    // the stage with the most busy time per thread is the bottleneck
+    printStage("decode", stats.decode, stats.seconds);
+    printStage("device", stats.device, stats.seconds);
+    printStage("encode", stats.encode, stats.seconds);
+    std::cout << "filtered images saved in " EX_NAME_IMG_BATCH_4_8 "/"
+              << std::endl;
+
+    return stats.encode.items == inputPaths.size();
+}
+
+D_OCL_REGISTER_EXAMPLE(EX_KERN_IMG_BATCH_4_8, EX_NAME_IMG_BATCH_4_8);
@@ -0,0 +1,8 @@
+#ifndef IMG_BATCH_4_8_H
+#define IMG_BATCH_4_8_H
+
+#include "../d_ocl_examples.h"
+
+auto D_OCL_EXAMPLES_API image_batch_4_8() -> bool;
+
+#endif
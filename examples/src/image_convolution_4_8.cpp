@@ -1,6 +1,11 @@
 #include "image_convolution_4_8.h"
 #include "../../core/d_ocl.h"
+#include "../../core/d_ocl_convert.h"
+#include "../../core/d_ocl_convolution.h"
+#include "../../core/d_ocl_handle.h"
+#include "../../core/d_ocl_pipeline.h"
 #include "programs_defines.h"
+#include <algorithm>
 #include <iostream>
 #include <opencv2/imgcodecs.hpp>
 #include <opencv2/imgproc.hpp>
@@ -8,175 +13,358 @@
 
 #define EX_NAME_IMG_CONVOLUTION_4_8 "image_convolution_4_8"
 #define EX_KERN_IMG_CONVOLUTION_4_8 image_convolution_4_8
+// # horizontal strips the image is filtered in
+#define CONVOLUTION_STRIPS 4
+// 2 = double buffered strips
+#define CONVOLUTION_PIPELINE_DEPTH 2
+// lens blur wide enough for the fft to pay off
+#define FFT_FILTER_WIDTH 21
 
-static float gaussianBlurFilterFactor = 273.0f;
+// binomial approximation of a gaussian, the outer product of
+// {1, 4, 6, 4, 1} with itself, so it runs as 2 separable passes
+static float gaussianBlurFilterFactor = 256.0f;
 static std::vector<float> gaussianBlurFilter
-    = {1.0f,  4.0f, 7.0f,  4.0f,  1.0f,  4.0f, 16.0f, 26.0f, 16.0f,
-       4.0f,  7.0f, 26.0f, 41.0f, 26.0f, 7.0f, 4.0f,  16.0f, 26.0f,
-       16.0f, 4.0f, 1.0f,  4.0f,  7.0f,  4.0f, 1.0f};
+    = {1.0f,  4.0f, 6.0f,  4.0f,  1.0f,  4.0f, 16.0f, 24.0f, 16.0f,
+       4.0f,  6.0f, 24.0f, 36.0f, 24.0f, 6.0f, 4.0f,  16.0f, 24.0f,
+       16.0f, 4.0f, 1.0f,  4.0f,  6.0f,  4.0f, 1.0f};
 static const int gaussianBlurFilterWidth = 5;
 
-auto image_convolution_4_8() -> bool
+// normalized disc, like an out of focus lens. not separable
+static auto discFilter(int width) -> std::vector<float>
 {
-    // context and command queue for the first gpu device found
-    d_ocl::context_set contextSet;
-    if (!d_ocl::createContextSet(contextSet)) {
-        return false;
+    const int radius = width / 2;
+    std::vector<float> filter(width * width, 0.0f);
+    float sum = 0.0f;
+    for (int i = 0; i < width; i++) {
+        for (int j = 0; j < width; j++) {
+            if ((i - radius) * (i - radius) + (j - radius) * (j - radius)
+                <= radius * radius) {
+                filter[i * width + j] = 1.0f;
+                sum += 1.0f;
+            }
+        }
+    }
+    for (float& coefficient : filter) {
+        coefficient /= sum;
     }
+    return filter;
+}
 
-    // read in the src image in greyscale 32-bit float (format expected by kernel
-    // program)
-    cv::Mat inputMat;
+// whole image through the fft, then by whichever method is faster on this
+// device, each checked against the host
+static auto fftConvolution(const d_ocl::context_set& contextSet) -> bool
+{
+    cv::Mat rgbaMat;
     std::shared_ptr<d_ocl::utils::manager<cl_mem>> inputImage
-        = d_ocl::createInputImage(contextSet.context->openclObject,
-                                  CL_MEM_READ_ONLY | CL_MEM_HOST_WRITE_ONLY,
-                                  EX_RESOURCE_ROOT "/cat.bmp",
-                                  {d_ocl::utils::toGreyscale, d_ocl::utils::toFloat},
-                                  &inputMat);
-    // deviec-side buffer for output image
+        = d_ocl::createInputImage(
+            contextSet.context->openclObject,
+            CL_MEM_READ_ONLY | CL_MEM_HOST_NO_ACCESS,
+            EX_RESOURCE_ROOT "/cat.bmp",
+            {d_ocl::utils::toRgba, d_ocl::utils::toFloat},
+            &rgbaMat);
+    if (!inputImage) {
+        return false;
+    }
     std::shared_ptr<d_ocl::utils::manager<cl_mem>> outputImage
         = d_ocl::createOutputImage(contextSet.context->openclObject,
                                    CL_MEM_WRITE_ONLY | CL_MEM_HOST_READ_ONLY,
-                                   inputMat);
-    if (!inputImage || !outputImage) {
+                                   rgbaMat);
+    if (!outputImage) {
         return false;
     }
+    std::vector<float> filter = discFilter(FFT_FILTER_WIDTH);
+    cv::Mat referenceMat;
+    cv::filter2D(rgbaMat,
+                 referenceMat,
+                 CV_32F,
+                 cv::Mat(FFT_FILTER_WIDTH,
+                         FFT_FILTER_WIDTH,
+                         CV_32F,
+                         filter.data()),
+                 cv::Point(-1, -1),
+                 0,
+                 cv::BORDER_REPLICATE);
 
-    // will pass filter coefficients into the kernel as an arg
-    std::shared_ptr<d_ocl::utils::manager<cl_mem>> filter
-        = d_ocl::utils::manager<cl_mem>::makeShared(
-            clCreateBuffer(contextSet.context->openclObject,
-                           CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR
-                               | CL_MEM_HOST_WRITE_ONLY,
-                           gaussianBlurFilter.size() * sizeof(float),
-                           gaussianBlurFilter.data(),
-                           nullptr),
-            clReleaseMemObject);
-    // don't go beyond the src image
-    std::vector<cl_sampler_properties> samplerProps
-        = {CL_SAMPLER_NORMALIZED_COORDS,
-           CL_FALSE,
-           CL_SAMPLER_ADDRESSING_MODE,
-           CL_ADDRESS_CLAMP_TO_EDGE,
-           CL_SAMPLER_FILTER_MODE,
-           CL_FILTER_NEAREST,
-           0};
-    std::shared_ptr<d_ocl::utils::manager<cl_sampler>> sampler
-        = d_ocl::utils::manager<cl_sampler>::makeShared(
-            clCreateSamplerWithProperties(
-                contextSet.context->openclObject, samplerProps.data(), nullptr),
-            clReleaseSampler);
-    if (!filter || !sampler) {
+    const d_ocl::convolution_method methods[]
+        = {d_ocl::convolution_method::fft,
+           d_ocl::convolution_method::automatic};
+    for (d_ocl::convolution_method method : methods) {
+        d_ocl::convolution convolution(contextSet.context->openclObject,
+                                       filter,
+                                       FFT_FILTER_WIDTH,
+                                       true,
+                                       method);
+        // automatic times direct against fft for this size on the idle
+        // queue, once per device. later runs read the tuning database
+        if (!convolution
+            || !convolution.tune(contextSet.cmdQueue->openclObject,
+                                 inputImage->openclObject,
+                                 outputImage->openclObject,
+                                 rgbaMat.cols,
+                                 rgbaMat.rows)) {
+            return false;
+        }
+
+        d_ocl::handle<cl_event> filtered;
+        cv::Mat outputMat;
+        std::shared_ptr<d_ocl::mapped_memory> mapping;
+        if (!convolution.run(contextSet.cmdQueue->openclObject,
+                             inputImage->openclObject,
+                             outputImage->openclObject,
+                             rgbaMat.cols,
+                             rgbaMat.rows,
+                             {},
+                             filtered.outParam())
+            || !d_ocl::readImage(contextSet.cmdQueue->openclObject,
+                                 outputImage->openclObject,
+                                 {filtered.get()},
+                                 outputMat,
+                                 mapping)) {
+            return false;
+        }
+
+        const char* methodName = convolution.usesFft() ? "fft" : "direct";
+        const double maxDifference
+            = cv::norm(referenceMat, outputMat, cv::NORM_INF);
+        if (maxDifference > 1e-3) {
+            std::cerr << methodName << " filtered image differs from the "
+                      << "host's by " << maxDifference << std::endl;
+            return false;
+        }
+        std::cout << FFT_FILTER_WIDTH << " x " << FFT_FILTER_WIDTH
+                  << " filter by " << methodName
+                  << (method == d_ocl::convolution_method::automatic
+                          ? ", the faster on this device,"
+                          : "")
+                  << " matches the host" << std::endl;
+    }
+    return true;
+}
+
+auto image_convolution_4_8() -> bool
+{
+    // context and command queue for the best device found
+    d_ocl::context_set contextSet;
+    if (!d_ocl::createContextSet(contextSet)) {
         return false;
     }
 
-    std::shared_ptr<d_ocl::utils::manager<cl_program>> program
-        = d_ocl::createProgram(contextSet.context->openclObject,
-                               EX_RESOURCE_ROOT "/" EX_NAME_IMG_CONVOLUTION_4_8
-                                                "." D_OCL_KERN_EXT);
-    if (!program) {
+    // read in the src image as decoded. converted to rgba 32-bit float on the
+    // device, so a quarter of the bytes is uploaded. every channel is
+    // filtered
+    cv::Mat inputMat;
+    if (!d_ocl::loadImage(EX_RESOURCE_ROOT "/cat.bmp", {}, inputMat)) {
         return false;
     }
-    std::shared_ptr<d_ocl::utils::manager<cl_kernel>> kernel
-        = d_ocl::utils::manager<cl_kernel>::makeShared(
-            clCreateKernel(
-                program->openclObject, EX_NAME_IMG_CONVOLUTION_4_8, nullptr),
-            clReleaseKernel);
-    // args for
-    // void image_convolution_4_8(
-    //                        int imageWidth,
-    //                        int imageHeight,
-    //      __read_only image2d_t inputImage,
-    //     __write_only image2d_t outputImage,
-    //          __constant float* filter,
-    //                        int filterWidth,
-    //                  sampler_t sampler)
-    if (!kernel
-        || !d_ocl::utils::checkRun(
-            "clSetKernelArg",
-            clSetKernelArg(
-                kernel->openclObject, 0, sizeof(inputMat.cols), &inputMat.cols))
-        || !d_ocl::utils::checkRun(
-            "clSetKernelArg",
-            clSetKernelArg(
-                kernel->openclObject, 1, sizeof(inputMat.rows), &inputMat.rows))
-        || !d_ocl::utils::checkRun("clSetKernelArg",
-                                   clSetKernelArg(kernel->openclObject,
-                                                  2,
-                                                  sizeof(cl_mem),
-                                                  &inputImage->openclObject))
-        || !d_ocl::utils::checkRun("clSetKernelArg",
-                                   clSetKernelArg(kernel->openclObject,
-                                                  3,
-                                                  sizeof(cl_mem),
-                                                  &outputImage->openclObject))
-        || !d_ocl::utils::checkRun(
-            "clSetKernelArg",
-            clSetKernelArg(
-                kernel->openclObject, 4, sizeof(cl_mem), &filter->openclObject))
-        || !d_ocl::utils::checkRun(
-            "clSetKernelArg",
-            clSetKernelArg(kernel->openclObject,
-                           5,
-                           sizeof(gaussianBlurFilterWidth),
-                           &gaussianBlurFilterWidth))
-        || !d_ocl::utils::checkRun("clSetKernelArg",
-                                   clSetKernelArg(kernel->openclObject,
-                                                  6,
-                                                  sizeof(cl_sampler),
-                                                  &sampler->openclObject))) {
+    const std::vector<d_ocl::utils::mat_convert_func> deviceConverts
+        = {d_ocl::utils::deviceToRgba, d_ocl::utils::deviceToFloat};
+    d_ocl::device_converter converter(contextSet.context->openclObject);
+    if (!converter) {
         return false;
     }
 
-    // # work-groups * # work-items = # concurrent global work-items
-    cl_uint numWorkgroups = d_ocl::utils::maxComputeUnits(contextSet.device);
-    std::vector<size_t> workgroupSize
-        = d_ocl::utils::maxWorkGroupSize(contextSet.device);
-    if (numWorkgroups == 0 || workgroupSize.size() < 2) {
-        std::cerr << "unable to determine work-items topology" << std::endl;
+    // the image is filtered in horizontal strips, so one strip uploads while
+    // the one before is filtered and the one before that downloads.
+    // each strip's input has halo rows above and below for the filter
+    const int halo = gaussianBlurFilterWidth / 2;
+    const int stripRows = (inputMat.rows + CONVOLUTION_STRIPS - 1)
+                          / CONVOLUTION_STRIPS;
+    const size_t numStrips = (inputMat.rows + stripRows - 1) / stripRows;
+    const int slotRows = stripRows + 2 * halo;
+    const cv::Mat slotSpec(slotRows, inputMat.cols, CV_32FC4);
+    const cv::Mat byteSlotSpec(slotRows, inputMat.cols, CV_8UC4);
+    // per pipeline slot: raw strip as uploaded, its float rgba version,
+    // the filtered float strip, and that back in 8-bit to be downloaded
+    std::vector<std::shared_ptr<d_ocl::utils::manager<cl_mem>>> rawStrips;
+    std::vector<std::shared_ptr<d_ocl::utils::manager<cl_mem>>> inputImages;
+    std::vector<std::shared_ptr<d_ocl::utils::manager<cl_mem>>> outputImages;
+    std::vector<std::shared_ptr<d_ocl::utils::manager<cl_mem>>> byteImages;
+    for (size_t slot = 0; slot < CONVOLUTION_PIPELINE_DEPTH; slot++) {
+        rawStrips.push_back(d_ocl::utils::manager<cl_mem>::makeShared(
+            clCreateBuffer(contextSet.context->openclObject,
+                           CL_MEM_READ_ONLY | CL_MEM_HOST_WRITE_ONLY,
+                           inputMat.step[0] * slotRows,
+                           nullptr,
+                           nullptr),
+            clReleaseMemObject));
+        inputImages.push_back(
+            d_ocl::createOutputImage(contextSet.context->openclObject,
+                                     CL_MEM_READ_WRITE | CL_MEM_HOST_NO_ACCESS,
+                                     slotSpec));
+        outputImages.push_back(
+            d_ocl::createOutputImage(contextSet.context->openclObject,
+                                     CL_MEM_READ_WRITE | CL_MEM_HOST_NO_ACCESS,
+                                     slotSpec));
+        byteImages.push_back(
+            d_ocl::createOutputImage(contextSet.context->openclObject,
+                                     CL_MEM_WRITE_ONLY | CL_MEM_HOST_READ_ONLY,
+                                     byteSlotSpec));
+        if (!rawStrips.back() || !inputImages.back() || !outputImages.back()
+            || !byteImages.back()) {
+            return false;
+        }
+    }
+    cv::Mat outputMat(inputMat.rows, inputMat.cols, CV_8UC4);
+
+    // normalized so the filtered image stays in 0.0~1.0
+    std::vector<float> filterCoefficients;
+    for (float coefficient : gaussianBlurFilter) {
+        filterCoefficients.push_back(coefficient / gaussianBlurFilterFactor);
+    }
+    // local-memory tiled kernels. the filter is found to be separable, so
+    // each pixel takes 2 x 5 taps instead of 5 x 5
+    d_ocl::convolution convolution(contextSet.context->openclObject,
+                                   filterCoefficients,
+                                   gaussianBlurFilterWidth);
+    if (!convolution) {
         return false;
     }
-    // 1 work-item : 1 pixel
-    std::vector<size_t> globalWorkSize
-        = {numWorkgroups * workgroupSize[0], numWorkgroups * workgroupSize[1]};
-    cl_event kernelEvent;
-    // run the image convolution
-    if (!d_ocl::utils::checkRun(
-            "clEnqueueNDRangeKernel",
-            clEnqueueNDRangeKernel(contextSet.cmdQueue->openclObject,
-                                   kernel->openclObject,
-                                   2,
-                                   nullptr,
-                                   globalWorkSize.data(),
-                                   nullptr,
-                                   0,
-                                   nullptr,
-                                   &kernelEvent))) {
+    std::cout << "filter is " << (convolution.separable() ? "" : "not ")
+              << "separable" << std::endl;
+    // fastest work-group size for strips on this device, on the idle queue
+    // before the pipeline starts. timed on first run, then read from the
+    // tuning database
+    if (!convolution.tune(contextSet.cmdQueue->openclObject,
+                          inputImages[0]->openclObject,
+                          outputImages[0]->openclObject,
+                          inputMat.cols,
+                          slotRows)) {
+        std::cerr << "unable to tune the convolution" << std::endl;
         return false;
     }
 
-    // transfer the image to host-side
-    std::vector<size_t> origin(3, 0);
-    std::vector<size_t> region
-        = {(size_t)inputMat.cols, (size_t)inputMat.rows, 1};
-    // allocate image so we can transfer rotated image to this buffer
-    cv::Mat outputMat = cv::Mat::zeros(inputMat.size(), inputMat.type());
-    if (!d_ocl::utils::checkRun(
+    // first and last image row a strip writes, and the rows its input
+    // needs including the halo
+    auto stripBounds = [&](size_t strip,
+                           int& y0,
+                           int& y1,
+                           int& inTop,
+                           int& inBottom) -> void {
+        y0 = static_cast<int>(strip) * stripRows;
+        y1 = std::min(inputMat.rows, y0 + stripRows);
+        inTop = std::max(0, y0 - halo);
+        inBottom = std::min(inputMat.rows, y1 + halo);
+    };
+    d_ocl::chunk_pipeline_stages stages;
+    stages.upload = [&](size_t strip,
+                        size_t slot,
+                        cl_command_queue queue,
+                        const std::vector<cl_event>& waitList,
+                        cl_event* event) -> bool {
+        int y0, y1, inTop, inBottom;
+        stripBounds(strip, y0, y1, inTop, inBottom);
+        return d_ocl::utils::checkRun(
+            "clEnqueueWriteBuffer",
+            clEnqueueWriteBuffer(queue,
+                                 rawStrips[slot]->openclObject,
+                                 CL_FALSE,
+                                 0,
+                                 inputMat.step[0] * (inBottom - inTop),
+                                 inputMat.ptr(inTop),
+                                 static_cast<cl_uint>(waitList.size()),
+                                 waitList.empty() ? nullptr : waitList.data(),
+                                 event));
+    };
+    // raw strip -> float rgba -> filtered -> 8-bit.
+    // the kernel clamps to the strip's rows, so the image edges are handled
+    // as with a single image
+    stages.compute = [&](size_t strip,
+                         size_t slot,
+                         cl_command_queue queue,
+                         const std::vector<cl_event>& waitList,
+                         cl_event* event) -> bool {
+        int y0, y1, inTop, inBottom;
+        stripBounds(strip, y0, y1, inTop, inBottom);
+        d_ocl::handle<cl_event> converted;
+        d_ocl::handle<cl_event> filtered;
+        return converter.bytesToImage(queue,
+                                      rawStrips[slot]->openclObject,
+                                      inputMat.step[0],
+                                      inputMat.type(),
+                                      inputMat.cols,
+                                      inBottom - inTop,
+                                      deviceConverts,
+                                      inputImages[slot]->openclObject,
+                                      waitList,
+                                      converted.outParam())
+               && convolution.run(queue,
+                                  inputImages[slot]->openclObject,
+                                  outputImages[slot]->openclObject,
+                                  inputMat.cols,
+                                  inBottom - inTop,
+                                  {converted.get()},
+                                  filtered.outParam())
+               && converter.floatToBytes(queue,
+                                         outputImages[slot]->openclObject,
+                                         inputMat.cols,
+                                         inBottom - inTop,
+                                         byteImages[slot]->openclObject,
+                                         {filtered.get()},
+                                         event);
+    };
+    // only the strip's own rows, without the halo
+    stages.download = [&](size_t strip,
+                          size_t slot,
+                          cl_command_queue queue,
+                          const std::vector<cl_event>& waitList,
+                          cl_event* event) -> bool {
+        int y0, y1, inTop, inBottom;
+        stripBounds(strip, y0, y1, inTop, inBottom);
+        const size_t origin[3] = {0, (size_t)(y0 - inTop), 0};
+        const size_t region[3] = {(size_t)inputMat.cols, (size_t)(y1 - y0), 1};
+        return d_ocl::utils::checkRun(
             "clEnqueueReadImage",
-            clEnqueueReadImage(contextSet.cmdQueue->openclObject,
-                               outputImage->openclObject,
-                               CL_TRUE,
-                               origin.data(),
-                               region.data(),
-                               inputMat.step[0],
+            clEnqueueReadImage(queue,
+                               byteImages[slot]->openclObject,
+                               CL_FALSE,
+                               origin,
+                               region,
+                               outputMat.step[0],
                                0,
-                               outputMat.data,
-                               1,
-                               &kernelEvent,
-                               nullptr))) {
+                               outputMat.ptr(y0),
+                               static_cast<cl_uint>(waitList.size()),
+                               waitList.empty() ? nullptr : waitList.data(),
+                               event));
+    };
+    // stage events are timed if the queues profile, e.g. with D_OCL_PROFILE=1
+    if (!d_ocl::runChunkPipeline(contextSet,
+                                 EX_NAME_IMG_CONVOLUTION_4_8,
+                                 numStrips,
+                                 CONVOLUTION_PIPELINE_DEPTH,
+                                 stages)) {
+        return false;
+    }
+
+    // same filter on the host, edges replicated as the kernels clamp.
+    // allow 1 off for rounding
+    cv::Mat rgbaMat;
+    if (!d_ocl::convertImage(inputMat,
+                             {d_ocl::utils::toRgba, d_ocl::utils::toFloat},
+                             rgbaMat)) {
+        return false;
+    }
+    cv::Mat referenceMat;
+    cv::filter2D(rgbaMat,
+                 referenceMat,
+                 CV_32F,
+                 cv::Mat(gaussianBlurFilterWidth,
+                         gaussianBlurFilterWidth,
+                         CV_32F,
+                         filterCoefficients.data()),
+                 cv::Point(-1, -1),
+                 0,
+                 cv::BORDER_REPLICATE);
+    referenceMat.convertTo(referenceMat, CV_8U, 255.0);
+    const double maxDifference
+        = cv::norm(referenceMat, outputMat, cv::NORM_INF);
+    if (maxDifference > 1) {
+        std::cerr << "filtered image differs from the host's by "
+                  << maxDifference << std::endl;
         return false;
     }
 
+    // opencv writes bgr[a]
+    cv::cvtColor(outputMat, outputMat, cv::COLOR_RGBA2BGRA);
     if (!cv::imwrite(EX_NAME_IMG_CONVOLUTION_4_8 ".png", outputMat)) {
         std::cerr << "error saving filtered image to disk" << std::endl;
         return false;
@@ -185,7 +373,7 @@ auto image_convolution_4_8() -> bool
     std::cout << "filtered image saved in " EX_NAME_IMG_CONVOLUTION_4_8 ".png"
               << std::endl;
 
-    return true;
+    return fftConvolution(contextSet);
 }
 
 D_OCL_REGISTER_EXAMPLE(EX_KERN_IMG_CONVOLUTION_4_8,
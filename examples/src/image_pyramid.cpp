@@ -0,0 +1,222 @@
+#include "image_pyramid.h"
+#include "../../core/d_ocl.h"
+#include "../../core/d_ocl_handle.h"
+#include "../../core/d_ocl_profiler.h"
+#include "../../core/d_ocl_pyramid.h"
+#include "programs_defines.h"
+#include <iostream>
+#include <memory>
+#include <opencv2/core.hpp>
+#include <opencv2/imgproc.hpp>
+#include <vector>
+
+#define EX_NAME_IMAGE_PYRAMID "image_pyramid"
+#define EX_KERN_IMAGE_PYRAMID image_pyramid
+#define PYRAMID_LEVELS 5
+// mean difference from opencv allowed per 0 ~ 1 channel value, as the
+// sampler's interpolation weights have fewer bits than opencv's
+#define PYRAMID_TOLERANCE 0.01
+
+// mean difference per channel value
+static auto meanDifference(const cv::Mat& a, const cv::Mat& b) -> double
+{
+    return cv::norm(a, b, cv::NORM_L1) / (a.total() * a.channels());
+}
+
+// shrunk by area and bicubic, enlarged bilinearly, against cv::resize()
+static auto resizes(const d_ocl::context_set& contextSet,
+                    cl_mem inputImage,
+                    const cv::Mat& rgbaMat) -> bool
+{
+    d_ocl::resizer resizer(contextSet.context->openclObject);
+    if (!resizer) {
+        std::cerr << "error creating resize program" << std::endl;
+        return false;
+    }
+    const d_ocl::resize_interpolation interpolations[]
+        = {d_ocl::resize_interpolation::area,
+           d_ocl::resize_interpolation::bilinear,
+           d_ocl::resize_interpolation::bicubic};
+    const int cvInterpolations[]
+        = {cv::INTER_AREA, cv::INTER_LINEAR, cv::INTER_CUBIC};
+    const char* names[] = {"area", "bilinear", "bicubic"};
+    const double scales[] = {0.37, 1.7, 0.6};
+    for (int i = 0; i < 3; i++) {
+        const cv::Size size(static_cast<int>(rgbaMat.cols * scales[i]),
+                            static_cast<int>(rgbaMat.rows * scales[i]));
+        std::shared_ptr<d_ocl::utils::manager<cl_mem>> outputImage
+            = d_ocl::createOutputImage(
+                contextSet.context->openclObject,
+                CL_MEM_WRITE_ONLY | CL_MEM_HOST_READ_ONLY,
+                cv::Mat(size, rgbaMat.type()));
+        d_ocl::handle<cl_event> kernelEvent;
+        if (!outputImage
+            || !resizer.run(contextSet.cmdQueue->openclObject,
+                            inputImage,
+                            rgbaMat.cols,
+                            rgbaMat.rows,
+                            outputImage->openclObject,
+                            size.width,
+                            size.height,
+                            interpolations[i],
+                            {},
+                            kernelEvent.outParam())) {
+            return false;
+        }
+        d_ocl::recordEvent(EX_NAME_IMAGE_PYRAMID, kernelEvent.get());
+
+        cv::Mat outputMat;
+        std::shared_ptr<d_ocl::mapped_memory> outputMapping;
+        if (!d_ocl::readImage(contextSet.cmdQueue->openclObject,
+                              outputImage->openclObject,
+                              {kernelEvent.get()},
+                              outputMat,
+                              outputMapping)) {
+            return false;
+        }
+        cv::Mat referenceMat;
+        cv::resize(rgbaMat, referenceMat, size, 0, 0, cvInterpolations[i]);
+        const double difference = meanDifference(referenceMat, outputMat);
+        if (difference > PYRAMID_TOLERANCE) {
+            std::cerr << names[i] << " resize differs from cv::resize() by "
+                      << difference << " on average" << std::endl;
+            return false;
+        }
+        std::cout << names[i] << " resize to " << size.width << "x"
+                  << size.height << " matches cv::resize()" << std::endl;
+    }
+    return true;
+}
+
+// gaussian and laplacian pyramids against cv::pyrDown() / cv::pyrUp()
+static auto pyramids(const d_ocl::context_set& contextSet,
+                     d_ocl::pyramid& pyramid,
+                     cl_mem inputImage,
+                     const cv::Mat& rgbaMat) -> bool
+{
+    const char* layout
+        = pyramid.mipmapped() ? "mipmapped" : "1 image per level";
+    d_ocl::image_pyramid gaussian;
+    d_ocl::image_pyramid laplacian;
+    d_ocl::handle<cl_event> gaussianEvent;
+    d_ocl::handle<cl_event> laplacianEvent;
+    if (!pyramid.gaussian(contextSet.cmdQueue->openclObject,
+                          inputImage,
+                          PYRAMID_LEVELS,
+                          gaussian,
+                          {},
+                          gaussianEvent.outParam())
+        || !pyramid.laplacian(contextSet.cmdQueue->openclObject,
+                              inputImage,
+                              PYRAMID_LEVELS,
+                              laplacian,
+                              {},
+                              laplacianEvent.outParam())) {
+        std::cerr << "error building " << layout << " pyramids" << std::endl;
+        return false;
+    }
+    d_ocl::recordEvent(EX_NAME_IMAGE_PYRAMID, laplacianEvent.get());
+
+    // the same pyramids on the host, level sizes rounded down as the device's
+    std::vector<cv::Mat> gaussianMats(gaussian.sizes.size());
+    gaussianMats[0] = rgbaMat;
+    for (size_t level = 1; level < gaussian.sizes.size(); level++) {
+        cv::pyrDown(gaussianMats[level - 1],
+                    gaussianMats[level],
+                    gaussian.sizes[level]);
+    }
+    for (size_t level = 0; level < gaussian.sizes.size(); level++) {
+        cv::Mat referenceMat = gaussianMats[level];
+        if (level + 1 < gaussian.sizes.size()) {
+            cv::Mat upsampledMat;
+            cv::pyrUp(gaussianMats[level + 1],
+                      upsampledMat,
+                      gaussian.sizes[level]);
+            cv::subtract(gaussianMats[level], upsampledMat, referenceMat);
+        }
+        cv::Mat gaussianMat;
+        cv::Mat laplacianMat;
+        if (!d_ocl::readPyramidLevel(contextSet.cmdQueue->openclObject,
+                                     gaussian,
+                                     level,
+                                     rgbaMat.type(),
+                                     {gaussianEvent.get()},
+                                     gaussianMat)
+            || !d_ocl::readPyramidLevel(contextSet.cmdQueue->openclObject,
+                                        laplacian,
+                                        level,
+                                        rgbaMat.type(),
+                                        {laplacianEvent.get()},
+                                        laplacianMat)) {
+            return false;
+        }
+        const double gaussianDifference
+            = meanDifference(gaussianMats[level], gaussianMat);
+        const double laplacianDifference
+            = meanDifference(referenceMat, laplacianMat);
+        if (gaussianDifference > PYRAMID_TOLERANCE
+            || laplacianDifference > PYRAMID_TOLERANCE) {
+            std::cerr << layout << " pyramid level " << level
+                      << " differs from opencv's by " << gaussianDifference
+                      << " (gaussian) and " << laplacianDifference
+                      << " (laplacian) on average" << std::endl;
+            return false;
+        }
+    }
+    std::cout << gaussian.sizes.size() << " levels of " << layout
+              << " gaussian and laplacian pyramids match opencv's"
+              << std::endl;
+    return true;
+}
+
+auto image_pyramid() -> bool
+{
+    // context and command queue for the best device found
+    d_ocl::context_set contextSet;
+    if (!d_ocl::createContextSet(contextSet)) {
+        return false;
+    }
+
+    std::string inputImagePath = EX_RESOURCE_ROOT "/cat-face.bmp";
+    cv::Mat rgbaMat;
+    if (!d_ocl::loadImage(inputImagePath,
+                          {d_ocl::utils::toRgba, d_ocl::utils::toFloat},
+                          rgbaMat)) {
+        return false;
+    }
+    // uploaded once for every resize and pyramid
+    std::shared_ptr<d_ocl::utils::manager<cl_mem>> inputImage
+        = d_ocl::createInputImage(
+            contextSet.context->openclObject,
+            CL_MEM_READ_ONLY | CL_MEM_HOST_NO_ACCESS,
+            inputImagePath,
+            {d_ocl::utils::toRgba, d_ocl::utils::toFloat});
+    if (!inputImage) {
+        std::cerr << "error preparing input cl_mem from " << inputImagePath
+                  << std::endl;
+        return false;
+    }
+
+    if (!resizes(contextSet, inputImage->openclObject, rgbaMat)) {
+        return false;
+    }
+
+    // mipmapped where the device can, then the fallback on every device
+    cl_device_id device
+        = d_ocl::utils::queueDevice(contextSet.cmdQueue->openclObject);
+    d_ocl::pyramid mipmapped(contextSet.context->openclObject, device);
+    d_ocl::pyramid separate(contextSet.context->openclObject, device, false);
+    if (!mipmapped || !separate) {
+        std::cerr << "error creating pyramid program" << std::endl;
+        return false;
+    }
+    if (!mipmapped.mipmapped()) {
+        std::cout << "device has no cl_khr_mipmap_image_writes" << std::endl;
+    } else if (!pyramids(
+                   contextSet, mipmapped, inputImage->openclObject, rgbaMat)) {
+        return false;
+    }
+    return pyramids(contextSet, separate, inputImage->openclObject, rgbaMat);
+}
+
+D_OCL_REGISTER_EXAMPLE(EX_KERN_IMAGE_PYRAMID, EX_NAME_IMAGE_PYRAMID)
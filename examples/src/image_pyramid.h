@@ -0,0 +1,8 @@
+#ifndef IMAGE_PYRAMID_H
+#define IMAGE_PYRAMID_H
+
+#include "../d_ocl_examples.h"
+
+auto D_OCL_EXAMPLES_API image_pyramid() -> bool;
+
+#endif
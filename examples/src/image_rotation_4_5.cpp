@@ -1,17 +1,163 @@
 #include "image_rotation_4_5.h"
 #include "../../core/d_ocl.h"
+#include "../../core/d_ocl_handle.h"
+#include "../../core/d_ocl_profiler.h"
+#include "../../core/d_ocl_warp.h"
 #include "programs_defines.h"
 #include <iostream>
 #include <opencv2/core.hpp>
 #include <opencv2/imgcodecs.hpp>
 #include <opencv2/imgproc.hpp>
+#include <vector>
 
 #define EX_NAME_IMG_ROTATION_4_5 "image_rotation_4_5"
 #define EX_KERN_IMG_ROTATION_4_5 image_rotation_4_5
+// counter-clockwise about the image centre
+#define ROTATION_DEGREES 45.0
+// scaled and cropped to the middle of the image in the same warp
+#define ROTATION_SCALE 0.75
+#define ROTATION_CROP 0.8
+// mean difference from cv::warpAffine() allowed per 0 ~ 1 channel value,
+// as the sampler's interpolation weights have fewer bits than opencv's
+#define ROTATION_TOLERANCE 0.01
+// rotations of the same image in 1 batched dispatch, e.g. to augment a
+// training set
+#define ROTATION_BATCH 12
+// frames warped through 1 cached coordinate map
+#define REMAP_FRAMES 3
+
+// mean difference of outputImage's pixels from referenceMat's
+static auto meanDifference(const d_ocl::context_set& contextSet,
+                           cl_mem outputImage,
+                           cl_event ready,
+                           const cv::Mat& referenceMat,
+                           double& difference) -> bool
+{
+    cv::Mat outputMat;
+    std::shared_ptr<d_ocl::mapped_memory> outputMapping;
+    if (!d_ocl::readImage(contextSet.cmdQueue->openclObject,
+                          outputImage,
+                          {ready},
+                          outputMat,
+                          outputMapping)) {
+        return false;
+    }
+    difference = cv::norm(referenceMat, outputMat, cv::NORM_L1)
+                 / (outputMat.total() * outputMat.channels());
+    return true;
+}
+
+// the warp as a fixed stream of frames: its coordinate map built once and
+// reused, in both map formats, and a map made on the host uploaded
+static auto cachedRemaps(const d_ocl::context_set& contextSet,
+                         cl_mem inputImage,
+                         const cv::Mat& rgbaMat,
+                         const cv::Mat& referenceMat,
+                         const d_ocl::warp_matrix& transform) -> bool
+{
+    const int cols = referenceMat.cols;
+    const int rows = referenceMat.rows;
+    std::shared_ptr<d_ocl::utils::manager<cl_mem>> outputImage
+        = d_ocl::createOutputImage(
+            contextSet.context->openclObject,
+            CL_MEM_WRITE_ONLY | CL_MEM_HOST_READ_ONLY
+                | d_ocl::hostVisibleFlags(contextSet.context->openclObject),
+            referenceMat);
+    if (!outputImage) {
+        return false;
+    }
+
+    // source coordinates of every destination pixel on the host, as
+    // cv::initUndistortRectifyMap() would give for a camera
+    d_ocl::warp_matrix inverse;
+    transform.inverse(inverse);
+    cv::Mat coordinates(rows, cols, CV_32FC2);
+    for (int y = 0; y < rows; y++) {
+        float* row = coordinates.ptr<float>(y);
+        for (int x = 0; x < cols; x++) {
+            row[x * 2] = static_cast<float>(inverse.m[0] * x
+                                            + inverse.m[1] * y + inverse.m[2]);
+            row[x * 2 + 1] = static_cast<float>(
+                inverse.m[3] * x + inverse.m[4] * y + inverse.m[5]);
+        }
+    }
+
+    const d_ocl::remap_format formats[]
+        = {d_ocl::remap_format::float2, d_ocl::remap_format::fixed16};
+    const char* names[] = {"float2", "fixed16"};
+    for (int i = 0; i < 2; i++) {
+        d_ocl::remap remap(contextSet.context->openclObject,
+                           d_ocl::warp_interpolation::bilinear,
+                           formats[i]);
+        if (!remap) {
+            std::cerr << "error creating remap program" << std::endl;
+            return false;
+        }
+        // the first frame builds the map, the rest only read it
+        for (int frame = 0; frame < REMAP_FRAMES; frame++) {
+            d_ocl::handle<cl_event> kernelEvent;
+            double difference;
+            if (!remap.run(contextSet.cmdQueue->openclObject,
+                           inputImage,
+                           outputImage->openclObject,
+                           cols,
+                           rows,
+                           transform,
+                           {},
+                           kernelEvent.outParam())
+                || !meanDifference(contextSet,
+                                   outputImage->openclObject,
+                                   kernelEvent.get(),
+                                   referenceMat,
+                                   difference)) {
+                return false;
+            }
+            d_ocl::recordEvent(EX_NAME_IMG_ROTATION_4_5, kernelEvent.get());
+            if (difference > ROTATION_TOLERANCE) {
+                std::cerr << names[i] << " remap differs from the host's by "
+                          << difference << " on average" << std::endl;
+                return false;
+            }
+        }
+        if (remap.cached() != 1) {
+            std::cerr << names[i] << " remap cached " << remap.cached()
+                      << " maps of 1 transform" << std::endl;
+            return false;
+        }
+
+        std::shared_ptr<d_ocl::remap_map> uploaded
+            = remap.upload(coordinates, rgbaMat.cols, rgbaMat.rows);
+        d_ocl::handle<cl_event> kernelEvent;
+        double difference;
+        if (!uploaded
+            || !remap.apply(contextSet.cmdQueue->openclObject,
+                            inputImage,
+                            outputImage->openclObject,
+                            *uploaded,
+                            {},
+                            kernelEvent.outParam())
+            || !meanDifference(contextSet,
+                               outputImage->openclObject,
+                               kernelEvent.get(),
+                               referenceMat,
+                               difference)) {
+            return false;
+        }
+        if (difference > ROTATION_TOLERANCE) {
+            std::cerr << names[i] << " uploaded map differs from the host's by "
+                      << difference << " on average" << std::endl;
+            return false;
+        }
+        std::cout << names[i] << " remap of " << REMAP_FRAMES
+                  << " frames through 1 cached map matches the host"
+                  << std::endl;
+    }
+    return true;
+}
 
 auto image_rotation_4_5() -> bool
 {
-    // gpu context and command queue for the first gpu device found
+    // context and command queue for the best device found
     d_ocl::context_set contextSet;
     if (!d_ocl::createContextSet(contextSet)) {
         return false;
@@ -22,12 +168,13 @@ auto image_rotation_4_5() -> bool
     // read the input image with pixel datain 32-bit floats
     std::shared_ptr<d_ocl::utils::manager<cl_mem>> inputImage
         = d_ocl::createInputImage(
-            contextSet.context->openclObject,
+            contextSet.cmdQueue->openclObject,
             CL_MEM_READ_ONLY | CL_MEM_HOST_WRITE_ONLY,
             inputImagePath,
-            // the kernel expects pixel data in 32-bit floats
-            {&d_ocl::utils::toRgba, &d_ocl::utils::toFloat},
-            // get the input image as opencv matrix
+            // the kernel expects pixel data in 32-bit floats.
+            // converted on the device after uploading the 8-bit image
+            {&d_ocl::utils::deviceToRgba, &d_ocl::utils::deviceToFloat},
+            // get the input image's size and type
             &inputMat);
     if (!inputImage) {
         std::cerr << "error preparing input cl_mem from " << inputImagePath
@@ -35,137 +182,210 @@ auto image_rotation_4_5() -> bool
         return false;
     }
 
+    // rotate and scale about the centre, then crop, as 1 matrix computed
+    // once here instead of sin() / cos() per pixel
+    const int cropCols = static_cast<int>(inputMat.cols * ROTATION_CROP);
+    const int cropRows = static_cast<int>(inputMat.rows * ROTATION_CROP);
+    const d_ocl::warp_matrix transform
+        = d_ocl::warp_matrix::translation(-(inputMat.cols - cropCols) / 2.0,
+                                          -(inputMat.rows - cropRows) / 2.0)
+          * d_ocl::warp_matrix::rotation(inputMat.cols / 2.0,
+                                         inputMat.rows / 2.0,
+                                         ROTATION_DEGREES,
+                                         ROTATION_SCALE);
+
     // device-side buffer to get the rotated image
     std::shared_ptr<d_ocl::utils::manager<cl_mem>> outputImage
         = d_ocl::createOutputImage(
-            // rotated image will have same spec as input image,
-            // so tell the code to use inputMat to get properties like size
             contextSet.context->openclObject,
-            CL_MEM_WRITE_ONLY | CL_MEM_HOST_READ_ONLY,
-            inputMat);
+            // host-visible on unified memory devices for zero-copy readback
+            CL_MEM_WRITE_ONLY | CL_MEM_HOST_READ_ONLY
+                | d_ocl::hostVisibleFlags(contextSet.context->openclObject),
+            cv::Mat(cropRows, cropCols, inputMat.type()));
     if (!outputImage) {
         std::cerr << "error preparing output cl_mem " << std::endl;
+        return false;
     }
 
-    std::shared_ptr<d_ocl::utils::manager<cl_program>> program
-        = d_ocl::createProgram(contextSet.context->openclObject,
-                               EX_RESOURCE_ROOT "/" EX_NAME_IMG_ROTATION_4_5
-                                                "." D_OCL_KERN_EXT);
-    if (!program) {
+    // the same image and warp on the host
+    cv::Mat rgbaMat;
+    if (!d_ocl::loadImage(inputImagePath,
+                          {d_ocl::utils::toRgba, d_ocl::utils::toFloat},
+                          rgbaMat)) {
         return false;
     }
-    std::shared_ptr<d_ocl::utils::manager<cl_kernel>> kernel
-        = d_ocl::utils::manager<cl_kernel>::makeShared(
-            clCreateKernel(
-                program->openclObject, EX_NAME_IMG_ROTATION_4_5, nullptr),
-            clReleaseKernel);
-
-    // arbitrary image rotation angle
-    float theta = 45;
-    // set up args for
-    // void rotation(__read_only image2d_t inputImage,
-    //              __write_only image2d_t outputImage,
-    //                                 int imageWidth,
-    //                                 int imageHeight,
-    //                               float theta)
-    if (!kernel
-        || !d_ocl::utils::checkRun("clSetKernelArg",
-                                   clSetKernelArg(kernel->openclObject,
-                                                  0,
-                                                  sizeof(cl_mem),
-                                                  &inputImage->openclObject))
-        || !d_ocl::utils::checkRun("clSetKernelArg",
-                                   clSetKernelArg(kernel->openclObject,
-                                                  1,
-                                                  sizeof(cl_mem),
-                                                  &outputImage->openclObject))
-        || !d_ocl::utils::checkRun(
-            "clSetKernelArg",
-            clSetKernelArg(
-                kernel->openclObject, 2, sizeof(inputMat.cols), &inputMat.cols))
-        || !d_ocl::utils::checkRun(
-            "clSetKernelArg",
-            clSetKernelArg(
-                kernel->openclObject, 3, sizeof(inputMat.rows), &inputMat.rows))
-        || !d_ocl::utils::checkRun(
-            "clSetKernelArg",
-            clSetKernelArg(kernel->openclObject, 4, sizeof(theta), &theta))) {
-        std::cerr << "error creating and setting up kernel program"
+    cv::Mat affineMat(2, 3, CV_64F, const_cast<double*>(transform.m));
+
+    std::cout << "input image " << inputMat.cols << "x" << inputMat.rows
+              << " rotated by " << ROTATION_DEGREES << " degrees, scaled by "
+              << ROTATION_SCALE << " and cropped to " << cropCols << "x"
+              << cropRows << std::endl;
+
+    const d_ocl::warp_interpolation interpolations[]
+        = {d_ocl::warp_interpolation::nearest,
+           d_ocl::warp_interpolation::bilinear,
+           d_ocl::warp_interpolation::bicubic};
+    const int cvInterpolations[]
+        = {cv::INTER_NEAREST, cv::INTER_LINEAR, cv::INTER_CUBIC};
+    const char* names[] = {"nearest", "bilinear", "bicubic"};
+    for (int i = 0; i < 3; i++) {
+        d_ocl::warp warp(contextSet.context->openclObject, interpolations[i]);
+        if (!warp) {
+            std::cerr << "error creating warp program" << std::endl;
+            return false;
+        }
+        // fastest work sizes for this crop on this device. timed on first
+        // run, then read from the tuning database
+        if (!warp.tune(contextSet.cmdQueue->openclObject,
+                       inputImage->openclObject,
+                       outputImage->openclObject,
+                       cropCols,
+                       cropRows,
+                       transform)) {
+            std::cerr << "unable to determine work-items topology"
+                      << std::endl;
+            return false;
+        }
+        d_ocl::handle<cl_event> kernelEvent;
+        if (!warp.run(contextSet.cmdQueue->openclObject,
+                      inputImage->openclObject,
+                      outputImage->openclObject,
+                      cropCols,
+                      cropRows,
+                      transform,
+                      {},
+                      kernelEvent.outParam())) {
+            return false;
+        }
+        // timed if the queue profiles, e.g. with D_OCL_PROFILE=1
+        d_ocl::recordEvent(EX_NAME_IMG_ROTATION_4_5, kernelEvent.get());
+
+        // get the rotated image host-side.
+        // mapped in place on unified memory devices, else copied.
+        // outputMat is only valid while outputMapping lives
+        cv::Mat outputMat;
+        std::shared_ptr<d_ocl::mapped_memory> outputMapping;
+        if (!d_ocl::readImage(contextSet.cmdQueue->openclObject,
+                              outputImage->openclObject,
+                              {kernelEvent.get()},
+                              outputMat,
+                              outputMapping)) {
+            return false;
+        }
+
+        cv::Mat referenceMat;
+        cv::warpAffine(rgbaMat,
+                       referenceMat,
+                       affineMat,
+                       cv::Size(cropCols, cropRows),
+                       cvInterpolations[i],
+                       cv::BORDER_CONSTANT);
+        const double meanDifference
+            = cv::norm(referenceMat, outputMat, cv::NORM_L1)
+              / (outputMat.total() * outputMat.channels());
+        if (meanDifference > ROTATION_TOLERANCE) {
+            std::cerr << names[i] << " warp differs from the host's by "
+                      << meanDifference << " on average" << std::endl;
+            return false;
+        }
+        std::cout << names[i] << " warp matches the host" << std::endl;
+        if (interpolations[i] != d_ocl::warp_interpolation::bilinear) {
+            continue;
+        }
+
+        // outputMat is CV_32FC4 RGBA. convert to opencv native BGR (CV_32FC3)
+        // before calling cv::imwrite()
+        cv::Mat bgraMat = cv::Mat(outputMat.size(), outputMat.type());
+        cv::cvtColor(outputMat, bgraMat, cv::COLOR_RGBA2BGR);
+        if (!cv::imwrite(EX_NAME_IMG_ROTATION_4_5 ".tiff", bgraMat)) {
+            std::cerr << "error saving rotated image to disk" << std::endl;
+            return false;
+        }
+        std::cout << "rotated image saved in " EX_NAME_IMG_ROTATION_4_5 ".tiff"
                   << std::endl;
-        return false;
     }
 
-    // max # work-items per work-group in each dimension
-    std::vector<size_t> workGroupSize
-        = d_ocl::utils::maxWorkGroupSize(contextSet.device);
-    // max # work-groups
-    cl_uint numWorkGroups = d_ocl::utils::maxComputeUnits(contextSet.device);
-    if (workGroupSize.size() < 2 || numWorkGroups == 0) {
-        std::cerr << "unable to determine work-items topology" << std::endl;
+    cv::Mat remapReferenceMat;
+    cv::warpAffine(rgbaMat,
+                   remapReferenceMat,
+                   affineMat,
+                   cv::Size(cropCols, cropRows),
+                   cv::INTER_LINEAR,
+                   cv::BORDER_CONSTANT);
+    if (!cachedRemaps(contextSet,
+                      inputImage->openclObject,
+                      rgbaMat,
+                      remapReferenceMat,
+                      transform)) {
         return false;
     }
 
-    // 1:1 between pixel and work-item, i.e. exactly 1 work-item rotates exactly
-    // 1 pixel
-    std::vector<size_t> globalSize
-        = {std::min<size_t>(workGroupSize[0] * numWorkGroups, inputMat.cols),
-           std::min<size_t>(workGroupSize[1] * numWorkGroups, inputMat.rows)};
-
-    std::cout << "input image " << inputMat.cols << "x" << inputMat.rows << ". "
-              << globalSize[0] << "x" << globalSize[1]
-              << " pixels rotated at once by " << theta << " degrees"
-              << std::endl;
-
-    cl_event kernelEvent;
-    // queue the kernel onto the gpu
-    if (!d_ocl::utils::checkRun(
-            "clEnqueueNDRangeKernel",
-            clEnqueueNDRangeKernel(contextSet.cmdQueue->openclObject,
-                                   kernel->openclObject,
-                                   2,
-                                   nullptr,
-                                   globalSize.data(),
-                                   nullptr,
-                                   0,
-                                   nullptr,
-                                   &kernelEvent))) {
+    // every rotation into its own layer of 1 image array: 1 kernel launch
+    // and 1 readback for the whole batch, from the image uploaded above
+    std::vector<d_ocl::warp_matrix> transforms;
+    for (int i = 0; i < ROTATION_BATCH; i++) {
+        transforms.push_back(
+            d_ocl::warp_matrix::translation(-(inputMat.cols - cropCols) / 2.0,
+                                            -(inputMat.rows - cropRows) / 2.0)
+            * d_ocl::warp_matrix::rotation(inputMat.cols / 2.0,
+                                           inputMat.rows / 2.0,
+                                           i * 360.0 / ROTATION_BATCH,
+                                           ROTATION_SCALE));
+    }
+    std::shared_ptr<d_ocl::utils::manager<cl_mem>> outputArray
+        = d_ocl::createOutputImageArray(
+            contextSet.context->openclObject,
+            CL_MEM_WRITE_ONLY | CL_MEM_HOST_READ_ONLY,
+            cv::Mat(cropRows, cropCols, inputMat.type()),
+            transforms.size());
+    if (!outputArray) {
         return false;
     }
-
-    // transfer the rotated image to host-side and write out to local disk
-    std::vector<size_t> origin(3, 0);
-    std::vector<size_t> region
-        = {(size_t)inputMat.cols, (size_t)inputMat.rows, 1};
-    // allocate image so we can transfer rotated image to this buffer
-    cv::Mat outputMat = cv::Mat::zeros(inputMat.size(), inputMat.type());
-    if (!d_ocl::utils::checkRun(
-            "clEnqueueReadImage",
-            clEnqueueReadImage(contextSet.cmdQueue->openclObject,
-                               outputImage->openclObject,
-                               CL_TRUE,
-                               origin.data(),
-                               region.data(),
-                               inputMat.step[0],
-                               0,
-                               outputMat.data,
-                               1,
-                               &kernelEvent,
-                               nullptr))) {
+    d_ocl::warp warp(contextSet.context->openclObject);
+    d_ocl::handle<cl_event> batchEvent;
+    std::vector<cv::Mat> outputMats;
+    if (!warp
+        || !warp.runBatch(contextSet.cmdQueue->openclObject,
+                          inputImage->openclObject,
+                          outputArray->openclObject,
+                          cropCols,
+                          cropRows,
+                          transforms,
+                          {},
+                          batchEvent.outParam())) {
+        std::cerr << "error running batched warp" << std::endl;
         return false;
     }
-
-    // outputMat is CV_32FC4 RGBA. convert to opencv native BGR (CV_32FC3)
-    // before calling cv::imwrite()
-    cv::Mat bgraMat = cv::Mat(outputMat.size(), outputMat.type());
-    cv::cvtColor(outputMat, bgraMat, cv::COLOR_RGBA2BGR);
-    if (!cv::imwrite(EX_NAME_IMG_ROTATION_4_5 ".tiff", bgraMat)) {
-        std::cerr << "error saving rotated image to disk" << std::endl;
+    d_ocl::recordEvent(EX_NAME_IMG_ROTATION_4_5, batchEvent.get());
+    if (!d_ocl::readImageArray(contextSet.cmdQueue->openclObject,
+                               outputArray->openclObject,
+                               {batchEvent.get()},
+                               outputMats)) {
         return false;
     }
-
-    std::cout << "rotated image saved in " EX_NAME_IMG_ROTATION_4_5 ".tiff"
+    for (size_t i = 0; i < transforms.size(); i++) {
+        cv::Mat referenceMat;
+        cv::warpAffine(
+            rgbaMat,
+            referenceMat,
+            cv::Mat(2, 3, CV_64F, const_cast<double*>(transforms[i].m)),
+            cv::Size(cropCols, cropRows),
+            cv::INTER_LINEAR,
+            cv::BORDER_CONSTANT);
+        const double meanDifference
+            = cv::norm(referenceMat, outputMats[i], cv::NORM_L1)
+              / (outputMats[i].total() * outputMats[i].channels());
+        if (meanDifference > ROTATION_TOLERANCE) {
+            std::cerr << "batched rotation " << i
+                      << " differs from the host's by " << meanDifference
+                      << " on average" << std::endl;
+            return false;
+        }
+    }
+    std::cout << transforms.size()
+              << " batched rotations in 1 dispatch match the host"
               << std::endl;
     return true;
 }
 
-D_OCL_REGISTER_EXAMPLE(EX_KERN_IMG_ROTATION_4_5, EX_NAME_IMG_ROTATION_4_5)
\ No newline at end of file
+D_OCL_REGISTER_EXAMPLE(EX_KERN_IMG_ROTATION_4_5, EX_NAME_IMG_ROTATION_4_5)
@@ -0,0 +1,172 @@
+#include "image_tiling_4_8.h"
+#include "../../core/d_ocl.h"
+#include "../../core/d_ocl_kernel.h"
+#include "../../core/d_ocl_tiling.h"
+#include "programs_defines.h"
+#include <cstring>
+#include <iostream>
+#include <opencv2/imgcodecs.hpp>
+#include <vector>
+
+#define EX_NAME_IMG_TILING_4_8 "image_tiling_4_8"
+#define EX_KERN_IMG_TILING_4_8 image_tiling_4_8
+// same filter as image_convolution_4_8, applied tile by tile
+#define EX_NAME_IMG_CONVOLUTION_4_8 "image_convolution_4_8"
+// small tiles so even cat.bmp needs many of them
+#define TILE_COLS 96
+#define TILE_ROWS 64
+
+static float gaussianBlurFilterFactor = 273.0f;
+static std::vector<float> gaussianBlurFilter
+    = {1.0f,  4.0f, 7.0f,  4.0f,  1.0f,  4.0f, 16.0f, 26.0f, 16.0f,
+       4.0f,  7.0f, 26.0f, 41.0f, 26.0f, 7.0f, 4.0f,  16.0f, 26.0f,
+       16.0f, 4.0f, 1.0f,  4.0f,  7.0f,  4.0f, 1.0f};
+static const int gaussianBlurFilterWidth = 5;
+
+auto image_tiling_4_8() -> bool
+{
+    // context and command queues for the best device found
+    d_ocl::context_set contextSet;
+    if (!d_ocl::createContextSet(contextSet)) {
+        return false;
+    }
+
+    // greyscale 32-bit float as expected by the kernel
+    cv::Mat inputMat;
+    if (!d_ocl::loadImage(EX_RESOURCE_ROOT "/cat.bmp",
+                          {d_ocl::utils::toGreyscale, d_ocl::utils::toFloat},
+                          inputMat)) {
+        return false;
+    }
+
+    std::vector<float> filterCoefficients;
+    for (float coefficient : gaussianBlurFilter) {
+        filterCoefficients.push_back(coefficient / gaussianBlurFilterFactor);
+    }
+    std::shared_ptr<d_ocl::utils::manager<cl_mem>> filter
+        = d_ocl::utils::manager<cl_mem>::makeShared(
+            clCreateBuffer(contextSet.context->openclObject,
+                           CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR
+                               | CL_MEM_HOST_NO_ACCESS,
+                           filterCoefficients.size() * sizeof(float),
+                           filterCoefficients.data(),
+                           nullptr),
+            clReleaseMemObject);
+    std::vector<cl_sampler_properties> samplerProps
+        = {CL_SAMPLER_NORMALIZED_COORDS,
+           CL_FALSE,
+           CL_SAMPLER_ADDRESSING_MODE,
+           CL_ADDRESS_CLAMP_TO_EDGE,
+           CL_SAMPLER_FILTER_MODE,
+           CL_FILTER_NEAREST,
+           0};
+    std::shared_ptr<d_ocl::utils::manager<cl_sampler>> sampler
+        = d_ocl::utils::manager<cl_sampler>::makeShared(
+            clCreateSamplerWithProperties(
+                contextSet.context->openclObject, samplerProps.data(), nullptr),
+            clReleaseSampler);
+    if (!filter || !sampler) {
+        return false;
+    }
+
+    std::shared_ptr<d_ocl::utils::manager<cl_program>> program
+        = d_ocl::createProgram(
+            contextSet.context->openclObject,
+            EX_RESOURCE_ROOT "/" EX_NAME_IMG_CONVOLUTION_4_8 "." D_OCL_KERN_EXT,
+            std::string(),
+            {{"FILTER_WIDTH", std::to_string(gaussianBlurFilterWidth)}});
+    if (!program) {
+        return false;
+    }
+    d_ocl::launcher<int, int, cl_mem, cl_mem, cl_mem, int, cl_sampler>
+        convolution(program, EX_NAME_IMG_CONVOLUTION_4_8);
+    if (!convolution) {
+        return false;
+    }
+
+    // filter the tile and its halo. the kernel clamps to the tile's input,
+    // so tiles at the image borders see the same edge as the whole image
+    d_ocl::tile_process_func process
+        = [&](cl_command_queue queue,
+              const d_ocl::image_tile& tile,
+              cl_mem inputImage,
+              cl_mem outputImage,
+              const std::vector<cl_event>& waitList,
+              cl_event* event) -> bool {
+        d_ocl::nd_range range;
+        range.global = {(size_t)tile.inCols, (size_t)tile.inRows};
+        return convolution.run(queue,
+                               range,
+                               waitList,
+                               event,
+                               tile.inCols,
+                               tile.inRows,
+                               inputImage,
+                               outputImage,
+                               filter->openclObject,
+                               gaussianBlurFilterWidth,
+                               sampler->openclObject);
+    };
+
+    d_ocl::tiling_options options;
+    options.halo = gaussianBlurFilterWidth / 2;
+
+    // as few tiles as the device allows, i.e. 1 for cat.bmp
+    cv::Mat wholeMat(inputMat.rows, inputMat.cols, inputMat.type());
+    if (!d_ocl::processTiled(contextSet,
+                             EX_NAME_IMG_TILING_4_8 " whole",
+                             inputMat,
+                             wholeMat,
+                             options,
+                             process)) {
+        return false;
+    }
+
+    options.maxTileCols = TILE_COLS;
+    options.maxTileRows = TILE_ROWS;
+    std::vector<d_ocl::image_tile> tiles;
+    if (!d_ocl::planTiles(contextSet.device,
+                          inputMat.cols,
+                          inputMat.rows,
+                          inputMat.elemSize(),
+                          inputMat.elemSize(),
+                          options,
+                          tiles)) {
+        return false;
+    }
+    cv::Mat tiledMat(inputMat.rows, inputMat.cols, inputMat.type());
+    if (!d_ocl::processTiled(contextSet,
+                             EX_NAME_IMG_TILING_4_8 " tiled",
+                             inputMat,
+                             tiledMat,
+                             options,
+                             process)) {
+        return false;
+    }
+    std::cout << tiles.size() << " tiles of up to " << TILE_COLS << "x"
+              << TILE_ROWS << std::endl;
+
+    // stitched tiles must not differ from the whole image, not even at seams
+    for (int row = 0; row < inputMat.rows; row++) {
+        if (std::memcmp(wholeMat.ptr(row),
+                        tiledMat.ptr(row),
+                        inputMat.cols * inputMat.elemSize())
+            != 0) {
+            std::cerr << "tiled result differs in row " << row << std::endl;
+            return false;
+        }
+    }
+
+    cv::Mat outputMat;
+    tiledMat.convertTo(outputMat, CV_8U, 255.0);
+    if (!cv::imwrite(EX_NAME_IMG_TILING_4_8 ".png", outputMat)) {
+        std::cerr << "error saving filtered image to disk" << std::endl;
+        return false;
+    }
+    std::cout << "filtered image saved in " EX_NAME_IMG_TILING_4_8 ".png"
+              << std::endl;
+
+    return true;
+}
+
+D_OCL_REGISTER_EXAMPLE(EX_KERN_IMG_TILING_4_8, EX_NAME_IMG_TILING_4_8);
@@ -0,0 +1,255 @@
+#include "parallel_primitives.h"
+#include "../../core/d_ocl.h"
+#include "../../core/d_ocl_handle.h"
+#include "../../core/d_ocl_primitives.h"
+#include "programs_defines.h"
+#include <CL/cl.h>
+#include <algorithm>
+#include <iostream>
+#include <iterator>
+#include <numeric>
+#include <random>
+#include <utility>
+#include <vector>
+
+#define EX_NAME_PARALLEL_PRIMITIVES "parallel_primitives"
+#define EX_KERN_PARALLEL_PRIMITIVES parallel_primitives
+
+// enough elements for 3 levels of scan blocks, and not a multiple of any
+static const size_t g_numElements = (1 << 20) + 123;
+
+using buffer_ptr = std::shared_ptr<d_ocl::utils::manager<cl_mem>>;
+
+// device copy of data
+template<typename T>
+static auto upload(const d_ocl::context_set& contextSet,
+                   const std::vector<T>& data) -> buffer_ptr
+{
+    return d_ocl::utils::manager<cl_mem>::makeShared(
+        clCreateBuffer(contextSet.context->openclObject,
+                       CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR,
+                       data.size() * sizeof(T),
+                       const_cast<T*>(data.data()),
+                       nullptr),
+        &clReleaseMemObject);
+}
+
+// the first count elements of buffer, after finished
+template<typename T>
+static auto download(const d_ocl::context_set& contextSet,
+                     const buffer_ptr& buffer,
+                     size_t count,
+                     d_ocl::handle<cl_event>& finished,
+                     std::vector<T>& data) -> bool
+{
+    data.resize(count);
+    return d_ocl::utils::checkRun(
+        "clEnqueueReadBuffer",
+        clEnqueueReadBuffer(contextSet.cmdQueue->openclObject,
+                            buffer->openclObject,
+                            CL_TRUE,
+                            0,
+                            count * sizeof(T),
+                            data.data(),
+                            1,
+                            finished.address(),
+                            nullptr));
+}
+
+template<typename T>
+static auto verify(const char* what,
+                   const std::vector<T>& result,
+                   const std::vector<T>& expected) -> bool
+{
+    for (size_t i = 0; i < expected.size(); i++) {
+        if (result[i] != expected[i]) {
+            std::cerr << "opencl " << what << "[" << i << "] = " << result[i]
+                      << " != " << expected[i] << " = c++ " << what << "["
+                      << i << "]" << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+// sums and scans of ints, small enough not to overflow
+static auto intPrimitives(const d_ocl::context_set& contextSet,
+                          std::default_random_engine& randEngine) -> bool
+{
+    std::uniform_int_distribution<cl_int> randDistribution(-1000, 1000);
+    std::vector<cl_int> hostData(g_numElements);
+    for (cl_int& value : hostData) {
+        value = randDistribution(randEngine);
+    }
+
+    d_ocl::primitives<cl_int> sum(contextSet.context->openclObject,
+                                  contextSet.device);
+    buffer_ptr data = upload(contextSet, hostData);
+    buffer_ptr result = upload(contextSet, std::vector<cl_int>(1));
+    buffer_ptr scanned = upload(contextSet, hostData);
+    if (!sum || !data || !result || !scanned) {
+        return false;
+    }
+
+    cl_command_queue queue = contextSet.cmdQueue->openclObject;
+    d_ocl::handle<cl_event> reduced;
+    std::vector<cl_int> total;
+    if (!sum.reduce(queue,
+                    data->openclObject,
+                    g_numElements,
+                    result->openclObject,
+                    {},
+                    reduced.outParam())
+        || !download(contextSet, result, 1, reduced, total)
+        || !verify("sum",
+                   total,
+                   {std::accumulate(hostData.begin(), hostData.end(), 0)})) {
+        return false;
+    }
+
+    std::vector<cl_int> expected(g_numElements);
+    std::partial_sum(hostData.begin(), hostData.end(), expected.begin());
+    d_ocl::handle<cl_event> inclusive;
+    std::vector<cl_int> inclusiveScan;
+    if (!sum.inclusiveScan(queue,
+                           data->openclObject,
+                           scanned->openclObject,
+                           g_numElements,
+                           {},
+                           inclusive.outParam())
+        || !download(
+            contextSet, scanned, g_numElements, inclusive, inclusiveScan)
+        || !verify("inclusive scan", inclusiveScan, expected)) {
+        return false;
+    }
+
+    // in place this time
+    expected.insert(expected.begin(), 0);
+    expected.pop_back();
+    d_ocl::handle<cl_event> exclusive;
+    std::vector<cl_int> exclusiveScan;
+    return sum.exclusiveScan(queue,
+                             data->openclObject,
+                             data->openclObject,
+                             g_numElements,
+                             {},
+                             exclusive.outParam())
+           && download(
+               contextSet, data, g_numElements, exclusive, exclusiveScan)
+           && verify("exclusive scan", exclusiveScan, expected);
+}
+
+// the largest of floats, the positive ones compacted, and all sorted with
+// their indices
+static auto floatPrimitives(const d_ocl::context_set& contextSet,
+                            std::default_random_engine& randEngine) -> bool
+{
+    std::uniform_real_distribution<cl_float> randDistribution(-1000.0f,
+                                                              1000.0f);
+    std::vector<cl_float> hostData(g_numElements);
+    std::vector<cl_uint> hostFlags(g_numElements);
+    std::vector<cl_uint> hostIndices(g_numElements);
+    for (size_t i = 0; i < g_numElements; i++) {
+        hostData[i] = randDistribution(randEngine);
+        hostFlags[i] = hostData[i] > 0.0f ? 1 : 0;
+        hostIndices[i] = static_cast<cl_uint>(i);
+    }
+
+    d_ocl::primitives<cl_float, d_ocl::max_op> largest(
+        contextSet.context->openclObject, contextSet.device);
+    buffer_ptr data = upload(contextSet, hostData);
+    buffer_ptr flags = upload(contextSet, hostFlags);
+    buffer_ptr indices = upload(contextSet, hostIndices);
+    buffer_ptr result = upload(contextSet, std::vector<cl_float>(1));
+    buffer_ptr compacted = upload(contextSet, hostData);
+    buffer_ptr compactedCount = upload(contextSet, std::vector<cl_uint>(1));
+    if (!largest || !data || !flags || !indices || !result || !compacted
+        || !compactedCount) {
+        return false;
+    }
+
+    cl_command_queue queue = contextSet.cmdQueue->openclObject;
+    d_ocl::handle<cl_event> reduced;
+    std::vector<cl_float> maximum;
+    if (!largest.reduce(queue,
+                        data->openclObject,
+                        g_numElements,
+                        result->openclObject,
+                        {},
+                        reduced.outParam())
+        || !download(contextSet, result, 1, reduced, maximum)
+        || !verify("max",
+                   maximum,
+                   {*std::max_element(hostData.begin(), hostData.end())})) {
+        return false;
+    }
+
+    std::vector<cl_float> expected;
+    std::copy_if(hostData.begin(),
+                 hostData.end(),
+                 std::back_inserter(expected),
+                 [](cl_float value) { return value > 0.0f; });
+    d_ocl::handle<cl_event> kept;
+    std::vector<cl_uint> keptCount;
+    std::vector<cl_float> positives;
+    if (!largest.compact(queue,
+                         data->openclObject,
+                         flags->openclObject,
+                         g_numElements,
+                         compacted->openclObject,
+                         compactedCount->openclObject,
+                         {},
+                         kept.outParam())
+        || !download(contextSet, compactedCount, 1, kept, keptCount)
+        || !verify("compacted count",
+                   keptCount,
+                   {static_cast<cl_uint>(expected.size())})
+        || !download(contextSet, compacted, expected.size(), kept, positives)
+        || !verify("compacted", positives, expected)) {
+        return false;
+    }
+
+    // stable, so equal keys keep their indices' order
+    std::vector<cl_uint> expectedOrder(hostIndices);
+    std::stable_sort(expectedOrder.begin(),
+                     expectedOrder.end(),
+                     [&hostData](cl_uint a, cl_uint b) {
+                         return hostData[a] < hostData[b];
+                     });
+    expected.resize(g_numElements);
+    for (size_t i = 0; i < g_numElements; i++) {
+        expected[i] = hostData[expectedOrder[i]];
+    }
+    d_ocl::handle<cl_event> sorted;
+    std::vector<cl_float> sortedKeys;
+    std::vector<cl_uint> sortedIndices;
+    return largest.sort(queue,
+                        data->openclObject,
+                        indices->openclObject,
+                        g_numElements,
+                        {},
+                        sorted.outParam())
+           && download(contextSet, data, g_numElements, sorted, sortedKeys)
+           && download(
+               contextSet, indices, g_numElements, sorted, sortedIndices)
+           && verify("sorted", sortedKeys, expected)
+           && verify("sorted indices", sortedIndices, expectedOrder);
+}
+
+auto parallel_primitives() -> bool
+{
+    // context and command queue for the best device found
+    d_ocl::context_set contextSet;
+    if (!d_ocl::createContextSet(contextSet)) {
+        return false;
+    }
+
+    std::random_device randDevice;
+    std::default_random_engine randEngine(randDevice());
+    return intPrimitives(contextSet, randEngine)
+           && floatPrimitives(contextSet, randEngine);
+}
+
+// append to g_exampleNames and g_exampleFunctions
+D_OCL_REGISTER_EXAMPLE(EX_KERN_PARALLEL_PRIMITIVES,
+                       EX_NAME_PARALLEL_PRIMITIVES)
@@ -0,0 +1,8 @@
+#ifndef PARALLEL_PRIMITIVES_H
+#define PARALLEL_PRIMITIVES_H
+
+#include "../d_ocl_examples.h"
+
+auto D_OCL_EXAMPLES_API parallel_primitives() -> bool;
+
+#endif
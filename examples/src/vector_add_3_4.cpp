@@ -1,5 +1,8 @@
 #include "vector_add_3_4.h"
 #include "../../core/d_ocl.h"
+#include "../../core/d_ocl_handle.h"
+#include "../../core/d_ocl_kernel.h"
+#include "../../core/d_ocl_svm.h"
 #include "programs_defines.h"
 #include <iostream>
 #include <random>
@@ -8,35 +11,146 @@
 #define EX_NAME_VECTOR_ADD_3_4 "vector_add_3_4"
 #define EX_KERN_VECTOR_ADD_3_4 vector_add_3_4
 
-auto vector_add_3_4() -> bool
+// number of items in each array
+static const size_t g_numElements = 2048;
+
+// input data init
+static auto randomFill(int* data, size_t count) -> void
 {
-    // gpu context and command queue for the first gpu device found
-    d_ocl::context_set contextSet;
-    if (!d_ocl::createContextSet(contextSet)) {
+    std::random_device randDevice;
+    std::default_random_engine randEngine(randDevice());
+    std::uniform_int_distribution<int> randDistribution(
+        std::numeric_limits<int>::min(), std::numeric_limits<int>::max());
+    for (size_t i = 0; i < count; i++) {
+        data[i] = randDistribution(randEngine);
+    }
+}
+
+// check answer
+static auto verify(const int* hostA, const int* hostB, const int* hostC)
+    -> bool
+{
+    for (size_t i = 0; i < g_numElements; i++) {
+        if (hostA[i] + hostB[i] != hostC[i]) {
+            std::cerr << hostA[i] << " + " << hostB[i] << " != " << hostC[i]
+                      << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+// opencl 2.0 devices: the kernel works on the host's vectors in shared
+// virtual memory, no device-side mirrors or copies
+static auto vectorAddSvm(
+    const d_ocl::context_set& contextSet,
+    const std::shared_ptr<d_ocl::utils::manager<cl_program>>& program) -> bool
+{
+    cl_command_queue queue = contextSet.cmdQueue->openclObject;
+    const size_t dataSize = sizeof(int) * g_numElements;
+
+    // fine-grain svm needs no map / unmap around host access
+    const cl_svm_mem_flags svmFlags
+        = CL_MEM_READ_WRITE
+          | (d_ocl::contextSupportsSvm(contextSet.context->openclObject,
+                                       CL_DEVICE_SVM_FINE_GRAIN_BUFFER)
+                 ? CL_MEM_SVM_FINE_GRAIN_BUFFER
+                 : 0);
+    d_ocl::svm_allocator<int> allocator(contextSet.context, svmFlags);
+    using svm_vector = std::vector<int, d_ocl::svm_allocator<int>>;
+
+    try {
+        svm_vector svmA(allocator);
+        svm_vector svmB(allocator);
+        svm_vector svmC(allocator);
+        // allocate first so elements are constructed inside the mapping
+        svmA.reserve(g_numElements);
+        svmB.reserve(g_numElements);
+        svmC.reserve(g_numElements);
+        {
+            std::shared_ptr<d_ocl::svm_mapping> mapA = d_ocl::mapSvm(
+                queue, svmFlags, svmA.data(), dataSize, CL_MAP_WRITE, {});
+            std::shared_ptr<d_ocl::svm_mapping> mapB = d_ocl::mapSvm(
+                queue, svmFlags, svmB.data(), dataSize, CL_MAP_WRITE, {});
+            std::shared_ptr<d_ocl::svm_mapping> mapC = d_ocl::mapSvm(
+                queue, svmFlags, svmC.data(), dataSize, CL_MAP_WRITE, {});
+            if (!mapA || !mapB || !mapC) {
+                return false;
+            }
+            svmA.resize(g_numElements);
+            svmB.resize(g_numElements);
+            svmC.resize(g_numElements);
+            randomFill(svmA.data(), g_numElements);
+            randomFill(svmB.data(), g_numElements);
+        }
+
+        // vector_add(__global int* A, __global int* B, __global int* C)
+        d_ocl::launcher<d_ocl::svm_pointer<int>,
+                        d_ocl::svm_pointer<int>,
+                        d_ocl::svm_pointer<int>>
+            vectorAdd(program, EX_NAME_VECTOR_ADD_3_4);
+        if (!vectorAdd) {
+            std::cerr << "error creating program kernel" << std::endl;
+            return false;
+        }
+
+        d_ocl::handle<cl_event> kernel_event;
+        // queue the kernel onto the device
+        if (!vectorAdd.run(queue,
+                           {{g_numElements}, {}},
+                           {},
+                           kernel_event.outParam(),
+                           {svmA.data()},
+                           {svmB.data()},
+                           {svmC.data()})) {
+            return false;
+        }
+
+        // read the answer in place after kernel is finished
+        std::shared_ptr<d_ocl::svm_mapping> mapA
+            = d_ocl::mapSvm(queue,
+                            svmFlags,
+                            svmA.data(),
+                            dataSize,
+                            CL_MAP_READ,
+                            {kernel_event.get()});
+        std::shared_ptr<d_ocl::svm_mapping> mapB
+            = d_ocl::mapSvm(queue,
+                            svmFlags,
+                            svmB.data(),
+                            dataSize,
+                            CL_MAP_READ,
+                            {kernel_event.get()});
+        std::shared_ptr<d_ocl::svm_mapping> mapC
+            = d_ocl::mapSvm(queue,
+                            svmFlags,
+                            svmC.data(),
+                            dataSize,
+                            CL_MAP_READ,
+                            {kernel_event.get()});
+        // the mappings are destroyed first, and wait for their unmaps, so
+        // the vectors' clSVMFree() runs after the device is done with them
+        return mapA && mapB && mapC
+               && verify(svmA.data(), svmB.data(), svmC.data());
+    } catch (const std::bad_alloc&) {
         return false;
     }
+}
 
-    // number of items in each array
-    const size_t numElements = 2048;
+// opencl 1.x devices: device-side buffers mirroring host vectors
+static auto vectorAddBuffers(
+    const d_ocl::context_set& contextSet,
+    const std::shared_ptr<d_ocl::utils::manager<cl_program>>& program) -> bool
+{
     // data size in bytes
-    const size_t dataSize = sizeof(int) * numElements;
+    const size_t dataSize = sizeof(int) * g_numElements;
 
     // host buffers
     // input
-    std::vector<int> hostA(numElements);
-    std::vector<int> hostB(numElements);
-    // output
-    std::vector<int> hostC(numElements);
-
-    // input data init
-    std::random_device randDevice;
-    std::default_random_engine randEngine(randDevice());
-    std::uniform_int_distribution<int> randDistribution(
-        std::numeric_limits<int>::min(), std::numeric_limits<int>::max());
-    for (int i = 0; i < numElements; i++) {
-        hostA[i] = randDistribution(randEngine);
-        hostB[i] = randDistribution(randEngine);
-    }
+    std::vector<int> hostA(g_numElements);
+    std::vector<int> hostB(g_numElements);
+    randomFill(hostA.data(), g_numElements);
+    randomFill(hostB.data(), g_numElements);
 
     // device-side memory
     // initialize with data from host-side vector
@@ -58,11 +172,14 @@ auto vector_add_3_4() -> bool
                            hostB.data(),
                            nullptr),
             &clReleaseMemObject);
-    // to get answer from device to host accessible memory
+    // to get answer from device to host accessible memory.
+    // host-visible on unified memory devices so mapping it copies nothing
     std::shared_ptr<d_ocl::utils::manager<cl_mem>> deviceC
         = d_ocl::utils::manager<cl_mem>::makeShared(
             clCreateBuffer(contextSet.context->openclObject,
-                           CL_MEM_WRITE_ONLY | CL_MEM_HOST_READ_ONLY,
+                           CL_MEM_WRITE_ONLY | CL_MEM_HOST_READ_ONLY
+                               | d_ocl::hostVisibleFlags(
+                                   contextSet.context->openclObject),
                            dataSize,
                            nullptr,
                            nullptr),
@@ -72,84 +189,69 @@ auto vector_add_3_4() -> bool
         return false;
     }
 
-    // compile and link the program
-    std::shared_ptr<d_ocl::utils::manager<cl_program>> program
-        = d_ocl::createProgram(contextSet.context->openclObject,
-                               EX_RESOURCE_ROOT "/" EX_NAME_VECTOR_ADD_3_4
-                                                "." D_OCL_KERN_EXT);
-
-    std::shared_ptr<d_ocl::utils::manager<cl_kernel>> kernel;
-    if (program) {
-        // make a kernel out of the program
-        kernel = d_ocl::utils::manager<cl_kernel>::makeShared(
-            // specify the kernel name, decorated with __kernel in the source
-            clCreateKernel(
-                program->openclObject, EX_NAME_VECTOR_ADD_3_4, nullptr),
-            &clReleaseKernel);
-    }
-
-    if (!program
-        || !kernel
-        // arguments for
-        // vector_add(__global int* A, __global int* B, __global int* C)
-        || !d_ocl::utils::checkRun("clSetKernelArg",
-                                   clSetKernelArg(kernel->openclObject,
-                                                  0,
-                                                  sizeof(cl_mem),
-                                                  &deviceA->openclObject))
-        || !d_ocl::utils::checkRun("clSetKernelArg",
-                                   clSetKernelArg(kernel->openclObject,
-                                                  1,
-                                                  sizeof(cl_mem),
-                                                  &deviceB->openclObject))
-        || !d_ocl::utils::checkRun("clSetKernelArg",
-                                   clSetKernelArg(kernel->openclObject,
-                                                  2,
-                                                  sizeof(cl_mem),
-                                                  &deviceC->openclObject))) {
+    // vector_add(__global int* A, __global int* B, __global int* C)
+    d_ocl::launcher<cl_mem, cl_mem, cl_mem> vectorAdd(program,
+                                                      EX_NAME_VECTOR_ADD_3_4);
+    if (!vectorAdd) {
         std::cerr << "error creating program kernel" << std::endl;
         return false;
     }
 
-    cl_event kernel_event;
+    d_ocl::handle<cl_event> kernel_event;
     // queue the kernel onto the device
-    // read the answer into host buffer after kernel is finished
-    if (!d_ocl::utils::checkRun(
-            "clEnqueueNDRangeKernel",
-            clEnqueueNDRangeKernel(contextSet.cmdQueue->openclObject,
-                                   kernel->openclObject,
-                                   1,
-                                   nullptr,
-                                   &numElements,
-                                   nullptr,
-                                   0,
-                                   nullptr,
-                                   &kernel_event))
-        || !d_ocl::utils::checkRun(
-            "clEnqueueReadBuffer",
-            clEnqueueReadBuffer(contextSet.cmdQueue->openclObject,
-                                deviceC->openclObject,
-                                CL_TRUE,
-                                0,
-                                dataSize,
-                                hostC.data(),
-                                1,
-                                &kernel_event,
-                                nullptr))) {
+    if (!vectorAdd.run(contextSet.cmdQueue->openclObject,
+                       {{g_numElements}, {}},
+                       {},
+                       kernel_event.outParam(),
+                       deviceA->openclObject,
+                       deviceB->openclObject,
+                       deviceC->openclObject)) {
         return false;
     }
 
-    // check answer
-    for (size_t i = 0; i < numElements; i++) {
-        if (hostA[i] + hostB[i] != hostC[i]) {
-            std::cerr << hostA[i] << " + " << hostB[i] << " != " << hostC[i]
-                      << std::endl;
-            return false;
-        }
+    // map the answer after kernel is finished
+    std::shared_ptr<d_ocl::mapped_memory> mappedC
+        = d_ocl::mapBuffer(contextSet.cmdQueue->openclObject,
+                           deviceC->openclObject,
+                           CL_MAP_READ,
+                           0,
+                           dataSize,
+                           {kernel_event.get()});
+    if (!mappedC) {
+        return false;
     }
 
-    return true;
+    return verify(
+        hostA.data(), hostB.data(), static_cast<const int*>(mappedC->data));
+}
+
+auto vector_add_3_4() -> bool
+{
+    // context and command queue for the best device found
+    d_ocl::context_set contextSet;
+    if (!d_ocl::createContextSet(contextSet)) {
+        return false;
+    }
+
+    // svm pointers are only guaranteed for kernels compiled as opencl 2.0
+    const bool svm = d_ocl::contextSupportsSvm(
+        contextSet.context->openclObject, CL_DEVICE_SVM_COARSE_GRAIN_BUFFER);
+
+    // compile and link the program
+    std::shared_ptr<d_ocl::utils::manager<cl_program>> program
+        = d_ocl::createProgram(contextSet.context->openclObject,
+                               EX_RESOURCE_ROOT "/" EX_NAME_VECTOR_ADD_3_4
+                                                "." D_OCL_KERN_EXT,
+                               svm ? "-cl-std=CL2.0" : "");
+    if (!program) {
+        return false;
+    }
+
+    std::cout << (svm ? "shared virtual memory" : "device buffers")
+              << " for vector_add" << std::endl;
+    return svm ? vectorAddSvm(contextSet, program)
+               : vectorAddBuffers(contextSet, program);
 }
 
 // append to g_exampleNames and g_exampleFunctions
-D_OCL_REGISTER_EXAMPLE(EX_KERN_VECTOR_ADD_3_4, EX_NAME_VECTOR_ADD_3_4)
\ No newline at end of file
+D_OCL_REGISTER_EXAMPLE(EX_KERN_VECTOR_ADD_3_4, EX_NAME_VECTOR_ADD_3_4)
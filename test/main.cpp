@@ -1,20 +1,22 @@
 #include "../core/d_ocl.h"
+#include "../core/d_ocl_profiler.h"
+#include "../core/d_ocl_program_cache.h"
 #include "../examples/d_ocl_examples.h"
 #include <iostream>
 
 auto main(int argc, char** argv) -> int
 {
     std::unordered_map<cl_platform_id, std::vector<cl_device_id>>
-        platformDevices = d_ocl::gpuPlatformDevices();
+        platformDevices = d_ocl::platformDevices(CL_DEVICE_TYPE_ALL);
     if (platformDevices.empty()) {
-        std::cerr << "no gpu platforms / devices found" << std::endl;
+        std::cerr << "no platforms / devices found" << std::endl;
         return 1;
     }
 
     for (const std::pair<cl_platform_id, std::vector<cl_device_id>>& iter :
          platformDevices) {
         for (size_t i = 0; i < iter.second.size(); i++) {
-            // pretty print some information about this gpu device
+            // pretty print some information about this device
             std::cout << "----" << std::endl
                       << "device " << i << ":" << std::endl
                       << "----" << std::endl
@@ -22,6 +24,16 @@ auto main(int argc, char** argv) -> int
         }
     }
 
+    // the device every example will run on
+    cl_platform_id platform;
+    cl_device_id device;
+    if (!d_ocl::selectDevice(d_ocl::device_selector(), platform, device)) {
+        return 1;
+    }
+    std::cout << "----" << std::endl
+              << "selected device: " << d_ocl::utils::deviceName(device)
+              << std::endl;
+
     int retval = 0;
 
     // ----
@@ -51,5 +63,26 @@ auto main(int argc, char** argv) -> int
         funcIter++;
     }
 
+    // each example runs once, so programs built by several examples hit
+    // here; running the tests again should be all hits
+    d_ocl::program_cache_stats cacheStats = d_ocl::programCacheStats();
+    std::cout << "program cache: " << cacheStats.hits << " hits, "
+              << cacheStats.misses << " misses, " << cacheStats.stores
+              << " stores, " << cacheStats.invalidations << " invalidations"
+              << std::endl;
+
+    // only filled with D_OCL_PROFILE=1 or profiling queues
+    for (const std::pair<const std::string, d_ocl::command_stats>& stats :
+         d_ocl::profileStats()) {
+        std::cout << stats.first << ": " << stats.second.count << " runs, min "
+                  << stats.second.min * 1e3 << " ms, p50 "
+                  << stats.second.p50 * 1e3 << " ms, p99 "
+                  << stats.second.p99 * 1e3 << " ms";
+        if (stats.second.bytes > 0) {
+            std::cout << ", " << stats.second.bytes << " bytes";
+        }
+        std::cout << std::endl;
+    }
+
     return retval;
 }